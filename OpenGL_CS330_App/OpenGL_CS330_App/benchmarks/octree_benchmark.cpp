@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+//  octree_benchmark.cpp
+//  ====================
+//  Loose octree checks and benchmark.
+//
+//  Fills a LooseOctree with 10k, 100k and 1M boxes scattered through a
+//  200 unit cube, a few of them large and a few outside the root cell,
+//  and times insertion, small moves through Update(), and box, sphere,
+//  frustum and ray queries. Every query result is compared with a brute
+//  force pass over all the boxes, whose time is printed alongside. Exits
+//  with 1 on a mismatch.
+//
+//  Standalone, outside the app's project. From OpenGL_CS330_App/:
+//    g++ -O2 -Iincludes -ILibraries/glm benchmarks/octree_benchmark.cpp src/octree.cpp -o octree_benchmark
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "octree.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace
+{
+	const int QUERY_COUNT = 200;
+	const float WORLD_HALF_SIZE = 100.0f;
+
+	typedef std::chrono::steady_clock Clock;
+
+	double UMilliseconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	bool UBoxesTouch(const AABB& a, const AABB& b)
+	{
+		return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+	}
+
+	bool USphereTouches(const glm::vec3& center, float radius, const AABB& box)
+	{
+		glm::vec3 offset = glm::clamp(center, box.min, box.max) - center;
+		return glm::dot(offset, offset) <= radius * radius;
+	}
+
+	// Sorted copy, since the tree returns objects in node order
+	std::vector<int> USorted(std::vector<int> objects)
+	{
+		std::sort(objects.begin(), objects.end());
+		return objects;
+	}
+
+	// Query and brute force totals over QUERY_COUNT queries of one kind
+	struct QueryTimes
+	{
+		double tree;
+		double bruteForce;
+		size_t hits;
+		int wrong;
+	};
+
+	// hits: objects found per query, or for rays the share of rays that hit something
+	void UPrintQueries(const char* kind, const QueryTimes& times, bool rays = false)
+	{
+		printf("  %-8s %8.3f ms/query %10.0f queries/s  %8.1f %s   brute force %8.3f ms/query\n", kind,
+			times.tree / QUERY_COUNT, QUERY_COUNT * 1000.0 / std::max(times.tree, 1e-9), (double)times.hits / QUERY_COUNT * (rays ? 100.0 : 1.0),
+			rays ? "% hit   " : "hits avg", times.bruteForce / QUERY_COUNT);
+	}
+}
+
+int main()
+{
+	int wrong = 0;
+	for (int count : { 10000, 100000, 1000000 })
+	{
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> position(-WORLD_HALF_SIZE, WORLD_HALF_SIZE), size(0.05f, 1.0f), step(-0.05f, 0.05f);
+		std::vector<AABB> boxes(count);
+		for (AABB& box : boxes)
+		{
+			glm::vec3 center(position(random), position(random), position(random));
+			float halfSize = size(random);
+			if (random() % 100 == 0)
+				halfSize *= 20.0f;
+			if (random() % 1000 == 0)
+				center *= 1.5f;
+			box.min = center - halfSize;
+			box.max = center + halfSize;
+		}
+
+		LooseOctree tree;
+		AABB world = { glm::vec3(-WORLD_HALF_SIZE), glm::vec3(WORLD_HALF_SIZE) };
+		tree.Initialize(world, 8);
+		Clock::time_point start = Clock::now();
+		for (int object = 0; object < count; ++object)
+			tree.Insert(object, boxes[object]);
+		double insert = UMilliseconds(start);
+
+		for (AABB& box : boxes)
+		{
+			glm::vec3 move(step(random), step(random), step(random));
+			box.min += move;
+			box.max += move;
+		}
+		size_t reinsertions = tree.Reinsertions();
+		start = Clock::now();
+		for (int object = 0; object < count; ++object)
+			tree.Update(object, boxes[object]);
+		double update = UMilliseconds(start);
+		reinsertions = tree.Reinsertions() - reinsertions;
+
+		printf("%d objects, %zu nodes\n", count, tree.NodeCount());
+		printf("  insert   %8.1f ns/object   update %.1f ns/object (%.1f%% reinserted)\n",
+			insert * 1e6 / count, update * 1e6 / count, 100.0 * reinsertions / count);
+
+		QueryTimes box = {}, sphere = {}, frustum = {}, ray = {};
+		std::vector<int> found, expected;
+		for (int query = 0; query < QUERY_COUNT; ++query)
+		{
+			glm::vec3 center(position(random), position(random), position(random));
+
+			AABB region = { center - glm::vec3(8.0f), center + glm::vec3(8.0f) };
+			found.clear();
+			start = Clock::now();
+			tree.QueryBox(region, found);
+			box.tree += UMilliseconds(start);
+			expected.clear();
+			start = Clock::now();
+			for (int object = 0; object < count; ++object)
+			{
+				if (UBoxesTouch(boxes[object], region))
+					expected.push_back(object);
+			}
+			box.bruteForce += UMilliseconds(start);
+			box.hits += found.size();
+			box.wrong += USorted(found) != expected;
+
+			const float radius = 5.0f;
+			found.clear();
+			start = Clock::now();
+			tree.QuerySphere(center, radius, found);
+			sphere.tree += UMilliseconds(start);
+			expected.clear();
+			start = Clock::now();
+			for (int object = 0; object < count; ++object)
+			{
+				if (USphereTouches(center, radius, boxes[object]))
+					expected.push_back(object);
+			}
+			sphere.bruteForce += UMilliseconds(start);
+			sphere.hits += found.size();
+			sphere.wrong += USorted(found) != expected;
+
+			// A 45 degree camera at the point looking somewhere random, seeing 60 units out
+			glm::vec3 direction = glm::normalize(glm::vec3(position(random), position(random), position(random)));
+			glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 60.0f)
+				* glm::lookAt(center, center + direction, std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+			ExtractFrustumPlanes(viewProjection, planes);
+			found.clear();
+			start = Clock::now();
+			tree.QueryFrustum(planes, found);
+			frustum.tree += UMilliseconds(start);
+			expected.clear();
+			start = Clock::now();
+			for (int object = 0; object < count; ++object)
+			{
+				if (AABBInFrustum(planes, boxes[object]))
+					expected.push_back(object);
+			}
+			frustum.bruteForce += UMilliseconds(start);
+			frustum.hits += found.size();
+			frustum.wrong += USorted(found) != expected;
+
+			float t = 1e30f;
+			start = Clock::now();
+			int hit = tree.Raycast(center, direction, t);
+			ray.tree += UMilliseconds(start);
+			float nearest = 1e30f;
+			glm::vec3 invDirection = 1.0f / direction;
+			start = Clock::now();
+			for (int object = 0; object < count; ++object)
+				nearest = std::min(nearest, RayAABB(center, invDirection, boxes[object].min, boxes[object].max, nearest));
+			ray.bruteForce += UMilliseconds(start);
+			ray.hits += hit >= 0;
+			ray.wrong += t != nearest;
+		}
+		UPrintQueries("box", box);
+		UPrintQueries("sphere", sphere);
+		UPrintQueries("frustum", frustum);
+		UPrintQueries("ray", ray, true);
+
+		for (int object = 0; object < count; object += 2)
+			tree.Remove(object);
+		printf("  %zu nodes after removing half the objects\n", tree.NodeCount());
+
+		int mismatches = box.wrong + sphere.wrong + frustum.wrong + ray.wrong;
+		if (mismatches > 0)
+			printf("FAIL: %d of %d queries differ from brute force\n", mismatches, 4 * QUERY_COUNT);
+		wrong += mismatches;
+	}
+	return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,215 @@
+///////////////////////////////////////////////////////////////////////////////
+//  picking_benchmark.cpp
+//  =====================
+//  Pick ray checks and benchmark.
+//
+//  First the SoA Moller-Trumbore in PickShape::Intersect() against the
+//  plain scalar test over the same triangles, on a 24x24 UV sphere: the
+//  same hit or miss and the same distance for every ray, and the time
+//  each takes per triangle. Then a pick the way UPickObject() makes it,
+//  through a BVH over 100k randomly placed, rotated and scaled instances
+//  of the sphere, timed per pick and checked against a brute force pass
+//  over every instance. Exits with 1 on a mismatch.
+//
+//  Standalone, outside the app's project. From OpenGL_CS330_App/:
+//    g++ -O2 -mavx -Iincludes -ILibraries/glm -ILibraries/GLAD benchmarks/picking_benchmark.cpp src/picking.cpp src/bvh.cpp -o picking_benchmark
+//  and without -mavx for the SSE path. GLAD/glad.h is only needed for its
+//  GLenum constants; on a case-sensitive file system point -I at a copy
+//  named to match.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "bvh.h"
+#include "picking.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace
+{
+	const int SPHERE_STACKS = 24;
+	const int SPHERE_SLICES = 24;
+	const int SHAPE_RAYS = 100000;
+	const int INSTANCE_COUNT = 100000;
+	const int PICK_COUNT = 1000;
+	const int CHECKED_PICKS = 100;
+
+	typedef std::chrono::steady_clock Clock;
+
+	double UMilliseconds(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	// The reference: one triangle at a time, straight from the index list
+	int UScalarIntersect(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+		const glm::vec3& origin, const glm::vec3& direction, float& t)
+	{
+		int nearest = -1;
+		for (size_t index = 0; index + 2 < indices.size(); index += 3)
+		{
+			glm::vec3 v0 = positions[indices[index]];
+			glm::vec3 e1 = positions[indices[index + 1]] - v0;
+			glm::vec3 e2 = positions[indices[index + 2]] - v0;
+			glm::vec3 p = glm::cross(direction, e2);
+			float det = glm::dot(e1, p);
+			if (det == 0.0f)
+				continue;
+			float invDet = 1.0f / det;
+			glm::vec3 s = origin - v0;
+			float u = glm::dot(s, p) * invDet;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+			glm::vec3 q = glm::cross(s, e1);
+			float v = glm::dot(direction, q) * invDet;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+			float hit = glm::dot(e2, q) * invDet;
+			if (hit > 0.0f && hit < t)
+			{
+				t = hit;
+				nearest = (int)(index / 3);
+			}
+		}
+		return nearest;
+	}
+
+	// Same hit or miss, and the same distance; a ray through a shared edge may name either triangle
+	bool USameHit(int hit, float t, int expected, float expectedT)
+	{
+		if ((hit < 0) != (expected < 0))
+			return false;
+		return hit < 0 || std::abs(t - expectedT) <= 1e-5f * std::max(1.0f, expectedT);
+	}
+}
+
+int main()
+{
+	std::vector<glm::vec3> positions;
+	std::vector<GLuint> indices;
+	for (int stack = 0; stack <= SPHERE_STACKS; ++stack)
+	{
+		for (int slice = 0; slice <= SPHERE_SLICES; ++slice)
+		{
+			float theta = glm::pi<float>() * stack / SPHERE_STACKS;
+			float phi = glm::two_pi<float>() * slice / SPHERE_SLICES;
+			positions.push_back(glm::vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)));
+		}
+	}
+	for (int stack = 0; stack < SPHERE_STACKS; ++stack)
+	{
+		for (int slice = 0; slice < SPHERE_SLICES; ++slice)
+		{
+			GLuint a = stack * (SPHERE_SLICES + 1) + slice;
+			GLuint b = a + SPHERE_SLICES + 1;
+			indices.insert(indices.end(), { a, b, a + 1, b, b + 1, a + 1 });
+		}
+	}
+	PickShape shape;
+	shape.AddTriangles(positions, indices, GL_TRIANGLES, 0, (GLsizei)indices.size());
+
+	// Rays from around the sphere aimed near it, so about half hit
+	std::mt19937 random(2);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<glm::vec3> origins(SHAPE_RAYS), directions(SHAPE_RAYS);
+	for (int ray = 0; ray < SHAPE_RAYS; ++ray)
+	{
+		origins[ray] = glm::vec3(unit(random), unit(random), unit(random)) * 3.0f;
+		glm::vec3 target = glm::vec3(unit(random), unit(random), unit(random)) * 1.4f;
+		directions[ray] = glm::normalize(target - origins[ray]);
+	}
+
+	int wrong = 0, hits = 0;
+	std::vector<float> simdT(SHAPE_RAYS), scalarT(SHAPE_RAYS);
+	std::vector<int> simdHit(SHAPE_RAYS), scalarHit(SHAPE_RAYS);
+	Clock::time_point start = Clock::now();
+	for (int ray = 0; ray < SHAPE_RAYS; ++ray)
+	{
+		simdT[ray] = std::numeric_limits<float>::max();
+		simdHit[ray] = shape.Intersect(origins[ray], directions[ray], simdT[ray]);
+	}
+	double simd = UMilliseconds(start);
+	start = Clock::now();
+	for (int ray = 0; ray < SHAPE_RAYS; ++ray)
+	{
+		scalarT[ray] = std::numeric_limits<float>::max();
+		scalarHit[ray] = UScalarIntersect(positions, indices, origins[ray], directions[ray], scalarT[ray]);
+	}
+	double scalar = UMilliseconds(start);
+	for (int ray = 0; ray < SHAPE_RAYS; ++ray)
+	{
+		wrong += !USameHit(simdHit[ray], simdT[ray], scalarHit[ray], scalarT[ray]);
+		hits += scalarHit[ray] >= 0;
+	}
+	double tests = (double)SHAPE_RAYS * shape.TriangleCount();
+	printf("Shape of %zu triangles, %d rays (%d hit), %d differ from the scalar test\n", shape.TriangleCount(), SHAPE_RAYS, hits, wrong);
+	printf("  scalar  %6.2f ns/triangle   SoA %6.2f ns/triangle   (x%.1f)\n", scalar * 1e6 / tests, simd * 1e6 / tests, scalar / simd);
+
+	std::uniform_real_distribution<float> place(-100.0f, 100.0f), scale(0.2f, 1.5f);
+	std::vector<glm::mat4> models(INSTANCE_COUNT), toObject(INSTANCE_COUNT);
+	std::vector<AABB> boxes(INSTANCE_COUNT);
+	const AABB unitBox = { glm::vec3(-1.0f), glm::vec3(1.0f) };
+	for (int instance = 0; instance < INSTANCE_COUNT; ++instance)
+	{
+		glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + 0.01f);
+		models[instance] = glm::translate(glm::mat4(1.0f), glm::vec3(place(random), place(random) * 0.2f, place(random)))
+			* glm::rotate(glm::mat4(1.0f), unit(random) * 3.0f, axis)
+			* glm::scale(glm::mat4(1.0f), glm::vec3(scale(random), scale(random), scale(random)));
+		toObject[instance] = glm::inverse(models[instance]);
+		boxes[instance] = TransformAABB(unitBox, models[instance]);
+	}
+	BVH bvh;
+	bvh.Build(boxes);
+
+	double total = 0.0, worst = 0.0;
+	int picked = 0, pickWrong = 0;
+	for (int pick = 0; pick < PICK_COUNT; ++pick)
+	{
+		glm::vec3 origin(place(random), place(random) * 0.2f + 30.0f, place(random));
+		glm::vec3 direction = glm::normalize(glm::vec3(place(random), -40.0f, place(random)) - origin * 0.5f);
+
+		// As UPickObject() does it, inverse included
+		start = Clock::now();
+		float distance = std::numeric_limits<float>::max();
+		int object = bvh.Raycast(origin, direction, distance, [&](int candidate, float& t)
+		{
+			glm::mat4 inverse = glm::inverse(models[candidate]);
+			return shape.Intersect(glm::vec3(inverse * glm::vec4(origin, 1.0f)), glm::vec3(inverse * glm::vec4(direction, 0.0f)), t) >= 0;
+		});
+		double time = UMilliseconds(start);
+		total += time;
+		worst = std::max(worst, time);
+		picked += object >= 0;
+
+		if (pick >= CHECKED_PICKS)
+			continue;
+		float expectedDistance = std::numeric_limits<float>::max();
+		int expected = -1;
+		glm::vec3 invDirection = 1.0f / direction;
+		for (int instance = 0; instance < INSTANCE_COUNT; ++instance)
+		{
+			if (RayAABB(origin, invDirection, boxes[instance].min, boxes[instance].max, expectedDistance) >= expectedDistance)
+				continue;
+			glm::vec3 localOrigin(toObject[instance] * glm::vec4(origin, 1.0f));
+			glm::vec3 localDirection(toObject[instance] * glm::vec4(direction, 0.0f));
+			if (UScalarIntersect(positions, indices, localOrigin, localDirection, expectedDistance) >= 0)
+				expected = instance;
+		}
+		pickWrong += !USameHit(object, distance, expected, expectedDistance);
+	}
+	printf("%d instances, %d picks (%d hit): %.4f ms average, %.4f ms worst; %d of the first %d differ from brute force\n",
+		INSTANCE_COUNT, PICK_COUNT, picked, total / PICK_COUNT, worst, pickWrong, CHECKED_PICKS);
+
+	wrong += pickWrong;
+	if (wrong > 0)
+		printf("FAIL\n");
+	return wrong > 0 ? 1 : 0;
+}
@@ -0,0 +1,53 @@
+///////////////////////////////////////////////////////////////////////////////
+// blockencoder.h
+// ==============
+// CPU encoders for the BC1, BC3 and BC7 block compressed texture formats
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstddef>
+
+// EXT_texture_compression_s3tc is not part of the core profile glad was generated for
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum BlockFormat
+{
+	BLOCK_BC1,				// RGB, 4 bits per texel
+	BLOCK_BC3,				// RGBA, 8 bits per texel: BC1 color plus interpolated alpha
+	BLOCK_BC7,				// RGBA, 8 bits per texel; only mode 6 is encoded
+	BLOCK_FORMAT_COUNT
+};
+
+// glCompressedTexImage2D internal format of format
+GLenum BlockInternalFormat(BlockFormat format);
+// Short lower case name, e.g. "bc1", used in cache file names
+const char* BlockFormatName(BlockFormat format);
+// Bytes per 4x4 block: 8 for BC1, 16 otherwise
+size_t BlockSize(BlockFormat format);
+// Bytes of one encoded width x height image
+size_t EncodedSize(BlockFormat format, int width, int height);
+
+// Whether the current context can sample format. Call on the GL thread.
+bool BlockFormatSupported(BlockFormat format);
+
+///////////////////////////////////////////////////
+//	EncodeImage(BlockFormat, const unsigned char*, int, int, unsigned char*)
+//
+//	rgba: width x height tightly packed RGBA8 texels
+//	blocks: receives EncodedSize(format, width, height) bytes, blocks in
+//	rows from the first row of texels
+//
+//	Partial blocks at the right and bottom edges repeat the last texel.
+//	Thread safe: the texture loader encodes on its workers.
+///////////////////////////////////////////////////
+void EncodeImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks);
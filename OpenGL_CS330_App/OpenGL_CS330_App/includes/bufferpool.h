@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// bufferpool.h
+// ============
+// TLSF sub-allocator that hands out ranges of a few large immutable GL
+// buffers instead of one buffer object per mesh
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Identifies a sub-allocation; 0 is never a valid handle.
+// Offsets can change during Compact(), so resolve the handle when drawing.
+typedef unsigned int BufferHandle;
+
+// Snapshot of the pool for debugging and tuning
+struct BufferPoolStats
+{
+	size_t pages;				// Number of GL buffers backing the pool
+	size_t capacity;			// Total bytes of all pages
+	size_t usedBytes;			// Bytes handed out, including alignment padding
+	size_t freeBytes;
+	size_t largestFreeBlock;
+	size_t allocations;
+	size_t freeBlocks;
+	size_t bytesMoved;			// Total bytes copied by Compact() so far
+};
+
+class BufferPool
+{
+	// Two-level segregated fit parameters: 16 byte granularity, 16 second-level lists
+	static const int ALIGN_LOG2 = 4;
+	static const int SL_LOG2 = 4;
+	static const int SL_COUNT = 1 << SL_LOG2;
+	static const int FL_SHIFT = SL_LOG2 + ALIGN_LOG2;
+	static const int FL_COUNT = 32;
+	static const GLsizeiptr SMALL_BLOCK = GLsizeiptr(1) << FL_SHIFT;
+
+	// A physically contiguous range of a page, either free or owned by a handle
+	struct Block
+	{
+		GLintptr offset;
+		GLsizeiptr size;
+		int prevPhys, nextPhys;		// Neighbours by address, -1 at the ends
+		int prevFree, nextFree;		// Links in the segregated free list
+		bool free;
+		BufferHandle owner;
+	};
+
+	// One immutable GL buffer and the TLSF metadata describing it
+	struct Page
+	{
+		GLuint buffer;
+		GLsizeiptr capacity;
+		std::vector<Block> blocks;
+		std::vector<int> unusedBlocks;	// Recycled slots in blocks
+		int firstBlock;
+		unsigned int flBitmap;
+		unsigned int slBitmap[FL_COUNT];
+		int freeHeads[FL_COUNT][SL_COUNT];
+	};
+
+	struct Allocation
+	{
+		int page;
+		int block;
+		GLsizeiptr size;			// Requested size
+		GLsizeiptr alignment;
+	};
+
+public:
+	static const GLsizeiptr MIN_ALIGNMENT = GLsizeiptr(1) << ALIGN_LOG2;
+
+	BufferPool();
+
+	// pageSize: size of each backing buffer; larger requests get a page of their own
+	void Initialize(GLsizeiptr pageSize);
+	void Destroy();
+
+	// alignment may be any value, offsets will be a multiple of it
+	BufferHandle Allocate(GLsizeiptr size, GLsizeiptr alignment = MIN_ALIGNMENT);
+	void Free(BufferHandle handle);
+
+	GLuint Buffer(BufferHandle handle) const;
+	GLintptr Offset(BufferHandle handle) const;
+	GLsizeiptr Size(BufferHandle handle) const;
+
+	// Slide allocations towards the start of their page to merge free space,
+	// copying at most maxBytes (and at least one allocation). Returns bytes moved.
+	// Must not run while writes to the moved ranges are still queued on the CPU.
+	GLsizeiptr Compact(GLsizeiptr maxBytes);
+
+	BufferPoolStats GetStats() const;
+
+private:
+	int CreatePage(GLsizeiptr capacity);
+	int NewBlock(Page& page);
+	void InsertFree(Page& page, int block);
+	void RemoveFree(Page& page, int block);
+	int FindFree(Page& page, GLsizeiptr size);
+	int AllocateFromPage(Page& page, GLsizeiptr size, GLsizeiptr alignment, BufferHandle owner);
+	void FreeBlock(Page& page, int block);
+	bool MoveDown(int pageIndex, int freeBlock, GLsizeiptr& moved);
+
+	GLsizeiptr mPageSize;
+	std::vector<Page> mPages;
+	std::vector<Allocation> mAllocations;
+	std::vector<BufferHandle> mUnusedHandles;
+	GLuint mScratch;				// Bounce buffer for overlapping moves
+	GLsizeiptr mScratchSize;
+	size_t mBytesMoved;
+};
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+// bvh.h
+// =====
+// bounding volume hierarchy over world-space object boxes, with refit
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "frustum.h"
+
+#include <functional>
+#include <vector>
+
+class BVH
+{
+public:
+	// 32 byte node. Leaves (count > 0) own objects [first, first + count) of
+	// the object order; inner nodes keep their two children side by side at
+	// leftFirst and leftFirst + 1.
+	struct Node
+	{
+		glm::vec3 min;
+		int leftFirst;
+		glm::vec3 max;
+		int count;
+	};
+
+	// Refit cost may grow to this multiple of the cost after the last build
+	// before NeedsRebuild() asks for a new tree
+	static constexpr float REBUILD_RATIO = 1.3f;
+
+	// Precise test for ray queries: return true and set t when the ray hits
+	// the object closer than the t passed in
+	typedef std::function<bool(int object, float& t)> RayTest;
+
+	// Build a new tree with binned SAH; boxes[i] is the box of object i
+	void Build(const std::vector<AABB>& boxes);
+	// Update node bounds for moved objects, keeping the tree shape
+	void Refit(const std::vector<AABB>& boxes);
+	bool NeedsRebuild() const { return mCost > mBuildCost * REBUILD_RATIO; }
+	// Refit, or rebuild when the refitted tree has become too loose
+	// Returns true when the tree was rebuilt
+	bool Update(const std::vector<AABB>& boxes);
+
+	// Append every object whose box touches the frustum
+	void QueryFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], std::vector<int>& objects) const;
+	// Append every object whose box touches the sphere
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<int>& objects) const;
+	// Nearest object along the ray within t, or -1. Without a test the
+	// object boxes themselves are hit. t receives the hit distance.
+	int Raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const RayTest& test = RayTest()) const;
+
+	bool Empty() const { return mNodes.empty(); }
+	size_t NodeCount() const { return mNodes.size(); }
+	// Surface area heuristic cost of the current tree
+	float Cost() const { return mCost; }
+
+private:
+	void Subdivide(int node, int depth);
+	void UpdateBounds(int node);
+	float ComputeCost() const;
+
+	std::vector<Node> mNodes;
+	std::vector<int> mObjects;				// Object ids in leaf order
+	std::vector<AABB> mBoxes;				// Copy of the boxes given to Build() / Refit()
+	std::vector<glm::vec3> mCentroids;		// Build-time only
+	float mCost = 0.0f;
+	float mBuildCost = 0.0f;
+};
@@ -5,6 +5,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "frustum.h"
+
 #include <vector>
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
@@ -21,6 +23,9 @@ const float PITCH = 0.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+const float ORTHO_HALF_SIZE = 7.0f;
 
 
 // An abstract camera class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
@@ -40,6 +45,12 @@ public:
 	float MovementSpeed;
 	float MouseSensitivity;
 	float Zoom;
+	// projection options
+	bool Orthographic = false;
+	float AspectRatio = 4.0f / 3.0f;
+	float NearPlane = NEAR_PLANE;
+	float FarPlane = FAR_PLANE;
+	float OrthoHalfSize = ORTHO_HALF_SIZE;		// half width and height of the orthographic view volume
 
 	// constructor with vectors
 	Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
@@ -66,6 +77,35 @@ public:
 		return glm::lookAt(Position, Position + Front, Up);
 	}
 
+	// returns the perspective or orthographic projection matrix, depending on Orthographic
+	glm::mat4 GetProjectionMatrix() const
+	{
+		if (Orthographic)
+			return glm::ortho(-OrthoHalfSize, OrthoHalfSize, -OrthoHalfSize, OrthoHalfSize, 0.0f, FarPlane);
+		return glm::perspective(glm::radians(Zoom), AspectRatio, NearPlane, FarPlane);
+	}
+
+	// returns the six world-space planes of the active projection, pointing inward
+	void GetFrustumPlanes(glm::vec4 planes[FRUSTUM_PLANE_COUNT])
+	{
+		ExtractFrustumPlanes(GetProjectionMatrix() * GetViewMatrix(), planes);
+	}
+
+	// returns the diameter in pixels of a world-space sphere drawn with the active projection
+	// into a viewport viewportHeight pixels tall; FLT_MAX when the camera is inside the sphere
+	float ProjectedDiameter(const glm::vec3& center, float radius, float viewportHeight) const
+	{
+		if (Orthographic)
+			return radius / OrthoHalfSize * viewportHeight;
+
+		// the silhouette's angular radius is asin(radius / distance); its tangent over tan(fovy / 2) is the share of half the viewport
+		float distanceSq = glm::dot(center - Position, center - Position);
+		if (distanceSq <= radius * radius)
+			return FLT_MAX;
+		float tangent = radius / std::sqrt(distanceSq - radius * radius);
+		return tangent / std::tan(glm::radians(Zoom) * 0.5f) * viewportHeight;
+	}
+
 	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
 	void ProcessKeyboard(Camera_Movement direction, float deltaTime)
 	{
@@ -0,0 +1,51 @@
+///////////////////////////////////////////////////////////////////////////////
+// culling.h
+// =========
+// batched view-frustum culling of world-space boxes with SSE / AVX
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "frustum.h"
+
+#include <cstddef>
+#include <vector>
+
+// World boxes stored as structure-of-arrays (center and half extent per
+// axis) so four or eight boxes load into one SIMD register per component
+struct AABBList
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+
+	size_t Size() const { return centerX.size(); }
+	void Clear();
+	void Add(const AABB& box);
+};
+
+///////////////////////////////////////////////////
+//	CullAABBs(const glm::vec4[6], const AABBList&, unsigned char*)
+//
+//	planes: inward facing frustum planes, see ExtractFrustumPlanes()
+//	boxes: boxes to test
+//	visible: receives 1 for every box touching the frustum, 0 otherwise
+//
+//	Tests eight boxes per step when compiled with AVX, four with SSE.
+//	Returns the number of visible boxes.
+///////////////////////////////////////////////////
+size_t CullAABBs(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const AABBList& boxes, unsigned char* visible);
+
+///////////////////////////////////////////////////
+//	CullAABBsMultiView(const glm::vec4*, int, const AABBList&, unsigned char*)
+//
+//	planes: viewCount sets of FRUSTUM_PLANE_COUNT planes, one after the other
+//	viewCount: at most 8
+//	viewMasks: receives, for every box, bit v set when it touches view v
+//
+//	One pass over the boxes for all views: the union of the frustums is
+//	what survives (mask != 0). Returns the number of boxes visible in any
+//	view.
+///////////////////////////////////////////////////
+size_t CullAABBsMultiView(const glm::vec4* planes, int viewCount, const AABBList& boxes, unsigned char* viewMasks);
@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////
+// frustum.h
+// =========
+// view-frustum planes and bounding volume tests used for culling
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+// Plane order returned by ExtractFrustumPlanes()
+enum Frustum_Plane {
+	FRUSTUM_LEFT,
+	FRUSTUM_RIGHT,
+	FRUSTUM_BOTTOM,
+	FRUSTUM_TOP,
+	FRUSTUM_NEAR,
+	FRUSTUM_FAR,
+	FRUSTUM_PLANE_COUNT
+};
+
+///////////////////////////////////////////////////
+//	ExtractFrustumPlanes(const glm::mat4&, glm::vec4[6])
+//
+//	matrix: combined clip matrix (projection * view [* model])
+//	planes: receives the six normalized planes (xyz = normal, w = distance)
+//
+//	Gribb/Hartmann extraction. The planes point inward and live in whatever
+//	space the matrix transforms from, so passing projection * view * model
+//	gives object-space planes.
+///////////////////////////////////////////////////
+inline void ExtractFrustumPlanes(const glm::mat4& m, glm::vec4 planes[FRUSTUM_PLANE_COUNT])
+{
+	// glm matrices are column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	planes[FRUSTUM_LEFT] = row3 + row0;
+	planes[FRUSTUM_RIGHT] = row3 - row0;
+	planes[FRUSTUM_BOTTOM] = row3 + row1;
+	planes[FRUSTUM_TOP] = row3 - row1;
+	planes[FRUSTUM_NEAR] = row3 + row2;
+	planes[FRUSTUM_FAR] = row3 - row2;
+
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		float len = glm::length(glm::vec3(planes[i]));
+		if (len > 0.0f)
+			planes[i] /= len;
+	}
+}
+
+// returns true when the sphere is at least partially inside all six planes
+inline bool SphereInFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const glm::vec3& center, float radius)
+{
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+// Axis-aligned bounding box
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+///////////////////////////////////////////////////
+//	TransformAABB(const AABB&, const glm::mat4&)
+//
+//	Smallest world box around the transformed local box (Arvo's method):
+//	the new center is the transformed center, the new half extents are the
+//	old ones projected through the absolute values of the 3x3 part.
+///////////////////////////////////////////////////
+inline AABB TransformAABB(const AABB& box, const glm::mat4& m)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+	glm::vec3 worldCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent;
+	for (int i = 0; i < 3; ++i)
+		worldExtent[i] = std::fabs(m[0][i]) * extent.x + std::fabs(m[1][i]) * extent.y + std::fabs(m[2][i]) * extent.z;
+
+	AABB result = { worldCenter - worldExtent, worldCenter + worldExtent };
+	return result;
+}
+
+// returns true when the box is at least partially inside all six planes
+inline bool AABBInFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const AABB& box)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		glm::vec3 normal(planes[i]);
+		float radius = glm::dot(glm::abs(normal), extent);
+		if (glm::dot(normal, center) + planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+// Entry distance of the ray into the box, clamped to 0 when the origin is
+// inside, or FLT_MAX when it misses the box before tMax
+inline float RayAABB(const glm::vec3& origin, const glm::vec3& invDirection, const glm::vec3& min, const glm::vec3& max, float tMax)
+{
+	glm::vec3 t0 = (min - origin) * invDirection;
+	glm::vec3 t1 = (max - origin) * invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+// Frustum test of a box that tells partial from full containment
+// 0: outside, 1: intersecting, 2: completely inside
+inline int ClassifyAABB(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 center = (min + max) * 0.5f;
+	glm::vec3 extent = (max - min) * 0.5f;
+	int result = 2;
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		glm::vec3 normal(planes[i]);
+		float distance = glm::dot(normal, center) + planes[i].w;
+		float radius = glm::dot(glm::abs(normal), extent);
+		if (distance + radius < 0.0f)
+			return 0;
+		if (distance - radius < 0.0f)
+			result = 1;
+	}
+	return result;
+}
@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////
+// hiz.h
+// =====
+// hierarchical-Z depth pyramid for occlusion culling, tested on the GPU or CPU
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "frustum.h"
+
+#include <vector>
+
+class HiZBuffer
+{
+public:
+	// One object for Test(), laid out like the compute shader's std430 struct.
+	// When the object passes and flags has HIZ_DRAW set, instanceCount of its
+	// commands [firstCommand, firstCommand + commandCount) is set to 1.
+	struct Object
+	{
+		glm::vec4 boxMin;			// World-space box; w unused
+		glm::vec4 boxMax;
+		GLuint firstCommand;
+		GLuint commandCount;
+		GLuint flags;
+		GLuint padding;
+	};
+	static const GLuint HIZ_DRAW = 1;
+
+	// Commands are DrawElementsIndirectCommand sized, instanceCount second
+	static const GLsizeiptr COMMAND_SIZE = 5 * sizeof(GLuint);
+	// Texture unit the pyramid is bound to while building and testing
+	static const GLuint TEXTURE_UNIT = 1;
+	// The CPU path reads back the first level no wider than this
+	static const int CPU_READBACK_WIDTH = 128;
+
+	HiZBuffer();
+
+	bool Initialize(int width, int height);
+	void Destroy();
+	// Recreate the textures when the framebuffer size changed
+	void Resize(int width, int height);
+
+	// Copy the depth buffer of the read framebuffer and rebuild the pyramid
+	void Build();
+
+	// GPU path: test every object against the pyramid with viewProjection,
+	// write commands (instanceCount 0) into the indirect buffer first and let
+	// the shader enable the ones whose object passed. Also starts reading the
+	// results back for ReadVisibility().
+	void Test(const glm::mat4& viewProjection, const std::vector<Object>& objects, const void* commands, GLsizei commandCount);
+	GLuint CommandBuffer() const { return mCommandBuffer; }
+	// Copy the newest finished Test() results into visible, one byte per
+	// object; returns false while none has arrived. Never waits.
+	bool ReadVisibility(std::vector<unsigned char>& visible);
+
+	// CPU path: start an asynchronous read of a coarse pyramid level built
+	// from a frame drawn with viewProjection
+	void RequestReadback(const glm::mat4& viewProjection);
+	// Pick up a finished readback and build the coarser levels on the CPU;
+	// returns false while none has arrived. Never waits.
+	bool ReadPyramid();
+	// True when the box may be visible in the last pyramid read back
+	bool TestCPU(const AABB& box) const;
+
+	int Width() const { return mWidth; }
+	int Height() const { return mHeight; }
+	int LevelCount() const { return mLevels; }
+
+private:
+	void CreateTextures(int width, int height);
+	void DestroyTextures();
+	void ReserveObjects(GLsizei count);
+
+	int mWidth;
+	int mHeight;
+	int mLevels;
+	GLuint mDepthTexture;				// Copy of the depth buffer
+	GLuint mPyramid;					// R32F, level 0 = full resolution, texels hold the farthest depth below them
+	GLuint mReduceProgram;
+	GLuint mTestProgram;
+
+	// GPU test buffers, grown on demand
+	GLsizei mObjectCapacity;
+	GLsizei mCommandCapacity;
+	GLuint mObjectBuffer;
+	GLuint mVisibilityBuffer;
+	GLuint mCommandBuffer;
+	GLuint mReadbackBuffer;				// Persistently mapped copy of the visibility buffer
+	const GLuint* mReadbackMapped;
+	GLsizei mReadbackCount;
+	GLsync mReadbackFence;
+
+	// CPU path
+	GLuint mPixelBuffer;
+	GLsync mPixelFence;
+	int mReadbackLevel;					// Pyramid level mCpuLevels[0] holds
+	glm::mat4 mPendingViewProjection;
+	glm::mat4 mCpuViewProjection;
+	std::vector<std::vector<float> > mCpuLevels;
+	std::vector<glm::ivec2> mCpuSizes;
+};
@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+// idbuffer.h
+// ==========
+// offscreen target with an object-id attachment and asynchronous pick readback
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <deque>
+#include <functional>
+
+// What the id attachment held under a click
+struct IdPickResult
+{
+	GLuint id;				// IdBuffer::NO_OBJECT when the region was empty
+	int x, y;				// Pixel that was clicked, y up
+	unsigned int frames;	// Frames between the click and the result
+};
+
+typedef std::function<void(const IdPickResult&)> IdPickCallback;
+
+class IdBuffer
+{
+public:
+	// Value of pixels no object was drawn to
+	static const GLuint NO_OBJECT = 0xFFFFFFFF;
+	// Pixels read around the click in each direction; the hit nearest the
+	// center of the (2 * PICK_RADIUS + 1)^2 region wins
+	static const int PICK_RADIUS = 2;
+	// Readbacks that may be in flight at once; further clicks wait their turn
+	static const int MAX_PENDING_PICKS = 4;
+
+	IdBuffer();
+
+	bool Initialize(int width, int height);
+	void Destroy();
+	void Resize(int width, int height);
+
+	// Bind the target for drawing, color to location 0 and ids to
+	// location 1, and clear color, ids and depth
+	void Begin(const glm::vec4& clearColor);
+	// Queue readbacks for the clicks requested since the last frame,
+	// deliver the ones that have arrived, and copy color to the default
+	// framebuffer, which is left bound
+	void End();
+
+	// Read the id under pixel (x, y), y up. callback runs inside a later
+	// End() once the GPU has finished the copy; nothing ever waits for it.
+	void RequestPick(int x, int y, const IdPickCallback& callback);
+
+	// False before Initialize(), after Destroy() and after a failed Initialize()
+	bool IsValid() const { return mFramebuffer != 0; }
+
+	int Width() const { return mWidth; }
+	int Height() const { return mHeight; }
+
+private:
+	struct Request
+	{
+		int x, y;
+		IdPickCallback callback;
+		unsigned int frame;			// mFrame when requested
+	};
+
+	// One pixel buffer per readback in flight
+	struct Readback
+	{
+		GLuint buffer;
+		GLsync fence;
+		int x, y;					// Clicked pixel
+		int left, bottom;			// Region read, clamped to the target
+		int width, height;
+		IdPickCallback callback;
+		unsigned int frame;
+	};
+
+	void CreateTargets(int width, int height);
+	void DestroyTargets();
+	void IssueReadbacks();
+	void DeliverReadbacks();
+
+	int mWidth;
+	int mHeight;
+	GLuint mFramebuffer;
+	GLuint mColor;
+	GLuint mIds;
+	GLuint mDepth;
+	unsigned int mFrame;
+	std::deque<Request> mRequests;
+	Readback mReadbacks[MAX_PENDING_PICKS];
+};
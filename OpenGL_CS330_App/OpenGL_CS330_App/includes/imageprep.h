@@ -0,0 +1,34 @@
+///////////////////////////////////////////////////////////////////////////////
+// imageprep.h
+// ===========
+// pixel conversions applied to decoded images before they are uploaded
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+
+// Reverse the order of the rows in place. Decoders write the top row
+// first; GL expects the bottom one first.
+void FlipRowsVertically(unsigned char* image, int width, int height, int channels);
+
+// 3 or 4 channel pixels to RGBA, opaque alpha for 3 channels, flipped on
+// the way when flip is set. rgba receives width x height x 4 bytes and
+// must not overlap source.
+void ConvertToRGBA(const unsigned char* source, int width, int height, int channels, bool flip, unsigned char* rgba);
+
+// Bilinear resample of 3 or 4 channel pixels to newWidth x newHeight RGBA,
+// flipped on the way when flip is set. Neighbours wrap around the edges,
+// as GL_REPEAT sampling does.
+void ResampleToRGBA(const unsigned char* source, int width, int height, int channels, int newWidth, int newHeight, bool flip, unsigned char* rgba);
+
+// Scale the color of each RGBA texel by its alpha, rounded to nearest
+void PremultiplyAlpha(unsigned char* rgba, size_t texels);
+
+// RGBA with sRGB encoded color to linear floats, four per texel; alpha
+// is linear already and is only scaled to 0..1
+void SRGBToLinear(const unsigned char* rgba, size_t texels, float* linear);
+// And back, clamped and rounded to the nearest sRGB code
+void LinearToSRGB(const float* linear, size_t texels, unsigned char* rgba);
@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+// mappedfile.h
+// ============
+// read-only memory mapping of a whole file
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile() { Close(); }
+
+	// Map filename; false when it cannot be opened or is empty
+	bool Open(const char* filename);
+	void Close();
+
+	const unsigned char* Data() const { return mData; }
+	size_t Size() const { return mSize; }
+
+private:
+	// The mapping belongs to exactly one object
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char* mData;
+	size_t mSize;
+#ifdef _WIN32
+	void* mFile;				// HANDLEs, kept out of the header with <windows.h>
+	void* mMapping;
+#else
+	int mFile;
+#endif
+};
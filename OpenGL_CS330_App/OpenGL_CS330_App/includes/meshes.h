@@ -13,8 +13,17 @@
 
 #include <glm/glm.hpp>
 
+#include "frustum.h"
+#include "meshlet.h"
+
+#include <vector>
+
+class UploadQueue;
+class BufferPool;
+
 class Meshes
 {
+public:
 	// Stores the GL data relative to a given mesh
 	struct GLMesh
 	{
@@ -22,6 +31,24 @@ class Meshes
 		GLuint vbos[2];     // Handles for the vertex buffer objects
 		GLuint nVertices;	// Number of vertices for the mesh
 		GLuint nIndices;    // Number of indices for the mesh
+		unsigned int uploadTicket;	// Last queued upload for the mesh buffers
+		unsigned int vertexAlloc;	// BufferPool ranges holding the mesh, 0 when not pooled
+		unsigned int indexAlloc;
+		AABB bounds;				// Object-space box around the vertex positions
+		std::vector<glm::vec3> positions;	// CPU copies of the positions and indices, for picking
+		std::vector<GLuint> indices;
+		std::vector<Meshlet> meshlets;		// Clusters of a triangle list mesh in index order, empty for the others
+	};
+
+	// Laid out like DrawElementsIndirectCommand. Non-indexed meshes use the
+	// first four fields as DrawArraysIndirectCommand (baseVertex stays 0).
+	struct DrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint first;
+		GLint baseVertex;
+		GLuint baseInstance;
 	};
 
 public:
@@ -37,8 +64,18 @@ public:
 	GLMesh gTorusMesh;
 
 public:
-	void CreateMeshes();
+	void CreateMeshes(UploadQueue* uploadQueue = nullptr, BufferPool* bufferPool = nullptr);
 	void DestroyMeshes();
+	void DrawMesh(const GLMesh &mesh, GLenum mode, GLint first, GLsizei count) const;
+	void DrawMesh(const GLMesh &mesh, GLenum mode) const;
+	DrawCommand GetDrawCommand(const GLMesh &mesh, GLint first, GLsizei count, GLuint instanceCount = 1) const;
+	void DrawMeshIndirect(const GLMesh &mesh, GLenum mode, GLintptr commandOffset) const;
+	bool IsResident(const GLMesh &mesh) const;
+	// Draw the clusters of a triangle list mesh that pass the frustum and backface cone tests; returns how many
+	unsigned int DrawMeshClusters(const GLMesh &mesh, const glm::mat4 &model, const glm::mat4 &viewProjection, const glm::vec3 &eye, bool testCones) const;
+
+	// Tolerance used when welding the hand-authored primitive tables
+	float weldEpsilon = 1e-5f;
 
 private:
 	void UCreatePlaneMesh(GLMesh &mesh);
@@ -53,6 +90,18 @@ private:
 	void UCreateSphereMesh(GLMesh &mesh);
 
 	void UDestroyMesh(GLMesh &mesh);
+	void UGenBuffers(GLMesh &mesh, GLsizei count);
+	void UStorePositions(GLMesh &mesh, const GLfloat* verts, size_t vertexCount);
+	void UBufferData(GLMesh &mesh, GLenum target, GLsizeiptr size, const void* data);
+	void UBufferWeldedData(GLMesh &mesh, const char* name, const GLfloat* verts, GLuint floatsPerVertex, bool clustered = false);
+	void UBufferClusteredIndices(GLMesh &mesh, const GLuint* indices, size_t count);
 
 	void CalculateTriangleNormal(glm::vec3 px, glm::vec3 py, glm::vec3 pz);
+
+	UploadQueue* mUploadQueue = nullptr;
+	BufferPool* mBufferPool = nullptr;
+	// Surviving cluster ranges of the last DrawMeshClusters() call, kept to reuse their storage
+	mutable std::vector<GLsizei> mClusterCounts;
+	mutable std::vector<const void*> mClusterOffsets;
+	mutable std::vector<GLint> mClusterBaseVertices;
 };
\ No newline at end of file
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// meshlet.h
+// =========
+// split indexed triangle meshes into small clusters (meshlets) that can be
+// culled individually against the view frustum and a backface normal cone
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Cluster size limits
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// A contiguous range of the (reordered) index buffer plus its culling bounds.
+// All bounds are in the object space of the source mesh.
+struct Meshlet
+{
+	unsigned int indexOffset;	// First index of the cluster in the index buffer
+	unsigned int indexCount;	// Number of indices (3 per triangle)
+	unsigned int vertexCount;	// Number of unique vertices referenced by the cluster
+
+	glm::vec3 center;			// Bounding sphere center
+	float radius;				// Bounding sphere radius
+
+	glm::vec3 coneApex;			// Apex of the normal cone
+	glm::vec3 coneAxis;			// Average facing direction of the triangles
+	float coneCutoff;			// sin of the cone half-angle, 1.0 disables the cone test
+};
+
+///////////////////////////////////////////////////
+//	BuildMeshlets(...)
+//
+//	positions:	pointer to the x component of the first vertex position
+//	stride:		distance between two positions, in floats
+//	vertexCount: number of vertices in the position array
+//	indices:	triangle list, reordered in place so every meshlet is a
+//				contiguous index range
+//
+//	Returns the clusters in index buffer order.
+///////////////////////////////////////////////////
+std::vector<Meshlet> BuildMeshlets(const float* positions, size_t stride, size_t vertexCount, std::vector<unsigned int>& indices);
+
+///////////////////////////////////////////////////
+//	IsMeshletVisible(...)
+//
+//	planes: object-space frustum planes (see ExtractFrustumPlanes)
+//	eye:	camera position in the same object space
+//	testCone: false when the model matrix mirrors geometry (negative determinant)
+///////////////////////////////////////////////////
+bool IsMeshletVisible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& eye, bool testCone = true);
@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+// mipgenerator.h
+// ==============
+// complete RGBA8 mip chains built on the CPU
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstdint>
+#include <vector>
+
+enum MipFilter
+{
+	MIP_FILTER_BOX,				// Average of the 2x2 texels under each texel of the next level
+	MIP_FILTER_KAISER			// Kaiser windowed sinc over three texels of the next level either side; sharper
+};
+
+struct MipSettings
+{
+	MipFilter filter;
+	bool srgb;					// Color is sRGB encoded: filter it in linear space
+	float alphaCutoff;			// Alpha test threshold whose coverage every level keeps, 0 for none
+};
+
+// Filter, color space and cutoff in 32 bits, for telling caches built with other settings apart
+uint32_t MipSettingsKey(const MipSettings& settings);
+
+///////////////////////////////////////////////////
+//	GenerateMipChain(const unsigned char*, int, int, const MipSettings&, ...)
+//
+//	rgba: width x height RGBA8 texels, level 0
+//	levels: receives level 0 and every level below it down to 1x1, back
+//	to back, each as tightly packed RGBA8
+//	levelSizes: receives the bytes of each level
+//
+//	Thread safe; the texture loader calls it on its workers.
+///////////////////////////////////////////////////
+void GenerateMipChain(const unsigned char* rgba, int width, int height, const MipSettings& settings, std::vector<unsigned char>& levels, std::vector<GLsizei>& levelSizes);
@@ -0,0 +1,81 @@
+///////////////////////////////////////////////////////////////////////////////
+// occlusion.h
+// ===========
+// low resolution software depth rasterizer for CPU-side occlusion culling
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "frustum.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class OcclusionRasterizer
+{
+public:
+	// Size of the depth buffer; WIDTH is a multiple of the SIMD width
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	// Upper bound for the worker threads, each rasterizing one band of rows
+	static const int MAX_THREADS = 4;
+
+	OcclusionRasterizer();
+	~OcclusionRasterizer();
+
+	// Start threadCount - 1 workers; 0 picks one per core up to MAX_THREADS
+	void Initialize(int threadCount = 0);
+	void Destroy();
+
+	// Drop last frame's occluders; viewProjection is used by everything below
+	void BeginFrame(const glm::mat4& viewProjection);
+	// Queue a world-space triangle; either winding is accepted
+	void AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+	// Queue the 12 triangles of box transformed by model (an oriented box)
+	void AddOccluder(const AABB& box, const glm::mat4& model);
+	// Clip and set up the queued triangles, then clear and fill the depth
+	// buffer with all threads. Returns once every band is done.
+	void Rasterize();
+
+	// True when some part of the world-space box may be in front of the occluders
+	bool TestAABB(const AABB& box) const;
+
+	const float* DepthBuffer() const { return mDepth; }
+	// Triangles left after clipping in the last Rasterize()
+	size_t TriangleCount() const { return mSetups.size(); }
+
+private:
+	// A screen-space triangle ready for the inner loop. Edge i is
+	// edgeA[i] * x + edgeB[i] * y + edgeC[i], >= 0 inside; depth is
+	// depthA * x + depthB * y + depthC, all at pixel centers.
+	struct Setup
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, maxX, minY, maxY;
+	};
+
+	void SetupTriangle(const glm::vec4 clip[3]);
+	void RasterizeBand(int band);
+	void WorkerLoop(int band);
+
+	glm::mat4 mViewProjection;
+	std::vector<glm::vec4> mClipVertices;		// Three per queued triangle
+	std::vector<Setup> mSetups;
+	alignas(32) float mDepth[WIDTH * HEIGHT];
+
+	// Workers wait for mGeneration to change, rasterize their band and
+	// count mPending down
+	std::vector<std::thread> mWorkers;
+	int mBandCount;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	unsigned int mGeneration;
+	int mPending;
+	bool mQuit;
+};
@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+// occlusionquery.h
+// ================
+// bounding-box occlusion queries driving conditional rendering
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "frustum.h"
+
+#include <vector>
+
+class OcclusionQueries
+{
+public:
+	// Frames a query result may take to arrive before its object's slot is reused
+	static const int FRAMES_IN_FLIGHT = 3;
+
+	OcclusionQueries();
+
+	// One query per object and frame in flight, plus the box program and mesh
+	bool Initialize(int objectCount);
+	void Destroy();
+
+	// Start a frame drawn with viewProjection. The results of the queries
+	// last issued from this frame's slots are counted if they have arrived;
+	// this never waits for them.
+	void BeginFrame(const glm::mat4& viewProjection);
+
+	// Bracket Issue() calls: binds the box program and turns color and depth
+	// writes off, and back on afterwards. Issue after the occluders are drawn.
+	void BeginQueries();
+	void EndQueries();
+	// Draw the object's box inside its query. Returns false without issuing
+	// one when the eye is about nearPlane from the box or inside it, where the
+	// near plane would clip the box away and hide an object in plain view.
+	bool Issue(int object, const AABB& box, const glm::vec3& eye, float nearPlane);
+
+	// Draws between these are skipped by the GPU when none of the object's
+	// box passed the depth test this frame. GL_QUERY_NO_WAIT: a query that has
+	// not finished yet draws. Without a query issued this frame both do nothing.
+	void BeginConditional(int object);
+	void EndConditional();
+
+	// Queries issued since BeginFrame()
+	unsigned int IssuedCount() const { return mIssuedCount; }
+	// Results BeginFrame() read back, and how many of them skipped their draws
+	unsigned int ResultCount() const { return mResultCount; }
+	unsigned int HiddenCount() const { return mHiddenCount; }
+
+private:
+	GLuint Query(int object) const { return mQueries[mSlot * mObjectCount + object]; }
+
+	GLuint mProgram;
+	GLint mViewProjectionLocation;
+	GLint mBoxMinLocation;
+	GLint mBoxMaxLocation;
+	GLuint mVao;
+	GLuint mBuffers[2];				// Unit cube vertices and indices
+	int mObjectCount;
+	int mSlot;						// Frame slot in use, 0 .. FRAMES_IN_FLIGHT - 1
+	std::vector<GLuint> mQueries;	// [slot * object count + object]
+	std::vector<unsigned char> mIssued;	// Same layout: result not read yet
+	bool mConditional;				// A BeginConditional() started conditional rendering
+	glm::mat4 mViewProjection;
+	unsigned int mIssuedCount;
+	unsigned int mResultCount;
+	unsigned int mHiddenCount;
+};
@@ -0,0 +1,93 @@
+///////////////////////////////////////////////////////////////////////////////
+// octree.h
+// ========
+// loose octree over moving object boxes, with pooled nodes
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "frustum.h"
+
+#include <functional>
+#include <vector>
+
+class LooseOctree
+{
+public:
+	// 64 byte node. A node's cell is center +- halfSize; objects stored in it
+	// have their center in the cell and may reach halfSize beyond it, so its
+	// loose bounds are center +- 2 * halfSize.
+	struct Node
+	{
+		glm::vec3 center;
+		float halfSize;
+		int children[8];		// -1 where there is no child; index bit 0: +x, 1: +y, 2: +z
+		int parent;
+		int firstObject;		// Head of the node's object list, -1 when empty
+		int depth;
+		int childCount;
+	};
+
+	// Deepest level Initialize() accepts
+	static const int MAX_DEPTH = 12;
+
+	// Precise test for ray queries, as in BVH
+	typedef std::function<bool(int object, float& t)> RayTest;
+
+	// Start over with a root cell around bounds. Objects whose center lies
+	// outside it still work, they are kept in the root.
+	void Initialize(const AABB& bounds, int maxDepth = 8);
+	// Remove every object, keeping the node and object storage
+	void Clear();
+
+	// Objects are small non-negative ids, like indices into the caller's arrays
+	void Insert(int object, const AABB& box);
+	// Move an object. Returns true when it stayed in its node, which only
+	// stores the new box; otherwise it is removed and inserted again.
+	bool Update(int object, const AABB& box);
+	void Remove(int object);
+	bool Contains(int object) const { return object >= 0 && object < (int)mEntries.size() && mEntries[object].node >= 0; }
+
+	// Append every object whose box touches the box
+	void QueryBox(const AABB& box, std::vector<int>& objects) const;
+	// Append every object whose box touches the sphere
+	void QuerySphere(const glm::vec3& center, float radius, std::vector<int>& objects) const;
+	// Append every object whose box touches the frustum
+	void QueryFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], std::vector<int>& objects) const;
+	// Nearest object along the ray within t, or -1; see BVH::Raycast()
+	int Raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const RayTest& test = RayTest()) const;
+
+	bool Empty() const { return mObjectCount == 0; }
+	size_t ObjectCount() const { return mObjectCount; }
+	// Nodes in use, the root included
+	size_t NodeCount() const { return mNodes.size() - mFreeNodes.size(); }
+	// Update() calls since Initialize() that had to move an object to another node
+	size_t Reinsertions() const { return mReinsertions; }
+
+private:
+	// Per object: its box and its links in the node's list
+	struct Entry
+	{
+		AABB box;
+		int node;				// -1 when the object is not in the tree
+		int previous;
+		int next;
+	};
+
+	int PlacementDepth(const glm::vec3& center, const glm::vec3& extent) const;
+	int AllocateNode(int parent, int depth, const glm::vec3& center, float halfSize);
+	// Node at depth whose cell holds center, created along with any missing ancestors
+	int ObtainNode(const glm::vec3& center, int depth);
+	void Link(int object, int node);
+	void Unlink(int object);
+	void ReleaseEmpty(int node);
+
+	std::vector<Node> mNodes;			// mNodes[0] is the root
+	std::vector<int> mFreeNodes;
+	std::vector<Entry> mEntries;		// Indexed by object id
+	int mMaxDepth = 0;
+	size_t mObjectCount = 0;
+	size_t mReinsertions = 0;
+};
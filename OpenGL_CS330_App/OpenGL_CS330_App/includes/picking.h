@@ -0,0 +1,61 @@
+///////////////////////////////////////////////////////////////////////////////
+// picking.h
+// =========
+// ray casting against mesh triangles for mouse picking
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// What a pick ray hit; object and triangle are -1 on a miss
+struct PickResult
+{
+	int object;
+	int triangle;		// Index into the object's PickShape
+	float distance;		// World units from the ray origin
+};
+
+// Object-space triangles of one shape, stored as structure-of-arrays
+// (first vertex and two edges per axis) so four or eight triangles load
+// into one SIMD register per component. Instances share a shape and move
+// the ray into object space instead.
+class PickShape
+{
+public:
+	void Clear();
+	// Append the triangles a draw call of mode (GL_TRIANGLES, GL_TRIANGLE_STRIP
+	// or GL_TRIANGLE_FAN) over elements [first, first + count) produces;
+	// indices may be empty for non-indexed meshes
+	void AddTriangles(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, GLenum mode, GLint first, GLsizei count);
+
+	// Nearest triangle hit closer than t, or -1. t is measured in multiples
+	// of direction, which need not be normalized, and receives the hit.
+	int Intersect(const glm::vec3& origin, const glm::vec3& direction, float& t) const;
+
+	size_t TriangleCount() const { return mV0x.size(); }
+
+private:
+	void AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+
+	std::vector<float> mV0x, mV0y, mV0z;
+	std::vector<float> mE1x, mE1y, mE1z;
+	std::vector<float> mE2x, mE2y, mE2z;
+};
+
+///////////////////////////////////////////////////
+//	ScreenPointToRay(const glm::mat4&, const glm::vec2&, glm::vec3&, glm::vec3&)
+//
+//	viewProjection: matrix the scene is drawn with
+//	ndc: point on screen in normalized device coordinates (-1..1, y up)
+//	origin, direction: receive the world-space ray through the point,
+//	starting on the near plane, direction normalized
+///////////////////////////////////////////////////
+void ScreenPointToRay(const glm::mat4& viewProjection, const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction);
@@ -0,0 +1,54 @@
+///////////////////////////////////////////////////////////////////////////////
+// ringbuffer.h
+// ============
+// triple-buffered, persistently mapped buffer for data that changes every frame
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+class RingBuffer
+{
+public:
+	// Number of frames that may be in flight at once, one region each
+	static const int FRAME_COUNT = 3;
+
+	RingBuffer();
+
+	// target: GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER, selects the offset alignment
+	// frameSize: bytes available to each frame
+	bool Initialize(GLenum target, GLsizeiptr frameSize);
+	void Destroy();
+
+	// Start writing the next region; waits only if the GPU is still reading it
+	void BeginFrame();
+	// Fence the current region once every draw reading it has been issued
+	void EndFrame();
+
+	// Reserve size bytes in the current region and return a pointer into the
+	// mapping, or nullptr when the region is full. offset receives the
+	// position in the buffer to pass to Bind().
+	void* Allocate(GLsizeiptr size, GLintptr& offset);
+	// Allocate() and memcpy in one go; returns -1 when the region is full
+	GLintptr Write(const void* data, GLsizeiptr size);
+	// glBindBufferRange() on the ring's target
+	void Bind(GLuint index, GLintptr offset, GLsizeiptr size) const;
+
+	GLuint Buffer() const { return mBuffer; }
+	// Frames that had to wait for the GPU in BeginFrame()
+	unsigned int StallCount() const { return mStalls; }
+
+private:
+	GLenum mTarget;
+	GLuint mBuffer;
+	unsigned char* mMapped;
+	GLsizeiptr mFrameSize;
+	GLsizeiptr mAlignment;
+	int mFrame;
+	GLsizeiptr mHead;				// Bytes used in the current region
+	GLsync mFences[FRAME_COUNT];
+	unsigned int mStalls;
+};
@@ -0,0 +1,43 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturearray.h
+// ==============
+// square, mipmapped RGBA8 layers of one GL_TEXTURE_2D_ARRAY, handed out one at a time
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+class TextureArray
+{
+public:
+	TextureArray();
+
+	// Immutable storage for layerCount layers of layerSize x layerSize, with
+	// mip levels down to 1x1, cleared to the same grey as the 2D texture
+	// placeholders
+	bool Initialize(GLsizei layerSize, GLsizei layerCount);
+	void Destroy();
+
+	// A free layer, or -1 when every layer is taken
+	GLint AllocateLayer();
+	void FreeLayer(GLint layer);
+
+	GLuint Texture() const { return mTexture; }
+	GLsizei LayerSize() const { return mLayerSize; }
+	// Bytes of one layer's whole mip chain
+	size_t LayerBytes() const;
+	GLsizei UsedLayers() const { return mLayerCount - (GLsizei)mFreeLayers.size(); }
+
+private:
+	GLuint mTexture;
+	GLsizei mLayerSize;
+	GLsizei mLevels;
+	GLsizei mLayerCount;
+	std::vector<GLint> mFreeLayers;		// Popped from the back, lowest layer first
+};
@@ -0,0 +1,85 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturecache.h
+// ==============
+// shared, reference counted textures keyed by path and file content
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "texturearray.h"
+#include "textureloader.h"
+#include "uploadqueue.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A texture as the shaders see it: a 2D texture, or one layer of an array
+struct TextureHandle
+{
+	GLuint texture;			// 0 when loading failed
+	GLint layer;			// -1 for a GL_TEXTURE_2D
+};
+
+// Counters reported by TextureCache::GetStats()
+struct TextureCacheStats
+{
+	unsigned int hits;			// Acquire() calls served by a resident texture
+	unsigned int misses;		// Acquire() calls that had to decode a file
+	unsigned int textures;		// Textures resident now
+	unsigned int packedLayers;	// Those of them living in a layer of the texture array
+	size_t residentBytes;		// Their estimated GPU memory, mip chains included
+};
+
+class TextureCache
+{
+	struct Entry
+	{
+		TextureHandle handle;
+		uint64_t hash;				// Content hash of the file
+		unsigned int references;
+		size_t bytes;
+		std::vector<std::string> paths;	// Every path that resolved to this texture
+	};
+
+public:
+	TextureCache();
+
+	// New textures are decoded by loader; uploads is told when one is freed
+	// early. Small images go to layers of smallTextures while it has room;
+	// without it every image gets its own 2D texture.
+	void Initialize(TextureLoader* loader, UploadQueue* uploads, TextureArray* smallTextures = nullptr);
+	// Delete every texture still resident, whatever its reference count
+	void Destroy();
+
+	// Texture holding filename, texture 0 when the file cannot be read or
+	// decoded. A path seen before is a hit without touching the file;
+	// otherwise the file is read and hashed, and a file with the same content
+	// as a resident texture is a hit too. Each successful call takes one
+	// reference.
+	TextureHandle Acquire(const char* filename);
+	// Drop one reference; the last one deletes the texture or frees its layer
+	void Release(TextureHandle handle);
+
+	TextureCacheStats GetStats() const;
+
+private:
+	void Free(const Entry& entry);
+
+	TextureLoader* mLoader;
+	UploadQueue* mUploads;
+	TextureArray* mSmallTextures;
+	// Entries are keyed by texture and layer together, see UHandleKey()
+	std::unordered_map<uint64_t, Entry> mEntries;
+	std::unordered_map<std::string, uint64_t> mByPath;
+	std::unordered_map<uint64_t, uint64_t> mByHash;
+	unsigned int mHits;
+	unsigned int mMisses;
+	size_t mResidentBytes;
+};
@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturecontainer.h
+// ==================
+// DDS and KTX2 headers: GL format and the place of every stored mip level
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A 2D texture as stored in a container file, ready to upload level by level
+struct TextureContainer
+{
+	GLsizei width;
+	GLsizei height;
+	GLenum internalFormat;
+	GLenum format;						// Pixel format of raw levels, 0 for block compressed ones
+	bool generateMipmaps;				// The file holds level 0 only and asks for the rest to be built
+	std::vector<size_t> levelOffsets;	// File offset of each level, level 0 first
+	std::vector<GLsizei> levelSizes;	// Bytes of each level
+};
+
+// Whether filename ends in .dds or .ktx2, in any case
+bool IsTextureContainerFile(const char* filename);
+
+// Read the header and level index of a DDS or KTX2 file held in data.
+// Only single 2D images in 8-bit RGB(A) or a BCn format are taken, not
+// arrays, cube maps, volumes or supercompressed KTX2; anything else and
+// levels running past the end of the file print why and return false.
+bool ParseTextureContainer(const std::string& name, const unsigned char* data, size_t size, TextureContainer& container);
+
+// GPU bytes of the texture, mip chain included
+size_t ContainerBytes(const TextureContainer& container);
@@ -0,0 +1,130 @@
+///////////////////////////////////////////////////////////////////////////////
+// textureloader.h
+// ===============
+// image files decoded on worker threads and handed to the upload queue
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "blockencoder.h"
+#include "mappedfile.h"
+#include "mipgenerator.h"
+#include "texturearray.h"
+#include "texturecontainer.h"
+#include "texturestreamer.h"
+#include "threadpool.h"
+#include "uploadqueue.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Whole file into bytes; false when it cannot be read or is empty
+bool ReadFileBytes(const char* filename, std::vector<unsigned char>& bytes);
+// 64-bit FNV-1a of bytes with the length folded in last; identifies file content
+uint64_t HashFileBytes(const std::vector<unsigned char>& bytes);
+uint64_t HashFileBytes(const unsigned char* bytes, size_t size);
+
+class TextureLoader
+{
+	// An image a worker has finished with, waiting for the GL thread
+	struct Decoded
+	{
+		GLuint texture;
+		GLint layer;				// -1 for a GL_TEXTURE_2D
+		std::string filename;
+		int width;
+		int height;
+		int channels;
+		std::vector<unsigned char> pixels;	// Empty when decoding failed
+		GLenum compressedFormat;			// 0 for raw pixels
+		std::vector<GLsizei> levelSizes;	// 2D textures: bytes of each mip level in pixels
+		std::string chainPath;				// Streamed 2D textures: cache file holding the same chain, "" for none
+	};
+
+	// A decode submitted to the pool. GL may hand a cancelled texture's name
+	// out again, so the job number identifies it.
+	struct InFlight
+	{
+		unsigned int job;
+		GLuint texture;
+		GLint layer;
+		bool cancelled;
+	};
+
+public:
+	TextureLoader();
+
+	// Decodes run on pool; the pixels go through uploads
+	void Initialize(ThreadPool* pool, UploadQueue* uploads);
+	// Wait for the decodes still running and drop every result not uploaded yet
+	void Destroy();
+
+	// Block compress 2D textures on the workers: opaque images to format,
+	// images with alpha to alphaFormat. Encoded mip chains are stored in
+	// cacheDirectory, named by file content, and later runs upload them
+	// without decoding the image at all. Call before the first Load().
+	void EnableCompression(BlockFormat format, BlockFormat alphaFormat, const std::string& cacheDirectory);
+	// How workers filter the mip chains of 2D textures: Kaiser in linear
+	// space by default, the image files being sRGB. Call before the first Load().
+	void SetMipSettings(const MipSettings& settings) { mMipSettings = settings; }
+	// Hand the mip chains of 2D textures to streamer instead of uploading
+	// them whole; array layers and DDS / KTX2 files are not streamed. Chains
+	// are stored in cacheDirectory, where EnableCompression() puts its own,
+	// so the streamer can read their levels back instead of holding them.
+	void SetStreamer(TextureStreamer* streamer, const std::string& cacheDirectory);
+	// GPU bytes of a 2D texture made from a width x height image, mips included
+	size_t ResidentBytes(int width, int height, int channels) const;
+
+	// Create textureId holding a 1x1 grey placeholder and start decoding
+	// filename, flipped vertically. Only the image header is read here; false
+	// when it cannot be read or has a channel count other than 3 or 4.
+	bool Load(const char* filename, GLuint& textureId);
+	// Same for a file already read into memory; name is only used in messages
+	bool Load(const std::string& name, std::vector<unsigned char>&& file, GLuint& textureId);
+	// Upload the levels of a parsed DDS or KTX2 file as they are stored,
+	// straight from the mapping and without a worker; false when the GL
+	// cannot sample its format
+	bool Load(const std::string& name, std::shared_ptr<const MappedFile> file, const TextureContainer& container, GLuint& textureId);
+	// Decode file into layer of array, resampled to the layer size and mipmapped on the worker
+	bool LoadLayer(const std::string& name, std::vector<unsigned char>&& file, const TextureArray& array, GLint layer);
+	// Forget texture (or one layer of it) before it is deleted: a decode still running is thrown away,
+	// and the streamer stops streaming it
+	void Cancel(GLuint texture, GLint layer = -1);
+
+	// Call once per frame on the GL thread, before the upload queue runs:
+	// enqueues the images decoded since the last call
+	void Update();
+
+	// Images still decoding or waiting for Update()
+	size_t Pending() const;
+
+private:
+	void CreatePlaceholder(GLuint& textureId);
+	unsigned int BeginDecode(GLuint texture, GLint layer);
+	void Decode(unsigned int job, GLuint texture, GLint layer, GLsizei layerSize, const std::string& filename, const std::vector<unsigned char>& file);
+	void DecodeCompressed(const std::string& filename, const std::vector<unsigned char>& file, Decoded& result) const;
+	void StoreChain(const std::string& filename, const std::vector<unsigned char>& file, Decoded& result) const;
+
+	ThreadPool* mPool;
+	UploadQueue* mUploads;
+	TextureStreamer* mStreamer;
+	mutable std::mutex mMutex;
+	std::condition_variable mDecodeDone;
+	std::vector<Decoded> mDecoded;
+	std::vector<InFlight> mDecoding;
+	unsigned int mNextJob;
+	bool mCompress;
+	BlockFormat mFormat;
+	BlockFormat mAlphaFormat;
+	std::string mCacheDirectory;
+	MipSettings mMipSettings;
+};
@@ -0,0 +1,127 @@
+///////////////////////////////////////////////////////////////////////////////
+// texturestreamer.h
+// =================
+// mip levels of 2D textures uploaded as their on-screen size needs them
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "threadpool.h"
+#include "uploadqueue.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counters reported by TextureStreamer::GetStats()
+struct TextureStreamerStats
+{
+	unsigned int textures;			// Textures being streamed
+	size_t uploadedBytes;			// Bytes of their levels from the base level down, uploaded or queued. This is what
+									// the budget caps, not GPU memory: immutable storage holds every level regardless
+	size_t budgetBytes;
+	size_t memoryBytes;				// Levels kept in RAM for textures whose chain is not in the disk cache
+	unsigned int levelsStreamed;	// Levels uploaded since Initialize()
+	unsigned int levelsDropped;		// Levels given up to stay in budget since Initialize()
+	unsigned int levelsRead;		// Levels read back from the disk cache since Initialize()
+};
+
+class TextureStreamer
+{
+	struct Entry
+	{
+		GLsizei width;
+		GLsizei height;
+		GLenum internalFormat;
+		GLenum format;						// 0 for block compressed levels
+		std::vector<GLsizei> levelSizes;
+		std::vector<size_t> levelOffsets;	// Where each level starts, from level 0, in levels or in path
+		std::vector<unsigned char> levels;	// Levels finer than coarseLevel when there is no path, else empty
+		std::string path;					// Cache file holding the chain, read back a level at a time
+		size_t pathOffset;					// Where level 0 starts in path
+		GLint coarseLevel;					// Finest level uploaded with the storage; never dropped
+		GLint finestLevel;					// Finest level that can be streamed, 0 unless reading path failed
+		GLint residentLevel;				// Finest level uploaded or queued, the base level once it lands
+		GLint wantedLevel;					// Finest level asked for since the last Update()
+		unsigned int requestFrame;			// Update() count when wantedLevel was last asked for
+		unsigned int serial;				// Tells a read for this entry from one for an earlier texture of the same name
+		bool reading;						// A level is being read back from path
+		UploadTicket ticket;				// Upload still in flight, 0 for none
+	};
+
+	// A level a worker has read back from a cache file, waiting for Update()
+	struct LevelRead
+	{
+		GLuint texture;
+		unsigned int serial;
+		GLint level;
+		std::vector<unsigned char> bytes;	// Empty when the read failed
+	};
+
+public:
+	TextureStreamer();
+
+	// Levels no larger than this are uploaded with the storage and stay resident
+	static const GLsizei COARSE_SIZE = 64;
+
+	// Levels are read back on pool and go through uploads; budgetBytes caps
+	// the bytes of levels uploaded for every streamed texture together
+	void Initialize(ThreadPool* pool, UploadQueue* uploads, size_t budgetBytes);
+	// Wait for the reads still running and forget every texture
+	void Destroy();
+
+	void SetBudget(size_t budgetBytes) { mBudgetBytes = budgetBytes; }
+
+	// Take over a 2D texture's whole mip chain, levels back to back with
+	// level 0 first: the texture gets immutable storage for every level
+	// and only the levels no larger than COARSE_SIZE are uploaded. path
+	// holds the same levels from pathOffset on and finer levels are read
+	// back from it when needed; with no path they are kept in memory.
+	void Add(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& levels,
+		const std::string& path, size_t pathOffset);
+	// Stop streaming texture, before it is deleted
+	void Remove(GLuint texture);
+
+	// texture repeats once every pixels pixels on screen this frame; the
+	// finest level any request needs is streamed in by the next Update()
+	void Request(GLuint texture, float pixels);
+
+	// Call once per frame on the GL thread, before the upload queue runs:
+	// queues the levels read back since the last call and the next finer
+	// level of the textures that need one, most blurred first, dropping
+	// levels nobody needs when the budget is full
+	void Update();
+
+	TextureStreamerStats GetStats() const;
+
+private:
+	GLint WantedLevel(const Entry& entry) const;
+	bool DropLevel(GLuint keep);
+	void Enqueue(GLuint texture, Entry& entry, GLint firstLevel, GLint lastLevel, bool allocate, std::vector<unsigned char>&& data);
+	void StartRead(GLuint texture, Entry& entry, GLint level);
+	void ReadLevel(LevelRead read, const std::string& path, size_t offset, size_t size);
+	void FinishReads();
+
+	ThreadPool* mPool;
+	UploadQueue* mUploads;
+	std::unordered_map<GLuint, Entry> mEntries;
+	size_t mBudgetBytes;
+	size_t mUploadedBytes;
+	size_t mMemoryBytes;
+	unsigned int mFrame;
+	unsigned int mNextSerial;
+	unsigned int mLevelsStreamed;
+	unsigned int mLevelsDropped;
+	unsigned int mLevelsRead;
+	std::mutex mMutex;
+	std::condition_variable mReadDone;
+	std::vector<LevelRead> mRead;	// Finished reads, guarded by mMutex
+	unsigned int mReading;			// Reads submitted and not finished, guarded by mMutex
+};
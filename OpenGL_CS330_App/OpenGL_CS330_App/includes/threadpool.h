@@ -0,0 +1,48 @@
+///////////////////////////////////////////////////////////////////////////////
+// threadpool.h
+// ============
+// fixed set of worker threads taking queued tasks in submission order
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	ThreadPool();
+	~ThreadPool() { Destroy(); }
+
+	// threadCount 0: one worker per core, leaving one core for the render thread
+	void Initialize(unsigned int threadCount = 0);
+	// Run what is still queued, then stop and join the workers
+	void Destroy();
+
+	// Run task on a worker. Without workers it runs right here.
+	void Submit(Task task);
+	// Block until the queue is empty and no task is running
+	void WaitIdle();
+
+	unsigned int ThreadCount() const { return (unsigned int)mThreads.size(); }
+
+private:
+	void WorkerMain();
+
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mWake;		// Tasks queued or stopping
+	std::condition_variable mIdle;		// Queue drained and nothing running
+	std::deque<Task> mTasks;
+	unsigned int mBusy;				// Tasks taken off the queue and still running
+	bool mStopping;
+};
@@ -0,0 +1,122 @@
+///////////////////////////////////////////////////////////////////////////////
+// uploadqueue.h
+// =============
+// budgeted, incremental buffer and texture uploads through staging buffers
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "mappedfile.h"
+
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Identifies an enqueued upload, see UploadQueue::IsReady()
+typedef unsigned int UploadTicket;
+
+class UploadQueue
+{
+	// A piece of work waiting for its turn on the GL thread
+	struct Job
+	{
+		UploadTicket ticket;
+		bool isTexture;
+		GLuint target;				// Destination buffer or texture name
+		GLintptr destOffset;		// Destination offset in bytes (buffers only)
+		GLintptr offset;			// Bytes of data already issued (buffers only)
+		std::vector<unsigned char> data;
+		// texture only
+		GLsizei width;
+		GLsizei height;
+		GLenum internalFormat;
+		GLenum format;
+		bool generateMipmaps;
+		GLint layer;				// Layer of a GL_TEXTURE_2D_ARRAY, -1 for GL_TEXTURE_2D
+		bool isRegion;				// Rectangle of level 0 at regionX, regionY, width x height
+		GLint regionX;
+		GLint regionY;
+		std::vector<GLsizei> levelSizes;	// Mip chains: bytes of each level in data
+		std::vector<GLintptr> levelOffsets;	// Mip chains: offset of each level, empty when back to back
+		GLint firstLevel;			// Mip chains: level the first of levelSizes goes to
+		GLint storageLevels;		// Streamed textures: levels of their immutable storage, 0 otherwise
+		bool allocateStorage;		// Streamed textures: create that storage before the levels go in
+		// Mapped textures: data stays empty and the levels are copied from
+		// fileBytes bytes of file starting at fileOffset
+		std::shared_ptr<const MappedFile> file;
+		size_t fileOffset;
+		size_t fileBytes;
+	};
+
+	// A staging buffer whose copy has been issued but may still be read by the GPU
+	struct Staging
+	{
+		GLuint pbo;
+		GLsizeiptr capacity;
+		GLsync fence;
+		UploadTicket ticket;		// Set when the fence also completes a job
+	};
+
+public:
+	// Largest slice of a buffer copied in one step
+	static const GLsizeiptr CHUNK_SIZE = 1 << 20;
+
+	UploadQueue();
+
+	// Time the queue may spend issuing uploads in each ProcessUploads() call
+	void SetFrameBudget(double milliseconds) { mBudgetMs = milliseconds; }
+
+	// Copy size bytes into buffer at offset. The buffer must already have storage.
+	UploadTicket EnqueueBuffer(GLuint buffer, GLintptr offset, const void* data, GLsizeiptr size);
+	// (Re)specify level 0 of a 2D texture from tightly packed pixels
+	UploadTicket EnqueueTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, const void* pixels, bool generateMipmaps);
+	// Same, taking over pixels instead of copying them
+	UploadTicket EnqueueTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<unsigned char>&& pixels, bool generateMipmaps);
+	// (Re)specify a 2D texture's whole mip chain from levels stored one after the other; format 0
+	// means the levels are block compressed
+	UploadTicket EnqueueTextureLevels(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data);
+	// (Re)specify a 2D texture's mip chain straight from a mapped file; format 0 means the levels are
+	// block compressed. file stays mapped until the levels have been copied out.
+	UploadTicket EnqueueMappedTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, const std::vector<size_t>& levelOffsets, const std::vector<GLsizei>& levelSizes, std::shared_ptr<const MappedFile> file, bool generateMipmaps);
+	// Upload levels firstLevel onward of a streamed 2D texture and make firstLevel its base level, so
+	// sampling starts there once the levels are in. With allocate the texture first gets immutable
+	// storage for levels levels of width x height; format 0 means the levels are block compressed.
+	UploadTicket EnqueueStreamedLevels(GLuint texture, GLsizei width, GLsizei height, GLint levels, GLenum internalFormat, GLenum format, GLint firstLevel, bool allocate, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data);
+	// Replace a width x height rectangle of a 2D texture's level 0 at x, y; the texture must already have storage
+	UploadTicket EnqueueTextureRegion(GLuint texture, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, std::vector<unsigned char>&& pixels);
+	// Replace one layer of a texture array, levels 0 onward stored one after the other; the array's
+	// storage must already match
+	UploadTicket EnqueueTextureLayer(GLuint texture, GLint layer, GLsizei width, GLsizei height, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data);
+
+	// Drop texture jobs for texture (or one layer of it) that have not been issued yet, before it is deleted
+	void CancelTexture(GLuint texture, GLint layer = -1);
+
+	// Call once per frame: retire finished copies, then issue new ones until the budget runs out
+	void ProcessUploads();
+	// Issue and wait for everything that is still queued
+	void Flush();
+	// Release every staging buffer
+	void Destroy();
+
+	// true once the GPU has finished the copy for ticket
+	bool IsReady(UploadTicket ticket) const { return ticket <= mCompleted; }
+	bool IsIdle() const { return mJobs.empty() && mInFlight.empty(); }
+	size_t PendingBytes() const;
+
+private:
+	void RetireFinished(bool wait);
+	bool IssueNext();
+	GLuint AcquireStaging(GLsizeiptr size, GLsizeiptr& capacity);
+
+	double mBudgetMs;
+	UploadTicket mNextTicket;
+	UploadTicket mCompleted;
+	std::deque<Job> mJobs;
+	std::deque<Staging> mInFlight;
+	std::vector<Staging> mFree;
+};
@@ -0,0 +1,40 @@
+///////////////////////////////////////////////////////////////////////////////
+// vertexweld.h
+// ============
+// merge duplicated interleaved vertices and build an index buffer for them
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include <cstddef>
+#include <vector>
+
+// Default tolerance used when comparing two vertices component by component
+const float WELD_EPSILON = 1e-5f;
+
+// Output of WeldVertices(). indices[i] is the welded vertex that replaces
+// input vertex i, so drawing the indices with the same primitive mode and
+// ranges reproduces the original glDrawArrays calls exactly.
+struct WeldResult
+{
+	std::vector<GLfloat> vertices;	// Compacted interleaved vertex data
+	std::vector<GLuint> indices;	// One index per input vertex
+	size_t inputVertices;
+	size_t outputVertices;
+	size_t inputBytes;				// Size of the original vertex array
+	size_t outputBytes;				// Size of the compacted vertices plus the indices
+};
+
+///////////////////////////////////////////////////
+//	WeldVertices(...)
+//
+//	verts:			interleaved vertex data, position in the first three floats
+//	vertexCount:	number of vertices in verts
+//	floatsPerVertex: stride of one vertex in floats (>= 3)
+//	epsilon:		two vertices are merged when every component differs by at most epsilon
+///////////////////////////////////////////////////
+WeldResult WeldVertices(const GLfloat* verts, size_t vertexCount, size_t floatsPerVertex, float epsilon = WELD_EPSILON);
@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+// virtualtexture.h
+// ================
+// large textures sampled through page tables from a fixed cache of tiles
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <GLAD/glad.h>
+
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "uploadqueue.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counters reported by VirtualTextureSystem::GetStats()
+struct VirtualTextureStats
+{
+	unsigned int textures;
+	unsigned int cacheTiles;		// Slots in the tile cache
+	unsigned int residentTiles;		// Slots holding a tile the page tables point at
+	unsigned int requestedTiles;	// Distinct tiles in the last feedback read back
+	unsigned int missingTiles;		// Those of them not resident then
+	unsigned int loadedTiles;		// Tiles read and uploaded since Initialize()
+	unsigned int evictedTiles;		// Tiles replaced since Initialize()
+};
+
+class VirtualTextureSystem
+{
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_READING,				// Tile being read from its file on a worker
+		SLOT_UPLOADING,				// Tile waiting in the upload queue
+		SLOT_RESIDENT
+	};
+
+	// One tile-sized region of the cache texture
+	struct Slot
+	{
+		SlotState state;
+		uint32_t tile;				// Key of the tile it holds, see UTileKey()
+		unsigned int lastUsed;		// Update() count when feedback last needed it
+		UploadTicket ticket;
+		bool pinned;				// A texture's coarsest tile, never evicted
+	};
+
+	struct Texture
+	{
+		bool ready;					// Tiled file open and page table made; false while it is baked on a worker
+		std::shared_ptr<const MappedFile> file;
+		int tilesPerSide;			// At level 0; halved per level down to one
+		int levels;
+		GLuint pageTable;
+		int pinnedSlot;
+		std::vector<std::vector<int>> slots;	// Per level, the resident slot of each tile or -1
+		bool dirty;					// slots changed since the page table was last written
+	};
+
+	// A texture's tiled file a worker has opened, baking it first if needed; file is null on failure
+	struct OpenedFile
+	{
+		int texture;
+		std::string filename;
+		std::shared_ptr<MappedFile> file;
+	};
+
+	// A tile a worker has read, waiting for the GL thread
+	struct ReadTile
+	{
+		int slot;
+		uint32_t tile;
+		std::vector<unsigned char> texels;
+	};
+
+	// One pixel buffer per feedback copy in flight
+	struct Readback
+	{
+		GLuint buffer;
+		GLsync fence;
+		size_t texels;
+	};
+
+public:
+	// Texels of a tile's interior, and of the neighbours' texels repeated
+	// around it so bilinear filtering never reads another tile
+	static const int TILE_SIZE = 128;
+	static const int TILE_BORDER = 4;
+	static const int PADDED_TILE_SIZE = TILE_SIZE + 2 * TILE_BORDER;
+	// Framebuffer pixels per feedback texel along each axis
+	static const int FEEDBACK_SCALE = 8;
+	// Limits of the 32-bit feedback texels: 8 bits of texture, 4 of level, 10 per tile coordinate
+	static const int MAX_TEXTURES = 255;
+	static const int MAX_TILES_PER_SIDE = 1024;
+	static const int READBACK_COUNT = 3;
+	// Tile reads started per Update()
+	static const int MAX_READS_PER_UPDATE = 16;
+	// Image unit the surface shader writes feedback to; the depth pyramid's reduction uses 0 and 1
+	static const GLuint FEEDBACK_IMAGE_UNIT = 2;
+
+	VirtualTextureSystem();
+
+	// A cache of cacheTilesPerSide x cacheTilesPerSide tiles, feedback for a
+	// width x height framebuffer, tiled files kept in directory. Tiles are
+	// read on pool and uploaded through uploads.
+	bool Initialize(ThreadPool* pool, UploadQueue* uploads, int cacheTilesPerSide, int width, int height, const std::string& directory);
+	// Wait for the bakes and tile reads still running and delete every GL object
+	void Destroy();
+	void Resize(int width, int height);
+
+	// Make filename a virtual texture. Its tiled file is looked up in the
+	// directory on a worker, and baked there first unless one for the same
+	// content exists; the texture is ready from the Update() after that.
+	// Returns the id the surface shader's virtualTexture takes once it is
+	// ready, -1 on failure.
+	int Add(const char* filename);
+
+	// false until the texture's tiles can be sampled, and for good if its file could not be baked
+	bool IsReady(int texture) const { return texture >= 0 && mTextures[texture].ready; }
+	GLuint PageTable(int texture) const { return mTextures[texture].pageTable; }
+	GLuint CacheTexture() const { return mCache; }
+
+	// Call once per frame on the GL thread, before the upload queue runs:
+	// readies the textures whose files are open, takes in the feedback that
+	// has arrived, starts reading the missing tiles, queues the ones read
+	// and rewrites the page tables that changed
+	void Update();
+	// Clear the feedback image and bind it for the scene passes
+	void BeginFeedback();
+	// Copy the feedback out for a later Update(); nothing waits for it
+	void EndFeedback();
+
+	VirtualTextureStats GetStats() const;
+
+private:
+	void FinishAdd(OpenedFile& opened);
+	void CreateFeedback(int width, int height);
+	void DestroyFeedback();
+	void TakeFeedback(const uint32_t* texels, size_t count);
+	void Touch(uint32_t tile);
+	int AllocateSlot();
+	void StartRead(int slot, uint32_t tile);
+	void WritePageTable(Texture& texture);
+	size_t TileOffset(const Texture& texture, int level, int x, int y) const;
+
+	ThreadPool* mPool;
+	UploadQueue* mUploads;
+	std::string mDirectory;
+	int mCacheTilesPerSide;
+	GLuint mCache;
+	GLuint mFeedback;
+	int mFeedbackWidth;
+	int mFeedbackHeight;
+	Readback mReadbacks[READBACK_COUNT];
+	std::vector<Texture> mTextures;
+	std::vector<Slot> mSlots;
+	std::unordered_map<uint32_t, int> mSlotOfTile;	// Every tile in a slot, resident or on its way
+	std::mutex mMutex;
+	std::condition_variable mWorkDone;
+	std::vector<OpenedFile> mOpened;
+	std::vector<ReadTile> mRead;
+	unsigned int mWorking;			// Bakes and tile reads submitted to the pool and not finished
+	unsigned int mFrame;
+	VirtualTextureStats mStats;
+};
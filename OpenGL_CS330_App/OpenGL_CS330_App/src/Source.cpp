@@ -9,6 +9,12 @@
 
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>           // snprintf
+#include <cstring>          // memset
+#include <vector>
+#include <limits>
+#include <algorithm>        // sort
+#include <cstdint>
 #include <GLAD/glad.h>      // GLAD library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -22,6 +28,24 @@
 //includes
 #include <meshes.h>
 #include <camera.h>
+#include <uploadqueue.h>
+#include <bufferpool.h>
+#include <ringbuffer.h>
+#include <culling.h>
+#include <bvh.h>
+#include <octree.h>
+#include <hiz.h>
+#include <occlusion.h>
+#include <picking.h>
+#include <idbuffer.h>
+#include <occlusionquery.h>
+#include <threadpool.h>
+#include <blockencoder.h>
+#include <textureloader.h>
+#include <texturearray.h>
+#include <texturecache.h>
+#include <texturestreamer.h>
+#include <virtualtexture.h>
 
 using namespace std; // Standard namespace 
 
@@ -57,16 +81,178 @@ namespace
 	// Mesh data
 	Meshes meshes;
 
-	// Texture id
-	GLuint tabletextureId;
-	GLuint mactextureId;
-	GLuint macbacktextureId;
-	GLuint macapplewhitetexId;
-	GLuint mousetextureId;
-	GLuint cuptextureId;
+	// Spreads buffer and texture uploads over the first frames
+	UploadQueue gUploadQueue;
+	// Milliseconds per frame the queue may spend on uploads
+	const double UPLOAD_BUDGET_MS = 2.0;
+
+	// Worker threads for background jobs such as image decoding
+	ThreadPool gThreadPool;
+	// Decodes image files on the pool and feeds them to the upload queue
+	TextureLoader gTextureLoader;
+	// Shares one texture between every path and copy of the same image
+	TextureCache gTextureCache;
+	// Streams the finer mips of 2D textures in as objects using them come closer
+	TextureStreamer gTextureStreamer;
+	// Bytes of streamed levels that may be uploaded at once; the textures' storage is allocated whole regardless
+	const size_t TEXTURE_STREAMING_BUDGET = 16 << 20;
+	// Samples large textures through page tables from a fixed cache of tiles, loading the tiles on screen
+	VirtualTextureSystem gVirtualTextures;
+	// Tiles across the cache texture, which is 2176 texels square (19 MB) with 16
+	const int VIRTUAL_CACHE_TILES = 16;
+	// Tiled files are kept here, named by the source file's content hash
+	const char* const VIRTUAL_TEXTURE_DIRECTORY = "virtual_textures";
+	// Texture units uPageTable and uVirtualCache sample from
+	const GLuint PAGE_TABLE_UNIT = 3;
+	const GLuint VIRTUAL_CACHE_UNIT = 4;
+	// The table's virtual texture, -1 when it is drawn from its 2D texture
+	int gTableVirtualTexture = -1;
+	// Layers the cache packs small images into, sampled through one binding
+	TextureArray gTextureArray;
+	const GLsizei SMALL_TEXTURE_SIZE = 512;
+	const GLsizei SMALL_TEXTURE_LAYERS = 8;
+	// Texture unit uTextureArray samples from (unit 1 belongs to the depth pyramid)
+	const GLuint TEXTURE_ARRAY_UNIT = 2;
+	// Block formats 2D textures are compressed to on the loader's workers;
+	// BC7 stands in for either when the driver lacks S3TC
+	const BlockFormat OPAQUE_TEXTURE_FORMAT = BLOCK_BC1;
+	const BlockFormat ALPHA_TEXTURE_FORMAT = BLOCK_BC3;
+	// Encoded and streamed mip chains are kept here, named by the source file's content hash
+	const char* const COMPRESSED_TEXTURE_DIRECTORY = "compressed_textures";
+
+	// Shared vertex and index storage for all meshes
+	BufferPool gBufferPool;
+	// Size of each buffer backing the pool
+	const GLsizeiptr BUFFER_POOL_PAGE_SIZE = 4 << 20;
+	// Bytes the pool may move per frame while defragmenting
+	const GLsizeiptr BUFFER_POOL_COMPACT_BYTES = 64 << 10;
+
+	// Texture handles, each a 2D texture or a layer of gTextureArray
+	TextureHandle tabletextureId;
+	TextureHandle mactextureId;
+	TextureHandle macbacktextureId;
+	TextureHandle macapplewhitetexId;
+	TextureHandle mousetextureId;
+	TextureHandle cuptextureId;
 
 	glm::vec2 gUVScale(2.0f, 3.0f);
-	GLint gTexWrapMode = GL_REPEAT;
+
+	// Per-frame uniforms, laid out like the FrameData block (std140)
+	struct FrameUniforms
+	{
+		glm::mat4 view;
+		glm::mat4 projection;
+		glm::vec3 viewPosition;		float ambientStrength;
+		glm::vec3 ambientColor;		float specularIntensity1;
+		glm::vec3 light1Color;		float highlightSize1;
+		glm::vec3 light1Position;	float specularIntensity2;
+		glm::vec3 light2Color;		float highlightSize2;
+		glm::vec3 light2Position;	float padding;
+	};
+
+	// Per-object uniforms, laid out like the ObjectData block (std140)
+	struct ObjectUniforms
+	{
+		glm::mat4 model;
+		glm::mat4 normalMatrix;
+		glm::vec4 objectColor;
+		glm::vec2 uvScale;
+		GLint hasTexture;
+		GLuint objectId;			// Index into gSceneObjects, written to the id buffer
+		GLint textureLayer;			// Layer of gTextureArray, -1 to sample the bound 2D texture
+		GLint virtualTexture;		// Id in gVirtualTextures, sampled instead of either when not -1
+		GLint padding[2];
+	};
+
+	// Uniform block binding points shared by both shader programs
+	const GLuint FRAME_DATA_BINDING = 0;
+	const GLuint OBJECT_DATA_BINDING = 1;
+
+	// Persistently mapped storage for the uniforms above
+	RingBuffer gUniformRing;
+	// Bytes reserved per frame; each object takes one GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT slot at least
+	const GLsizeiptr UNIFORM_RING_FRAME_SIZE = 64 << 10;
+
+	// A glDrawArrays style range of a mesh; count 0 draws the whole mesh
+	struct DrawRange
+	{
+		GLenum mode;
+		GLint first;
+		GLsizei count;
+	};
+
+	// What an object contributes to the picture, which decides when it is too small to draw
+	enum ObjectClass
+	{
+		OBJECT_PROP,			// Free-standing desk items
+		OBJECT_DETAIL,			// Decals and insets on other objects
+		OBJECT_STRUCTURE,		// Large surfaces, always drawn
+		OBJECT_LAMP,
+		OBJECT_CLASS_COUNT
+	};
+
+	// Screen-space size and distance limits per object class; 0 disables a limit
+	struct ObjectClassLimits
+	{
+		float minPixels;		// Projected bounding sphere diameter below which the object is skipped
+		float maxDistance;		// World units from the camera beyond which the object is skipped
+	};
+	ObjectClassLimits gObjectClassLimits[OBJECT_CLASS_COUNT] = {
+		{ 6.0f, 0.0f },			// OBJECT_PROP
+		{ 12.0f, 30.0f },		// OBJECT_DETAIL
+		{ 0.0f, 0.0f },			// OBJECT_STRUCTURE
+		{ 2.0f, 0.0f },			// OBJECT_LAMP
+	};
+
+	// One object of the desk scene: which mesh, how it is placed and how it looks.
+	// Rows of gSceneObjects may stop after rangeCount; the rest keep these defaults.
+	struct SceneObject
+	{
+		const char* name;
+		const Meshes::GLMesh* mesh;
+		const TextureHandle* texture;	// nullptr for the untextured lamps
+		glm::vec3 scale;
+		float rotation;				// glm::rotate angle
+		glm::vec3 rotationAxis;
+		glm::vec3 position;
+		DrawRange ranges[3];
+		int rangeCount;
+		bool isLamp = false;		// Drawn with the lamp program, spinning with angle
+		float spin = 0.0f;			// Added to angle after the lamp is placed
+		bool isOccluder = false;	// Drawn into the software occlusion buffer as its box
+		ObjectClass objectClass = OBJECT_PROP;	// Size culling limits, see gObjectClassLimits
+		const int* virtualTexture = nullptr;	// Id in gVirtualTextures drawn instead of texture when not -1; nullptr for none
+	};
+
+	const glm::vec4 OBJECT_COLOR(0.5f, 0.5f, 0.5f, 1.0f);
+	const DrawRange CYLINDER_BOTTOM = { GL_TRIANGLE_FAN, 0, 36 };
+	const DrawRange CYLINDER_TOP = { GL_TRIANGLE_FAN, 36, 36 };
+	const DrawRange CYLINDER_SIDES = { GL_TRIANGLE_STRIP, 72, 146 };
+	const DrawRange WHOLE_TRIANGLES = { GL_TRIANGLES, 0, 0 };
+	const DrawRange WHOLE_STRIP = { GL_TRIANGLE_STRIP, 0, 0 };
+
+	// The scene, in draw order
+	const SceneObject gSceneObjects[] = {
+		// name					mesh							texture					scale						rotation	axis						position					draw ranges
+		{ "table",				&meshes.gPlaneMesh,				&tabletextureId,		{ 8.0f, 1.0f, 3.0f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 0.0f, 0.8f, 1.0f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, true, OBJECT_STRUCTURE, &gTableVirtualTexture },
+		{ "laptop",				&meshes.gBoxMesh,				&mactextureId,			{ 4.0f, 0.2f, 2.0f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 4.0f, 0.9f, 1.0f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, true, OBJECT_STRUCTURE },
+		{ "laptop back edge",	&meshes.gBoxMesh,				&macbacktextureId,		{ 2.8f, 0.2f, 0.01f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 4.0f, 0.9f, 2.0f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "laptop logo",		&meshes.gSphereMesh,			&macapplewhitetexId,	{ 0.3f, 0.006f, 0.2f },		-35.0f,		{ 0.0f, 1.0f, 0.0f },		{ 4.0f, 1.0f, 1.0f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, false, OBJECT_DETAIL },
+		{ "laptop logo 1",		&meshes.gSphereMesh,			&macapplewhitetexId,	{ 0.3f, 0.006f, 0.2f },		0.0f,		{ 0.0f, 1.0f, 0.0f },		{ 4.08f, 1.0f, 1.12f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, false, OBJECT_DETAIL },
+		{ "laptop logo box",	&meshes.gBoxMesh,				&macapplewhitetexId,	{ 0.33f, 0.006f, 0.1f },	35.0f,		{ 0.0f, 1.0f, 0.0f },		{ 3.8f, 1.0f, 1.0f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, false, OBJECT_DETAIL },
+		{ "mouse",				&meshes.gSphereMesh,			&mousetextureId,		{ 0.2f, 0.18f, 0.35f },		173.0f,		{ 1.0f, 0.0f, 0.0f },		{ 1.5f, 0.94f, 1.5f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "mouse bottom",		&meshes.gBoxMesh,				&mousetextureId,		{ 0.3f, 0.22f, 0.35f },		170.0f,		{ 1.0f, 0.0f, 0.0f },		{ 1.5f, 0.86f, 1.33f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "cup body",			&meshes.gTaperedCylinderMesh,	&cuptextureId,			{ 0.4f, -0.7f, 0.4f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 7.0f, 1.5f, 1.0f },		{ CYLINDER_BOTTOM, CYLINDER_TOP, CYLINDER_SIDES }, 3 },
+		{ "cup handle",			&meshes.gTorusMesh,				&cuptextureId,			{ 0.15f, 0.3f, 1.0f },		-0.65f,		{ 0.0f, 0.0f, 1.0f },		{ 7.3f, 1.2f, 1.05f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "cup depth",			&meshes.gSphereMesh,			&mactextureId,			{ 0.38f, 0.05f, 0.4f },		0.0f,		{ 0.0f, 1.0f, 0.0f },		{ 7.0f, 1.47f, 1.0f },		{ WHOLE_TRIANGLES }, 1, false, 0.0f, false, OBJECT_DETAIL },
+		{ "light stand 1",		&meshes.gCylinderMesh,			&mousetextureId,		{ 0.2f, 0.8f, 0.2f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 1.0f, 1.0f, -1.0f },		{ CYLINDER_BOTTOM, CYLINDER_TOP, CYLINDER_SIDES }, 3 },
+		{ "light stand 2",		&meshes.gCylinderMesh,			&mousetextureId,		{ 0.2f, 0.8f, 0.2f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 7.0f, 1.0f, -1.0f },		{ CYLINDER_BOTTOM, CYLINDER_TOP, CYLINDER_SIDES }, 3 },
+		{ "light base 1",		&meshes.gBoxMesh,				&mousetextureId,		{ 1.0f, 0.14f, 0.8f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 1.0f, 1.0f, -1.0f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "light base 2",		&meshes.gBoxMesh,				&mousetextureId,		{ 1.0f, 0.14f, 0.8f },		0.0f,		{ 1.0f, 1.0f, 1.0f },		{ 7.0f, 1.0f, -1.0f },		{ WHOLE_TRIANGLES }, 1 },
+		{ "lamp 1",				&meshes.gPyramid4Mesh,			nullptr,				{ 1.0f, 2.0f, 0.8f },		0.0f,		{ 0.0f, 1.0f, 0.0f },		{ 1.0f, 2.8f, -1.0f },		{ WHOLE_STRIP }, 1, true, 0.002f, false, OBJECT_LAMP },
+		{ "lamp 2",				&meshes.gPyramid4Mesh,			nullptr,				{ 1.0f, 2.0f, 0.8f },		0.0f,		{ 0.0f, 1.0f, 0.0f },		{ 7.0f, 2.8f, -1.0f },		{ WHOLE_STRIP }, 1, true, 0.001f, false, OBJECT_LAMP },
+	};
+	const int SCENE_OBJECT_COUNT = sizeof(gSceneObjects) / sizeof(gSceneObjects[0]);
 	
 	// Shader program
 	GLuint gProgramId;
@@ -79,13 +265,124 @@ namespace
 	float gLastY = WINDOW_HEIGHT / 2.0f;
 	bool gFirstMouse = true;
 	float angle = 0.0;
-	bool usePerspective = true;
-	bool useOrthographic = false;
-	float cameraSpeed = 2.5f;
 
 	// timing
 	float gDeltaTime = 0.0f; // time between current frame and last frame
 	float gLastFrame = 0.0f;
+
+	// Counters gathered while rendering, shown in the window title
+	struct FrameStats
+	{
+		unsigned int visibleObjects;
+		unsigned int culledObjects;
+		unsigned int bvhRebuilds;		// Total since start
+		unsigned int occludedObjects;	// Inside the frustum but hidden according to the Hi-Z test
+		unsigned int retestedObjects;	// Sent to the GPU re-test after the first pass
+		unsigned int rasterOccluded;	// Hidden behind the occluders in the software depth buffer
+		unsigned int sizeCulled;		// Inside the frustum but too small or too far for their class
+		unsigned int queriedObjects;	// Drawn behind an occlusion query's box
+		unsigned int querySkipped;		// Query results read this frame that let the GPU skip the draw
+		unsigned int drawnClusters;		// Meshlets of clustered meshes drawn, over every view
+		unsigned int culledClusters;	// Meshlets outside the frustum or facing away
+		unsigned int ringSkipped;		// Objects not drawn because the uniform ring was full
+	};
+	FrameStats gFrameStats = {};
+	// The first full uniform ring has been reported on the console
+	bool gReportedRingFull = false;
+	// Frames drawn since the title was last updated, and when that was
+	unsigned int gStatsFrames = 0;
+	double gStatsTime = 0.0;
+
+	// Model matrices and world boxes of the scene objects and the culling result, rebuilt every frame
+	glm::mat4 gObjectModels[SCENE_OBJECT_COUNT];
+	std::vector<AABB> gObjectBounds(SCENE_OBJECT_COUNT);
+	AABBList gWorldBounds;
+	unsigned char gObjectVisible[SCENE_OBJECT_COUNT];
+
+	// Hierarchy over the object boxes, refitted every frame as the lamps turn
+	BVH gSceneBVH;
+	// Loose octree over the same boxes; moving objects only relink when they change cells
+	LooseOctree gSceneOctree;
+	std::vector<int> gVisibleObjects;
+
+	// How frustum culling and picking find the objects
+	enum CullingMode
+	{
+		CULL_SIMD,		// Test every box with the flat SIMD pass (N key)
+		CULL_BVH,		// Query the BVH (B key)
+		CULL_OCTREE		// Query the loose octree (M key)
+	};
+	CullingMode gCullingMode = CULL_BVH;
+	// Skip objects below their class's pixel size or beyond its distance (C key on, V off)
+	bool gUseSizeCulling = true;
+
+	// Occlusion culling against a depth pyramid, see URender()
+	enum HiZMode
+	{
+		HIZ_OFF,
+		HIZ_GPU,		// Two passes in one frame, re-tested in a compute shader (H key)
+		HIZ_CPU			// Previous frame's pyramid read back and tested on the CPU (J key); K turns it off
+	};
+	HiZBuffer gHiZ;
+	HiZMode gHiZMode = HIZ_GPU;
+	// Newest GPU test result per object, drawn in the first pass when set
+	std::vector<unsigned char> gHiZVisible(SCENE_OBJECT_COUNT, 1);
+	// Objects drawn in the first pass, and the boxes and commands of the re-test
+	unsigned char gObjectDrawn[SCENE_OBJECT_COUNT];
+	std::vector<HiZBuffer::Object> gHiZObjects(SCENE_OBJECT_COUNT);
+	std::vector<Meshes::DrawCommand> gHiZCommands;
+
+	// The view being drawn, whose frustum and eye the meshlets of clustered meshes are culled against
+	glm::mat4 gClusterViewProjection;
+	bool gClusterConeTest = true;		// Off for orthographic views, where the eye is not a point
+
+	// CPU depth buffer of the big occluders, tested before anything is sent to GL (I key on, U off)
+	OcclusionRasterizer gOcclusionRasterizer;
+	bool gUseSoftwareOcclusion = true;
+
+	// Triangles for picking; objects with the same mesh and draw ranges share a shape
+	std::vector<PickShape> gPickShapes;
+	int gObjectShape[SCENE_OBJECT_COUNT];
+	// Result of the last left click
+	PickResult gLastPick = { -1, -1, 0.0f };
+
+	// Perspective and orthographic views side by side (F key on, G off). Both share one culling
+	// pass, one sorted draw list and one copy of the object uniforms; the Hi-Z, software occlusion
+	// and occlusion query passes only run with a single view.
+	bool gUseMultiView = false;
+	const int VIEW_COUNT = 2;
+	// Bit v set while the object is visible in view v
+	unsigned char gObjectViewMask[SCENE_OBJECT_COUNT];
+	// A visible object, its uniforms in the ring and the state it needs, sorted to switch state rarely
+	struct DrawItem
+	{
+		uint64_t key;				// Program, then vertex array, then texture
+		int object;
+		const Meshes::GLMesh* mesh;	// The object's mesh, or the box standing in for it
+		GLintptr uniformOffset;
+	};
+	std::vector<DrawItem> gDrawList;
+	// GPU time of each frame's scene passes, from a ring of timer queries read a few frames late so
+	// the CPU never waits on one. One-view and two-view frames are averaged apart, so flipping between
+	// F and G (with the single-view extras off: Hi-Z, software occlusion, queries) compares the two.
+	const int SCENE_TIMER_COUNT = 4;
+	GLuint gSceneTimers[SCENE_TIMER_COUNT] = {};
+	int gSceneTimerViews[SCENE_TIMER_COUNT] = {};	// Views the query timed, 0 while it is not in flight
+	int gSceneTimerNext = 0;
+	bool gSceneTimerRunning = false;
+	double gSceneGpuTime[VIEW_COUNT] = {};		// Milliseconds summed since the title was last updated
+	unsigned int gSceneGpuFrames[VIEW_COUNT] = {};
+	double gSceneGpuAverage[VIEW_COUNT] = {};		// Per frame, over the last title period that had such frames
+
+	// Box occlusion queries for expensive objects, whose draws then run only if the box was visible.
+	// Set per object (Y key on for the last picked object, T off); objects with many triangles start on.
+	OcclusionQueries gOcclusionQueries;
+	unsigned char gObjectQueried[SCENE_OBJECT_COUNT];
+	const size_t OCCLUSION_QUERY_MIN_TRIANGLES = 100;
+
+	// Object ids drawn alongside color for pixel-exact picking with the right button (Z key on, X off)
+	IdBuffer gIdBuffer;
+	bool gUseIdBuffer = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -100,10 +397,30 @@ out vec3 vertexFragmentNormal; // For outgoing normals to fragment shader
 out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
 out vec2 vertexTextureCoordinate;
 
-//Uniform / Global variables for the  transform matrices
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// Per-frame and per-object data, written into the ring buffer and bound by range (std140, see FrameUniforms / ObjectUniforms)
+layout(std140, binding = 0) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPosition;		float ambientStrength;
+	vec3 ambientColor;		float specularIntensity1;
+	vec3 light1Color;		float highlightSize1;
+	vec3 light1Position;	float specularIntensity2;
+	vec3 light2Color;		float highlightSize2;
+	vec3 light2Position;
+};
+
+layout(std140, binding = 1) uniform ObjectData
+{
+	mat4 model;
+	mat4 normalMatrix;		// transpose(inverse(model)), computed once on the CPU
+	vec4 objectColor;
+	vec2 uvScale;
+	bool ubHasTexture;
+	uint objectId;
+	int textureLayer;
+	int virtualTexture;
+};
 
 void main()
 {
@@ -111,7 +428,7 @@ void main()
 
 	vertexFragmentPos = vec3(model * vec4(vertexPosition, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
 
-	vertexFragmentNormal = mat3(transpose(inverse(model))) * vertexNormal; // get normal vectors in world space only and exclude normal translation properties
+	vertexFragmentNormal = mat3(normalMatrix) * vertexNormal; // get normal vectors in world space only and exclude normal translation properties
 	vertexTextureCoordinate = textureCoordinate;
 }
 );
@@ -121,28 +438,72 @@ void main()
 /* Surface Fragment Shader Source Code*/
 const GLchar* surfaceFragmentShaderSource = GLSL(440,
 
+// Hidden fragments must not write virtual texture feedback
+layout(early_fragment_tests) in;
+
 in vec3 vertexFragmentNormal; // For incoming normals
 in vec3 vertexFragmentPos; // For incoming fragment position
 in vec2 vertexTextureCoordinate;
 
-out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 0) out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 1) out uint fragmentObjectId; // Into the id buffer when it is bound, discarded otherwise
+
+// Object color, light color, light position, and camera/view position (same blocks as the vertex shader)
+layout(std140, binding = 0) uniform FrameData
+{
+	mat4 view;
+	mat4 projection;
+	vec3 viewPosition;		float ambientStrength;
+	vec3 ambientColor;		float specularIntensity1;
+	vec3 light1Color;		float highlightSize1;
+	vec3 light1Position;	float specularIntensity2;
+	vec3 light2Color;		float highlightSize2;
+	vec3 light2Position;
+};
+
+layout(std140, binding = 1) uniform ObjectData
+{
+	mat4 model;
+	mat4 normalMatrix;
+	vec4 objectColor;
+	vec2 uvScale;
+	bool ubHasTexture;
+	uint objectId;
+	int textureLayer;
+	int virtualTexture;
+};
 
-// Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec4 objectColor;
-uniform vec3 ambientColor;
-uniform vec3 light1Color;
-uniform vec3 light1Position;
-uniform vec3 light2Color;
-uniform vec3 light2Position;
-uniform vec3 viewPosition;
 uniform sampler2D uTexture; // Useful when working with multiple textures
-uniform vec2 uvScale;
-uniform bool ubHasTexture;
-uniform float ambientStrength = 0.1f; // Set ambient or global lighting strength
-uniform float specularIntensity1 = 0.8f;
-uniform float highlightSize1 = 15.0f;
-uniform float specularIntensity2 = 0.8f;
-uniform float highlightSize2 = 15.0f;
+uniform sampler2DArray uTextureArray; // Small textures, one per layer
+uniform sampler2D uPageTable; // Per tile and level of the virtual texture, the cache slot and level to sample
+uniform sampler2D uVirtualCache; // Tiles of every virtual texture
+layout(r32ui, binding = 2) uniform writeonly uimage2D uFeedback; // Tile each 8x8 pixel square wants (see VirtualTextureSystem)
+
+// Sample the virtual texture through its page table, from the finest tile resident at the level the
+// footprint asks for. Tiles are 128 texels square with a 4 texel border (136 in the cache).
+vec4 SampleVirtualTexture(vec2 uv)
+{
+	ivec2 tiles = textureSize(uPageTable, 0);
+	vec2 texel = uv * vec2(tiles) * 128.0;
+	vec2 dx = dFdx(texel);
+	vec2 dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+	int level = min(int(lod), textureQueryLevels(uPageTable) - 1);
+
+	vec2 wrapped = fract(uv);
+	ivec2 levelTiles = max(tiles >> level, ivec2(1));
+	ivec2 tile = min(ivec2(wrapped * vec2(levelTiles)), levelTiles - 1);
+
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	if (pixel.x % 8 == 0 && pixel.y % 8 == 0)
+		imageStore(uFeedback, pixel / 8, uvec4((uint(virtualTexture + 1) << 24) | (uint(level) << 20) | (uint(tile.y) << 10) | uint(tile.x)));
+
+	// x, y: cache slot, z: level of the tile held there, which covers this one
+	ivec3 page = ivec3(texelFetch(uPageTable, tile, level).xyz * 255.0 + 0.5);
+	vec2 inTile = fract(wrapped * vec2(max(tiles >> page.z, ivec2(1))));
+	vec2 cacheTexel = vec2(page.xy) * 136.0 + 4.0 + inTile * 128.0;
+	return textureLod(uVirtualCache, cacheTexel / vec2(textureSize(uVirtualCache, 0)), 0.0);
+}
 
 void main()
 	{
@@ -173,7 +534,12 @@ void main()
 
 		//**Calculate phong result**
 		//Texture holds the color to be used for all three components
-		vec4 textureColor = texture(uTexture, vertexTextureCoordinate * uvScale);
+		vec2 uv = vertexTextureCoordinate * uvScale;
+		vec4 textureColor;
+		if (virtualTexture >= 0)
+			textureColor = SampleVirtualTexture(uv);
+		else
+			textureColor = textureLayer >= 0 ? texture(uTextureArray, vec3(uv, textureLayer)) : texture(uTexture, uv);
 		vec3 phong1;
 		vec3 phong2;
 
@@ -189,6 +555,7 @@ void main()
 			}
 
 		fragmentColor = vec4(phong1 + phong2, 1.0); // Send lighting results to GPU
+		fragmentObjectId = objectId;
 		//fragmentColor = vec4(1.0f, 1.0f, 1.0f, 1.0f);
 	}
 );
@@ -201,10 +568,25 @@ const GLchar* lampVertexShaderSource = GLSL(440,
 
 	layout(location = 0) in vec3 aPos;  // VAP position 0 for vertex position data
 
-	//Uniform / Global variables for the  transform matrices
-	uniform mat4 model;
-	uniform mat4 view;
-	uniform mat4 projection;
+	// Leading members of the surface shader's frame block; the rest of the range is ignored
+	layout(std140, binding = 0) uniform FrameData
+	{
+		mat4 view;
+		mat4 projection;
+	};
+
+	// Declared in full, and identically in the fragment shader, which needs objectId
+	layout(std140, binding = 1) uniform ObjectData
+	{
+		mat4 model;
+		mat4 normalMatrix;
+		vec4 objectColor;
+		vec2 uvScale;
+		bool ubHasTexture;
+		uint objectId;
+		int textureLayer;
+		int virtualTexture;
+	};
 
 void main()
 	{
@@ -218,11 +600,25 @@ void main()
 /* Light Object Fragment Shader Source Code*/
 const GLchar* lampFragmentShaderSource = GLSL(440,
 
-	out vec4 FragColor;				// For outgoing lamp color (smaller cube) to the GPU
+	layout(location = 0) out vec4 FragColor;		// For outgoing lamp color (smaller cube) to the GPU
+	layout(location = 1) out uint FragObjectId;		// Into the id buffer when it is bound
+
+	layout(std140, binding = 1) uniform ObjectData
+	{
+		mat4 model;
+		mat4 normalMatrix;
+		vec4 objectColor;
+		vec2 uvScale;
+		bool ubHasTexture;
+		uint objectId;
+		int textureLayer;
+		int virtualTexture;
+	};
 
 void main()
 	{
 		FragColor = vec4(1.0);		// Set color to white (1.0f,1.0f,1.0f) with alpha 1.0
+		FragObjectId = objectId;
 	}
 );
 
@@ -239,40 +635,51 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 //void UCreateMesh(GLMesh &mesh);
 //void UDestroyMesh(GLMesh &mesh);
-bool UCreateTexture(const char* filename, GLuint& textureId);
-void UDestroyTexture(GLuint textureId);
+bool UCreateTexture(const char* filename, TextureHandle& textureId);
+void UDestroyTexture(TextureHandle textureId);
+GLintptr UWriteObjectUniforms(const SceneObject& object, const glm::mat4& model);
+const Meshes::GLMesh& UDrawnMesh(const SceneObject& object, const glm::mat4& model, glm::mat4& drawModel);
+void UDrawObjectRanges(const SceneObject& object, const glm::mat4& model, GLintptr commandOffset);
+void UDrawSceneObject(const SceneObject& object, const glm::mat4& model, GLintptr commandOffset = -1);
+void UDrawViews(FrameUniforms frame, int framebufferWidth, int framebufferHeight);
+bool UTooSmall(int object, const Camera& camera, float viewportHeight);
+void URequestTextureDetail(int object, const Camera& camera, float viewportHeight);
+void UEndFrame();
+void UBeginSceneTimer();
+void UEndSceneTimer();
+void UDrawScenePass(const glm::mat4 models[], const unsigned char draw[], bool indirect);
+void UBindTextureArray();
+int UVirtualTexture(const SceneObject& object);
+void UBindPageTable(const SceneObject& object);
 void URender();
+void UUpdateWindowTitle();
+void UBuildPickShapes();
+PickResult UPickObject();
+void URequestIdPick();
 bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
 void UDestroyShaderProgram(GLuint programId);
 
-// Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
-void flipImageVertically(unsigned char* image, int width, int height, int channels)
-{
-	for (int j = 0; j < height / 2; ++j)
-	{
-		int index1 = j * width * channels;
-		int index2 = (height - 1 - j) * width * channels;
-
-		for (int i = width * channels; i > 0; --i)
-		{
-			unsigned char tmp = image[index1];
-			image[index1] = image[index2];
-			image[index2] = tmp;
-			++index1;
-			++index2;
-		}
-	}
-}
-
-
 // main function. Entry point to the OpenGL program
 int main(int argc, char* argv[])
 {
 	if (!UInitialize(argc, argv, &gWindow))
 		return EXIT_FAILURE;
 
-	// Create the mesh
-	meshes.CreateMeshes();
+	// Create the mesh (the vertex data itself arrives through the upload queue)
+	gUploadQueue.SetFrameBudget(UPLOAD_BUDGET_MS);
+	gBufferPool.Initialize(BUFFER_POOL_PAGE_SIZE);
+	meshes.CreateMeshes(&gUploadQueue, &gBufferPool);
+
+	UBuildPickShapes();
+
+	// Only geometry that costs much more to draw than its box is worth a query; the lamps and large surfaces are always drawn
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		gObjectQueried[i] = !gSceneObjects[i].isLamp && gSceneObjects[i].objectClass != OBJECT_STRUCTURE
+			&& gPickShapes[gObjectShape[i]].TriangleCount() >= OCCLUSION_QUERY_MIN_TRIANGLES;
+
+	BufferPoolStats poolStats = gBufferPool.GetStats();
+	cout << "INFO: Buffer pool holds " << poolStats.allocations << " ranges, " << poolStats.usedBytes
+		<< " of " << poolStats.capacity << " bytes in " << poolStats.pages << " buffer(s)" << endl;
 
 	// Create the shader program
 	if (!UCreateShaderProgram(surfaceVertexShaderSource, surfaceFragmentShaderSource, gProgramId))
@@ -281,7 +688,19 @@ int main(int argc, char* argv[])
 	if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
 		return EXIT_FAILURE;
 
-	// Load texture
+	// Load texture (decoded in the background, drawn with a placeholder until then)
+	gThreadPool.Initialize();
+	gTextureLoader.Initialize(&gThreadPool, &gUploadQueue);
+	gTextureStreamer.Initialize(&gThreadPool, &gUploadQueue, TEXTURE_STREAMING_BUDGET);
+	gTextureLoader.SetStreamer(&gTextureStreamer, COMPRESSED_TEXTURE_DIRECTORY);
+	if (BlockFormatSupported(OPAQUE_TEXTURE_FORMAT) && BlockFormatSupported(ALPHA_TEXTURE_FORMAT))
+		gTextureLoader.EnableCompression(OPAQUE_TEXTURE_FORMAT, ALPHA_TEXTURE_FORMAT, COMPRESSED_TEXTURE_DIRECTORY);
+	else if (BlockFormatSupported(BLOCK_BC7))
+		gTextureLoader.EnableCompression(BLOCK_BC7, BLOCK_BC7, COMPRESSED_TEXTURE_DIRECTORY);
+	if (gTextureArray.Initialize(SMALL_TEXTURE_SIZE, SMALL_TEXTURE_LAYERS))
+		gTextureCache.Initialize(&gTextureLoader, &gUploadQueue, &gTextureArray);
+	else
+		gTextureCache.Initialize(&gTextureLoader, &gUploadQueue);
 	const char* tableTexFilename = "C:\\Users\\Kenyk\\Desktop\\SNHUCompsci\\CS-330_Portfolio\\OpenGL_CS330_App\\resources\\tabletexture1.jpg";
 	const char* macTexFilename = "C:\\Users\\Kenyk\\Desktop\\SNHUCompsci\\CS-330_Portfolio\\OpenGL_CS330_App\\resources\\mactexture.jpg";
 	const char* macbackTexFilename = "C:\\Users\\Kenyk\\Desktop\\SNHUCompsci\\CS-330_Portfolio\\OpenGL_CS330_App\\resources\\macbacktexture.jpg";
@@ -324,13 +743,47 @@ int main(int argc, char* argv[])
 		cout << "Failed to load texture " << cupTexFilename << endl;
 		return EXIT_FAILURE;
 	}
+
+	TextureCacheStats textureStats = gTextureCache.GetStats();
+	cout << "INFO: Texture cache holds " << textureStats.textures << " textures (" << textureStats.packedLayers << " in array layers), "
+		<< textureStats.residentBytes << " bytes (" << textureStats.hits << " hits, " << textureStats.misses << " misses)" << endl;
 	
 	// tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
 	glUseProgram(gProgramId);
 
 	// We set the texture as texture unit 0
 	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"),  0);
-	glUniform2f(glGetUniformLocation(gProgramId, "uvScale"), gUVScale.x, gUVScale.y);
+	glUniform1i(glGetUniformLocation(gProgramId, "uTextureArray"), TEXTURE_ARRAY_UNIT);
+	glUniform1i(glGetUniformLocation(gProgramId, "uPageTable"), PAGE_TABLE_UNIT);
+	glUniform1i(glGetUniformLocation(gProgramId, "uVirtualCache"), VIRTUAL_CACHE_UNIT);
+
+	// Per-frame and per-object uniforms are streamed through a persistently mapped ring
+	if (!gUniformRing.Initialize(GL_UNIFORM_BUFFER, UNIFORM_RING_FRAME_SIZE))
+		return EXIT_FAILURE;
+
+	// Software occlusion culling, one thread per core
+	gOcclusionRasterizer.Initialize();
+
+	// Depth pyramid for occlusion culling
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
+	if (!gHiZ.Initialize(framebufferWidth, framebufferHeight))
+		return EXIT_FAILURE;
+
+	// Object id target for right-click picking; the scene still renders without it
+	if (!gIdBuffer.Initialize(framebufferWidth, framebufferHeight))
+		gUseIdBuffer = false;
+
+	// The table through a virtual texture once its tiles are baked; until then, or if that fails, it streams its 2D texture
+	if (gVirtualTextures.Initialize(&gThreadPool, &gUploadQueue, VIRTUAL_CACHE_TILES, framebufferWidth, framebufferHeight, VIRTUAL_TEXTURE_DIRECTORY))
+		gTableVirtualTexture = gVirtualTextures.Add(tableTexFilename);
+
+	// Occlusion queries for conditional rendering; without them every object is drawn directly
+	if (!gOcclusionQueries.Initialize(SCENE_OBJECT_COUNT))
+		memset(gObjectQueried, 0, sizeof(gObjectQueried));
+
+	// Timer queries for the one view against two views comparison in the title
+	glGenQueries(SCENE_TIMER_COUNT, gSceneTimers);
 
 	// Sets the background color of the window to black (it will be implicitely used by glClear)
 	glClearColor(0.3f, 0.2f, 0.1f, 1.0);
@@ -354,14 +807,33 @@ int main(int argc, char* argv[])
 		// -----
 		UProcessInput(gWindow);
 
+		// queue the images decoded since last frame, the mips last frame's objects asked for and the tiles they showed,
+		// then upload pending mesh and texture data within this frame's budget
+		gTextureLoader.Update();
+		gTextureStreamer.Update();
+		gVirtualTextures.Update();
+		gUploadQueue.ProcessUploads();
+
+		// defragment the mesh buffers a little at a time, never under a queued upload
+		if (gUploadQueue.IsIdle())
+			gBufferPool.Compact(BUFFER_POOL_COMPACT_BYTES);
+
 		// Render this frame
 		URender();
+		UUpdateWindowTitle();
 
 		glfwPollEvents();
 	}
 
+	// Let running decodes and tile reads finish, then finish outstanding uploads and release the staging buffers
+	gTextureLoader.Destroy();
+	gVirtualTextures.Destroy();
+	gThreadPool.Destroy();
+	gUploadQueue.Destroy();
+
 	// Release mesh data
 	meshes.DestroyMeshes();
+	gBufferPool.Destroy();
 
 	// Release texture
 	UDestroyTexture(tabletextureId);
@@ -370,6 +842,17 @@ int main(int argc, char* argv[])
 	UDestroyTexture(macapplewhitetexId);
 	UDestroyTexture(mousetextureId);
 	UDestroyTexture(cuptextureId);
+	gTextureCache.Destroy();
+	gTextureArray.Destroy();
+	gTextureStreamer.Destroy();
+
+	// Release the uniform ring and the depth pyramid
+	gUniformRing.Destroy();
+	gHiZ.Destroy();
+	gIdBuffer.Destroy();
+	gOcclusionQueries.Destroy();
+	gOcclusionRasterizer.Destroy();
+	glDeleteQueries(SCENE_TIMER_COUNT, gSceneTimers);
 
 	// Release shader program
 	UDestroyShaderProgram(gProgramId);
@@ -380,7 +863,7 @@ int main(int argc, char* argv[])
 
 
 // Initialize GLFW, GLAD, and create a window
-bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+bool UInitialize(int, char* [], GLFWwindow** window)
 {
 	// GLFW: initialize and configure
 	// ------------------------------
@@ -452,20 +935,53 @@ void UProcessInput(GLFWwindow* window)
 		gCamera.Position += gCamera.Up * velocity;
 
 	if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
-	{
-		usePerspective = true;
-		useOrthographic = false;
-	}
+		gCamera.Orthographic = false;
 	if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
-	{
-		usePerspective = false;
-		useOrthographic = true;
-	}
+		gCamera.Orthographic = true;
+
+	if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS)
+		gCullingMode = CULL_BVH;
+	if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS)
+		gCullingMode = CULL_SIMD;
+	if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)
+		gCullingMode = CULL_OCTREE;
+
+	if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS && gLastPick.object >= 0)
+		gObjectQueried[gLastPick.object] = 1;
+	if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && gLastPick.object >= 0)
+		gObjectQueried[gLastPick.object] = 0;
+
+	if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
+		gUseMultiView = true;
+	if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS)
+		gUseMultiView = false;
+
+	if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS)
+		gUseSizeCulling = true;
+	if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS)
+		gUseSizeCulling = false;
+
+	if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS)
+		gHiZMode = HIZ_GPU;
+	if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS)
+		gHiZMode = HIZ_CPU;
+	if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS)
+		gHiZMode = HIZ_OFF;
+
+	if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
+		gUseSoftwareOcclusion = true;
+	if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS)
+		gUseSoftwareOcclusion = false;
+
+	if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
+		gUseIdBuffer = gIdBuffer.IsValid();
+	if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS)
+		gUseIdBuffer = false;
 
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
-void UResizeWindow(GLFWwindow* window, int width, int height)
+void UResizeWindow(GLFWwindow*, int width, int height)
 {
 	glViewport(0, 0, width, height);
 }
@@ -473,7 +989,7 @@ void UResizeWindow(GLFWwindow* window, int width, int height)
 
 // glfw: whenever the mouse moves, this callback is called
 // -------------------------------------------------------
-void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
+void UMousePositionCallback(GLFWwindow*, double xpos, double ypos)
 {
 	if (gFirstMouse)
 	{
@@ -494,7 +1010,7 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
-void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
+void UMouseScrollCallback(GLFWwindow*, double, double yoffset)
 {
 	gCamera.ProcessMouseScroll(yoffset);
 }
@@ -502,14 +1018,25 @@ void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 
 // glfw: handle mouse button events
 // --------------------------------
-void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+void UMouseButtonCallback(GLFWwindow*, int button, int action, int)
 {
 	switch (button)
 	{
 	case GLFW_MOUSE_BUTTON_LEFT:
 	{
 		if (action == GLFW_PRESS)
+		{
 			cout << "Left mouse button pressed" << endl;
+
+			double startTime = glfwGetTime();
+			gLastPick = UPickObject();
+			double pickMs = (glfwGetTime() - startTime) * 1000.0;
+			if (gLastPick.object >= 0)
+				cout << "INFO: Picked " << gSceneObjects[gLastPick.object].name << ", triangle " << gLastPick.triangle
+					<< " at distance " << gLastPick.distance << " (" << pickMs << " ms)" << endl;
+			else
+				cout << "INFO: Picked nothing (" << pickMs << " ms)" << endl;
+		}
 		else
 			cout << "Left mouse button released" << endl;
 	}
@@ -527,7 +1054,12 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 	case GLFW_MOUSE_BUTTON_RIGHT:
 	{
 		if (action == GLFW_PRESS)
+		{
 			cout << "Right mouse button pressed" << endl;
+
+			if (gUseIdBuffer)
+				URequestIdPick();
+		}
 		else
 			cout << "Right mouse button released" << endl;
 	}
@@ -540,628 +1072,838 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 }
 
 
-// Functioned called to render a frame
-void URender()
+// Write one object's uniforms into the ring; returns where, or -1 when the ring is full
+GLintptr UWriteObjectUniforms(const SceneObject& object, const glm::mat4& model)
 {
+	ObjectUniforms uniforms;
+	uniforms.model = model;
+	uniforms.normalMatrix = glm::transpose(glm::inverse(model));
+	uniforms.objectColor = OBJECT_COLOR;
+	uniforms.uvScale = gUVScale;
+	uniforms.hasTexture = object.texture != nullptr;
+	uniforms.objectId = (GLuint)(&object - gSceneObjects);
+	uniforms.textureLayer = object.texture != nullptr ? object.texture->layer : -1;
+	uniforms.virtualTexture = UVirtualTexture(object);
+
+	// Counted for the title; only the first time is printed, the console would flood otherwise
+	GLintptr offset = gUniformRing.Write(&uniforms, sizeof(uniforms));
+	if (offset < 0)
+	{
+		++gFrameStats.ringSkipped;
+		if (!gReportedRingFull)
+			cout << "WARNING: Uniform ring full, skipped " << object.name << " (further skips are counted in the title)" << endl;
+		gReportedRingFull = true;
+	}
+	return offset;
+}
 
-	// Enable z-depth
-	glEnable(GL_DEPTH_TEST);
 
-	// Clear the frame and z buffers
-	glClearColor(0.3f, 0.2f, 0.1f, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// The mesh to draw an object with and the model matrix placing it: its own mesh, or while that is
+// still on the upload queue the box mesh, which is always resident, stretched over its bounds
+const Meshes::GLMesh& UDrawnMesh(const SceneObject& object, const glm::mat4& model, glm::mat4& drawModel)
+{
+	drawModel = model;
+	if (meshes.IsResident(*object.mesh))
+		return *object.mesh;
+
+	// Flat meshes keep a sliver of thickness so the normal matrix stays invertible
+	const AABB& bounds = object.mesh->bounds;
+	glm::vec3 size = glm::max(bounds.max - bounds.min, glm::vec3(1e-3f));
+	drawModel = model * glm::translate((bounds.min + bounds.max) * 0.5f) * glm::scale(size);
+	return meshes.gBoxMesh;
+}
 
-	// Set the shader to be used
-	glUseProgram(gProgramId);
 
-	// camera/view transformation
-	glm::mat4 view = gCamera.GetViewMatrix();
+// Write one object's uniforms into the ring, bind them and draw its ranges
+// With a command offset the ranges are drawn from consecutive indirect commands there instead
+void UDrawSceneObject(const SceneObject& object, const glm::mat4& model, GLintptr commandOffset)
+{
+	glm::mat4 drawModel;
+	const Meshes::GLMesh& mesh = UDrawnMesh(object, model, drawModel);
+	GLintptr offset = UWriteObjectUniforms(object, drawModel);
+	if (offset < 0)
+		return;
+	gUniformRing.Bind(OBJECT_DATA_BINDING, offset, sizeof(ObjectUniforms));
 
-	// Creates a orthographic projection
-	glm::mat4 orthoProjection = glm::ortho(-7.0f, 7.0f, -7.0f, 7.0f, 0.0f, 100.0f);
+	// Activate the VBOs contained within the mesh's VAO
+	glBindVertexArray(mesh.vao);
 
-	// Creates a perspective projection
-	glm::mat4 perspectiveProjection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+	// Bind the texture to texture unit 0, which uTexture samples from; array layers are already bound
+	if (object.texture != nullptr && object.texture->layer < 0)
+		glBindTexture(GL_TEXTURE_2D, object.texture->texture);
+	UBindPageTable(object);
 
-	// Create a perspective/ortho projection matrix based on the current projection mode
-	glm::mat4 projection;
-	if (usePerspective)
-	{
-		projection = perspectiveProjection;
-	}
+	// The stand-in box is drawn whole and directly, whatever the indirect commands say
+	if (&mesh != object.mesh)
+		meshes.DrawMesh(mesh, GL_TRIANGLES);
 	else
+		UDrawObjectRanges(object, model, commandOffset);
+}
+
+
+// Draw the object's ranges with its vertex array, texture and uniforms already bound. A whole
+// clustered mesh only sends the meshlets that face the view and lie inside it.
+void UDrawObjectRanges(const SceneObject& object, const glm::mat4& model, GLintptr commandOffset)
+{
+	// Draws the triangles
+	for (int i = 0; i < object.rangeCount; ++i)
 	{
-		projection = orthoProjection;
+		const DrawRange& range = object.ranges[i];
+		if (commandOffset >= 0)
+			meshes.DrawMeshIndirect(*object.mesh, range.mode, commandOffset + i * sizeof(Meshes::DrawCommand));
+		else if (range.count == 0 && range.mode == GL_TRIANGLES && !object.mesh->meshlets.empty())
+		{
+			unsigned int drawn = meshes.DrawMeshClusters(*object.mesh, model, gClusterViewProjection, gCamera.Position, gClusterConeTest);
+			gFrameStats.drawnClusters += drawn;
+			gFrameStats.culledClusters += (unsigned int)object.mesh->meshlets.size() - drawn;
+		}
+		else if (range.count == 0)
+			meshes.DrawMesh(*object.mesh, range.mode);
+		else
+			meshes.DrawMesh(*object.mesh, range.mode, range.first, range.count);
 	}
+}
 
-	GLint modelLoc;
-	GLint viewLoc;
-	GLint projLoc;
-	GLint viewPosLoc;
-	GLint ambStrLoc;
-	GLint ambColLoc;
-	GLint light1ColLoc;
-	GLint light1PosLoc;
-	GLint light2ColLoc;
-	GLint light2PosLoc;
-	GLint objColLoc;
-	GLint specInt1Loc;
-	GLint highlghtSz1Loc;
-	GLint specInt2Loc;
-	GLint highlghtSz2Loc;
-	GLint uHasTextureLoc;
-	bool ubHasTextureVal;
-	glm::mat4 scale;
-	glm::mat4 rotation;
-	glm::mat4 translation;
-	glm::mat4 model;
-
-	// Retrieves and passes transform matrices to the Shader program
-	modelLoc = glGetUniformLocation(gProgramId, "model");
-	viewLoc = glGetUniformLocation(gProgramId, "view");
-	projLoc = glGetUniformLocation(gProgramId, "projection");
-	viewPosLoc = glGetUniformLocation(gProgramId, "viewPosition");
-	ambStrLoc = glGetUniformLocation(gProgramId, "ambientStrength");
-	ambColLoc = glGetUniformLocation(gProgramId, "ambientColor");
-	light1ColLoc = glGetUniformLocation(gProgramId, "light1Color");
-	light1PosLoc = glGetUniformLocation(gProgramId, "light1Position");
-	light2ColLoc = glGetUniformLocation(gProgramId, "light2Color");
-	light2PosLoc = glGetUniformLocation(gProgramId, "light2Position");
-	objColLoc = glGetUniformLocation(gProgramId, "objectColor");
-	specInt1Loc = glGetUniformLocation(gProgramId, "specularIntensity1");
-	highlghtSz1Loc = glGetUniformLocation(gProgramId, "highlightSize1");
-	specInt2Loc = glGetUniformLocation(gProgramId, "specularIntensity2");
-	highlghtSz2Loc = glGetUniformLocation(gProgramId, "highlightSize2");
-	uHasTextureLoc = glGetUniformLocation(gProgramId, "ubHasTexture");
-
-
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-	//set the camera view location
-	glUniform3f(viewPosLoc, gCamera.Position.x, gCamera.Position.y, gCamera.Position.z);
-	//set ambient lighting strength
-	glUniform1f(ambStrLoc, 0.4f);
-	//set ambient color
-	glUniform3f(ambColLoc,		0.2f, 0.2f,  0.2f);
-	glUniform3f(light1ColLoc,   0.5f, 0.5f,  0.5f);
-	glUniform3f(light1PosLoc,   7.0f, 2.8f, -1.0f);
-	glUniform3f(light2ColLoc,   0.5f, 0.5f,  0.5f);
-	glUniform3f(light2PosLoc,   2.0f, 1.0f, -1.0f);
-	//set specular intensity
-	glUniform1f(specInt1Loc, .8f);
-	glUniform1f(specInt2Loc, .8f);
-	//set specular highlight size
-	glUniform1f(highlghtSz1Loc, 2.0f);
-	glUniform1f(highlghtSz2Loc, 2.0f);
-
-	ubHasTextureVal = true;
-	glUniform1i(uHasTextureLoc, ubHasTextureVal);
-
-	GLint UVScaleLoc = glGetUniformLocation(gProgramId, "uvScale");
-	
-
-	//////////////////////////////////////////
-	///   3D Scene- Main Objects Render    ///
-	/////////////////////////////////////////
 
-	//plane (table)
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gPlaneMesh.vao);
+// Gather the triangles of every object's draw ranges for picking, once the meshes exist
+void UBuildPickShapes()
+{
+	gPickShapes.clear();
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		const SceneObject& object = gSceneObjects[i];
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, tabletextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(8.0f, 1.0f, 3.0f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(0.0f, 0.8f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
-	
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+		// Reuse the shape of an earlier object drawn the same way
+		gObjectShape[i] = -1;
+		for (int j = 0; j < i && gObjectShape[i] < 0; ++j)
+		{
+			const SceneObject& other = gSceneObjects[j];
+			bool same = other.mesh == object.mesh && other.rangeCount == object.rangeCount;
+			for (int r = 0; same && r < object.rangeCount; ++r)
+				same = other.ranges[r].mode == object.ranges[r].mode && other.ranges[r].first == object.ranges[r].first
+					&& other.ranges[r].count == object.ranges[r].count;
+			if (same)
+				gObjectShape[i] = gObjectShape[j];
+		}
+		if (gObjectShape[i] >= 0)
+			continue;
+
+		gObjectShape[i] = (int)gPickShapes.size();
+		gPickShapes.push_back(PickShape());
+		PickShape& shape = gPickShapes.back();
+		const Meshes::GLMesh& mesh = *object.mesh;
+		for (int r = 0; r < object.rangeCount; ++r)
+		{
+			const DrawRange& range = object.ranges[r];
+			GLsizei count = range.count != 0 ? range.count : (GLsizei)(mesh.nIndices > 0 ? mesh.nIndices : mesh.nVertices);
+			shape.AddTriangles(mesh.positions, mesh.indices, range.mode, range.first, count);
+		}
+	}
+}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
 
+// Cast a ray through the cursor, or the window center while the camera holds the cursor.
+// The BVH finds the objects whose boxes the ray crosses, nearest first; only those are
+// tested triangle by triangle, with the ray moved into object space so shapes stay shared.
+PickResult UPickObject()
+{
+	PickResult result = { -1, -1, 0.0f };
+	if (gSceneBVH.Empty())
+		return result;
+
+	int width, height;
+	glfwGetWindowSize(gWindow, &width, &height);
+	if (width <= 0 || height <= 0)
+		return result;
+	double cursorX = width * 0.5;
+	double cursorY = height * 0.5;
+	if (glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+		glfwGetCursorPos(gWindow, &cursorX, &cursorY);
+
+	// With several views the ray goes through the one under the cursor, with its projection
+	Camera camera = gCamera;
+	double viewWidth = width;
+	if (gUseMultiView)
+	{
+		viewWidth = (double)width / VIEW_COUNT;
+		int view = std::min((int)(cursorX / viewWidth), VIEW_COUNT - 1);
+		cursorX -= view * viewWidth;
+		camera.Orthographic = view == 1;
+		camera.AspectRatio = (float)(viewWidth / height);
+	}
 
-	//Laptop Box
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gBoxMesh.vao);
+	glm::vec2 ndc((float)(2.0 * cursorX / viewWidth - 1.0), (float)(1.0 - 2.0 * cursorY / height));
+	glm::vec3 origin, direction;
+	ScreenPointToRay(camera.GetProjectionMatrix() * camera.GetViewMatrix(), ndc, origin, direction);
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mactextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(4.0f, 0.2f, 2.0f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(4.0f, 0.9f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	float distance = std::numeric_limits<float>::max();
+	int triangle = -1;
+	auto testObject = [&](int candidate, float& t)
+	{
+		// The direction is not renormalized, so t keeps measuring world units
+		glm::mat4 toObject = glm::inverse(gObjectModels[candidate]);
+		glm::vec3 localOrigin(toObject * glm::vec4(origin, 1.0f));
+		glm::vec3 localDirection(toObject * glm::vec4(direction, 0.0f));
+		int hit = gPickShapes[gObjectShape[candidate]].Intersect(localOrigin, localDirection, t);
+		if (hit < 0)
+			return false;
+		triangle = hit;
+		return true;
+	};
+	int object = gCullingMode == CULL_OCTREE ? gSceneOctree.Raycast(origin, direction, distance, testObject)
+		: gSceneBVH.Raycast(origin, direction, distance, testObject);
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	if (object >= 0)
+	{
+		result.object = object;
+		result.triangle = triangle;
+		result.distance = distance;
+	}
+	return result;
+}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
 
+// Ask the id buffer for the object under the cursor, or the window center while the
+// camera holds the cursor. The answer is printed a frame or two later, when the readback lands.
+void URequestIdPick()
+{
+	int width, height, framebufferWidth, framebufferHeight;
+	glfwGetWindowSize(gWindow, &width, &height);
+	glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
+	if (width <= 0 || height <= 0)
+		return;
+	double cursorX = width * 0.5;
+	double cursorY = height * 0.5;
+	if (glfwGetInputMode(gWindow, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+		glfwGetCursorPos(gWindow, &cursorX, &cursorY);
+
+	// Window coordinates to framebuffer pixels, y up
+	int x = (int)(cursorX * framebufferWidth / width);
+	int y = framebufferHeight - 1 - (int)(cursorY * framebufferHeight / height);
+
+	double requestTime = glfwGetTime();
+	gIdBuffer.RequestPick(x, y, [requestTime](const IdPickResult& result)
+	{
+		double latencyMs = (glfwGetTime() - requestTime) * 1000.0;
+		if (result.id < (GLuint)SCENE_OBJECT_COUNT)
+			cout << "INFO: ID buffer picked " << gSceneObjects[result.id].name;
+		else
+			cout << "INFO: ID buffer picked nothing";
+		cout << " at pixel (" << result.x << ", " << result.y << "), " << result.frames << " frames later (" << latencyMs << " ms)" << endl;
+	});
+}
 
-	// back edge of laptop
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gBoxMesh.vao);
 
-	// Bind the texture to the corresponding texture unit
+// Bind the packed small textures and the virtual texture cache for the whole pass and leave unit 0
+// active for the per-object 2D binds
+void UBindTextureArray()
+{
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_UNIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, gTextureArray.Texture());
+	glActiveTexture(GL_TEXTURE0 + VIRTUAL_CACHE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, gVirtualTextures.CacheTexture());
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, macbacktextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(2.8f, 0.2f, 0.01f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(4.0f, 0.9f, 2.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+}
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
 
-	
-	// laptop Logo sphere
-	// 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gSphereMesh.vao);
+// The object's virtual texture id, -1 if it has none or it is still being baked
+int UVirtualTexture(const SceneObject& object)
+{
+	if (object.virtualTexture == nullptr || !gVirtualTextures.IsReady(*object.virtualTexture))
+		return -1;
+	return *object.virtualTexture;
+}
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, macapplewhitetexId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.3f, 0.006f, 0.2f));
-	// 2. Rotate the object
-	rotation = glm::rotate(-35.0f, glm::vec3(0.0, 1.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(4.0f, 1.0f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+// Bind the page table of the object's virtual texture, if it has one
+void UBindPageTable(const SceneObject& object)
+{
+	int virtualTexture = UVirtualTexture(object);
+	if (virtualTexture < 0)
+		return;
+	glActiveTexture(GL_TEXTURE0 + PAGE_TABLE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, gVirtualTextures.PageTable(virtualTexture));
+	glActiveTexture(GL_TEXTURE0);
+}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
 
-	// laptop Logo1 sphere
-	// 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gSphereMesh.vao);
+// Draw the flagged objects, surfaces first and then the lamps
+// indirect: draw from the re-test's commands, which the GPU enabled only for objects that passed
+void UDrawScenePass(const glm::mat4 models[], const unsigned char draw[], bool indirect)
+{
+	if (indirect)
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gHiZ.CommandBuffer());
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, macapplewhitetexId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.3f, 0.006f, 0.2f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(0.0, 1.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(4.08f, 1.0f, 1.12f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Set the shader to be used
+	glUseProgram(gProgramId);
+	UBindTextureArray();
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	// Objects behind occlusion queries wait until the rest has filled the depth buffer
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		if (!gSceneObjects[i].isLamp && draw[i] && (indirect || !gObjectQueried[i]))
+			UDrawSceneObject(gSceneObjects[i], models[i], indirect ? (GLintptr)(gHiZObjects[i].firstCommand * sizeof(Meshes::DrawCommand)) : -1);
+	}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	// Their boxes are tested against that depth, and their real draws only run on the GPU
+	// when a sample of the box passed. The indirect pass was already decided by the Hi-Z test.
+	if (!indirect)
+	{
+		gOcclusionQueries.BeginQueries();
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (!gSceneObjects[i].isLamp && draw[i] && gObjectQueried[i])
+				gOcclusionQueries.Issue(i, gObjectBounds[i], gCamera.Position, gCamera.NearPlane);
+		}
+		gOcclusionQueries.EndQueries();
 
-	//laptop logo box
-	// 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gBoxMesh.vao);
+		glUseProgram(gProgramId);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (!gSceneObjects[i].isLamp && draw[i] && gObjectQueried[i])
+			{
+				gOcclusionQueries.BeginConditional(i);
+				UDrawSceneObject(gSceneObjects[i], models[i]);
+				gOcclusionQueries.EndConditional();
+			}
+		}
+	}
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, macapplewhitetexId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.33f, 0.006f, 0.1f));
-	// 2. Rotate the object
-	rotation = glm::rotate(35.0f, glm::vec3(0.0, 1.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(3.8f, 1.0f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Light Object
+	glUseProgram(gLampProgramId);
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		if (gSceneObjects[i].isLamp && draw[i])
+			UDrawSceneObject(gSceneObjects[i], models[i], indirect ? (GLintptr)(gHiZObjects[i].firstCommand * sizeof(Meshes::DrawCommand)) : -1);
+	}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	glUseProgram(0);
 
+	if (indirect)
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
 
-	// Mouse Sphere
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gSphereMesh.vao);
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mousetextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.2f, 0.18f, 0.35f));
-	// 2. Rotate the object
-	rotation = glm::rotate(173.0f, glm::vec3(1.0, 0.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(1.5f, 0.94f, 1.5f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+// Show frame rate and culling counters in the title bar, once per second
+void UUpdateWindowTitle()
+{
+	++gStatsFrames;
+	double now = glfwGetTime();
+	if (now - gStatsTime < 1.0)
+		return;
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	for (int views = 0; views < VIEW_COUNT; ++views)
+	{
+		if (gSceneGpuFrames[views] > 0)
+			gSceneGpuAverage[views] = gSceneGpuTime[views] / gSceneGpuFrames[views];
+		gSceneGpuTime[views] = 0.0;
+		gSceneGpuFrames[views] = 0;
+	}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	char title[640];
+	const char* cullingModeNames[] = { "SIMD", "BVH", "octree" };
+	const char* hiZModeNames[] = { "off", "GPU", "CPU" };
+	const char* viewNames = gUseMultiView ? "2 views, " : "";
+	TextureStreamerStats streaming = gTextureStreamer.GetStats();
+	VirtualTextureStats tiles = gVirtualTextures.GetStats();
+	snprintf(title, sizeof(title), "%s - %.0f fps | %s%s culling: visible %u, culled %u, rebuilds %u, too small %u | raster occluded %u | Hi-Z %s: occluded %u, retested %u | queries %u, skipped %u | ring skipped %u | clusters %u, culled %u | mip uploads %.1f of %.1f MB, %.1f MB in RAM | tiles %u of %u, missing %u | GPU %.2f ms 1 view, %.2f ms 2 views",
+		WINDOW_TITLE, gStatsFrames / (now - gStatsTime), viewNames, gUseMultiView ? "SIMD" : cullingModeNames[gCullingMode],
+		gFrameStats.visibleObjects, gFrameStats.culledObjects, gFrameStats.bvhRebuilds, gFrameStats.sizeCulled, gFrameStats.rasterOccluded,
+		hiZModeNames[gHiZMode], gFrameStats.occludedObjects, gFrameStats.retestedObjects,
+		gFrameStats.queriedObjects, gFrameStats.querySkipped, gFrameStats.ringSkipped, gFrameStats.drawnClusters, gFrameStats.culledClusters, streaming.uploadedBytes / 1048576.0, streaming.budgetBytes / 1048576.0, streaming.memoryBytes / 1048576.0,
+		tiles.residentTiles, tiles.cacheTiles, tiles.missingTiles, gSceneGpuAverage[0], gSceneGpuAverage[1]);
+	glfwSetWindowTitle(gWindow, title);
+
+	gStatsFrames = 0;
+	gStatsTime = now;
+}
 
 
-	// Mouse buttom Box
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gBoxMesh.vao);
+// Functioned called to render a frame
+void URender()
+{
+	// Claim this frame's region of the uniform ring
+	gUniformRing.BeginFrame();
+	gFrameStats.drawnClusters = 0;
+	gFrameStats.culledClusters = 0;
+	gFrameStats.ringSkipped = 0;
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mousetextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.3f, 0.22f, 0.35f));
-	// 2. Rotate the object
-	rotation = glm::rotate(170.0f, glm::vec3(1.0, 0.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(1.5f, 0.86f, 1.33f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Enable z-depth
+	glEnable(GL_DEPTH_TEST);
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+	// The id buffer, the depth pyramid and the virtual texture feedback have to match the framebuffer
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	// Every scene pass writes the tiles it samples
+	gVirtualTextures.Resize(framebufferWidth, framebufferHeight);
+	gVirtualTextures.BeginFeedback();
 
+	// Clear the frame and z buffers, drawing into the id buffer's targets when it is on
+	if (gUseIdBuffer)
+	{
+		gIdBuffer.Resize(framebufferWidth, framebufferHeight);
+		gIdBuffer.Begin(glm::vec4(0.3f, 0.2f, 0.1f, 1.0f));
+	}
+	else
+	{
+		glClearColor(0.3f, 0.2f, 0.1f, 1.0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+	UBeginSceneTimer();
 
-	//Cup Cylinder Body
-	// 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gTaperedCylinderMesh.vao);
+	// camera/view transformation
+	glm::mat4 view = gCamera.GetViewMatrix();
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, cuptextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.4f, -0.7f, 0.4f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(7.0f, 1.5f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Perspective or orthographic projection, depending on the current projection mode
+	gCamera.AspectRatio = (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT;
+	glm::mat4 projection = gCamera.GetProjectionMatrix();
+	gClusterViewProjection = projection * view;
+	gClusterConeTest = !gCamera.Orthographic;
+
+	// Camera and lighting for the whole frame, written once and shared by both programs
+	FrameUniforms frame;
+	frame.view = view;
+	frame.projection = projection;
+	frame.viewPosition = gCamera.Position;
+	frame.ambientStrength = 0.4f;
+	frame.ambientColor = glm::vec3(0.2f, 0.2f, 0.2f);
+	frame.light1Color = glm::vec3(0.5f, 0.5f, 0.5f);
+	frame.light1Position = glm::vec3(7.0f, 2.8f, -1.0f);
+	frame.light2Color = glm::vec3(0.5f, 0.5f, 0.5f);
+	frame.light2Position = glm::vec3(2.0f, 1.0f, -1.0f);
+	frame.specularIntensity1 = 0.8f;
+	frame.specularIntensity2 = 0.8f;
+	frame.highlightSize1 = 2.0f;
+	frame.highlightSize2 = 2.0f;
+	frame.padding = 0.0f;
 
-	// Draws the triangles
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+	glm::mat4 scale;
+	glm::mat4 rotation;
+	glm::mat4 translation;
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	// Place every object and collect its world-space box
+	gWorldBounds.Clear();
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		const SceneObject& object = gSceneObjects[i];
 
-	// Cup Torus handle
-	// 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gTorusMesh.vao);
+		// 1. Scales the object
+		scale = glm::scale(object.scale);
+		// 2. Rotate the object, lamps spin around their stand
+		float objectAngle = object.rotation;
+		if (object.isLamp)
+		{
+			objectAngle += angle;
+			angle += object.spin;
+		}
+		rotation = glm::rotate(objectAngle, object.rotationAxis);
+		// 3. Position the object
+		translation = glm::translate(object.position);
+		// Model matrix: transformations are applied right-to-left order
+		gObjectModels[i] = translation * rotation * scale;
+
+		gObjectBounds[i] = TransformAABB(object.mesh->bounds, gObjectModels[i]);
+		gWorldBounds.Add(gObjectBounds[i]);
+	}
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, cuptextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.15f, 0.3f, 1.0f));
-	// 2. Rotate the object
-	rotation = glm::rotate(-0.65f, glm::vec3(0.0, 0.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(7.3f, 1.2f, 1.05f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Moving objects only refit the hierarchy; it is rebuilt once refitting has made it too loose
+	if (gSceneBVH.Update(gObjectBounds))
+		++gFrameStats.bvhRebuilds;
 
-	// Draws the triangles
-	glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+	// The octree's root is sized to the scene as first placed; objects straying outside it stay in the root
+	if (gSceneOctree.NodeCount() == 0)
+	{
+		AABB sceneBounds = gObjectBounds[0];
+		for (int i = 1; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			sceneBounds.min = glm::min(sceneBounds.min, gObjectBounds[i].min);
+			sceneBounds.max = glm::max(sceneBounds.max, gObjectBounds[i].max);
+		}
+		gSceneOctree.Initialize(sceneBounds, 6);
+	}
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		gSceneOctree.Update(i, gObjectBounds[i]);
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	if (gUseMultiView)
+	{
+		UDrawViews(frame, framebufferWidth, framebufferHeight);
+		UEndFrame();
+		return;
+	}
 
-	// Cup Sphere/depth
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gSphereMesh.vao);
+	GLintptr frameOffset = gUniformRing.Write(&frame, sizeof(frame));
+	gUniformRing.Bind(FRAME_DATA_BINDING, frameOffset, sizeof(frame));
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mactextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.38f,  0.05f, 0.4f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(0.0, 1.0f, 0.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(7.0f, 1.47f, 1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Drop everything outside the view frustum
+	glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+	ExtractFrustumPlanes(projection * view, planes);
+	if (gCullingMode != CULL_SIMD)
+	{
+		gVisibleObjects.clear();
+		if (gCullingMode == CULL_OCTREE)
+			gSceneOctree.QueryFrustum(planes, gVisibleObjects);
+		else
+			gSceneBVH.QueryFrustum(planes, gVisibleObjects);
+		memset(gObjectVisible, 0, sizeof(gObjectVisible));
+		for (int object : gVisibleObjects)
+			gObjectVisible[object] = 1;
+		gFrameStats.visibleObjects = (unsigned int)gVisibleObjects.size();
+	}
+	else
+		gFrameStats.visibleObjects = (unsigned int)CullAABBs(planes, gWorldBounds, gObjectVisible);
+	gFrameStats.culledObjects = SCENE_OBJECT_COUNT - gFrameStats.visibleObjects;
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-	glBindVertexArray(0);
+	// Drop what would cover only a few pixels, or lies beyond its class's draw distance
+	gFrameStats.sizeCulled = 0;
+	if (gUseSizeCulling)
+	{
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (gObjectVisible[i] && UTooSmall(i, gCamera, (float)framebufferHeight))
+			{
+				gObjectVisible[i] = 0;
+				++gFrameStats.sizeCulled;
+			}
+		}
+	}
 
-	// Light stands
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gCylinderMesh.vao);
+	// Software occlusion: draw the visible occluders on the CPU and drop every
+	// other object hidden behind them before anything is sent to GL
+	glm::mat4 viewProjection = projection * view;
+	gFrameStats.rasterOccluded = 0;
+	if (gUseSoftwareOcclusion)
+	{
+		gOcclusionRasterizer.BeginFrame(viewProjection);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (gSceneObjects[i].isOccluder && gObjectVisible[i])
+				gOcclusionRasterizer.AddOccluder(gSceneObjects[i].mesh->bounds, gObjectModels[i]);
+		}
+		gOcclusionRasterizer.Rasterize();
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mousetextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.2f, 0.8f, 0.2f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(1.0f, 1.0f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (!gSceneObjects[i].isOccluder && gObjectVisible[i] && !gOcclusionRasterizer.TestAABB(gObjectBounds[i]))
+			{
+				gObjectVisible[i] = 0;
+				++gFrameStats.rasterOccluded;
+			}
+		}
+	}
 
-	// Draws the triangles
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(0.2f, 0.8f, 0.2f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(7.0f, 1.0f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	// Hi-Z occlusion culling
+	gHiZ.Resize(framebufferWidth, framebufferHeight);
+	gFrameStats.occludedObjects = 0;
+	gFrameStats.retestedObjects = 0;
 
-	// Draws the triangles
-	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+	if (gHiZMode == HIZ_CPU)
+	{
+		// Test against the newest pyramid read back, one or two frames old
+		gHiZ.ReadPyramid();
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (gObjectVisible[i] && !gHiZ.TestCPU(gObjectBounds[i]))
+			{
+				gObjectVisible[i] = 0;
+				++gFrameStats.occludedObjects;
+			}
+		}
+	}
 
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+	// Ask for the mip levels the objects still visible are close enough to show
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		if (gObjectVisible[i])
+			URequestTextureDetail(i, gCamera, (float)framebufferHeight);
+	}
 
-	// Light Base
-	//
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gBoxMesh.vao);
+	// First pass: with the GPU test only the objects that passed it last time
+	memcpy(gObjectDrawn, gObjectVisible, sizeof(gObjectDrawn));
+	if (gHiZMode == HIZ_GPU)
+	{
+		gHiZ.ReadVisibility(gHiZVisible);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			if (gObjectVisible[i] && !gHiZVisible[i])
+			{
+				gObjectDrawn[i] = 0;
+				++gFrameStats.occludedObjects;
+			}
+		}
+	}
 
-	// Bind the texture to the corresponding texture unit
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, mousetextureId);
-	// Set the texture uniform in the shader
-	glUniform1i(glGetUniformLocation(gProgramId, "uTexture"), 0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(1.0f, 0.14f, 0.8f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(1.0f, 1.0f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	//////////////////////////////////////////
+	///   3D Scene- Main Objects Render    ///
+	/////////////////////////////////////////
+	gOcclusionQueries.BeginFrame(viewProjection);
+	UDrawScenePass(gObjectModels, gObjectDrawn, false);
+	gFrameStats.queriedObjects = gOcclusionQueries.IssuedCount();
+	gFrameStats.querySkipped = gOcclusionQueries.HiddenCount();
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-
-	// 1. Scales the object
-	scale = glm::scale(glm::vec3(1.0f, 0.14f, 0.8f));
-	// 2. Rotate the object
-	rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-	// 3. Position the object
-	translation = glm::translate(glm::vec3(7.0f, 1.0f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-	glUniform4f(objColLoc, 0.5f, 0.5f, 0.5f, 1.0f);
+	if (gHiZMode == HIZ_GPU)
+	{
+		// Second pass: build the pyramid from what the first pass drew, test every
+		// box against it and draw the objects the first pass skipped that turn out
+		// to be visible now. Nothing waits for the result on the CPU, and objects
+		// that come out from behind an occluder appear in the same frame.
+		gHiZ.Build();
+
+		gHiZCommands.clear();
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+		{
+			const SceneObject& object = gSceneObjects[i];
+			HiZBuffer::Object& hizObject = gHiZObjects[i];
+			hizObject.boxMin = glm::vec4(gObjectBounds[i].min, 1.0f);
+			hizObject.boxMax = glm::vec4(gObjectBounds[i].max, 1.0f);
+			hizObject.firstCommand = (GLuint)gHiZCommands.size();
+			hizObject.commandCount = object.rangeCount;
+			hizObject.flags = gObjectVisible[i] && !gObjectDrawn[i] ? HiZBuffer::HIZ_DRAW : 0;
+			hizObject.padding = 0;
+			gFrameStats.retestedObjects += hizObject.flags != 0;
+
+			for (int r = 0; r < object.rangeCount; ++r)
+			{
+				const DrawRange& range = object.ranges[r];
+				GLsizei count = range.count != 0 ? range.count
+					: (GLsizei)(object.mesh->nIndices > 0 ? object.mesh->nIndices : object.mesh->nVertices);
+				gHiZCommands.push_back(meshes.GetDrawCommand(*object.mesh, range.first, count));
+			}
+		}
+		gHiZ.Test(viewProjection, gHiZObjects, gHiZCommands.data(), (GLsizei)gHiZCommands.size());
 
-	// Draws the triangles
-	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
-	// Deactivate the Vertex Array Object
-	glBindVertexArray(0);
+		for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+			gObjectDrawn[i] = gHiZObjects[i].flags != 0;
+		UDrawScenePass(gObjectModels, gObjectDrawn, true);
+	}
+	else if (gHiZMode == HIZ_CPU)
+	{
+		// Pyramid of this frame for the test a frame or two from now
+		gHiZ.Build();
+		gHiZ.RequestReadback(viewProjection);
+	}
 
+	UEndFrame();
+}
 
-	////////////////////////////////////////////
-	///   3D Scene- Lights Objects Render    ///
-	////////////////////////////////////////////
-	// Light Object
-	glUseProgram(gLampProgramId);
 
-	// Retrieves and passes transform matrices to the Shader program
-	modelLoc = glGetUniformLocation(gLampProgramId, "model");
-	viewLoc = glGetUniformLocation(gLampProgramId, "view");
-	projLoc = glGetUniformLocation(gLampProgramId, "projection");
+// Size culling test: true when the object's bounding sphere covers fewer pixels in the camera's
+// view than its class allows, or lies beyond the class's draw distance
+bool UTooSmall(int object, const Camera& camera, float viewportHeight)
+{
+	const ObjectClassLimits& limits = gObjectClassLimits[gSceneObjects[object].objectClass];
+	glm::vec3 center = (gObjectBounds[object].min + gObjectBounds[object].max) * 0.5f;
+	float radius = glm::length(gObjectBounds[object].max - gObjectBounds[object].min) * 0.5f;
+	bool tooFar = limits.maxDistance > 0.0f && glm::length(center - camera.Position) - radius > limits.maxDistance;
+	bool tooSmall = limits.minPixels > 0.0f && camera.ProjectedDiameter(center, radius, viewportHeight) < limits.minPixels;
+	return tooFar || tooSmall;
+}
 
-	glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-	glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
+// Texture streaming request: the object's bounding sphere diameter on screen, divided by the times
+// the texture repeats across it, estimates the pixels one repeat of the texture covers. Objects drawn
+// from a virtual texture ask for their tiles through its feedback instead.
+void URequestTextureDetail(int object, const Camera& camera, float viewportHeight)
+{
+	const TextureHandle* texture = gSceneObjects[object].texture;
+	if (texture == nullptr || texture->layer >= 0 || UVirtualTexture(gSceneObjects[object]) >= 0)
+		return;
+	glm::vec3 center = (gObjectBounds[object].min + gObjectBounds[object].max) * 0.5f;
+	float radius = glm::length(gObjectBounds[object].max - gObjectBounds[object].min) * 0.5f;
+	float pixels = camera.ProjectedDiameter(center, radius, viewportHeight);
+	gTextureStreamer.Request(texture->texture, pixels / std::max(gUVScale.x, gUVScale.y));
+}
 
-	// Activate the VBOs contained within the mesh's VAO
-	glBindVertexArray(meshes.gPyramid4Mesh.vao);
-
-	// 1. Scales the object by 2
-	scale = glm::scale(glm::vec3(1.0f, 2.0f, 0.8f));
-	// 2. Rotates shape by 15 degrees in the x axis
-	rotation = glm::rotate(angle, glm::vec3(0.0, 1.0f, 0.0f));
-	angle += 0.002;
-	// 3. Place object at the origin
-	translation = glm::translate(glm::vec3(1.0f, 2.8f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
-
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);
+// Draw the perspective view on the left half of the framebuffer and the orthographic one on the right.
+// Everything but the draw calls is done once: one culling pass over the boxes tests both frustums and
+// leaves a bit per view, every visible object's uniforms are written once, and one draw list sorted by
+// program, vertex array and texture is walked for each view.
+void UDrawViews(FrameUniforms frame, int framebufferWidth, int framebufferHeight)
+{
+	int viewWidth = std::max(framebufferWidth / VIEW_COUNT, 1);
+	Camera viewCameras[VIEW_COUNT] = { gCamera, gCamera };
+	viewCameras[0].Orthographic = false;
+	viewCameras[1].Orthographic = true;
+
+	// Per-view camera blocks, written next to each other
+	GLintptr frameOffsets[VIEW_COUNT];
+	glm::vec4 planes[VIEW_COUNT * FRUSTUM_PLANE_COUNT];
+	for (int v = 0; v < VIEW_COUNT; ++v)
+	{
+		viewCameras[v].AspectRatio = (GLfloat)viewWidth / (GLfloat)std::max(framebufferHeight, 1);
+		frame.projection = viewCameras[v].GetProjectionMatrix();
+		frameOffsets[v] = gUniformRing.Write(&frame, sizeof(frame));
+		ExtractFrustumPlanes(frame.projection * frame.view, planes + v * FRUSTUM_PLANE_COUNT);
+	}
 
-	// 1. Scales the object by 2
-	scale = glm::scale(glm::vec3(1.0f, 2.0f, 0.8f));
-	// 2. Rotates shape by 15 degrees in the x axis
-	rotation = glm::rotate(angle, glm::vec3(0.0, 1.0f, 0.0f));
-	angle += 0.001;
-	// 3. Place object at the origin
-	translation = glm::translate(glm::vec3(7.0f, 2.8f, -1.0f));
-	// Model matrix: transformations are applied right-to-left order
-	model = translation * rotation * scale;
+	// One culling pass for the union of the frustums, then size culling per view
+	gFrameStats.visibleObjects = (unsigned int)CullAABBsMultiView(planes, VIEW_COUNT, gWorldBounds, gObjectViewMask);
+	gFrameStats.sizeCulled = 0;
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		if (!gUseSizeCulling || gObjectViewMask[i] == 0)
+			continue;
+		for (int v = 0; v < VIEW_COUNT; ++v)
+		{
+			if ((gObjectViewMask[i] >> v) & 1 && UTooSmall(i, viewCameras[v], (float)framebufferHeight))
+				gObjectViewMask[i] &= ~(1 << v);
+		}
+		gFrameStats.sizeCulled += gObjectViewMask[i] == 0;
+	}
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		for (int v = 0; v < VIEW_COUNT; ++v)
+		{
+			if ((gObjectViewMask[i] >> v) & 1)
+				URequestTextureDetail(i, viewCameras[v], (float)framebufferHeight);
+		}
+	}
+	gFrameStats.culledObjects = SCENE_OBJECT_COUNT - gFrameStats.visibleObjects;
+	gFrameStats.occludedObjects = 0;
+	gFrameStats.retestedObjects = 0;
+	gFrameStats.rasterOccluded = 0;
+	gFrameStats.queriedObjects = 0;
+	gFrameStats.querySkipped = 0;
+
+	// Uniforms of every object visible anywhere, written once for all views
+	gDrawList.clear();
+	for (int i = 0; i < SCENE_OBJECT_COUNT; ++i)
+	{
+		if (gObjectViewMask[i] == 0)
+			continue;
+
+		const SceneObject& object = gSceneObjects[i];
+		glm::mat4 drawModel;
+		DrawItem item;
+		item.mesh = &UDrawnMesh(object, gObjectModels[i], drawModel);
+		item.key = ((uint64_t)object.isLamp << 63) | ((uint64_t)item.mesh->vao << 32) | (object.texture != nullptr ? object.texture->texture : 0);
+		item.object = i;
+		item.uniformOffset = UWriteObjectUniforms(object, drawModel);
+		if (item.uniformOffset >= 0)
+			gDrawList.push_back(item);
+	}
+	std::sort(gDrawList.begin(), gDrawList.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
 
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-	
+	UBindTextureArray();
+	for (int v = 0; v < VIEW_COUNT; ++v)
+	{
+		glViewport(v * viewWidth, 0, viewWidth, framebufferHeight);
+		gUniformRing.Bind(FRAME_DATA_BINDING, frameOffsets[v], sizeof(FrameUniforms));
+		gClusterViewProjection = viewCameras[v].GetProjectionMatrix() * frame.view;
+		gClusterConeTest = !viewCameras[v].Orthographic;
+
+		// State changes only where the sorted list changes program, vertex array or texture
+		GLuint program = 0;
+		GLuint vao = 0;
+		GLuint texture = 0;
+		for (const DrawItem& item : gDrawList)
+		{
+			if (((gObjectViewMask[item.object] >> v) & 1) == 0)
+				continue;
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);
+			const SceneObject& object = gSceneObjects[item.object];
+			GLuint itemProgram = object.isLamp ? gLampProgramId : gProgramId;
+			if (itemProgram != program)
+			{
+				program = itemProgram;
+				glUseProgram(program);
+			}
+			if (item.mesh->vao != vao)
+			{
+				vao = item.mesh->vao;
+				glBindVertexArray(vao);
+			}
+			if (object.texture != nullptr && object.texture->layer < 0 && object.texture->texture != texture)
+			{
+				texture = object.texture->texture;
+				glBindTexture(GL_TEXTURE_2D, texture);
+			}
+			UBindPageTable(object);
 
-	glBindVertexArray(0);
+			gUniformRing.Bind(OBJECT_DATA_BINDING, item.uniformOffset, sizeof(ObjectUniforms));
+			if (item.mesh != object.mesh)
+				meshes.DrawMesh(*item.mesh, GL_TRIANGLES);
+			else
+				UDrawObjectRanges(object, gObjectModels[item.object], -1);
+		}
+	}
 
 	glUseProgram(0);
+	glViewport(0, 0, framebufferWidth, framebufferHeight);
+}
+
+
+// Close the frame: release the uniform ring's region, present the id buffer's color and swap
+void UEndFrame()
+{
+	UEndSceneTimer();
 
 	// Deactivate the Vertex Array Object
 	glBindVertexArray(0);
 
+	// Every draw reading this frame's uniforms has been issued
+	gUniformRing.EndFrame();
+
+	// Copy out the tiles this frame sampled, read by a later frame's update
+	gVirtualTextures.EndFeedback();
+
+	// Start readbacks for new clicks, deliver finished ones and show the color target
+	if (gUseIdBuffer)
+		gIdBuffer.End();
+
 	// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 	glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
 }
 
 
-// Function to generate and load a texture from an image file
-bool UCreateTexture(const char* filename, GLuint& textureId)
+// Start timing the frame's scene passes, first collecting the oldest query in the ring. If its
+// result is not back yet this frame goes untimed rather than stalling on it.
+void UBeginSceneTimer()
 {
-	int width, height, channels;
-	stbi_set_flip_vertically_on_load(true); // Flip the image vertically during loading
-	unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
-	if (image)
-	{
-		glGenTextures(1, &textureId);
-		glBindTexture(GL_TEXTURE_2D, textureId);
-
-		// Set the texture wrapping parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-		// Set texture filtering parameters
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		if (channels == 3)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-		else if (channels == 4)
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-		else
-		{
-			cout << "Not implemented to handle an image with " << channels << " channels" << endl;
-			return false;
-		}
+	int slot = gSceneTimerNext;
+	if (gSceneTimerViews[slot] > 0)
+	{
+		GLuint available = 0;
+		glGetQueryObjectuiv(gSceneTimers[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			return;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(gSceneTimers[slot], GL_QUERY_RESULT, &nanoseconds);
+		gSceneGpuTime[gSceneTimerViews[slot] - 1] += nanoseconds * 1e-6;
+		++gSceneGpuFrames[gSceneTimerViews[slot] - 1];
+		gSceneTimerViews[slot] = 0;
+	}
 
-		glGenerateMipmap(GL_TEXTURE_2D);
+	glBeginQuery(GL_TIME_ELAPSED, gSceneTimers[slot]);
+	gSceneTimerViews[slot] = gUseMultiView ? VIEW_COUNT : 1;
+	gSceneTimerRunning = true;
+}
 
-		// Clean up
-		stbi_image_free(image);
-		glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
 
-		return true;
-	}
+// Stop the query UBeginSceneTimer() started, if it started one
+void UEndSceneTimer()
+{
+	if (!gSceneTimerRunning)
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	gSceneTimerRunning = false;
+	gSceneTimerNext = (gSceneTimerNext + 1) % SCENE_TIMER_COUNT;
+}
 
-	// Error loading the image
-	return false;
+
+// Function to get the shared texture for an image file, loading it in the background on first use
+bool UCreateTexture(const char* filename, TextureHandle& textureId)
+{
+	textureId = gTextureCache.Acquire(filename);
+	return textureId.texture != 0;
 }
 
-void UDestroyTexture(GLuint textureId)
+// Drops this user's reference; the texture is deleted with the last one
+void UDestroyTexture(TextureHandle textureId)
 {
-	glGenTextures(1, &textureId);
+	gTextureCache.Release(textureId);
 }
 
 
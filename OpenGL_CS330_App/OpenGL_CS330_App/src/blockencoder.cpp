@@ -0,0 +1,560 @@
+///////////////////////////////////////////////////////////////////////////////
+//  blockencoder.cpp
+//  ================
+//  Block compression encoders.
+//
+//  Every format stores a 4x4 block as two endpoint colors and a small
+//  index per texel choosing a point on the line between them, so each
+//  encoder follows the same steps: fit a line through the block's colors
+//  (mean and principal axis from the covariance), take the extreme
+//  projections as endpoints, quantize them to the format's precision and
+//  pick the nearest palette entry for every texel. One least-squares pass
+//  then moves the endpoints to best fit the chosen indices, and is kept
+//  when it lowers the error.
+//
+//  The block is held as structure-of-arrays floats so the nearest-entry
+//  search, where the time goes, runs on eight texels per step with AVX
+//  and four with SSE.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "blockencoder.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	// The texels of one block, row by row, one array per channel
+	struct BlockPixels
+	{
+		alignas(32) float channel[4][16];
+	};
+
+	// Up to sixteen palette colors (BC7 mode 6), also one array per channel
+	struct Palette
+	{
+		float channel[4][16];
+		int size;
+	};
+
+	// BC7 mode 6 interpolation weights, out of 64
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	void ULoadBlock(const unsigned char* rgba, int width, int height, int blockX, int blockY, BlockPixels& block)
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			int sourceY = std::min(blockY * 4 + y, height - 1);
+			for (int x = 0; x < 4; ++x)
+			{
+				int sourceX = std::min(blockX * 4 + x, width - 1);
+				const unsigned char* texel = rgba + ((size_t)sourceY * width + sourceX) * 4;
+				for (int c = 0; c < 4; ++c)
+					block.channel[c][y * 4 + x] = texel[c];
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	UFitLine(const BlockPixels&, int, float*, float*)
+	//
+	//	Fits the line through the first channels channels of the block:
+	//	mean plus the principal axis, found by power iteration on the
+	//	covariance. Writes the line's points at the smallest and largest
+	//	projection of any texel. A flat block gives both at the mean.
+	///////////////////////////////////////////////////
+	void UFitLine(const BlockPixels& block, int channels, float start[4], float end[4])
+	{
+		float mean[4] = {};
+		for (int c = 0; c < channels; ++c)
+		{
+			for (int i = 0; i < 16; ++i)
+				mean[c] += block.channel[c][i];
+			mean[c] /= 16.0f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float d[4];
+			for (int c = 0; c < channels; ++c)
+				d[c] = block.channel[c][i] - mean[c];
+			for (int j = 0; j < channels; ++j)
+				for (int k = 0; k < channels; ++k)
+					covariance[j][k] += d[j] * d[k];
+		}
+
+		// Start from the row of the widest spread, which can not be orthogonal to the principal axis
+		int widest = 0;
+		for (int c = 1; c < channels; ++c)
+			if (covariance[c][c] > covariance[widest][widest])
+				widest = c;
+		float axis[4] = {};
+		for (int c = 0; c < channels; ++c)
+			axis[c] = covariance[widest][c];
+
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (int j = 0; j < channels; ++j)
+			{
+				for (int k = 0; k < channels; ++k)
+					next[j] += covariance[j][k] * axis[k];
+				length += next[j] * next[j];
+			}
+			if (length < 1e-12f)
+				break;
+			length = 1.0f / std::sqrt(length);
+			for (int c = 0; c < channels; ++c)
+				axis[c] = next[c] * length;
+		}
+
+		float minT = FLT_MAX, maxT = -FLT_MAX;
+		for (int i = 0; i < 16; ++i)
+		{
+			float t = 0.0f;
+			for (int c = 0; c < channels; ++c)
+				t += (block.channel[c][i] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+		for (int c = 0; c < channels; ++c)
+		{
+			start[c] = mean[c] + axis[c] * minT;
+			end[c] = mean[c] + axis[c] * maxT;
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	UNearestIndices(const BlockPixels&, const Palette&, int, unsigned char*)
+	//
+	//	Index of the nearest palette color, over the first channels
+	//	channels, for every texel. Returns the summed squared error.
+	///////////////////////////////////////////////////
+	float UNearestIndices(const BlockPixels& block, const Palette& palette, int channels, unsigned char indices[16])
+	{
+		alignas(32) int bestIndex[16];
+		alignas(32) float bestError[16];
+
+#if defined(__AVX__)
+		for (int i = 0; i < 16; i += 8)
+		{
+			__m256 best = _mm256_set1_ps(FLT_MAX);
+			__m256 index = _mm256_setzero_ps();
+			for (int k = 0; k < palette.size; ++k)
+			{
+				__m256 error = _mm256_setzero_ps();
+				for (int c = 0; c < channels; ++c)
+				{
+					__m256 d = _mm256_sub_ps(_mm256_load_ps(block.channel[c] + i), _mm256_set1_ps(palette.channel[c][k]));
+					error = _mm256_add_ps(error, _mm256_mul_ps(d, d));
+				}
+				__m256 closer = _mm256_cmp_ps(error, best, _CMP_LT_OQ);
+				best = _mm256_min_ps(error, best);
+				index = _mm256_or_ps(_mm256_and_ps(closer, _mm256_set1_ps((float)k)), _mm256_andnot_ps(closer, index));
+			}
+			_mm256_store_ps(bestError + i, best);
+			_mm256_store_si256((__m256i*)(bestIndex + i), _mm256_cvtps_epi32(index));
+		}
+#else
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i index = _mm_setzero_si128();
+			for (int k = 0; k < palette.size; ++k)
+			{
+				__m128 error = _mm_setzero_ps();
+				for (int c = 0; c < channels; ++c)
+				{
+					__m128 d = _mm_sub_ps(_mm_load_ps(block.channel[c] + i), _mm_set1_ps(palette.channel[c][k]));
+					error = _mm_add_ps(error, _mm_mul_ps(d, d));
+				}
+				__m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, best));
+				best = _mm_min_ps(error, best);
+				index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, index));
+			}
+			_mm_store_ps(bestError + i, best);
+			_mm_store_si128((__m128i*)(bestIndex + i), index);
+		}
+#endif
+
+		float total = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			indices[i] = (unsigned char)bestIndex[i];
+			total += bestError[i];
+		}
+		return total;
+	}
+
+	///////////////////////////////////////////////////
+	//	URefineEndpoints(const BlockPixels&, int, const unsigned char*, const float*, float*, float*)
+	//
+	//	Least-squares endpoints for fixed indices: texel i is modelled as
+	//	start * weights[indices[i]] + end * (1 - weights[indices[i]]).
+	//	Returns false when all texels use one weight and the system is singular.
+	///////////////////////////////////////////////////
+	bool URefineEndpoints(const BlockPixels& block, int channels, const unsigned char indices[16], const float* weights, float start[4], float end[4])
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; ++i)
+		{
+			float a = weights[indices[i]];
+			float b = 1.0f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channels; ++c)
+			{
+				ax[c] += a * block.channel[c][i];
+				bx[c] += b * block.channel[c][i];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			return false;
+		determinant = 1.0f / determinant;
+		for (int c = 0; c < channels; ++c)
+		{
+			start[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) * determinant, 0.0f), 255.0f);
+			end[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) * determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// 8-bit color to 5:6:5, rounding to the nearest representable value
+	uint16_t UPack565(const float color[3])
+	{
+		int r = (int)(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		int g = (int)(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+		int b = (int)(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	// 5:6:5 back to 8 bits, as the hardware expands it
+	void UUnpack565(uint16_t packed, int color[3])
+	{
+		int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// BC1 weights of the first endpoint for indices 0..3 in four color mode
+	const float BC1_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+
+	float UFitBC1(const BlockPixels& block, uint16_t color0, uint16_t color1, unsigned char indices[16])
+	{
+		int c0[3], c1[3];
+		UUnpack565(color0, c0);
+		UUnpack565(color1, c1);
+
+		Palette palette;
+		palette.size = 4;
+		for (int c = 0; c < 3; ++c)
+		{
+			palette.channel[c][0] = (float)c0[c];
+			palette.channel[c][1] = (float)c1[c];
+			palette.channel[c][2] = (float)((2 * c0[c] + c1[c]) / 3);
+			palette.channel[c][3] = (float)((c0[c] + 2 * c1[c]) / 3);
+		}
+		return UNearestIndices(block, palette, 3, indices);
+	}
+
+	///////////////////////////////////////////////////
+	//	UEncodeBC1(const BlockPixels&, unsigned char*)
+	//
+	//	Always four color mode: color0 > color1, swapping the endpoints and
+	//	remapping the indices when the fit came out the other way round.
+	///////////////////////////////////////////////////
+	void UEncodeBC1(const BlockPixels& block, unsigned char* out)
+	{
+		float start[4], end[4];
+		UFitLine(block, 3, start, end);
+		uint16_t color0 = UPack565(end);
+		uint16_t color1 = UPack565(start);
+
+		unsigned char indices[16];
+		float error = UFitBC1(block, color0, color1, indices);
+		if (URefineEndpoints(block, 3, indices, BC1_WEIGHTS, end, start))
+		{
+			uint16_t refined0 = UPack565(end);
+			uint16_t refined1 = UPack565(start);
+			unsigned char refinedIndices[16];
+			if (UFitBC1(block, refined0, refined1, refinedIndices) < error)
+			{
+				color0 = refined0;
+				color1 = refined1;
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		uint32_t bits = 0;
+		if (color0 != color1)
+		{
+			for (int i = 0; i < 16; ++i)
+				bits |= (uint32_t)indices[i] << (2 * i);
+			if (color0 < color1)
+			{
+				std::swap(color0, color1);
+				bits ^= 0x55555555u;		// 0 <-> 1 and 2 <-> 3
+			}
+		}
+
+		out[0] = (unsigned char)color0;
+		out[1] = (unsigned char)(color0 >> 8);
+		out[2] = (unsigned char)color1;
+		out[3] = (unsigned char)(color1 >> 8);
+		for (int i = 0; i < 4; ++i)
+			out[4 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	///////////////////////////////////////////////////
+	//	UEncodeAlpha(const BlockPixels&, unsigned char*)
+	//
+	//	BC3 alpha block in eight value mode (alpha0 > alpha1). The palette is
+	//	evenly spaced, so the nearest entry is the rounded position between
+	//	the endpoints.
+	///////////////////////////////////////////////////
+	void UEncodeAlpha(const BlockPixels& block, unsigned char* out)
+	{
+		float low = 255.0f, high = 0.0f;
+		for (int i = 0; i < 16; ++i)
+		{
+			low = std::min(low, block.channel[3][i]);
+			high = std::max(high, block.channel[3][i]);
+		}
+		int alpha0 = (int)(high + 0.5f);
+		int alpha1 = (int)(low + 0.5f);
+		out[0] = (unsigned char)alpha0;
+		out[1] = (unsigned char)alpha1;
+
+		// Position 0 is alpha0 (index 0), 7 is alpha1 (index 1), 1..6 are indices 2..7
+		static const int INDEX_AT[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+		uint64_t bits = 0;
+		if (alpha0 != alpha1)
+		{
+			float scale = 7.0f / (alpha0 - alpha1);
+			for (int i = 0; i < 16; ++i)
+			{
+				int position = (int)((alpha0 - block.channel[3][i]) * scale + 0.5f);
+				bits |= (uint64_t)INDEX_AT[std::min(std::max(position, 0), 7)] << (3 * i);
+			}
+		}
+		for (int i = 0; i < 6; ++i)
+			out[2 + i] = (unsigned char)(bits >> (8 * i));
+	}
+
+	// Appends fields to a 128-bit block, least significant bit first
+	struct BitWriter
+	{
+		unsigned char* out;
+		int position;
+
+		void Write(unsigned int value, int bits)
+		{
+			for (int i = 0; i < bits; ++i, ++position)
+				if ((value >> i) & 1)
+					out[position >> 3] |= (unsigned char)(1 << (position & 7));
+		}
+	};
+
+	///////////////////////////////////////////////////
+	//	UQuantizeBC7(const float*, int*, int&)
+	//
+	//	Mode 6 endpoint: seven bits per channel plus one p-bit shared by
+	//	the endpoint's channels, giving even or odd 8-bit values. Both
+	//	p-bits are tried and the closer result is kept.
+	///////////////////////////////////////////////////
+	void UQuantizeBC7(const float color[4], int quantized[4], int& pBit)
+	{
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; ++p)
+		{
+			int candidate[4];
+			float error = 0.0f;
+			for (int c = 0; c < 4; ++c)
+			{
+				candidate[c] = std::min(std::max((int)((color[c] - p) * 0.5f + 0.5f), 0), 127);
+				float d = (float)(candidate[c] * 2 + p) - color[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				memcpy(quantized, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	float UFitBC7(const BlockPixels& block, const int endpoint0[4], int p0, const int endpoint1[4], int p1, unsigned char indices[16])
+	{
+		Palette palette;
+		palette.size = 16;
+		for (int c = 0; c < 4; ++c)
+		{
+			int e0 = endpoint0[c] * 2 + p0;
+			int e1 = endpoint1[c] * 2 + p1;
+			for (int k = 0; k < 16; ++k)
+				palette.channel[c][k] = (float)((e0 * (64 - BC7_WEIGHTS[k]) + e1 * BC7_WEIGHTS[k] + 32) >> 6);
+		}
+		return UNearestIndices(block, palette, 4, indices);
+	}
+
+	///////////////////////////////////////////////////
+	//	UEncodeBC7(const BlockPixels&, unsigned char*)
+	//
+	//	Mode 6: one subset, RGBA endpoints and sixteen interpolation steps,
+	//	which suits the smooth photographic textures of the scene. The first
+	//	texel's index must have its top bit clear (it is stored with three
+	//	bits), so endpoints and indices are flipped when it does not.
+	///////////////////////////////////////////////////
+	void UEncodeBC7(const BlockPixels& block, unsigned char* out)
+	{
+		float start[4], end[4];
+		UFitLine(block, 4, start, end);
+
+		int endpoint0[4], endpoint1[4], p0 = 0, p1 = 0;
+		UQuantizeBC7(start, endpoint0, p0);
+		UQuantizeBC7(end, endpoint1, p1);
+		unsigned char indices[16];
+		float error = UFitBC7(block, endpoint0, p0, endpoint1, p1, indices);
+
+		float weights[16];
+		for (int k = 0; k < 16; ++k)
+			weights[k] = 1.0f - BC7_WEIGHTS[k] / 64.0f;
+		if (URefineEndpoints(block, 4, indices, weights, start, end))
+		{
+			int refined0[4], refined1[4], refinedP0 = 0, refinedP1 = 0;
+			UQuantizeBC7(start, refined0, refinedP0);
+			UQuantizeBC7(end, refined1, refinedP1);
+			unsigned char refinedIndices[16];
+			if (UFitBC7(block, refined0, refinedP0, refined1, refinedP1, refinedIndices) < error)
+			{
+				memcpy(endpoint0, refined0, sizeof(endpoint0));
+				memcpy(endpoint1, refined1, sizeof(endpoint1));
+				p0 = refinedP0;
+				p1 = refinedP1;
+				memcpy(indices, refinedIndices, sizeof(indices));
+			}
+		}
+
+		if (indices[0] & 8)
+		{
+			std::swap(endpoint0, endpoint1);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; ++i)
+				indices[i] = (unsigned char)(15 - indices[i]);
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer = { out, 0 };
+		writer.Write(1 << 6, 7);			// Mode 6: six zero bits, then a one
+		for (int c = 0; c < 4; ++c)
+		{
+			writer.Write(endpoint0[c], 7);
+			writer.Write(endpoint1[c], 7);
+		}
+		writer.Write(p0, 1);
+		writer.Write(p1, 1);
+		writer.Write(indices[0], 3);
+		for (int i = 1; i < 16; ++i)
+			writer.Write(indices[i], 4);
+	}
+}
+
+GLenum BlockInternalFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BLOCK_BC1:
+		return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	default:
+		return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+}
+
+const char* BlockFormatName(BlockFormat format)
+{
+	static const char* const NAMES[BLOCK_FORMAT_COUNT] = { "bc1", "bc3", "bc7" };
+	return NAMES[format];
+}
+
+size_t BlockSize(BlockFormat format)
+{
+	return format == BLOCK_BC1 ? 8 : 16;
+}
+
+size_t EncodedSize(BlockFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+}
+
+///////////////////////////////////////////////////
+//	BlockFormatSupported(BlockFormat)
+//
+//	BC7 is core since GL 4.2. BC1 and BC3 need the S3TC extension, which
+//	desktop drivers (and Mesa's llvmpipe) expose but the core spec lacks.
+///////////////////////////////////////////////////
+bool BlockFormatSupported(BlockFormat format)
+{
+	if (format == BLOCK_BC7)
+		return true;
+
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (name != nullptr && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+			return true;
+	}
+	return false;
+}
+
+void EncodeImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* blocks)
+{
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	size_t blockSize = BlockSize(format);
+
+	BlockPixels block;
+	for (int y = 0; y < blocksY; ++y)
+	{
+		for (int x = 0; x < blocksX; ++x)
+		{
+			ULoadBlock(rgba, width, height, x, y, block);
+			unsigned char* out = blocks + ((size_t)y * blocksX + x) * blockSize;
+			switch (format)
+			{
+			case BLOCK_BC1:
+				UEncodeBC1(block, out);
+				break;
+			case BLOCK_BC3:
+				UEncodeAlpha(block, out);
+				UEncodeBC1(block, out + 8);
+				break;
+			default:
+				UEncodeBC7(block, out);
+				break;
+			}
+		}
+	}
+}
@@ -0,0 +1,536 @@
+///////////////////////////////////////////////////////////////////////////////
+//  bufferpool.cpp
+//  ==============
+//  Two-Level Segregated Fit allocator over immutable GL buffers.
+//
+//  Free blocks are binned by size class: the first level is the power of
+//  two, the second level splits it into 16 linear steps. A bitmap per level
+//  finds a non-empty bin in constant time. Free neighbours are merged on
+//  release, so two free blocks are never adjacent.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "bufferpool.h"
+
+#include <algorithm>
+
+namespace
+{
+	// Default size of a backing buffer
+	const GLsizeiptr DEFAULT_PAGE_SIZE = 4 << 20;
+
+	inline int Log2(unsigned long long value)
+	{
+		int result = 0;
+		while (value >>= 1)
+			++result;
+		return result;
+	}
+
+	inline int LowestBit(unsigned int value)
+	{
+		int result = 0;
+		while ((value & 1u) == 0)
+		{
+			value >>= 1;
+			++result;
+		}
+		return result;
+	}
+
+	inline GLsizeiptr AlignUp(GLsizeiptr value, GLsizeiptr alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	inline GLsizeiptr Gcd(GLsizeiptr a, GLsizeiptr b)
+	{
+		while (b != 0)
+		{
+			GLsizeiptr t = a % b;
+			a = b;
+			b = t;
+		}
+		return a;
+	}
+
+	// Size class of a block
+	inline void Mapping(GLsizeiptr size, GLsizeiptr smallBlock, int slLog2, int flShift, int& fl, int& sl)
+	{
+		if (size < smallBlock)
+		{
+			fl = 0;
+			sl = (int)(size / (smallBlock >> slLog2));
+		}
+		else
+		{
+			int f = Log2((unsigned long long)size);
+			sl = (int)(size >> (f - slLog2)) ^ (1 << slLog2);
+			fl = f - (flShift - 1);
+		}
+	}
+}
+
+BufferPool::BufferPool()
+	: mPageSize(DEFAULT_PAGE_SIZE), mScratch(0), mScratchSize(0), mBytesMoved(0)
+{
+}
+
+void BufferPool::Initialize(GLsizeiptr pageSize)
+{
+	mPageSize = AlignUp(pageSize, MIN_ALIGNMENT);
+	CreatePage(mPageSize);
+}
+
+void BufferPool::Destroy()
+{
+	for (Page& page : mPages)
+		glDeleteBuffers(1, &page.buffer);
+	if (mScratch != 0)
+		glDeleteBuffers(1, &mScratch);
+
+	mPages.clear();
+	mAllocations.clear();
+	mUnusedHandles.clear();
+	mScratch = 0;
+	mScratchSize = 0;
+}
+
+///////////////////////////////////////////////////
+//	Allocate(GLsizeiptr, GLsizeiptr)
+//
+//	size: bytes needed
+//	alignment: required offset multiple, combined with the 16 byte granularity
+//
+//	Tries every existing page first and only creates a new page (sized to
+//	fit when the request is larger than a page) when all of them are full.
+///////////////////////////////////////////////////
+BufferHandle BufferPool::Allocate(GLsizeiptr size, GLsizeiptr alignment)
+{
+	size = AlignUp(std::max(size, GLsizeiptr(MIN_ALIGNMENT)), MIN_ALIGNMENT);
+	alignment = std::max(alignment, GLsizeiptr(1));
+	// least common multiple keeps every block boundary on the 16 byte grid
+	alignment = alignment / Gcd(alignment, MIN_ALIGNMENT) * MIN_ALIGNMENT;
+
+	BufferHandle handle;
+	if (!mUnusedHandles.empty())
+	{
+		handle = mUnusedHandles.back();
+		mUnusedHandles.pop_back();
+	}
+	else
+	{
+		mAllocations.push_back(Allocation());
+		handle = (BufferHandle)mAllocations.size();
+	}
+
+	int pageIndex = -1;
+	int block = -1;
+	for (size_t i = 0; i < mPages.size() && block < 0; ++i)
+	{
+		block = AllocateFromPage(mPages[i], size, alignment, handle);
+		pageIndex = (int)i;
+	}
+	if (block < 0)
+	{
+		// FindFree() rounds up to the next size class, so a dedicated page needs that much room
+		GLsizeiptr needed = size + alignment - MIN_ALIGNMENT;
+		if (needed >= SMALL_BLOCK)
+			needed += GLsizeiptr(1) << (Log2((unsigned long long)needed) - SL_LOG2);
+		pageIndex = CreatePage(std::max(mPageSize, needed));
+		block = AllocateFromPage(mPages[pageIndex], size, alignment, handle);
+	}
+
+	Allocation& allocation = mAllocations[handle - 1];
+	allocation.page = pageIndex;
+	allocation.block = block;
+	allocation.size = size;
+	allocation.alignment = alignment;
+	return handle;
+}
+
+void BufferPool::Free(BufferHandle handle)
+{
+	if (handle == 0 || handle > mAllocations.size())
+		return;
+
+	Allocation& allocation = mAllocations[handle - 1];
+	if (allocation.block < 0)
+		return;
+
+	FreeBlock(mPages[allocation.page], allocation.block);
+	allocation.block = -1;
+	mUnusedHandles.push_back(handle);
+}
+
+GLuint BufferPool::Buffer(BufferHandle handle) const
+{
+	return mPages[mAllocations[handle - 1].page].buffer;
+}
+
+GLintptr BufferPool::Offset(BufferHandle handle) const
+{
+	const Allocation& allocation = mAllocations[handle - 1];
+	return mPages[allocation.page].blocks[allocation.block].offset;
+}
+
+GLsizeiptr BufferPool::Size(BufferHandle handle) const
+{
+	return mAllocations[handle - 1].size;
+}
+
+///////////////////////////////////////////////////
+//	Compact(GLsizeiptr)
+//
+//	Walks each page by address and, for every free block followed by an
+//	allocation, slides the allocation down into the hole. Repeated calls
+//	gather all free space at the end of each page.
+///////////////////////////////////////////////////
+GLsizeiptr BufferPool::Compact(GLsizeiptr maxBytes)
+{
+	GLsizeiptr moved = 0;
+	for (size_t p = 0; p < mPages.size(); ++p)
+	{
+		int block = mPages[p].firstBlock;
+		while (block >= 0 && (moved == 0 || moved < maxBytes))
+		{
+			const Block& current = mPages[p].blocks[block];
+			int next = current.nextPhys;
+			if (current.free && next >= 0 && MoveDown((int)p, block, moved))
+			{
+				// the allocation now sits where the hole started; continue behind it
+				block = mPages[p].blocks[next].nextPhys;
+			}
+			else
+				block = next;
+		}
+		if (moved >= maxBytes)
+			break;
+	}
+
+	mBytesMoved += moved;
+	return moved;
+}
+
+BufferPoolStats BufferPool::GetStats() const
+{
+	BufferPoolStats stats = {};
+	stats.pages = mPages.size();
+	stats.bytesMoved = mBytesMoved;
+	for (const Page& page : mPages)
+	{
+		stats.capacity += page.capacity;
+		for (int b = page.firstBlock; b >= 0; b = page.blocks[b].nextPhys)
+		{
+			const Block& block = page.blocks[b];
+			if (block.free)
+			{
+				stats.freeBytes += block.size;
+				stats.largestFreeBlock = std::max(stats.largestFreeBlock, (size_t)block.size);
+				++stats.freeBlocks;
+			}
+			else
+			{
+				stats.usedBytes += block.size;
+				++stats.allocations;
+			}
+		}
+	}
+	return stats;
+}
+
+// Create an immutable buffer and a single free block spanning it
+int BufferPool::CreatePage(GLsizeiptr capacity)
+{
+	mPages.push_back(Page());
+	Page& page = mPages.back();
+	page.capacity = capacity;
+	page.firstBlock = -1;
+	page.flBitmap = 0;
+	for (int fl = 0; fl < FL_COUNT; ++fl)
+	{
+		page.slBitmap[fl] = 0;
+		for (int sl = 0; sl < SL_COUNT; ++sl)
+			page.freeHeads[fl][sl] = -1;
+	}
+
+	glGenBuffers(1, &page.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_DYNAMIC_STORAGE_BIT);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	int block = NewBlock(page);
+	page.blocks[block].offset = 0;
+	page.blocks[block].size = capacity;
+	page.firstBlock = block;
+	InsertFree(page, block);
+
+	return (int)mPages.size() - 1;
+}
+
+int BufferPool::NewBlock(Page& page)
+{
+	int index;
+	if (!page.unusedBlocks.empty())
+	{
+		index = page.unusedBlocks.back();
+		page.unusedBlocks.pop_back();
+	}
+	else
+	{
+		page.blocks.push_back(Block());
+		index = (int)page.blocks.size() - 1;
+	}
+
+	Block& block = page.blocks[index];
+	block.offset = 0;
+	block.size = 0;
+	block.prevPhys = block.nextPhys = -1;
+	block.prevFree = block.nextFree = -1;
+	block.free = false;
+	block.owner = 0;
+	return index;
+}
+
+void BufferPool::InsertFree(Page& page, int index)
+{
+	Block& block = page.blocks[index];
+	int fl, sl;
+	Mapping(block.size, SMALL_BLOCK, SL_LOG2, FL_SHIFT, fl, sl);
+
+	block.free = true;
+	block.owner = 0;
+	block.prevFree = -1;
+	block.nextFree = page.freeHeads[fl][sl];
+	if (block.nextFree >= 0)
+		page.blocks[block.nextFree].prevFree = index;
+	page.freeHeads[fl][sl] = index;
+	page.flBitmap |= 1u << fl;
+	page.slBitmap[fl] |= 1u << sl;
+}
+
+void BufferPool::RemoveFree(Page& page, int index)
+{
+	Block& block = page.blocks[index];
+	int fl, sl;
+	Mapping(block.size, SMALL_BLOCK, SL_LOG2, FL_SHIFT, fl, sl);
+
+	if (block.prevFree >= 0)
+		page.blocks[block.prevFree].nextFree = block.nextFree;
+	else
+		page.freeHeads[fl][sl] = block.nextFree;
+	if (block.nextFree >= 0)
+		page.blocks[block.nextFree].prevFree = block.prevFree;
+
+	if (page.freeHeads[fl][sl] < 0)
+	{
+		page.slBitmap[fl] &= ~(1u << sl);
+		if (page.slBitmap[fl] == 0)
+			page.flBitmap &= ~(1u << fl);
+	}
+
+	block.free = false;
+	block.prevFree = block.nextFree = -1;
+}
+
+// Find a free block of at least size bytes, or -1
+int BufferPool::FindFree(Page& page, GLsizeiptr size)
+{
+	// round up to the next size class so any block in the found bin fits
+	if (size >= SMALL_BLOCK)
+		size += (GLsizeiptr(1) << (Log2((unsigned long long)size) - SL_LOG2)) - 1;
+
+	int fl, sl;
+	Mapping(size, SMALL_BLOCK, SL_LOG2, FL_SHIFT, fl, sl);
+	if (fl >= FL_COUNT)
+		return -1;
+
+	unsigned int slMap = page.slBitmap[fl] & (~0u << sl);
+	if (slMap == 0)
+	{
+		unsigned int flMap = (fl + 1 < FL_COUNT) ? page.flBitmap & (~0u << (fl + 1)) : 0;
+		if (flMap == 0)
+			return -1;
+		fl = LowestBit(flMap);
+		slMap = page.slBitmap[fl];
+	}
+	sl = LowestBit(slMap);
+	return page.freeHeads[fl][sl];
+}
+
+// Carve size bytes at the requested alignment out of the page, or -1
+int BufferPool::AllocateFromPage(Page& page, GLsizeiptr size, GLsizeiptr alignment, BufferHandle owner)
+{
+	// worst case padding in front of an aligned offset
+	GLsizeiptr padded = size + alignment - MIN_ALIGNMENT;
+	int index = FindFree(page, padded);
+	if (index < 0)
+		return -1;
+
+	RemoveFree(page, index);
+
+	// split off the alignment gap as its own free block
+	GLsizeiptr gap = AlignUp(page.blocks[index].offset, alignment) - page.blocks[index].offset;
+	if (gap > 0)
+	{
+		int before = NewBlock(page);
+		Block& block = page.blocks[index];
+		Block& gapBlock = page.blocks[before];
+		gapBlock.offset = block.offset;
+		gapBlock.size = gap;
+		gapBlock.prevPhys = block.prevPhys;
+		gapBlock.nextPhys = index;
+		if (block.prevPhys >= 0)
+			page.blocks[block.prevPhys].nextPhys = before;
+		else
+			page.firstBlock = before;
+		block.prevPhys = before;
+		block.offset += gap;
+		block.size -= gap;
+		InsertFree(page, before);
+	}
+
+	// return the unused tail to the free lists
+	if (page.blocks[index].size - size >= MIN_ALIGNMENT)
+	{
+		int after = NewBlock(page);
+		Block& block = page.blocks[index];
+		Block& tail = page.blocks[after];
+		tail.offset = block.offset + size;
+		tail.size = block.size - size;
+		tail.prevPhys = index;
+		tail.nextPhys = block.nextPhys;
+		if (block.nextPhys >= 0)
+			page.blocks[block.nextPhys].prevPhys = after;
+		block.nextPhys = after;
+		block.size = size;
+		InsertFree(page, after);
+	}
+
+	page.blocks[index].owner = owner;
+	return index;
+}
+
+// Release a block and merge it with free neighbours
+void BufferPool::FreeBlock(Page& page, int index)
+{
+	int prev = page.blocks[index].prevPhys;
+	if (prev >= 0 && page.blocks[prev].free)
+	{
+		RemoveFree(page, prev);
+		Block& block = page.blocks[index];
+		Block& merged = page.blocks[prev];
+		merged.size += block.size;
+		merged.nextPhys = block.nextPhys;
+		if (block.nextPhys >= 0)
+			page.blocks[block.nextPhys].prevPhys = prev;
+		page.unusedBlocks.push_back(index);
+		index = prev;
+	}
+
+	int next = page.blocks[index].nextPhys;
+	if (next >= 0 && page.blocks[next].free)
+	{
+		RemoveFree(page, next);
+		Block& block = page.blocks[index];
+		Block& merged = page.blocks[next];
+		block.size += merged.size;
+		block.nextPhys = merged.nextPhys;
+		if (merged.nextPhys >= 0)
+			page.blocks[merged.nextPhys].prevPhys = index;
+		page.unusedBlocks.push_back(next);
+	}
+
+	InsertFree(page, index);
+}
+
+///////////////////////////////////////////////////
+//	MoveDown(int, int, GLsizeiptr&)
+//
+//	The free block F is followed by allocation U. U is copied to the first
+//	suitably aligned offset inside F and the space it leaves behind becomes
+//	a free block merged with whatever follows. Returns false when alignment
+//	leaves no room to move.
+///////////////////////////////////////////////////
+bool BufferPool::MoveDown(int pageIndex, int freeIndex, GLsizeiptr& moved)
+{
+	Page& page = mPages[pageIndex];
+	int usedIndex = page.blocks[freeIndex].nextPhys;
+	if (page.blocks[usedIndex].free)
+		return false;
+
+	Allocation& allocation = mAllocations[page.blocks[usedIndex].owner - 1];
+	GLintptr freeOffset = page.blocks[freeIndex].offset;
+	GLsizeiptr freeSize = page.blocks[freeIndex].size;
+	GLintptr oldOffset = page.blocks[usedIndex].offset;
+	GLsizeiptr usedSize = page.blocks[usedIndex].size;
+
+	GLsizeiptr gap = AlignUp(freeOffset, allocation.alignment) - freeOffset;
+	if (gap >= freeSize)
+		return false;
+	GLintptr newOffset = freeOffset + gap;
+
+	// copy the contents; overlapping ranges of one buffer go through the scratch buffer
+	if (newOffset + usedSize <= oldOffset)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, page.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, oldOffset, newOffset, usedSize);
+	}
+	else
+	{
+		if (mScratchSize < usedSize)
+		{
+			if (mScratch != 0)
+				glDeleteBuffers(1, &mScratch);
+			mScratchSize = std::max(usedSize, mPageSize);
+			glGenBuffers(1, &mScratch);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, mScratch);
+			glBufferStorage(GL_COPY_WRITE_BUFFER, mScratchSize, nullptr, 0);
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, page.buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mScratch);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, oldOffset, 0, usedSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, mScratch);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, page.buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, newOffset, usedSize);
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	moved += usedSize;
+
+	// the hole shrinks to the alignment gap, or disappears
+	RemoveFree(page, freeIndex);
+	if (gap > 0)
+	{
+		page.blocks[freeIndex].size = gap;
+		InsertFree(page, freeIndex);
+	}
+	else
+	{
+		int prev = page.blocks[freeIndex].prevPhys;
+		if (prev >= 0)
+			page.blocks[prev].nextPhys = usedIndex;
+		else
+			page.firstBlock = usedIndex;
+		page.blocks[usedIndex].prevPhys = prev;
+		page.unusedBlocks.push_back(freeIndex);
+	}
+	page.blocks[usedIndex].offset = newOffset;
+
+	// the space left behind becomes free and merges with the next block if possible
+	int rest = NewBlock(page);
+	Block& used = page.blocks[usedIndex];
+	Block& tail = page.blocks[rest];
+	tail.offset = newOffset + usedSize;
+	tail.size = freeSize - gap;
+	tail.prevPhys = usedIndex;
+	tail.nextPhys = used.nextPhys;
+	if (used.nextPhys >= 0)
+		page.blocks[used.nextPhys].prevPhys = rest;
+	used.nextPhys = rest;
+	FreeBlock(page, rest);
+
+	return true;
+}
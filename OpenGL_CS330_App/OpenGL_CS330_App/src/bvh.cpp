@@ -0,0 +1,403 @@
+///////////////////////////////////////////////////////////////////////////////
+//  bvh.cpp
+//  =======
+//  Binned SAH build, bottom-up refit and stack based queries.
+//
+//  Nodes are allocated as sibling pairs in depth-first order, so a parent
+//  always precedes its children. Refit can therefore walk the array
+//  backwards and see every child before its parent, and traversal touches
+//  both children of a node on the same cache line.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	// Centroid bins tried per axis during the build
+	const int SAH_BINS = 8;
+	// Nodes with more objects than this are always split
+	const int MAX_LEAF_SIZE = 4;
+	// Relative cost of visiting a node versus testing an object
+	const float TRAVERSAL_COST = 1.0f;
+	// Deepest traversal stack a query may need
+	const int STACK_SIZE = 64;
+
+	inline float SurfaceArea(const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+}
+
+///////////////////////////////////////////////////
+//	Build(const std::vector<AABB>&)
+//
+//	Top-down build choosing the split plane with the lowest surface area
+//	heuristic cost among SAH_BINS centroid bins on each axis.
+///////////////////////////////////////////////////
+void BVH::Build(const std::vector<AABB>& boxes)
+{
+	mBoxes = boxes;
+	mNodes.clear();
+	mObjects.resize(boxes.size());
+	mCentroids.resize(boxes.size());
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		mObjects[i] = (int)i;
+		mCentroids[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+	}
+
+	mCost = mBuildCost = 0.0f;
+	if (boxes.empty())
+		return;
+
+	// a binary tree over n leaves never needs more than 2n - 1 nodes, so references stay valid
+	mNodes.reserve(boxes.size() * 2);
+	Node root = {};
+	root.leftFirst = 0;
+	root.count = (int)boxes.size();
+	mNodes.push_back(root);
+	UpdateBounds(0);
+	Subdivide(0, 0);
+
+	mCost = mBuildCost = ComputeCost();
+}
+
+void BVH::Refit(const std::vector<AABB>& boxes)
+{
+	mBoxes = boxes;
+	for (int i = (int)mNodes.size() - 1; i >= 0; --i)
+	{
+		Node& node = mNodes[i];
+		if (node.count > 0)
+			UpdateBounds(i);
+		else
+		{
+			const Node& left = mNodes[node.leftFirst];
+			const Node& right = mNodes[node.leftFirst + 1];
+			node.min = glm::min(left.min, right.min);
+			node.max = glm::max(left.max, right.max);
+		}
+	}
+	mCost = ComputeCost();
+}
+
+bool BVH::Update(const std::vector<AABB>& boxes)
+{
+	if (mNodes.empty() || boxes.size() != mBoxes.size())
+	{
+		Build(boxes);
+		return true;
+	}
+
+	Refit(boxes);
+	if (!NeedsRebuild())
+		return false;
+
+	Build(boxes);
+	return true;
+}
+
+void BVH::QueryFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], std::vector<int>& objects) const
+{
+	if (mNodes.empty())
+		return;
+
+	// second entry: the node is known to be completely inside, skip the plane tests
+	int stack[STACK_SIZE];
+	bool inside[STACK_SIZE];
+	int top = 0;
+	stack[top] = 0;
+	inside[top++] = false;
+
+	while (top > 0)
+	{
+		--top;
+		const Node& node = mNodes[stack[top]];
+		bool nodeInside = inside[top];
+		if (!nodeInside)
+		{
+			int result = ClassifyAABB(planes, node.min, node.max);
+			if (result == 0)
+				continue;
+			nodeInside = (result == 2);
+		}
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				if (nodeInside || AABBInFrustum(planes, mBoxes[mObjects[i]]))
+					objects.push_back(mObjects[i]);
+			}
+		}
+		else if (top + 2 <= STACK_SIZE)
+		{
+			stack[top] = node.leftFirst + 1;
+			inside[top++] = nodeInside;
+			stack[top] = node.leftFirst;
+			inside[top++] = nodeInside;
+		}
+	}
+}
+
+void BVH::QuerySphere(const glm::vec3& center, float radius, std::vector<int>& objects) const
+{
+	if (mNodes.empty())
+		return;
+
+	const float radiusSq = radius * radius;
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = mNodes[stack[--top]];
+		glm::vec3 closest = glm::clamp(center, node.min, node.max);
+		glm::vec3 offset = closest - center;
+		if (glm::dot(offset, offset) > radiusSq)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				const AABB& box = mBoxes[mObjects[i]];
+				offset = glm::clamp(center, box.min, box.max) - center;
+				if (glm::dot(offset, offset) <= radiusSq)
+					objects.push_back(mObjects[i]);
+			}
+		}
+		else if (top + 2 <= STACK_SIZE)
+		{
+			stack[top++] = node.leftFirst + 1;
+			stack[top++] = node.leftFirst;
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	Raycast(const glm::vec3&, const glm::vec3&, float&, const RayTest&)
+//
+//	Visits the nearer child first and skips any node whose entry distance
+//	is beyond the closest hit so far.
+///////////////////////////////////////////////////
+int BVH::Raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const RayTest& test) const
+{
+	if (mNodes.empty())
+		return -1;
+
+	glm::vec3 invDirection = 1.0f / direction;
+	int hit = -1;
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const Node& node = mNodes[stack[--top]];
+		if (RayAABB(origin, invDirection, node.min, node.max, t) == FLT_MAX)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+			{
+				int object = mObjects[i];
+				const AABB& box = mBoxes[object];
+				float boxT = RayAABB(origin, invDirection, box.min, box.max, t);
+				if (boxT == FLT_MAX)
+					continue;
+
+				// without a precise test the box itself is the hit
+				float objectT = boxT;
+				if (test)
+				{
+					objectT = t;
+					if (!test(object, objectT))
+						continue;
+				}
+
+				if (objectT < t)
+				{
+					t = objectT;
+					hit = object;
+				}
+			}
+			continue;
+		}
+
+		if (top + 2 > STACK_SIZE)
+			continue;
+
+		int left = node.leftFirst;
+		int right = node.leftFirst + 1;
+		float leftT = RayAABB(origin, invDirection, mNodes[left].min, mNodes[left].max, t);
+		float rightT = RayAABB(origin, invDirection, mNodes[right].min, mNodes[right].max, t);
+		if (leftT > rightT)
+		{
+			std::swap(left, right);
+			std::swap(leftT, rightT);
+		}
+		// push the far child first so the near one is popped next
+		if (rightT != FLT_MAX)
+			stack[top++] = right;
+		if (leftT != FLT_MAX)
+			stack[top++] = left;
+	}
+
+	return hit;
+}
+
+void BVH::Subdivide(int nodeIndex, int depth)
+{
+	Node& node = mNodes[nodeIndex];
+	if (node.count <= 1 || depth >= STACK_SIZE - 2)
+		return;
+
+	// bounds of the centroids decide where the bins go
+	glm::vec3 cMin(FLT_MAX), cMax(-FLT_MAX);
+	for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+	{
+		cMin = glm::min(cMin, mCentroids[mObjects[i]]);
+		cMax = glm::max(cMax, mCentroids[mObjects[i]]);
+	}
+
+	float bestCost = FLT_MAX;
+	int bestAxis = -1;
+	int bestSplit = 0;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = cMax[axis] - cMin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		struct Bin { glm::vec3 min, max; int count; } bins[SAH_BINS];
+		for (Bin& bin : bins)
+		{
+			bin.min = glm::vec3(FLT_MAX);
+			bin.max = glm::vec3(-FLT_MAX);
+			bin.count = 0;
+		}
+
+		float scale = SAH_BINS / extent;
+		for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+		{
+			int object = mObjects[i];
+			int b = std::min(SAH_BINS - 1, (int)((mCentroids[object][axis] - cMin[axis]) * scale));
+			bins[b].min = glm::min(bins[b].min, mBoxes[object].min);
+			bins[b].max = glm::max(bins[b].max, mBoxes[object].max);
+			++bins[b].count;
+		}
+
+		// sweep from both sides to get the area and count left and right of each split
+		float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+		int leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+		glm::vec3 lMin(FLT_MAX), lMax(-FLT_MAX), rMin(FLT_MAX), rMax(-FLT_MAX);
+		int lCount = 0, rCount = 0;
+		for (int i = 0; i < SAH_BINS - 1; ++i)
+		{
+			lCount += bins[i].count;
+			lMin = glm::min(lMin, bins[i].min);
+			lMax = glm::max(lMax, bins[i].max);
+			leftCount[i] = lCount;
+			leftArea[i] = SurfaceArea(lMin, lMax);
+
+			rCount += bins[SAH_BINS - 1 - i].count;
+			rMin = glm::min(rMin, bins[SAH_BINS - 1 - i].min);
+			rMax = glm::max(rMax, bins[SAH_BINS - 1 - i].max);
+			rightCount[SAH_BINS - 2 - i] = rCount;
+			rightArea[SAH_BINS - 2 - i] = SurfaceArea(rMin, rMax);
+		}
+
+		for (int i = 0; i < SAH_BINS - 1; ++i)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0)
+				continue;
+			float cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = i;
+			}
+		}
+	}
+
+	// compare against keeping everything in one leaf
+	float parentArea = SurfaceArea(node.min, node.max);
+	float splitCost = TRAVERSAL_COST + (parentArea > 0.0f ? bestCost / parentArea : 0.0f);
+	if (node.count <= MAX_LEAF_SIZE && (bestAxis < 0 || splitCost >= (float)node.count))
+		return;
+
+	int first = node.leftFirst;
+	int mid;
+	if (bestAxis >= 0)
+	{
+		float scale = SAH_BINS / (cMax[bestAxis] - cMin[bestAxis]);
+		int* split = std::partition(&mObjects[first], &mObjects[first] + node.count, [&](int object)
+		{
+			int b = std::min(SAH_BINS - 1, (int)((mCentroids[object][bestAxis] - cMin[bestAxis]) * scale));
+			return b <= bestSplit;
+		});
+		mid = (int)(split - &mObjects[0]);
+	}
+	else
+	{
+		// every centroid coincides, split the list in half
+		mid = first + node.count / 2;
+	}
+
+	int leftIndex = (int)mNodes.size();
+	Node left = {};
+	left.leftFirst = first;
+	left.count = mid - first;
+	Node right = {};
+	right.leftFirst = mid;
+	right.count = node.count - left.count;
+	mNodes.push_back(left);
+	mNodes.push_back(right);
+
+	node.leftFirst = leftIndex;
+	node.count = 0;
+
+	UpdateBounds(leftIndex);
+	UpdateBounds(leftIndex + 1);
+	Subdivide(leftIndex, depth + 1);
+	Subdivide(leftIndex + 1, depth + 1);
+}
+
+void BVH::UpdateBounds(int nodeIndex)
+{
+	Node& node = mNodes[nodeIndex];
+	node.min = glm::vec3(FLT_MAX);
+	node.max = glm::vec3(-FLT_MAX);
+	for (int i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+	{
+		node.min = glm::min(node.min, mBoxes[mObjects[i]].min);
+		node.max = glm::max(node.max, mBoxes[mObjects[i]].max);
+	}
+}
+
+// Expected cost of a random query relative to the root: inner nodes count
+// as traversal steps, leaves as one test per object
+float BVH::ComputeCost() const
+{
+	float rootArea = SurfaceArea(mNodes[0].min, mNodes[0].max);
+	if (rootArea <= 0.0f)
+		return 0.0f;
+
+	float cost = 0.0f;
+	for (const Node& node : mNodes)
+	{
+		float area = SurfaceArea(node.min, node.max) / rootArea;
+		cost += node.count > 0 ? area * node.count : area * TRAVERSAL_COST;
+	}
+	return cost;
+}
@@ -0,0 +1,167 @@
+///////////////////////////////////////////////////////////////////////////////
+//  culling.cpp
+//  ===========
+//  SIMD box-versus-frustum test.
+//
+//  For a plane (n, w) a box with center c and half extent e is outside when
+//  dot(n, c) + w < -dot(|n|, e). Each plane is broadcast into registers
+//  once and compared against a whole batch of boxes; a box survives only
+//  if no plane rejects it. Boxes left over after the last full batch go
+//  through the scalar version of the same test. With several views each
+//  batch is loaded once and tested against every view's planes in turn.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "culling.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+void AABBList::Clear()
+{
+	centerX.clear(); centerY.clear(); centerZ.clear();
+	extentX.clear(); extentY.clear(); extentZ.clear();
+}
+
+void AABBList::Add(const AABB& box)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+}
+
+size_t CullAABBs(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], const AABBList& boxes, unsigned char* visible)
+{
+	// With one view the mask is the visibility flag itself
+	return CullAABBsMultiView(planes, 1, boxes, visible);
+}
+
+size_t CullAABBsMultiView(const glm::vec4* planes, int viewCount, const AABBList& boxes, unsigned char* viewMasks)
+{
+	const size_t count = boxes.Size();
+	size_t visibleCount = 0;
+	size_t i = 0;
+
+#if defined(__AVX__)
+	const size_t WIDTH = 8;
+	for (; i + WIDTH <= count; i += WIDTH)
+	{
+		__m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+		for (size_t k = 0; k < WIDTH; ++k)
+			viewMasks[i + k] = 0;
+
+		// the batch stays in registers while every view tests it
+		for (int v = 0; v < viewCount; ++v)
+		{
+			const glm::vec4* viewPlanes = planes + v * FRUSTUM_PLANE_COUNT;
+			__m256 outside = _mm256_setzero_ps();
+			for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p)
+			{
+				__m256 nx = _mm256_set1_ps(viewPlanes[p].x);
+				__m256 ny = _mm256_set1_ps(viewPlanes[p].y);
+				__m256 nz = _mm256_set1_ps(viewPlanes[p].z);
+				__m256 ax = _mm256_set1_ps(std::fabs(viewPlanes[p].x));
+				__m256 ay = _mm256_set1_ps(std::fabs(viewPlanes[p].y));
+				__m256 az = _mm256_set1_ps(std::fabs(viewPlanes[p].z));
+
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)),
+					_mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(viewPlanes[p].w)));
+				__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, ex), _mm256_mul_ps(ay, ey)), _mm256_mul_ps(az, ez));
+
+				// distance + radius < 0 means the box lies completely behind the plane
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(outside);
+			for (size_t k = 0; k < WIDTH; ++k)
+				viewMasks[i + k] |= (mask >> k) & 1 ? 0 : (unsigned char)(1 << v);
+		}
+
+		for (size_t k = 0; k < WIDTH; ++k)
+			visibleCount += viewMasks[i + k] != 0;
+	}
+#else
+	const size_t WIDTH = 4;
+	for (; i + WIDTH <= count; i += WIDTH)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+		__m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+		__m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+		__m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+		__m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+		for (size_t k = 0; k < WIDTH; ++k)
+			viewMasks[i + k] = 0;
+
+		// the batch stays in registers while every view tests it
+		for (int v = 0; v < viewCount; ++v)
+		{
+			const glm::vec4* viewPlanes = planes + v * FRUSTUM_PLANE_COUNT;
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p)
+			{
+				__m128 nx = _mm_set1_ps(viewPlanes[p].x);
+				__m128 ny = _mm_set1_ps(viewPlanes[p].y);
+				__m128 nz = _mm_set1_ps(viewPlanes[p].z);
+				__m128 ax = _mm_set1_ps(std::fabs(viewPlanes[p].x));
+				__m128 ay = _mm_set1_ps(std::fabs(viewPlanes[p].y));
+				__m128 az = _mm_set1_ps(std::fabs(viewPlanes[p].z));
+
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+					_mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(viewPlanes[p].w)));
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, ex), _mm_mul_ps(ay, ey)), _mm_mul_ps(az, ez));
+
+				// distance + radius < 0 means the box lies completely behind the plane
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			}
+
+			int mask = _mm_movemask_ps(outside);
+			for (size_t k = 0; k < WIDTH; ++k)
+				viewMasks[i + k] |= (mask >> k) & 1 ? 0 : (unsigned char)(1 << v);
+		}
+
+		for (size_t k = 0; k < WIDTH; ++k)
+			visibleCount += viewMasks[i + k] != 0;
+	}
+#endif
+
+	// remaining boxes one at a time
+	for (; i < count; ++i)
+	{
+		viewMasks[i] = 0;
+		for (int v = 0; v < viewCount; ++v)
+		{
+			const glm::vec4* viewPlanes = planes + v * FRUSTUM_PLANE_COUNT;
+			bool inside = true;
+			for (int p = 0; p < FRUSTUM_PLANE_COUNT && inside; ++p)
+			{
+				float distance = viewPlanes[p].x * boxes.centerX[i] + viewPlanes[p].y * boxes.centerY[i] + viewPlanes[p].z * boxes.centerZ[i] + viewPlanes[p].w;
+				float radius = std::fabs(viewPlanes[p].x) * boxes.extentX[i] + std::fabs(viewPlanes[p].y) * boxes.extentY[i] + std::fabs(viewPlanes[p].z) * boxes.extentZ[i];
+				inside = distance + radius >= 0.0f;
+			}
+			if (inside)
+				viewMasks[i] |= (unsigned char)(1 << v);
+		}
+		visibleCount += viewMasks[i] != 0;
+	}
+
+	return visibleCount;
+}
@@ -0,0 +1,615 @@
+///////////////////////////////////////////////////////////////////////////////
+//  hiz.cpp
+//  =======
+//  Hierarchical-Z occlusion culling.
+//
+//  Build() copies the depth buffer and reduces it into a mip pyramid whose
+//  texels keep the farthest depth of the four (or, at odd edges, up to
+//  nine) texels below them. An object's box is projected to a screen
+//  rectangle and its nearest depth; the level where the rectangle covers
+//  at most 2x2 texels is fetched, and if the box is nearer than none of
+//  them it is hidden behind what was drawn.
+//
+//  Test() runs that check in a compute shader and switches the object's
+//  indirect draws on, so the result never has to come back to the CPU
+//  before drawing. The CPU path instead reads a coarse level back through
+//  a pixel buffer a frame or two later and tests on the CPU.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "hiz.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+/*Shader program Macro*/
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+namespace
+{
+	const GLuint REDUCE_GROUP_SIZE = 8;
+	const GLuint TEST_GROUP_SIZE = 64;
+
+	/* Pyramid reduction: level 0 copies the depth texture, every further level keeps the farthest depth below each texel */
+	const GLchar* reduceShaderSource = GLSL(440,
+
+	layout(local_size_x = 8, local_size_y = 8) in;
+
+	layout(r32f, binding = 0) uniform readonly image2D srcLevel;
+	layout(r32f, binding = 1) uniform writeonly image2D dstLevel;
+	uniform sampler2D depthTexture;
+	uniform bool fromDepth;
+	uniform ivec2 srcSize;
+	uniform ivec2 dstSize;
+
+	void main()
+	{
+		ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+		if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+			return;
+
+		if (fromDepth)
+		{
+			imageStore(dstLevel, dst, vec4(texelFetch(depthTexture, dst, 0).r));
+			return;
+		}
+
+		// The last texel of a level with odd size also covers the source texel left over
+		int lastX = (dst.x == dstSize.x - 1 && (srcSize.x & 1) != 0) ? 2 : 1;
+		int lastY = (dst.y == dstSize.y - 1 && (srcSize.y & 1) != 0) ? 2 : 1;
+
+		float farthest = 0.0;
+		for (int y = 0; y <= lastY; ++y)
+			for (int x = 0; x <= lastX; ++x)
+				farthest = max(farthest, imageLoad(srcLevel, min(dst * 2 + ivec2(x, y), srcSize - 1)).r);
+		imageStore(dstLevel, dst, vec4(farthest));
+	}
+	);
+
+	/* Occlusion test: one invocation per object */
+	const GLchar* testShaderSource = GLSL(440,
+
+	layout(local_size_x = 64) in;
+
+	struct Object
+	{
+		vec4 boxMin;
+		vec4 boxMax;
+		uint firstCommand;
+		uint commandCount;
+		uint flags;
+		uint padding;
+	};
+
+	layout(std430, binding = 0) readonly buffer Objects { Object objects[]; };
+	layout(std430, binding = 1) writeonly buffer Visibility { uint visible[]; };
+	layout(std430, binding = 2) buffer Commands { uint commands[]; };
+
+	uniform sampler2D pyramid;
+	uniform mat4 viewProjection;
+	uniform ivec2 screenSize;
+	uniform int levelCount;
+	uniform uint objectCount;
+
+	bool IsVisible(vec3 boxMin, vec3 boxMax)
+	{
+		vec2 rectMin = vec2(1.0);
+		vec2 rectMax = vec2(-1.0);
+		float nearest = 1.0;
+		for (int i = 0; i < 8; ++i)
+		{
+			vec3 corner = mix(boxMin, boxMax, vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+			vec4 clip = viewProjection * vec4(corner, 1.0);
+			// A corner behind the eye: the rectangle is unbounded
+			if (clip.w <= 0.0)
+				return true;
+			vec3 ndc = clip.xyz / clip.w;
+			rectMin = min(rectMin, ndc.xy);
+			rectMax = max(rectMax, ndc.xy);
+			nearest = min(nearest, ndc.z);
+		}
+		nearest = nearest * 0.5 + 0.5;
+		if (nearest <= 0.0)
+			return true;
+
+		rectMin = clamp(rectMin * 0.5 + 0.5, 0.0, 1.0) * vec2(screenSize);
+		rectMax = clamp(rectMax * 0.5 + 0.5, 0.0, 1.0) * vec2(screenSize);
+		float size = max(rectMax.x - rectMin.x, rectMax.y - rectMin.y);
+		int level = clamp(int(ceil(log2(max(size, 1.0)))), 0, levelCount - 1);
+
+		ivec2 lastTexel = textureSize(pyramid, level) - 1;
+		ivec2 texelMin = min(ivec2(rectMin) >> level, lastTexel);
+		ivec2 texelMax = min(ivec2(rectMax) >> level, lastTexel);
+		float farthest = 0.0;
+		for (int y = texelMin.y; y <= texelMax.y; ++y)
+			for (int x = texelMin.x; x <= texelMax.x; ++x)
+				farthest = max(farthest, texelFetch(pyramid, ivec2(x, y), level).r);
+		return nearest <= farthest;
+	}
+
+	void main()
+	{
+		uint i = gl_GlobalInvocationID.x;
+		if (i >= objectCount)
+			return;
+
+		bool isVisible = IsVisible(objects[i].boxMin.xyz, objects[i].boxMax.xyz);
+		visible[i] = isVisible ? 1u : 0u;
+		if (isVisible && (objects[i].flags & 1u) != 0u)
+		{
+			for (uint c = 0u; c < objects[i].commandCount; ++c)
+				commands[(objects[i].firstCommand + c) * 5u + 1u] = 1u;
+		}
+	}
+	);
+
+	///////////////////////////////////////////////////
+	//	UCreateComputeProgram(const char*, GLuint&)
+	//
+	//	Compile and link a program from a single compute shader
+	///////////////////////////////////////////////////
+	bool UCreateComputeProgram(const char* source, GLuint& programId)
+	{
+		int success = 0;
+		char infoLog[512];
+
+		GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(shaderId, 1, &source, NULL);
+		glCompileShader(shaderId);
+		glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+			glDeleteShader(shaderId);
+			return false;
+		}
+
+		programId = glCreateProgram();
+		glAttachShader(programId, shaderId);
+		glLinkProgram(programId);
+		glDeleteShader(shaderId);
+		glGetProgramiv(programId, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+		return true;
+	}
+
+	// Levels of a full mip chain for the given size
+	int LevelCountFor(int width, int height)
+	{
+		int levels = 1;
+		for (int size = std::max(width, height); size > 1; size >>= 1)
+			++levels;
+		return levels;
+	}
+
+	// Wait-free fence check; deletes the fence once it has signaled
+	bool FenceSignaled(GLsync& fence)
+	{
+		if (fence == 0)
+			return false;
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return false;
+		glDeleteSync(fence);
+		fence = 0;
+		return true;
+	}
+}
+
+HiZBuffer::HiZBuffer()
+	: mWidth(0), mHeight(0), mLevels(0), mDepthTexture(0), mPyramid(0), mReduceProgram(0), mTestProgram(0),
+	mObjectCapacity(0), mCommandCapacity(0), mObjectBuffer(0), mVisibilityBuffer(0), mCommandBuffer(0),
+	mReadbackBuffer(0), mReadbackMapped(nullptr), mReadbackCount(0), mReadbackFence(0),
+	mPixelBuffer(0), mPixelFence(0), mReadbackLevel(0), mPendingViewProjection(1.0f), mCpuViewProjection(1.0f)
+{
+}
+
+///////////////////////////////////////////////////
+//	Initialize(int, int)
+//
+//	Compiles both compute programs and creates the pyramid for a
+//	framebuffer of width x height pixels
+///////////////////////////////////////////////////
+bool HiZBuffer::Initialize(int width, int height)
+{
+	if (!UCreateComputeProgram(reduceShaderSource, mReduceProgram) || !UCreateComputeProgram(testShaderSource, mTestProgram))
+	{
+		std::cout << "Failed to create the Hi-Z programs" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	glUseProgram(mReduceProgram);
+	glUniform1i(glGetUniformLocation(mReduceProgram, "depthTexture"), TEXTURE_UNIT);
+	glUseProgram(mTestProgram);
+	glUniform1i(glGetUniformLocation(mTestProgram, "pyramid"), TEXTURE_UNIT);
+	glUseProgram(0);
+
+	glGenBuffers(1, &mObjectBuffer);
+	glGenBuffers(1, &mVisibilityBuffer);
+	glGenBuffers(1, &mCommandBuffer);
+	glGenBuffers(1, &mPixelBuffer);
+
+	CreateTextures(width, height);
+	return true;
+}
+
+void HiZBuffer::Destroy()
+{
+	DestroyTextures();
+
+	if (mReadbackFence != 0)
+		glDeleteSync(mReadbackFence);
+	mReadbackFence = 0;
+
+	if (mReadbackBuffer != 0)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mReadbackBuffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &mReadbackBuffer);
+	}
+	mReadbackBuffer = 0;
+	mReadbackMapped = nullptr;
+
+	GLuint buffers[] = { mObjectBuffer, mVisibilityBuffer, mCommandBuffer, mPixelBuffer };
+	glDeleteBuffers(4, buffers);
+	mObjectBuffer = mVisibilityBuffer = mCommandBuffer = mPixelBuffer = 0;
+	mObjectCapacity = mCommandCapacity = 0;
+
+	if (mReduceProgram != 0)
+		glDeleteProgram(mReduceProgram);
+	if (mTestProgram != 0)
+		glDeleteProgram(mTestProgram);
+	mReduceProgram = mTestProgram = 0;
+}
+
+void HiZBuffer::Resize(int width, int height)
+{
+	if (width == mWidth && height == mHeight)
+		return;
+
+	DestroyTextures();
+	CreateTextures(width, height);
+}
+
+void HiZBuffer::CreateTextures(int width, int height)
+{
+	mWidth = std::max(width, 1);
+	mHeight = std::max(height, 1);
+	mLevels = LevelCountFor(mWidth, mHeight);
+
+	glGenTextures(1, &mDepthTexture);
+	glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, mWidth, mHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glGenTextures(1, &mPyramid);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+	glTexStorage2D(GL_TEXTURE_2D, mLevels, GL_R32F, mWidth, mHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The CPU path reads the first level narrow enough to stay cheap
+	mReadbackLevel = 0;
+	while (mReadbackLevel + 1 < mLevels && std::max(mWidth >> mReadbackLevel, 1) > CPU_READBACK_WIDTH)
+		++mReadbackLevel;
+
+	// A readback of the old size is of no use any more
+	if (mPixelFence != 0)
+		glDeleteSync(mPixelFence);
+	mPixelFence = 0;
+	mCpuLevels.clear();
+	mCpuSizes.clear();
+}
+
+void HiZBuffer::DestroyTextures()
+{
+	if (mDepthTexture != 0)
+		glDeleteTextures(1, &mDepthTexture);
+	if (mPyramid != 0)
+		glDeleteTextures(1, &mPyramid);
+	mDepthTexture = mPyramid = 0;
+}
+
+///////////////////////////////////////////////////
+//	Build()
+//
+//	Copies the depth buffer of the read framebuffer (the back buffer) into
+//	mDepthTexture, then fills the pyramid one level per dispatch, each
+//	reading the level written by the one before.
+///////////////////////////////////////////////////
+void HiZBuffer::Build()
+{
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mDepthTexture);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, mWidth, mHeight);
+
+	glUseProgram(mReduceProgram);
+	GLint fromDepthLocation = glGetUniformLocation(mReduceProgram, "fromDepth");
+	GLint srcSizeLocation = glGetUniformLocation(mReduceProgram, "srcSize");
+	GLint dstSizeLocation = glGetUniformLocation(mReduceProgram, "dstSize");
+
+	int srcWidth = mWidth;
+	int srcHeight = mHeight;
+	for (int level = 0; level < mLevels; ++level)
+	{
+		int dstWidth = level == 0 ? mWidth : std::max(srcWidth >> 1, 1);
+		int dstHeight = level == 0 ? mHeight : std::max(srcHeight >> 1, 1);
+
+		glUniform1i(fromDepthLocation, level == 0);
+		glUniform2i(srcSizeLocation, srcWidth, srcHeight);
+		glUniform2i(dstSizeLocation, dstWidth, dstHeight);
+		glBindImageTexture(0, mPyramid, std::max(level - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, mPyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((dstWidth + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, (dstHeight + REDUCE_GROUP_SIZE - 1) / REDUCE_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		srcWidth = dstWidth;
+		srcHeight = dstHeight;
+	}
+
+	// Later readers sample the pyramid or copy it into a pixel buffer
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(0);
+}
+
+void HiZBuffer::ReserveObjects(GLsizei count)
+{
+	if (count <= mObjectCapacity)
+		return;
+
+	mObjectCapacity = std::max(count, mObjectCapacity * 2);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mObjectCapacity * sizeof(Object), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mVisibilityBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mObjectCapacity * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// The readback buffer is mapped for good, so it is recreated rather than resized
+	if (mReadbackFence != 0)
+		glDeleteSync(mReadbackFence);
+	mReadbackFence = 0;
+	if (mReadbackBuffer != 0)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mReadbackBuffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glDeleteBuffers(1, &mReadbackBuffer);
+	}
+
+	const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &mReadbackBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, mReadbackBuffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, mObjectCapacity * sizeof(GLuint), nullptr, flags);
+	mReadbackMapped = (const GLuint*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, mObjectCapacity * sizeof(GLuint), flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+///////////////////////////////////////////////////
+//	Test(const glm::mat4&, const std::vector<Object>&, const void*, GLsizei)
+//
+//	viewProjection: matrix the depth in the pyramid was drawn with
+//	objects: boxes to test, see Object
+//	commands: commandCount indirect commands of COMMAND_SIZE bytes, uploaded
+//	to CommandBuffer() with instanceCount cleared
+//
+//	Draws from CommandBuffer() issued after this call see the result.
+///////////////////////////////////////////////////
+void HiZBuffer::Test(const glm::mat4& viewProjection, const std::vector<Object>& objects, const void* commands, GLsizei commandCount)
+{
+	GLsizei objectCount = (GLsizei)objects.size();
+	if (objectCount == 0)
+		return;
+	ReserveObjects(objectCount);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mObjectBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(Object), objects.data());
+
+	std::vector<GLuint> cleared(commandCount * COMMAND_SIZE / sizeof(GLuint));
+	if (commandCount > 0)
+		memcpy(cleared.data(), commands, commandCount * COMMAND_SIZE);
+	for (GLsizei c = 0; c < commandCount; ++c)
+		cleared[c * COMMAND_SIZE / sizeof(GLuint) + 1] = 0;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mCommandBuffer);
+	if (commandCount > mCommandCapacity)
+	{
+		mCommandCapacity = std::max(commandCount, mCommandCapacity * 2);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, mCommandCapacity * COMMAND_SIZE, nullptr, GL_DYNAMIC_DRAW);
+	}
+	if (commandCount > 0)
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, commandCount * COMMAND_SIZE, cleared.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(mTestProgram);
+	glUniformMatrix4fv(glGetUniformLocation(mTestProgram, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+	glUniform2i(glGetUniformLocation(mTestProgram, "screenSize"), mWidth, mHeight);
+	glUniform1i(glGetUniformLocation(mTestProgram, "levelCount"), mLevels);
+	glUniform1ui(glGetUniformLocation(mTestProgram, "objectCount"), objectCount);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, mObjectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mVisibilityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mCommandBuffer);
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+	glActiveTexture(GL_TEXTURE0);
+
+	glDispatchCompute((objectCount + TEST_GROUP_SIZE - 1) / TEST_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glUseProgram(0);
+
+	// Hand the results to the CPU unless the previous copy is still on its way
+	if (mReadbackFence == 0 && mReadbackMapped != nullptr)
+	{
+		glBindBuffer(GL_COPY_READ_BUFFER, mVisibilityBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, mReadbackBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, objectCount * sizeof(GLuint));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		mReadbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		mReadbackCount = objectCount;
+	}
+}
+
+bool HiZBuffer::ReadVisibility(std::vector<unsigned char>& visible)
+{
+	if (!FenceSignaled(mReadbackFence))
+		return false;
+
+	visible.resize(mReadbackCount);
+	for (GLsizei i = 0; i < mReadbackCount; ++i)
+		visible[i] = mReadbackMapped[i] != 0;
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	RequestReadback(const glm::mat4&)
+//
+//	Queue a copy of level mReadbackLevel into the pixel buffer. Skipped
+//	while the previous copy has not arrived, so at most one is in flight.
+///////////////////////////////////////////////////
+void HiZBuffer::RequestReadback(const glm::mat4& viewProjection)
+{
+	if (mPixelFence != 0)
+		return;
+
+	int width = std::max(mWidth >> mReadbackLevel, 1);
+	int height = std::max(mHeight >> mReadbackLevel, 1);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, mPixelBuffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(float), nullptr, GL_STREAM_READ);
+	glBindTexture(GL_TEXTURE_2D, mPyramid);
+	glGetTexImage(GL_TEXTURE_2D, mReadbackLevel, GL_RED, GL_FLOAT, nullptr);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	mPixelFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mPendingViewProjection = viewProjection;
+}
+
+bool HiZBuffer::ReadPyramid()
+{
+	if (!FenceSignaled(mPixelFence))
+		return false;
+
+	int width = std::max(mWidth >> mReadbackLevel, 1);
+	int height = std::max(mHeight >> mReadbackLevel, 1);
+	GLsizeiptr size = width * height * sizeof(float);
+
+	mCpuLevels.resize(mLevels - mReadbackLevel);
+	mCpuSizes.resize(mLevels - mReadbackLevel);
+	mCpuLevels[0].resize(width * height);
+	mCpuSizes[0] = glm::ivec2(width, height);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, mPixelBuffer);
+	const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (pixels != nullptr)
+	{
+		memcpy(mCpuLevels[0].data(), pixels, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (pixels == nullptr)
+	{
+		mCpuLevels.clear();
+		mCpuSizes.clear();
+		return false;
+	}
+
+	// Same reduction as the compute shader
+	for (size_t level = 1; level < mCpuLevels.size(); ++level)
+	{
+		const std::vector<float>& src = mCpuLevels[level - 1];
+		glm::ivec2 srcSize = mCpuSizes[level - 1];
+		glm::ivec2 dstSize(std::max(srcSize.x >> 1, 1), std::max(srcSize.y >> 1, 1));
+		std::vector<float>& dst = mCpuLevels[level];
+		dst.resize(dstSize.x * dstSize.y);
+		mCpuSizes[level] = dstSize;
+
+		for (int y = 0; y < dstSize.y; ++y)
+		{
+			int lastY = (y == dstSize.y - 1 && (srcSize.y & 1) != 0) ? 2 : 1;
+			for (int x = 0; x < dstSize.x; ++x)
+			{
+				int lastX = (x == dstSize.x - 1 && (srcSize.x & 1) != 0) ? 2 : 1;
+				float farthest = 0.0f;
+				for (int sy = 0; sy <= lastY; ++sy)
+				{
+					int row = std::min(y * 2 + sy, srcSize.y - 1) * srcSize.x;
+					for (int sx = 0; sx <= lastX; ++sx)
+						farthest = std::max(farthest, src[row + std::min(x * 2 + sx, srcSize.x - 1)]);
+				}
+				dst[y * dstSize.x + x] = farthest;
+			}
+		}
+	}
+
+	mCpuViewProjection = mPendingViewProjection;
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	TestCPU(const AABB&)
+//
+//	The compute shader's test against the pyramid read back last. Levels
+//	finer than the one read back are not available, so small boxes are
+//	tested against coarser texels, which only makes the test more
+//	conservative. Returns true (visible) while no readback has arrived.
+///////////////////////////////////////////////////
+bool HiZBuffer::TestCPU(const AABB& box) const
+{
+	if (mCpuLevels.empty())
+		return true;
+
+	glm::vec2 rectMin(1.0f);
+	glm::vec2 rectMax(-1.0f);
+	float nearest = 1.0f;
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		glm::vec4 clip = mCpuViewProjection * glm::vec4(corner, 1.0f);
+		if (clip.w <= 0.0f)
+			return true;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		rectMin = glm::min(rectMin, glm::vec2(ndc));
+		rectMax = glm::max(rectMax, glm::vec2(ndc));
+		nearest = std::min(nearest, ndc.z);
+	}
+	nearest = nearest * 0.5f + 0.5f;
+	if (nearest <= 0.0f)
+		return true;
+
+	glm::vec2 screenSize((float)mWidth, (float)mHeight);
+	rectMin = glm::clamp(rectMin * 0.5f + 0.5f, 0.0f, 1.0f) * screenSize;
+	rectMax = glm::clamp(rectMax * 0.5f + 0.5f, 0.0f, 1.0f) * screenSize;
+	float size = std::max(rectMax.x - rectMin.x, rectMax.y - rectMin.y);
+	int level = (int)std::ceil(std::log2(std::max(size, 1.0f)));
+	level = std::min(std::max(level, mReadbackLevel), mLevels - 1);
+
+	const std::vector<float>& texels = mCpuLevels[level - mReadbackLevel];
+	glm::ivec2 lastTexel = mCpuSizes[level - mReadbackLevel] - 1;
+	glm::ivec2 texelMin = glm::min(glm::ivec2(rectMin) >> level, lastTexel);
+	glm::ivec2 texelMax = glm::min(glm::ivec2(rectMax) >> level, lastTexel);
+	float farthest = 0.0f;
+	for (int y = texelMin.y; y <= texelMax.y; ++y)
+		for (int x = texelMin.x; x <= texelMax.x; ++x)
+			farthest = std::max(farthest, texels[y * (lastTexel.x + 1) + x]);
+	return nearest <= farthest;
+}
@@ -0,0 +1,262 @@
+///////////////////////////////////////////////////////////////////////////////
+//  idbuffer.cpp
+//  ============
+//  Pixel-exact picking without stalling the render loop.
+//
+//  The scene is drawn into a framebuffer with a second, R32UI attachment
+//  that every fragment writes its object id to. A click does not read it
+//  right away: at the end of the frame a small region around the cursor is
+//  copied into a pixel buffer and fenced. glReadPixels into a bound pack
+//  buffer returns immediately; the fence is polled (with a zero timeout)
+//  in the following frames and the callback runs once it has signaled,
+//  usually one or two frames later.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "idbuffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+IdBuffer::IdBuffer()
+	: mWidth(0), mHeight(0), mFramebuffer(0), mColor(0), mIds(0), mDepth(0), mFrame(0), mReadbacks()
+{
+}
+
+///////////////////////////////////////////////////
+//	Initialize(int, int)
+//
+//	Creates the render targets for a width x height framebuffer and one
+//	pixel buffer per readback slot
+///////////////////////////////////////////////////
+bool IdBuffer::Initialize(int width, int height)
+{
+	const GLsizeiptr regionBytes = (2 * PICK_RADIUS + 1) * (2 * PICK_RADIUS + 1) * sizeof(GLuint);
+	for (Readback& readback : mReadbacks)
+	{
+		glGenBuffers(1, &readback.buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, regionBytes, nullptr, GL_STREAM_READ);
+		readback.fence = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	glGenFramebuffers(1, &mFramebuffer);
+	CreateTargets(width, height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Failed to create the id framebuffer (status 0x" << std::hex << status << std::dec << ")" << std::endl;
+		Destroy();
+		return false;
+	}
+	return true;
+}
+
+void IdBuffer::Destroy()
+{
+	for (Readback& readback : mReadbacks)
+	{
+		if (readback.fence != 0)
+			glDeleteSync(readback.fence);
+		if (readback.buffer != 0)
+			glDeleteBuffers(1, &readback.buffer);
+		readback = Readback();
+	}
+	mRequests.clear();
+
+	DestroyTargets();
+	if (mFramebuffer != 0)
+		glDeleteFramebuffers(1, &mFramebuffer);
+	mFramebuffer = 0;
+	mWidth = mHeight = 0;
+}
+
+void IdBuffer::Resize(int width, int height)
+{
+	if (!IsValid() || (width == mWidth && height == mHeight))
+		return;
+
+	DestroyTargets();
+	CreateTargets(width, height);
+}
+
+void IdBuffer::CreateTargets(int width, int height)
+{
+	mWidth = std::max(width, 1);
+	mHeight = std::max(height, 1);
+
+	GLuint renderbuffers[3];
+	glGenRenderbuffers(3, renderbuffers);
+	mColor = renderbuffers[0];
+	mIds = renderbuffers[1];
+	mDepth = renderbuffers[2];
+
+	glBindRenderbuffer(GL_RENDERBUFFER, mColor);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, mWidth, mHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, mIds);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, mWidth, mHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, mDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, mWidth, mHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mColor);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_RENDERBUFFER, mIds);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, mDepth);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Clicks on the old image would land on the wrong pixels
+	mRequests.clear();
+}
+
+void IdBuffer::DestroyTargets()
+{
+	GLuint renderbuffers[3] = { mColor, mIds, mDepth };
+	glDeleteRenderbuffers(3, renderbuffers);
+	mColor = mIds = mDepth = 0;
+}
+
+void IdBuffer::Begin(const glm::vec4& clearColor)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	// glClear would write the float clear color into the integer attachment too
+	const GLuint noObject[4] = { NO_OBJECT, 0, 0, 0 };
+	glClearBufferfv(GL_COLOR, 0, &clearColor[0]);
+	glClearBufferuiv(GL_COLOR, 1, noObject);
+	glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+}
+
+void IdBuffer::End()
+{
+	IssueReadbacks();
+	DeliverReadbacks();
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	++mFrame;
+}
+
+void IdBuffer::RequestPick(int x, int y, const IdPickCallback& callback)
+{
+	Request request;
+	request.x = x;
+	request.y = y;
+	request.callback = callback;
+	request.frame = mFrame;
+	mRequests.push_back(request);
+}
+
+///////////////////////////////////////////////////
+//	IssueReadbacks()
+//
+//	Start an asynchronous copy of the region around each queued click into
+//	a free slot's pixel buffer. Clicks that find every slot busy stay queued.
+///////////////////////////////////////////////////
+void IdBuffer::IssueReadbacks()
+{
+	if (mRequests.empty())
+		return;
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mFramebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+	for (Readback& readback : mReadbacks)
+	{
+		if (mRequests.empty())
+			break;
+		if (readback.fence != 0 || readback.buffer == 0)
+			continue;
+
+		const Request& request = mRequests.front();
+		readback.x = request.x;
+		readback.y = request.y;
+		readback.left = std::min(std::max(request.x - PICK_RADIUS, 0), mWidth - 1);
+		readback.bottom = std::min(std::max(request.y - PICK_RADIUS, 0), mHeight - 1);
+		readback.width = std::min(request.x + PICK_RADIUS + 1, mWidth) - readback.left;
+		readback.height = std::min(request.y + PICK_RADIUS + 1, mHeight) - readback.bottom;
+		readback.callback = request.callback;
+		readback.frame = request.frame;
+		mRequests.pop_front();
+
+		if (readback.width <= 0 || readback.height <= 0)
+		{
+			// Outside the target: nothing to read
+			IdPickResult result = { NO_OBJECT, readback.x, readback.y, mFrame - readback.frame };
+			if (readback.callback)
+				readback.callback(result);
+			continue;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		glReadPixels(readback.left, readback.bottom, readback.width, readback.height, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+///////////////////////////////////////////////////
+//	DeliverReadbacks()
+//
+//	Poll every slot's fence without waiting and hand finished regions to
+//	their callbacks
+///////////////////////////////////////////////////
+void IdBuffer::DeliverReadbacks()
+{
+	for (Readback& readback : mReadbacks)
+	{
+		if (readback.fence == 0)
+			continue;
+
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		IdPickResult result = { NO_OBJECT, readback.x, readback.y, mFrame - readback.frame };
+		GLsizeiptr size = readback.width * readback.height * sizeof(GLuint);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const GLuint* ids = (const GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (ids != nullptr)
+		{
+			// The id nearest the clicked pixel, so a click just beside thin geometry still hits
+			int bestDistance = -1;
+			for (int row = 0; row < readback.height; ++row)
+			{
+				for (int column = 0; column < readback.width; ++column)
+				{
+					GLuint id = ids[row * readback.width + column];
+					int dx = readback.left + column - readback.x;
+					int dy = readback.bottom + row - readback.y;
+					int distance = dx * dx + dy * dy;
+					if (id != NO_OBJECT && (bestDistance < 0 || distance < bestDistance))
+					{
+						result.id = id;
+						bestDistance = distance;
+					}
+				}
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (readback.callback)
+			readback.callback(result);
+		readback.callback = IdPickCallback();
+	}
+}
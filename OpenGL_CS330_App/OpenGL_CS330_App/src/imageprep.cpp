@@ -0,0 +1,296 @@
+///////////////////////////////////////////////////////////////////////////////
+//  imageprep.cpp
+//  =============
+//  Image preparation.
+//
+//  These run on the texture loader's workers right after decoding, so
+//  the GL thread only ever sees RGBA8 rows in upload order. Row flips
+//  and 4 channel copies are plain moves, done 32 bytes at a time with AVX
+//  and 16 with SSE. RGB expansion shuffles four texels into place per
+//  step with SSSE3 (implied by AVX); without it four texels are read as
+//  three 32-bit words and shifted apart. Premultiplying needs 16-bit
+//  multiplies, which AVX only has at 128 bits, so it is SSE2 throughout.
+//
+//  sRGB decoding is a 256 entry table. Encoding rounds exactly: a 4096
+//  bucket table gives the lowest code a linear value can round to, and
+//  one compare against the midpoint to the next code finishes the job.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "imageprep.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	const int SRGB_BUCKETS = 4096;
+
+	struct SRGBTables
+	{
+		float toLinear[256];
+		float midpoints[256];				// Linear value halfway between code k and k + 1
+		unsigned char bucketCodes[SRGB_BUCKETS + 1];	// Code of bucket b's lowest value, b / SRGB_BUCKETS
+
+		SRGBTables()
+		{
+			for (int code = 0; code < 256; ++code)
+			{
+				toLinear[code] = UDecode(code / 255.0);
+				midpoints[code] = code < 255 ? UDecode((code + 0.5) / 255.0) : 2.0f;
+			}
+			int code = 0;
+			for (int bucket = 0; bucket <= SRGB_BUCKETS; ++bucket)
+			{
+				float value = (float)bucket / SRGB_BUCKETS;
+				while (value >= midpoints[code])
+					++code;
+				bucketCodes[bucket] = (unsigned char)code;
+			}
+		}
+
+		static float UDecode(double encoded)
+		{
+			return (float)(encoded <= 0.04045 ? encoded / 12.92 : std::pow((encoded + 0.055) / 1.055, 2.4));
+		}
+	};
+
+	// Built on first use; static initialization is thread safe
+	const SRGBTables& USRGBTables()
+	{
+		static const SRGBTables tables;
+		return tables;
+	}
+
+	void USwapRows(unsigned char* a, unsigned char* b, size_t bytes)
+	{
+		size_t i = 0;
+#if defined(__AVX__)
+		for (; i + 32 <= bytes; i += 32)
+		{
+			__m256i rowA = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i rowB = _mm256_loadu_si256((const __m256i*)(b + i));
+			_mm256_storeu_si256((__m256i*)(a + i), rowB);
+			_mm256_storeu_si256((__m256i*)(b + i), rowA);
+		}
+#endif
+		for (; i + 16 <= bytes; i += 16)
+		{
+			__m128i rowA = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i rowB = _mm_loadu_si128((const __m128i*)(b + i));
+			_mm_storeu_si128((__m128i*)(a + i), rowB);
+			_mm_storeu_si128((__m128i*)(b + i), rowA);
+		}
+		for (; i < bytes; ++i)
+			std::swap(a[i], b[i]);
+	}
+
+	// One row of RGB to RGBA with opaque alpha
+	void UExpandRow(const unsigned char* rgb, int width, unsigned char* rgba)
+	{
+		int x = 0;
+#if defined(__AVX__)
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+		// A 16 byte load for four 3 byte texels must not run past the row
+		for (; x + 6 <= width; x += 4)
+		{
+			__m128i texels = _mm_loadu_si128((const __m128i*)(rgb + x * 3));
+			_mm_storeu_si128((__m128i*)(rgba + x * 4), _mm_or_si128(_mm_shuffle_epi8(texels, spread), opaque));
+		}
+#else
+		// Little endian: r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+		for (; x + 4 <= width; x += 4)
+		{
+			uint32_t words[3], texels[4];
+			memcpy(words, rgb + x * 3, sizeof(words));
+			texels[0] = words[0] | 0xff000000u;
+			texels[1] = (words[0] >> 24) | (words[1] << 8) | 0xff000000u;
+			texels[2] = (words[1] >> 16) | (words[2] << 16) | 0xff000000u;
+			texels[3] = (words[2] >> 8) | 0xff000000u;
+			memcpy(rgba + x * 4, texels, sizeof(texels));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			rgba[x * 4 + 0] = rgb[x * 3 + 0];
+			rgba[x * 4 + 1] = rgb[x * 3 + 1];
+			rgba[x * 4 + 2] = rgb[x * 3 + 2];
+			rgba[x * 4 + 3] = 255;
+		}
+	}
+
+	// value / 255 rounded to nearest, exact for value up to 255 * 255
+	inline unsigned int UDivide255(unsigned int value)
+	{
+		value += 128;
+		return (value + (value >> 8)) >> 8;
+	}
+}
+
+void FlipRowsVertically(unsigned char* image, int width, int height, int channels)
+{
+	size_t rowBytes = (size_t)width * channels;
+	for (int y = 0; y < height / 2; ++y)
+		USwapRows(image + (size_t)y * rowBytes, image + (size_t)(height - 1 - y) * rowBytes, rowBytes);
+}
+
+void ConvertToRGBA(const unsigned char* source, int width, int height, int channels, bool flip, unsigned char* rgba)
+{
+	size_t sourceRowBytes = (size_t)width * channels;
+	size_t rowBytes = (size_t)width * 4;
+	if (channels == 4 && !flip)
+	{
+		memcpy(rgba, source, rowBytes * height);
+		return;
+	}
+
+	for (int y = 0; y < height; ++y)
+	{
+		const unsigned char* row = source + (size_t)(flip ? height - 1 - y : y) * sourceRowBytes;
+		if (channels == 4)
+			memcpy(rgba + (size_t)y * rowBytes, row, rowBytes);
+		else
+			UExpandRow(row, width, rgba + (size_t)y * rowBytes);
+	}
+}
+
+///////////////////////////////////////////////////
+//	ResampleToRGBA(...)
+//
+//	Pixel centers map onto pixel centers. Only texture array layers and
+//	virtual texture bakes come through here, so it stays scalar.
+///////////////////////////////////////////////////
+void ResampleToRGBA(const unsigned char* source, int width, int height, int channels, int newWidth, int newHeight, bool flip, unsigned char* rgba)
+{
+	float scaleX = (float)width / newWidth;
+	float scaleY = (float)height / newHeight;
+
+	for (int y = 0; y < newHeight; ++y)
+	{
+		float sourceY = (y + 0.5f) * scaleY - 0.5f;
+		float floorY = std::floor(sourceY);
+		float weightY = sourceY - floorY;
+		int y0 = ((int)floorY + height) % height;
+		int y1 = (y0 + 1) % height;
+		unsigned char* row = rgba + (size_t)(flip ? newHeight - 1 - y : y) * newWidth * 4;
+
+		for (int x = 0; x < newWidth; ++x)
+		{
+			float sourceX = (x + 0.5f) * scaleX - 0.5f;
+			float floorX = std::floor(sourceX);
+			float weightX = sourceX - floorX;
+			int x0 = ((int)floorX + width) % width;
+			int x1 = (x0 + 1) % width;
+
+			const unsigned char* p00 = source + ((size_t)y0 * width + x0) * channels;
+			const unsigned char* p10 = source + ((size_t)y0 * width + x1) * channels;
+			const unsigned char* p01 = source + ((size_t)y1 * width + x0) * channels;
+			const unsigned char* p11 = source + ((size_t)y1 * width + x1) * channels;
+			unsigned char* out = row + (size_t)x * 4;
+			for (int c = 0; c < 4; ++c)
+			{
+				if (c >= channels)
+				{
+					out[c] = 255;
+					continue;
+				}
+				float top = p00[c] + (p10[c] - p00[c]) * weightX;
+				float bottom = p01[c] + (p11[c] - p01[c]) * weightX;
+				out[c] = (unsigned char)(top + (bottom - top) * weightY + 0.5f);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	PremultiplyAlpha(unsigned char*, size_t)
+//
+//	Two texels per 16-bit vector: each channel is multiplied by its
+//	texel's alpha, broadcast within the texel, except alpha itself, which
+//	is multiplied by 255 and so comes out unchanged.
+///////////////////////////////////////////////////
+void PremultiplyAlpha(unsigned char* rgba, size_t texels)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alphaLanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+	const __m128i full = _mm_set1_epi16(255);
+	const __m128i half = _mm_set1_epi16(128);
+
+	size_t i = 0;
+	for (; i + 4 <= texels; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+		__m128i halves[2] = { _mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero) };
+		for (__m128i& channels : halves)
+		{
+			__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(channels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			alpha = _mm_or_si128(_mm_andnot_si128(alphaLanes, alpha), _mm_and_si128(alphaLanes, full));
+			__m128i product = _mm_add_epi16(_mm_mullo_epi16(channels, alpha), half);
+			channels = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i*)(rgba + i * 4), _mm_packus_epi16(halves[0], halves[1]));
+	}
+	for (; i < texels; ++i)
+	{
+		unsigned char* texel = rgba + i * 4;
+		for (int c = 0; c < 3; ++c)
+			texel[c] = (unsigned char)UDivide255((unsigned int)texel[c] * texel[3]);
+	}
+}
+
+void SRGBToLinear(const unsigned char* rgba, size_t texels, float* linear)
+{
+	const SRGBTables& tables = USRGBTables();
+	for (size_t i = 0; i < texels; ++i)
+	{
+		linear[i * 4 + 0] = tables.toLinear[rgba[i * 4 + 0]];
+		linear[i * 4 + 1] = tables.toLinear[rgba[i * 4 + 1]];
+		linear[i * 4 + 2] = tables.toLinear[rgba[i * 4 + 2]];
+		linear[i * 4 + 3] = rgba[i * 4 + 3] * (1.0f / 255.0f);
+	}
+}
+
+///////////////////////////////////////////////////
+//	LinearToSRGB(const float*, size_t, unsigned char*)
+//
+//	A texel is one SSE vector: clamped and turned into bucket indices for
+//	the color and a rounded code for alpha in one go. No bucket spans more
+//	than one midpoint, so a single compare settles all three color codes.
+///////////////////////////////////////////////////
+void LinearToSRGB(const float* linear, size_t texels, unsigned char* rgba)
+{
+	const SRGBTables& tables = USRGBTables();
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_setr_ps((float)SRGB_BUCKETS, (float)SRGB_BUCKETS, (float)SRGB_BUCKETS, 255.0f);
+	const __m128 round = _mm_setr_ps(0.0f, 0.0f, 0.0f, 0.5f);
+
+	for (size_t i = 0; i < texels; ++i)
+	{
+		__m128 texel = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i * 4), zero), one);
+		alignas(16) int32_t indices[4];
+		_mm_store_si128((__m128i*)indices, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(texel, scale), round)));
+
+		int r = tables.bucketCodes[indices[0]];
+		int g = tables.bucketCodes[indices[1]];
+		int b = tables.bucketCodes[indices[2]];
+		__m128i codes = _mm_setr_epi32(r, g, b, indices[3]);
+		// The alpha lane compares against 2 and never steps
+		__m128 midpoints = _mm_setr_ps(tables.midpoints[r], tables.midpoints[g], tables.midpoints[b], 2.0f);
+		codes = _mm_sub_epi32(codes, _mm_castps_si128(_mm_cmpge_ps(texel, midpoints)));
+
+		codes = _mm_packs_epi32(codes, codes);
+		int packed = _mm_cvtsi128_si32(_mm_packus_epi16(codes, codes));
+		memcpy(rgba + i * 4, &packed, sizeof(packed));
+	}
+}
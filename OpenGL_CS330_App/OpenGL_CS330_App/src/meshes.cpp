@@ -8,25 +8,43 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "meshes.h"
+#include "bufferpool.h"
+#include "uploadqueue.h"
+#include "vertexweld.h"
+#include <iostream>
 #include <vector>
 
 namespace
 {
 	const double M_PI = 3.14159265358979323846f;
 	const double M_PI_2 = 1.571428571428571;
+
+	// Every primitive interleaves position, normal and texture coordinate
+	const GLsizeiptr VERTEX_STRIDE = sizeof(GLfloat) * 8;
 }
 
 ///////////////////////////////////////////////////
-//	CreateMeshes()
+//	CreateMeshes(UploadQueue*, BufferPool*)
+//
+//	uploadQueue: optional queue that performs the buffer uploads over the
+//	next frames instead of right away
+//	bufferPool: optional pool the vertex and index data is sub-allocated
+//	from instead of creating two buffer objects per mesh
 //
 //	Create all the following 3D meshes:
 //		plane, pyramid, cube, cylinder, torus, sphere
+//	The box is uploaded right away whatever the queue, so it can stand in
+//	for the meshes that are not resident yet.
 ///////////////////////////////////////////////////
-void Meshes::CreateMeshes()
+void Meshes::CreateMeshes(UploadQueue* uploadQueue, BufferPool* bufferPool)
 {
+	mUploadQueue = nullptr;
+	mBufferPool = bufferPool;
+	UCreateBoxMesh(gBoxMesh);
+
+	mUploadQueue = uploadQueue;
 	UCreatePlaneMesh(gPlaneMesh);
 	UCreatePrismMesh(gPrismMesh);
-	UCreateBoxMesh(gBoxMesh);
 	UCreateConeMesh(gConeMesh);
 	UCreateCylinderMesh(gCylinderMesh);
 	UCreateTaperedCylinderMesh(gTaperedCylinderMesh);
@@ -63,7 +81,7 @@ void Meshes::DestroyMeshes()
 // 
 //  Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gPlaneMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	meshes.DrawMesh(meshes.gPlaneMesh, GL_TRIANGLES);
 ///////////////////////////////////////////////////
 void Meshes::UCreatePlaneMesh(GLMesh &mesh)
 {
@@ -96,12 +114,12 @@ void Meshes::UCreatePlaneMesh(GLMesh &mesh)
 	glBindVertexArray(mesh.vao);	// activate the VAO
 
 	// Create VBOs for the mesh
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends data to the GPU
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(verts), verts); // Sends data to the GPU
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	UBufferData(mesh, GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices);
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -126,7 +144,7 @@ void Meshes::UCreatePlaneMesh(GLMesh &mesh)
 //
 //  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid3Mesh.nVertices);
+//	meshes.DrawMesh(meshes.gPyramid3Mesh, GL_TRIANGLE_STRIP);
 ///////////////////////////////////////////////////
 void Meshes::UCreatePyramid3Mesh(GLMesh &mesh)
 {
@@ -163,11 +181,11 @@ void Meshes::UCreatePyramid3Mesh(GLMesh &mesh)
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
 
 	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
+	UGenBuffers(mesh, 1);						// Creates 1 VBO
 	glBindVertexArray(mesh.vao);				// Activates the VAO
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
 	// Sends vertex or coordinate data to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(verts), verts);
 
 	// Strides between sets of attribute data
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
@@ -190,7 +208,7 @@ void Meshes::UCreatePyramid3Mesh(GLMesh &mesh)
 //
 //  Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPyramid4Mesh.nVertices);
+//	meshes.DrawMesh(meshes.gPyramid4Mesh, GL_TRIANGLE_STRIP);
 ///////////////////////////////////////////////////
 void Meshes::UCreatePyramid4Mesh(GLMesh &mesh)
 {
@@ -236,11 +254,11 @@ void Meshes::UCreatePyramid4Mesh(GLMesh &mesh)
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor + floatsPerUV));
 
 	glGenVertexArrays(1, &mesh.vao);			// Creates 1 VAO
-	glGenBuffers(1, mesh.vbos);					// Creates 1 VBO
+	UGenBuffers(mesh, 1);						// Creates 1 VBO
 	glBindVertexArray(mesh.vao);				// Activates the VAO
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]);	// Activates the VBO
 	// Sends vertex or coordinate data to the GPU
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(verts), verts);
 
 	// Strides between sets of attribute data
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor + floatsPerUV);
@@ -259,11 +277,11 @@ void Meshes::UCreatePyramid4Mesh(GLMesh &mesh)
 //
 //	mesh: reference to mesh structure for storing data
 //
-//	Create a pyramid mesh and store it in a VAO/VBO
+//	Create a prism mesh, weld it and store it in a VAO/VBO
 //
 //	Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLE_STRIP, 0, meshes.gPrismMesh.nVertices);
+//	meshes.DrawMesh(meshes.gPrismMesh, GL_TRIANGLE_STRIP);
 ///////////////////////////////////////////////////
 void Meshes::UCreatePrismMesh(GLMesh &mesh)
 {
@@ -326,9 +344,10 @@ void Meshes::UCreatePrismMesh(GLMesh &mesh)
 	glBindVertexArray(mesh.vao);
 
 	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Weld duplicated vertices and send the compacted vertices plus indices to the GPU
+	UBufferWeldedData(mesh, "prism", verts, floatsPerVertex + floatsPerNormal + floatsPerUV);
 
 	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
@@ -353,7 +372,7 @@ void Meshes::UCreatePrismMesh(GLMesh &mesh)
 //
 //	Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gBoxMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	meshes.DrawMesh(meshes.gBoxMesh, GL_TRIANGLES);
 ///////////////////////////////////////////////////
 void Meshes::UCreateBoxMesh(GLMesh &mesh)
 {
@@ -426,12 +445,12 @@ void Meshes::UCreateBoxMesh(GLMesh &mesh)
 	glBindVertexArray(mesh.vao);
 
 	// Create 2 buffers: first one for the vertex data; second one for the indices
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(verts), verts); // Sends vertex or coordinate data to the GPU
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	UBufferData(mesh, GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices);
 
 	// Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
@@ -452,12 +471,12 @@ void Meshes::UCreateBoxMesh(GLMesh &mesh)
 //
 //	mesh: reference to mesh structure for storing data
 //
-//	Create a cylinder mesh and store it in a VAO/VBO
+//	Create a cone mesh, weld it and store it in a VAO/VBO
 //
 //  Correct triangle drawing commands:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_STRIP, 36, 108);	//sides
+//	meshes.DrawMesh(meshes.gConeMesh, GL_TRIANGLE_FAN, 0, 36);		//bottom
+//	meshes.DrawMesh(meshes.gConeMesh, GL_TRIANGLE_STRIP, 36, 108);	//sides
 ///////////////////////////////////////////////////
 void Meshes::UCreateConeMesh(GLMesh &mesh)
 {
@@ -618,16 +637,16 @@ void Meshes::UCreateConeMesh(GLMesh &mesh)
 
 	// store vertex and index count
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
 
 	// Create VAO
 	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
 	glBindVertexArray(mesh.vao);
 
 	// Create VBO
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Weld duplicated vertices and send the compacted vertices plus indices to the GPU
+	UBufferWeldedData(mesh, "cone", verts, floatsPerVertex + floatsPerNormal + floatsPerUV);
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -674,13 +693,13 @@ void Meshes::CalculateTriangleNormal(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2)
 //
 //	mesh: reference to mesh structure for storing data
 //
-//	Create a cylinder mesh and store it in a VAO/VBO
+//	Create a cylinder mesh, weld it and store it in a VAO/VBO
 //
 //  Correct triangle drawing commands:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_FAN, 36, 36);		//top
-//	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+//	meshes.DrawMesh(meshes.gCylinderMesh, GL_TRIANGLE_FAN, 0, 36);		//bottom
+//	meshes.DrawMesh(meshes.gCylinderMesh, GL_TRIANGLE_FAN, 36, 36);		//top
+//	meshes.DrawMesh(meshes.gCylinderMesh, GL_TRIANGLE_STRIP, 72, 146);	//sides
 ///////////////////////////////////////////////////
 void Meshes::UCreateCylinderMesh(GLMesh &mesh)
 {
@@ -917,16 +936,16 @@ void Meshes::UCreateCylinderMesh(GLMesh &mesh)
 
 	// store vertex and index count
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
 
 	// Create VAO
 	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
 	glBindVertexArray(mesh.vao);
 
 	// Create VBO
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Weld duplicated vertices and send the compacted vertices plus indices to the GPU
+	UBufferWeldedData(mesh, "cylinder", verts, floatsPerVertex + floatsPerNormal + floatsPerUV);
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -947,13 +966,13 @@ void Meshes::UCreateCylinderMesh(GLMesh &mesh)
 //
 //	mesh: reference to mesh structure for storing data
 //
-//	Create a tapered cylinder mesh and store it in a VAO/VBO
+//	Create a tapered cylinder mesh, weld it and store it in a VAO/VBO
 //
 //  Correct triangle drawing commands:
 //
-//	glDrawArrays(GL_TRIANGLE_FAN, 0, 36);		//bottom
-//	glDrawArrays(GL_TRIANGLE_FAN, 36, 72);		//top
-//	glDrawArrays(GL_TRIANGLE_STRIP, 72, 146);	//sides
+//	meshes.DrawMesh(meshes.gTaperedCylinderMesh, GL_TRIANGLE_FAN, 0, 36);		//bottom
+//	meshes.DrawMesh(meshes.gTaperedCylinderMesh, GL_TRIANGLE_FAN, 36, 36);		//top
+//	meshes.DrawMesh(meshes.gTaperedCylinderMesh, GL_TRIANGLE_STRIP, 72, 146);	//sides
 ///////////////////////////////////////////////////
 void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
 {
@@ -1190,16 +1209,16 @@ void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
 
 	// store vertex and index count
 	mesh.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-	mesh.nIndices = 0;
 
 	// Create VAO
 	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
 	glBindVertexArray(mesh.vao);
 
 	// Create VBO
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Weld duplicated vertices and send the compacted vertices plus indices to the GPU
+	UBufferWeldedData(mesh, "tapered cylinder", verts, floatsPerVertex + floatsPerNormal + floatsPerUV);
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -1220,11 +1239,11 @@ void Meshes::UCreateTaperedCylinderMesh(GLMesh &mesh)
 //
 //	mesh: reference to mesh structure for storing data
 //
-//	Create a torus mesh and store it in a VAO/VBO
+//	Create a torus mesh, weld it and store it in a VAO/VBO
 //
 //	Correct triangle drawing command:
 //
-//	glDrawArrays(GL_TRIANGLES, 0, meshes.gTorusMesh.nVertices);
+//	meshes.DrawMesh(meshes.gTorusMesh, GL_TRIANGLES);
 ///////////////////////////////////////////////////
 void Meshes::UCreateTorusMesh(GLMesh &mesh)
 {
@@ -1426,7 +1445,7 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 	std::vector<GLfloat> combined_values;
 
 	// combine interleaved vertices, normals, and texture coords
-	for (int i = 0; i < vertex_list.size(); i++)
+	for (size_t i = 0; i < vertex_list.size(); i++)
 	{
 		vertex = vertex_list[i];
 		normal = normals_list[i];
@@ -1446,18 +1465,18 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 	const GLuint floatsPerNormal = 3;
 	const GLuint floatsPerUV = 2;
 
-	// store vertex and index count
+	// store vertex count before welding
 	mesh.nVertices = vertex_list.size();
-	mesh.nIndices = 0;
 
 	// Create VAO
 	glGenVertexArrays(1, &mesh.vao); // we can also generate multiple VAOs or buffers at the same time
 	glBindVertexArray(mesh.vao);
 
 	// Create VBOs
-	glGenBuffers(1, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	// Weld duplicated vertices and send the compacted vertices plus clustered indices to the GPU
+	UBufferWeldedData(mesh, "torus", combined_values.data(), floatsPerVertex + floatsPerNormal + floatsPerUV, true);
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -1482,7 +1501,7 @@ void Meshes::UCreateTorusMesh(GLMesh &mesh)
 //
 //  Correct triangle drawing command:
 //
-//	glDrawElements(GL_TRIANGLES, meshes.gSphereMesh.nIndices, GL_UNSIGNED_INT, (void*)0);
+//	meshes.DrawMesh(meshes.gSphereMesh, GL_TRIANGLES);
 ///////////////////////////////////////////////////
 void Meshes::UCreateSphereMesh(GLMesh &mesh)
 {
@@ -2280,7 +2299,7 @@ void Meshes::UCreateSphereMesh(GLMesh &mesh)
 	std::vector<GLfloat> combined_values;
 
 	// combine interleaved vertices, normals, and texture coords
-	for (int i = 0; i < sizeof(verts) / (sizeof(verts[0])); i += 3)
+	for (size_t i = 0; i < sizeof(verts) / (sizeof(verts[0])); i += 3)
 	{
 		vert = glm::vec3(verts[i], verts[i + 1], verts[i + 2]);
 		normal = normalize(vert - center);
@@ -2301,12 +2320,12 @@ void Meshes::UCreateSphereMesh(GLMesh &mesh)
 	glBindVertexArray(mesh.vao);
 
 	// Create VBOs
-	glGenBuffers(2, mesh.vbos);
+	UGenBuffers(mesh, 2);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbos[0]); // Activates the vertex buffer
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data(), GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(GLfloat) * combined_values.size(), combined_values.data()); // Sends vertex or coordinate data to the GPU
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	UBufferClusteredIndices(mesh, indices, sizeof(indices) / sizeof(indices[0]));
 
 	// Strides between vertex coordinates
 	GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);
@@ -2322,8 +2341,320 @@ void Meshes::UCreateSphereMesh(GLMesh &mesh)
 	glEnableVertexAttribArray(2);
 }
 
+///////////////////////////////////////////////////
+//	DrawMesh(const GLMesh&, GLenum, GLint, GLsizei)
+//
+//	Draw count vertices starting at first, the same range glDrawArrays
+//	takes. Indexed meshes are drawn through their index buffer instead.
+//	Pooled meshes are looked up on every call because Compact() may have
+//	moved them since the last frame.
+///////////////////////////////////////////////////
+void Meshes::DrawMesh(const GLMesh &mesh, GLenum mode, GLint first, GLsizei count) const
+{
+	GLint baseVertex = 0;
+	GLintptr indexOffset = 0;
+	if (mesh.vertexAlloc != 0)
+		baseVertex = (GLint)(mBufferPool->Offset(mesh.vertexAlloc) / VERTEX_STRIDE);
+	if (mesh.indexAlloc != 0)
+		indexOffset = mBufferPool->Offset(mesh.indexAlloc);
+
+	if (mesh.nIndices > 0)
+		glDrawElementsBaseVertex(mode, count, GL_UNSIGNED_INT, (void*)(indexOffset + sizeof(GLuint) * first), baseVertex);
+	else
+		glDrawArrays(mode, baseVertex + first, count);
+}
+
+///////////////////////////////////////////////////
+//	DrawMesh(const GLMesh&, GLenum)
+//
+//	Draw every vertex of the mesh, indexed or not
+///////////////////////////////////////////////////
+void Meshes::DrawMesh(const GLMesh &mesh, GLenum mode) const
+{
+	DrawMesh(mesh, mode, 0, mesh.nIndices > 0 ? mesh.nIndices : mesh.nVertices);
+}
+
+///////////////////////////////////////////////////
+//	GetDrawCommand(const GLMesh&, GLint, GLsizei, GLuint)
+//
+//	The indirect command drawing the same range as DrawMesh(mesh, mode,
+//	first, count). Like DrawMesh() it resolves the pooled offsets at call
+//	time, so commands must be rebuilt after the pool compacts.
+///////////////////////////////////////////////////
+Meshes::DrawCommand Meshes::GetDrawCommand(const GLMesh &mesh, GLint first, GLsizei count, GLuint instanceCount) const
+{
+	GLint baseVertex = 0;
+	GLuint firstIndex = 0;
+	if (mesh.vertexAlloc != 0)
+		baseVertex = (GLint)(mBufferPool->Offset(mesh.vertexAlloc) / VERTEX_STRIDE);
+	if (mesh.indexAlloc != 0)
+		firstIndex = (GLuint)(mBufferPool->Offset(mesh.indexAlloc) / sizeof(GLuint));
+
+	DrawCommand command;
+	command.count = count;
+	command.instanceCount = instanceCount;
+	command.baseInstance = 0;
+	if (mesh.nIndices > 0)
+	{
+		command.first = firstIndex + first;
+		command.baseVertex = baseVertex;
+	}
+	else
+	{
+		command.first = baseVertex + first;
+		command.baseVertex = 0;		// baseInstance of DrawArraysIndirectCommand
+	}
+	return command;
+}
+
+///////////////////////////////////////////////////
+//	DrawMeshIndirect(const GLMesh&, GLenum, GLintptr)
+//
+//	Draw with the DrawCommand at commandOffset in the buffer bound to
+//	GL_DRAW_INDIRECT_BUFFER, see GetDrawCommand()
+///////////////////////////////////////////////////
+void Meshes::DrawMeshIndirect(const GLMesh &mesh, GLenum mode, GLintptr commandOffset) const
+{
+	if (mesh.nIndices > 0)
+		glDrawElementsIndirect(mode, GL_UNSIGNED_INT, (void*)commandOffset);
+	else
+		glDrawArraysIndirect(mode, (void*)commandOffset);
+}
+
+///////////////////////////////////////////////////
+//	DrawMeshClusters(const GLMesh&, const glm::mat4&, const glm::mat4&, const glm::vec3&, bool)
+//
+//	model: model matrix the bound uniforms place the mesh with
+//	viewProjection: projection * view of the view being drawn
+//	eye: world-space camera position
+//	testCones: false for orthographic views, where the eye is not a point
+//
+//	The clusters are culled in object space: the planes come from the full
+//	clip matrix and the eye goes through the inverse model matrix. The
+//	surviving index ranges, neighbours merged, go out in one multi-draw.
+///////////////////////////////////////////////////
+unsigned int Meshes::DrawMeshClusters(const GLMesh &mesh, const glm::mat4 &model, const glm::mat4 &viewProjection, const glm::vec3 &eye, bool testCones) const
+{
+	glm::vec4 planes[FRUSTUM_PLANE_COUNT];
+	ExtractFrustumPlanes(viewProjection * model, planes);
+	glm::vec3 localEye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+	// a mirroring transform flips the winding, so the cone no longer applies
+	testCones = testCones && glm::determinant(glm::mat3(model)) > 0.0f;
+
+	GLint baseVertex = 0;
+	GLintptr indexOffset = 0;
+	if (mesh.vertexAlloc != 0)
+		baseVertex = (GLint)(mBufferPool->Offset(mesh.vertexAlloc) / VERTEX_STRIDE);
+	if (mesh.indexAlloc != 0)
+		indexOffset = mBufferPool->Offset(mesh.indexAlloc);
+
+	mClusterCounts.clear();
+	mClusterOffsets.clear();
+	unsigned int visible = 0;
+	unsigned int rangeEnd = ~0u;
+	for (const Meshlet &meshlet : mesh.meshlets)
+	{
+		if (!IsMeshletVisible(meshlet, planes, localEye, testCones))
+			continue;
+
+		++visible;
+		if (meshlet.indexOffset == rangeEnd)
+			mClusterCounts.back() += meshlet.indexCount;
+		else
+		{
+			mClusterCounts.push_back(meshlet.indexCount);
+			mClusterOffsets.push_back((const void*)(indexOffset + sizeof(GLuint) * meshlet.indexOffset));
+		}
+		rangeEnd = meshlet.indexOffset + meshlet.indexCount;
+	}
+
+	if (mClusterCounts.empty())
+		return 0;
+
+	mClusterBaseVertices.assign(mClusterCounts.size(), baseVertex);
+	glMultiDrawElementsBaseVertex(GL_TRIANGLES, mClusterCounts.data(), GL_UNSIGNED_INT, mClusterOffsets.data(),
+		(GLsizei)mClusterCounts.size(), mClusterBaseVertices.data());
+	return visible;
+}
+
+///////////////////////////////////////////////////
+//	IsResident(const GLMesh&)
+//
+//	Returns true once every buffer of the mesh holds its real data
+///////////////////////////////////////////////////
+bool Meshes::IsResident(const GLMesh &mesh) const
+{
+	return mUploadQueue == nullptr || mUploadQueue->IsReady(mesh.uploadTicket);
+}
+
+///////////////////////////////////////////////////
+//	UBufferData(GLMesh&, GLenum, GLsizeiptr, const void*)
+//
+//	Fill the buffer currently bound to target (one of the mesh's vbos).
+//	Vertex data also sets the mesh's bounding box, and both vertex
+//	positions and indices are kept on the CPU for picking.
+//	Without an upload queue this is plain glBufferData. With one, zeroed
+//	storage is allocated now and the real data is copied in when the queue
+//	gets to it; until IsResident() the mesh would draw as degenerate
+//	triangles, so callers draw gBoxMesh over its bounds instead.
+//
+//	With a buffer pool the data goes into a range of a shared pool buffer
+//	instead, which is left bound to target. Vertex ranges are aligned to
+//	the vertex stride so DrawMesh() can address them with a base vertex.
+///////////////////////////////////////////////////
+void Meshes::UBufferData(GLMesh &mesh, GLenum target, GLsizeiptr size, const void* data)
+{
+	if (target == GL_ARRAY_BUFFER)
+		UStorePositions(mesh, (const GLfloat*)data, size / VERTEX_STRIDE);
+	else
+		mesh.indices.assign((const GLuint*)data, (const GLuint*)data + size / sizeof(GLuint));
+
+	if (mBufferPool != nullptr)
+	{
+		bool isIndex = (target == GL_ELEMENT_ARRAY_BUFFER);
+		BufferHandle handle = isIndex
+			? mBufferPool->Allocate(size, sizeof(GLuint))
+			: mBufferPool->Allocate(size, VERTEX_STRIDE);
+		if (isIndex)
+			mesh.indexAlloc = handle;
+		else
+			mesh.vertexAlloc = handle;
+
+		GLuint buffer = mBufferPool->Buffer(handle);
+		GLintptr offset = mBufferPool->Offset(handle);
+		glBindBuffer(target, buffer);
+		if (mUploadQueue == nullptr)
+		{
+			glBufferSubData(target, offset, size, data);
+			return;
+		}
+
+		glClearBufferSubData(target, GL_R8, offset, size, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		mesh.uploadTicket = mUploadQueue->EnqueueBuffer(buffer, offset, data, size);
+		return;
+	}
+
+	if (mUploadQueue == nullptr)
+	{
+		glBufferData(target, size, data, GL_STATIC_DRAW);
+		return;
+	}
+
+	glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+	glClearBufferData(target, GL_R8, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+
+	GLuint buffer = (target == GL_ELEMENT_ARRAY_BUFFER) ? mesh.vbos[1] : mesh.vbos[0];
+	mesh.uploadTicket = mUploadQueue->EnqueueBuffer(buffer, 0, data, size);
+}
+
+///////////////////////////////////////////////////
+//	UBufferWeldedData(GLMesh&, const char*, const GLfloat*, GLuint)
+//
+//	mesh: mesh whose VAO and vbos are bound, nVertices holds the raw count
+//	name: primitive name used in the savings report
+//	verts: interleaved, unindexed vertex data
+//	floatsPerVertex: stride of one vertex in floats
+//	clustered: the mesh is a triangle list, split its indices into meshlets
+//
+//	Weld the vertices, upload the compacted array and the index buffer
+//	and report how much was saved. When welding would not save memory the
+//	original array is uploaded as is and nIndices stays 0.
+///////////////////////////////////////////////////
+void Meshes::UBufferWeldedData(GLMesh &mesh, const char* name, const GLfloat* verts, GLuint floatsPerVertex, bool clustered)
+{
+	WeldResult weld = WeldVertices(verts, mesh.nVertices, floatsPerVertex, weldEpsilon);
+
+	std::cout << "INFO: Welded " << name << ": " << weld.inputVertices << " -> " << weld.outputVertices
+		<< " vertices, " << weld.inputBytes << " -> " << weld.outputBytes << " bytes ("
+		<< (long long)weld.inputBytes - (long long)weld.outputBytes << " saved)";
+
+	// tables with few duplicates grow once the index buffer is added, keep those unindexed
+	if (weld.outputBytes >= weld.inputBytes)
+	{
+		std::cout << ", kept unindexed" << std::endl;
+		mesh.nIndices = 0;
+		UBufferData(mesh, GL_ARRAY_BUFFER, weld.inputBytes, verts);
+		return;
+	}
+	std::cout << std::endl;
+
+	mesh.nVertices = weld.outputVertices;
+	mesh.nIndices = weld.indices.size();
+
+	UBufferData(mesh, GL_ARRAY_BUFFER, sizeof(GLfloat) * weld.vertices.size(), weld.vertices.data());
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.vbos[1]); // Activates the index buffer
+	if (clustered)
+		UBufferClusteredIndices(mesh, weld.indices.data(), weld.indices.size());
+	else
+		UBufferData(mesh, GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * weld.indices.size(), weld.indices.data());
+}
+
+///////////////////////////////////////////////////
+//	UBufferClusteredIndices(GLMesh&, const GLuint*, size_t)
+//
+//	Split a triangle list into meshlets over the positions the vertex data
+//	stored, and upload the indices in the cluster order that leaves each
+//	meshlet a contiguous range. Call after the vertex data is buffered.
+///////////////////////////////////////////////////
+void Meshes::UBufferClusteredIndices(GLMesh &mesh, const GLuint* indices, size_t count)
+{
+	std::vector<unsigned int> clustered(indices, indices + count);
+	mesh.meshlets.clear();
+	if (!mesh.positions.empty())
+		mesh.meshlets = BuildMeshlets(&mesh.positions[0].x, 3, mesh.positions.size(), clustered);
+
+	UBufferData(mesh, GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * clustered.size(), clustered.data());
+}
+
+///////////////////////////////////////////////////
+//	UGenBuffers(GLMesh&, GLsizei)
+//
+//	Create count buffer objects for the mesh, or none when its data will
+//	live in the buffer pool
+///////////////////////////////////////////////////
+void Meshes::UGenBuffers(GLMesh &mesh, GLsizei count)
+{
+	mesh.vbos[0] = mesh.vbos[1] = 0;
+	mesh.vertexAlloc = mesh.indexAlloc = 0;
+	mesh.uploadTicket = 0;
+	if (mBufferPool == nullptr)
+		glGenBuffers(count, mesh.vbos);
+}
+
+///////////////////////////////////////////////////
+//	UStorePositions(GLMesh&, const GLfloat*, size_t)
+//
+//	Keep the positions of interleaved vertex data on the CPU and store
+//	the box around them
+///////////////////////////////////////////////////
+void Meshes::UStorePositions(GLMesh &mesh, const GLfloat* verts, size_t vertexCount)
+{
+	const size_t floatsPerVertex = VERTEX_STRIDE / sizeof(GLfloat);
+
+	mesh.positions.resize(vertexCount);
+	mesh.bounds.min = glm::vec3(0.0f);
+	mesh.bounds.max = glm::vec3(0.0f);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		glm::vec3 position(verts[i * floatsPerVertex], verts[i * floatsPerVertex + 1], verts[i * floatsPerVertex + 2]);
+		mesh.positions[i] = position;
+		if (i == 0)
+			mesh.bounds.min = mesh.bounds.max = position;
+		mesh.bounds.min = glm::min(mesh.bounds.min, position);
+		mesh.bounds.max = glm::max(mesh.bounds.max, position);
+	}
+}
+
 void Meshes::UDestroyMesh(GLMesh &mesh)
 {
 	glDeleteVertexArrays(1, &mesh.vao);
 	glDeleteBuffers(2, mesh.vbos);
+	if (mBufferPool != nullptr)
+	{
+		mBufferPool->Free(mesh.vertexAlloc);
+		mBufferPool->Free(mesh.indexAlloc);
+	}
+	mesh.positions.clear();
+	mesh.indices.clear();
+	mesh.meshlets.clear();
 }
\ No newline at end of file
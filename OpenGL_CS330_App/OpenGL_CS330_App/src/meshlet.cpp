@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+//  meshlet.cpp
+//  ===========
+//  Greedy meshlet builder with bounding sphere and normal cone per cluster
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "meshlet.h"
+#include "frustum.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Fetch the position of vertex i from a strided float array
+	inline glm::vec3 Position(const float* positions, size_t stride, unsigned int i)
+	{
+		const float* p = positions + stride * i;
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	// Ritter's bounding sphere over the vertices referenced by the cluster
+	void ComputeBoundingSphere(const std::vector<glm::vec3>& points, glm::vec3& center, float& radius)
+	{
+		// start with the two points furthest apart along a pair of sweeps
+		glm::vec3 a = points[0];
+		glm::vec3 b = a;
+		float best = -1.0f;
+		for (const glm::vec3& p : points)
+		{
+			float d = glm::dot(p - a, p - a);
+			if (d > best) { best = d; b = p; }
+		}
+		glm::vec3 c = b;
+		best = -1.0f;
+		for (const glm::vec3& p : points)
+		{
+			float d = glm::dot(p - b, p - b);
+			if (d > best) { best = d; c = p; }
+		}
+
+		center = (b + c) * 0.5f;
+		radius = glm::length(c - b) * 0.5f;
+
+		// grow the sphere until it contains every point
+		for (const glm::vec3& p : points)
+		{
+			float d = glm::length(p - center);
+			if (d > radius)
+			{
+				float newRadius = (radius + d) * 0.5f;
+				center += (p - center) * ((newRadius - radius) / d);
+				radius = newRadius;
+			}
+		}
+	}
+
+	// Fill in the sphere and cone bounds for the triangles [first, first + count)
+	void ComputeBounds(Meshlet& meshlet, const float* positions, size_t stride, const std::vector<unsigned int>& indices)
+	{
+		std::vector<glm::vec3> points;
+		std::vector<glm::vec3> normals;
+		std::vector<glm::vec3> corners;
+		points.reserve(meshlet.indexCount);
+
+		glm::vec3 normalSum(0.0f);
+		for (unsigned int i = meshlet.indexOffset; i < meshlet.indexOffset + meshlet.indexCount; i += 3)
+		{
+			glm::vec3 p0 = Position(positions, stride, indices[i]);
+			glm::vec3 p1 = Position(positions, stride, indices[i + 1]);
+			glm::vec3 p2 = Position(positions, stride, indices[i + 2]);
+			points.push_back(p0);
+			points.push_back(p1);
+			points.push_back(p2);
+
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float len = glm::length(n);
+			if (len <= 0.0f)
+				continue;	// degenerate triangles never face the camera
+			n /= len;
+			normals.push_back(n);
+			corners.push_back(p0);
+			normalSum += n;
+		}
+
+		ComputeBoundingSphere(points, meshlet.center, meshlet.radius);
+
+		// Normal cone: disabled unless every triangle faces roughly the same way
+		meshlet.coneApex = meshlet.center;
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+
+		float sumLength = glm::length(normalSum);
+		if (normals.empty() || sumLength <= 0.0f)
+			return;
+
+		glm::vec3 axis = normalSum / sumLength;
+		float minDot = 1.0f;
+		for (const glm::vec3& n : normals)
+			minDot = std::min(minDot, glm::dot(axis, n));
+
+		// a spread wider than ~84 degrees makes the cone useless and numerically unstable
+		if (minDot <= 0.1f)
+			return;
+
+		// move the apex back along the axis so every triangle plane is in front of it
+		float maxT = 0.0f;
+		for (size_t i = 0; i < normals.size(); ++i)
+		{
+			float dc = glm::dot(meshlet.center - corners[i], normals[i]);
+			float dn = glm::dot(axis, normals[i]);
+			maxT = std::max(maxT, dc / dn);
+		}
+
+		meshlet.coneApex = meshlet.center - axis * maxT;
+		meshlet.coneAxis = axis;
+		meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+}
+
+///////////////////////////////////////////////////
+//	BuildMeshlets(...)
+//
+//	Walks the triangle list in order and starts a new cluster whenever the
+//	next triangle would push the current one past the vertex or triangle
+//	limit. Triangles are written back grouped by cluster.
+///////////////////////////////////////////////////
+std::vector<Meshlet> BuildMeshlets(const float* positions, size_t stride, size_t vertexCount, std::vector<unsigned int>& indices)
+{
+	std::vector<Meshlet> meshlets;
+	if (indices.size() < 3 || vertexCount == 0)
+		return meshlets;
+
+	// stamp[v] == current cluster id when vertex v is already part of the cluster
+	std::vector<unsigned int> stamp(vertexCount, ~0u);
+	std::vector<unsigned int> reordered;
+	reordered.reserve(indices.size());
+
+	Meshlet current = {};
+	unsigned int clusterId = 0;
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		unsigned int a = indices[i];
+		unsigned int b = indices[i + 1];
+		unsigned int c = indices[i + 2];
+
+		// count the distinct vertices this triangle would add to the cluster
+		unsigned int newVertices = 0;
+		if (stamp[a] != clusterId) ++newVertices;
+		if (stamp[b] != clusterId && b != a) ++newVertices;
+		if (stamp[c] != clusterId && c != a && c != b) ++newVertices;
+
+		bool full = current.vertexCount + newVertices > MESHLET_MAX_VERTICES
+			|| current.indexCount / 3 + 1 > MESHLET_MAX_TRIANGLES;
+		if (full && current.indexCount > 0)
+		{
+			meshlets.push_back(current);
+			current = Meshlet();
+			current.indexOffset = (unsigned int)reordered.size();
+			++clusterId;
+		}
+
+		for (unsigned int v : { a, b, c })
+		{
+			if (stamp[v] != clusterId)
+			{
+				stamp[v] = clusterId;
+				++current.vertexCount;
+			}
+			reordered.push_back(v);
+		}
+		current.indexCount += 3;
+	}
+
+	if (current.indexCount > 0)
+		meshlets.push_back(current);
+
+	indices.swap(reordered);
+
+	for (Meshlet& meshlet : meshlets)
+		ComputeBounds(meshlet, positions, stride, indices);
+
+	return meshlets;
+}
+
+///////////////////////////////////////////////////
+//	IsMeshletVisible(...)
+//
+//	Sphere against the six planes, then the normal cone: the cluster is
+//	backfacing when the eye lies inside the negative cone behind the apex.
+///////////////////////////////////////////////////
+bool IsMeshletVisible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& eye, bool testCone)
+{
+	if (!SphereInFrustum(planes, meshlet.center, meshlet.radius))
+		return false;
+
+	if (testCone && meshlet.coneCutoff < 1.0f)
+	{
+		glm::vec3 toApex = meshlet.coneApex - eye;
+		float len = glm::length(toApex);
+		if (len > 0.0f && glm::dot(toApex / len, meshlet.coneAxis) >= meshlet.coneCutoff)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,346 @@
+///////////////////////////////////////////////////////////////////////////////
+//  mipgenerator.cpp
+//  ================
+//  CPU mipmap generation.
+//
+//  Every level is filtered from the one above it, kept in float with
+//  linear color premultiplied by alpha. Linear color keeps dark and light
+//  detail in balance where averaging sRGB values darkens it, and
+//  premultiplying keeps the color of fully transparent texels from
+//  bleeding into their neighbours. Only the copy written out is converted
+//  back to straight alpha and 8 bits.
+//
+//  Filters are separable: each axis gets a table of source texels and
+//  weights per destination texel, built for the level's exact size
+//  ratio, so odd sizes are handled the same way as even ones. Sampling
+//  wraps around the edges, as GL_REPEAT does. Rows are filtered one RGBA
+//  texel per SSE vector; columns accumulate whole rows at once, two
+//  texels per AVX vector.
+//
+//  With an alpha cutoff, alpha in each level is scaled until the share of
+//  texels passing the alpha test matches level 0, so alpha tested
+//  foliage and fences don't thin out in the distance.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "mipgenerator.h"
+
+#include "imageprep.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+	// Half width of the Kaiser filter in texels of the smaller level, and its window shape
+	const float KAISER_WIDTH = 3.0f;
+	const float KAISER_ALPHA = 4.0f;
+
+	// Modified Bessel function of the first kind, order 0, from its power series
+	float UBesselI0(float x)
+	{
+		float sum = 1.0f, term = 1.0f;
+		for (int k = 1; k < 32 && term > 1e-7f * sum; ++k)
+		{
+			float factor = x / (2.0f * k);
+			term *= factor * factor;
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Weight of a source texel t texels of the smaller level away from the destination center
+	float UFilterWeight(MipFilter filter, float t)
+	{
+		t = std::fabs(t);
+		if (filter == MIP_FILTER_BOX)
+			return t < 0.5f ? 1.0f : (t == 0.5f ? 0.5f : 0.0f);
+		if (t >= KAISER_WIDTH)
+			return 0.0f;
+		float sinc = t > 0.0f ? std::sin(PI * t) / (PI * t) : 1.0f;
+		float r = t / KAISER_WIDTH;
+		return sinc * UBesselI0(KAISER_ALPHA * std::sqrt(1.0f - r * r)) / UBesselI0(KAISER_ALPHA);
+	}
+
+	// Source texels and weights of every destination texel along one axis
+	struct Taps
+	{
+		int count;					// Per destination texel; zero weights pad the short ones
+		std::vector<int> indices;	// Already wrapped into the source
+		std::vector<float> weights;	// Normalized to sum to one
+	};
+
+	void UBuildTaps(int sourceSize, int size, MipFilter filter, Taps& taps)
+	{
+		float scale = (float)sourceSize / size;
+		float radius = (filter == MIP_FILTER_BOX ? 0.5f : KAISER_WIDTH) * scale;
+		taps.count = (int)std::ceil(radius * 2.0f) + 1;
+		taps.indices.assign((size_t)size * taps.count, 0);
+		taps.weights.assign((size_t)size * taps.count, 0.0f);
+
+		for (int x = 0; x < size; ++x)
+		{
+			float center = (x + 0.5f) * scale;
+			int first = (int)std::floor(center - radius);
+			float total = 0.0f;
+			for (int k = 0; k < taps.count; ++k)
+			{
+				int source = first + k;
+				float weight = UFilterWeight(filter, (source + 0.5f - center) / scale);
+				taps.indices[(size_t)x * taps.count + k] = ((source % sourceSize) + sourceSize) % sourceSize;
+				taps.weights[(size_t)x * taps.count + k] = weight;
+				total += weight;
+			}
+			for (int k = 0; k < taps.count; ++k)
+				taps.weights[(size_t)x * taps.count + k] /= total;
+		}
+
+		// Drop the taps that are zero for every texel, at either end; an
+		// exact halving with the box filter needs two, not three
+		int lead = taps.count, trail = taps.count;
+		for (int x = 0; x < size; ++x)
+		{
+			const float* weights = &taps.weights[(size_t)x * taps.count];
+			int first = 0, last = taps.count - 1;
+			while (first < last && weights[first] == 0.0f)
+				++first;
+			while (last > first && weights[last] == 0.0f)
+				--last;
+			lead = std::min(lead, first);
+			trail = std::min(trail, taps.count - 1 - last);
+		}
+		int count = taps.count - lead - trail;
+		for (int x = 0; x < size; ++x)
+		{
+			for (int k = 0; k < count; ++k)
+			{
+				taps.indices[(size_t)x * count + k] = taps.indices[(size_t)x * taps.count + lead + k];
+				taps.weights[(size_t)x * count + k] = taps.weights[(size_t)x * taps.count + lead + k];
+			}
+		}
+		taps.count = count;
+		taps.indices.resize((size_t)size * count);
+		taps.weights.resize((size_t)size * count);
+	}
+
+	// Alpha broadcast to every lane of a texel, except 1 in the alpha lane itself
+	inline __m128 UAlphaFactor(__m128 texel)
+	{
+		const __m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+		__m128 alpha = _mm_shuffle_ps(texel, texel, _MM_SHUFFLE(3, 3, 3, 3));
+		return _mm_or_ps(_mm_andnot_ps(alphaLane, alpha), _mm_and_ps(alphaLane, _mm_set1_ps(1.0f)));
+	}
+
+	// 8-bit texels to premultiplied linear floats, one texel per vector
+	void UToLinear(const unsigned char* rgba, size_t texels, bool srgb, float* linear)
+	{
+		if (srgb)
+			SRGBToLinear(rgba, texels, linear);
+		const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+		const __m128i zero = _mm_setzero_si128();
+		for (size_t i = 0; i < texels; ++i)
+		{
+			__m128 texel;
+			if (srgb)
+				texel = _mm_loadu_ps(linear + i * 4);
+			else
+			{
+				int packed;
+				memcpy(&packed, rgba + i * 4, sizeof(packed));
+				__m128i codes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+				texel = _mm_mul_ps(_mm_cvtepi32_ps(codes), scale);
+			}
+			_mm_storeu_ps(linear + i * 4, _mm_mul_ps(texel, UAlphaFactor(texel)));
+		}
+	}
+
+	// One row filtered horizontally into width texels
+	void UFilterRow(const float* source, const Taps& taps, int width, float* row)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			const int* indices = &taps.indices[(size_t)x * taps.count];
+			const float* weights = &taps.weights[(size_t)x * taps.count];
+			__m128 sum = _mm_setzero_ps();
+			for (int k = 0; k < taps.count; ++k)
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + (size_t)indices[k] * 4)));
+			_mm_storeu_ps(row + (size_t)x * 4, sum);
+		}
+	}
+
+	///////////////////////////////////////////////////
+	//	UFilterColumns(const float*, const Taps&, int, int, float*)
+	//
+	//	Filters the horizontally filtered rows down to height rows of
+	//	level. Results are clamped to premultiplied range, color no
+	//	brighter than alpha, so the Kaiser filter's ringing does not build
+	//	up from level to level.
+	///////////////////////////////////////////////////
+	void UFilterColumns(const float* rows, const Taps& taps, int width, int height, float* level)
+	{
+		const size_t rowFloats = (size_t)width * 4;
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (int y = 0; y < height; ++y)
+		{
+			float* out = level + (size_t)y * rowFloats;
+			memset(out, 0, rowFloats * sizeof(float));
+			for (int k = 0; k < taps.count; ++k)
+			{
+				float weight = taps.weights[(size_t)y * taps.count + k];
+				const float* row = rows + (size_t)taps.indices[(size_t)y * taps.count + k] * rowFloats;
+				size_t i = 0;
+#if defined(__AVX__)
+				__m256 weight8 = _mm256_set1_ps(weight);
+				for (; i + 8 <= rowFloats; i += 8)
+					_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(weight8, _mm256_loadu_ps(row + i))));
+#endif
+				__m128 weight4 = _mm_set1_ps(weight);
+				for (; i < rowFloats; i += 4)
+					_mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(weight4, _mm_loadu_ps(row + i))));
+			}
+
+			for (int x = 0; x < width; ++x)
+			{
+				__m128 texel = _mm_loadu_ps(out + (size_t)x * 4);
+				__m128 alpha = _mm_min_ps(_mm_max_ps(_mm_shuffle_ps(texel, texel, _MM_SHUFFLE(3, 3, 3, 3)), zero), one);
+				_mm_storeu_ps(out + (size_t)x * 4, _mm_min_ps(_mm_max_ps(texel, zero), alpha));
+			}
+		}
+	}
+
+	// Share of texels whose alpha, scaled, passes the alpha test at cutoff
+	float UCoverage(const float* linear, size_t texels, float cutoff, float scale)
+	{
+		size_t passing = 0;
+		for (size_t i = 0; i < texels; ++i)
+			passing += linear[i * 4 + 3] * scale > cutoff;
+		return (float)passing / texels;
+	}
+
+	// Alpha scale giving level the coverage of level 0, found by bisection
+	float UCoverageScale(const float* linear, size_t texels, float cutoff, float coverage)
+	{
+		float low = 0.0f, high = 4.0f;
+		while (UCoverage(linear, texels, cutoff, high) < coverage && high < 256.0f)
+			high *= 2.0f;
+		for (int step = 0; step < 16; ++step)
+		{
+			float middle = (low + high) * 0.5f;
+			if (UCoverage(linear, texels, cutoff, middle) < coverage)
+				low = middle;
+			else
+				high = middle;
+		}
+		return high;
+	}
+
+	// Premultiplied linear floats back to straight 8-bit texels, alpha scaled by alphaScale
+	void UToBytes(const float* linear, size_t texels, bool srgb, float alphaScale, std::vector<float>& straight, unsigned char* rgba)
+	{
+		straight.resize(texels * 4);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 alphaLane = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+		const __m128 alphaScales = _mm_setr_ps(1.0f, 1.0f, 1.0f, alphaScale);
+		for (size_t i = 0; i < texels; ++i)
+		{
+			__m128 texel = _mm_loadu_ps(linear + i * 4);
+			__m128 factor = UAlphaFactor(texel);
+			// Fully transparent texels have no color left to recover
+			__m128 visible = _mm_cmpgt_ps(factor, zero);
+			__m128 color = _mm_and_ps(_mm_div_ps(texel, _mm_or_ps(factor, _mm_andnot_ps(visible, one))), visible);
+			color = _mm_or_ps(_mm_andnot_ps(alphaLane, color), _mm_and_ps(alphaLane, texel));
+			_mm_storeu_ps(&straight[i * 4], _mm_min_ps(_mm_mul_ps(color, alphaScales), one));
+		}
+
+		if (srgb)
+		{
+			LinearToSRGB(straight.data(), texels, rgba);
+			return;
+		}
+		const __m128 scale = _mm_set1_ps(255.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		for (size_t i = 0; i < texels; ++i)
+		{
+			__m128i codes = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_max_ps(_mm_loadu_ps(&straight[i * 4]), zero), scale), half));
+			codes = _mm_packs_epi32(codes, codes);
+			int packed = _mm_cvtsi128_si32(_mm_packus_epi16(codes, codes));
+			memcpy(rgba + i * 4, &packed, sizeof(packed));
+		}
+	}
+}
+
+uint32_t MipSettingsKey(const MipSettings& settings)
+{
+	uint32_t cutoff = (uint32_t)std::lround(std::min(std::max(settings.alphaCutoff, 0.0f), 1.0f) * 255.0f);
+	return (uint32_t)settings.filter | ((uint32_t)settings.srgb << 8) | (cutoff << 16);
+}
+
+///////////////////////////////////////////////////
+//	GenerateMipChain(const unsigned char*, int, int, const MipSettings&, ...)
+//
+//	Level 0 is never held in float: its rows are converted one at a time
+//	as the first level is filtered from them.
+///////////////////////////////////////////////////
+void GenerateMipChain(const unsigned char* rgba, int width, int height, const MipSettings& settings, std::vector<unsigned char>& levels, std::vector<GLsizei>& levelSizes)
+{
+	size_t texels = (size_t)width * height;
+	levels.assign(rgba, rgba + texels * 4);
+	levelSizes.assign(1, (GLsizei)(texels * 4));
+
+	float coverage = 0.0f;
+	if (settings.alphaCutoff > 0.0f)
+	{
+		size_t passing = 0;
+		for (size_t i = 0; i < texels; ++i)
+			passing += rgba[i * 4 + 3] * (1.0f / 255.0f) > settings.alphaCutoff;
+		coverage = (float)passing / texels;
+	}
+	// With nothing or everything passing there is no edge to keep in place
+	bool keepCoverage = coverage > 0.0f && coverage < 1.0f;
+
+	std::vector<float> current, next, rows, straight, sourceRow((size_t)width * 4);
+	Taps tapsX, tapsY;
+	while (width > 1 || height > 1)
+	{
+		int levelWidth = std::max(width / 2, 1);
+		int levelHeight = std::max(height / 2, 1);
+		size_t levelTexels = (size_t)levelWidth * levelHeight;
+
+		UBuildTaps(width, levelWidth, settings.filter, tapsX);
+		UBuildTaps(height, levelHeight, settings.filter, tapsY);
+		rows.resize((size_t)levelWidth * height * 4);
+		for (int y = 0; y < height; ++y)
+		{
+			const float* source = current.data() + (size_t)y * width * 4;
+			if (current.empty())
+			{
+				UToLinear(rgba + (size_t)y * width * 4, width, settings.srgb, sourceRow.data());
+				source = sourceRow.data();
+			}
+			UFilterRow(source, tapsX, levelWidth, rows.data() + (size_t)y * levelWidth * 4);
+		}
+		next.resize(levelTexels * 4);
+		UFilterColumns(rows.data(), tapsY, levelWidth, levelHeight, next.data());
+
+		float alphaScale = keepCoverage ? UCoverageScale(next.data(), levelTexels, settings.alphaCutoff, coverage) : 1.0f;
+		size_t offset = levels.size();
+		levels.resize(offset + levelTexels * 4);
+		UToBytes(next.data(), levelTexels, settings.srgb, alphaScale, straight, levels.data() + offset);
+		levelSizes.push_back((GLsizei)(levelTexels * 4));
+
+		current.swap(next);
+		width = levelWidth;
+		height = levelHeight;
+	}
+}
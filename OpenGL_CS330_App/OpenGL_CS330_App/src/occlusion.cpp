@@ -0,0 +1,398 @@
+///////////////////////////////////////////////////////////////////////////////
+//  occlusion.cpp
+//  =============
+//  Software occlusion culling on a 256x128 depth buffer.
+//
+//  A handful of large occluders are clipped against the near plane and set
+//  up as edge and depth planes on one thread. The buffer is then split into
+//  horizontal bands, one per thread, and every thread walks all triangles
+//  over its own rows, so no two threads ever touch the same pixel. Each step
+//  evaluates the three edge functions for eight pixels (AVX, four with SSE),
+//  turns them into a coverage mask and keeps the nearest depth under it.
+//  Coverage is conservative: the edges are moved half a pixel inwards, so
+//  a pixel only counts as covered when the whole pixel is, and its depth
+//  is the farthest the triangle reaches inside it. An occludee is never
+//  hidden by a sliver of occluder that only crosses a pixel center.
+//
+//  Occludees are tested by projecting their box to a screen rectangle and
+//  nearest depth: the box is hidden when every pixel of the rectangle holds
+//  something nearer. All of this happens before any GL call, without
+//  waiting on the GPU.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "occlusion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	// Triangles with less screen area than this (in pixels squared) are dropped
+	const float MIN_AREA = 1e-6f;
+
+	// Corner i of a box; bit 0 selects max.x, bit 1 max.y, bit 2 max.z
+	glm::vec3 BoxCorner(const AABB& box, int i)
+	{
+		return glm::vec3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+	}
+
+	// Triangles of a box as corner indices, two per face
+	const int BOX_TRIANGLES[12][3] = {
+		{ 0, 2, 3 }, { 0, 3, 1 },	// -z
+		{ 4, 5, 7 }, { 4, 7, 6 },	// +z
+		{ 0, 1, 5 }, { 0, 5, 4 },	// -y
+		{ 2, 6, 7 }, { 2, 7, 3 },	// +y
+		{ 0, 4, 6 }, { 0, 6, 2 },	// -x
+		{ 1, 3, 7 }, { 1, 7, 5 },	// +x
+	};
+}
+
+OcclusionRasterizer::OcclusionRasterizer()
+	: mViewProjection(1.0f), mBandCount(1), mGeneration(0), mPending(0), mQuit(false)
+{
+	std::fill(mDepth, mDepth + WIDTH * HEIGHT, 1.0f);
+}
+
+OcclusionRasterizer::~OcclusionRasterizer()
+{
+	Destroy();
+}
+
+void OcclusionRasterizer::Initialize(int threadCount)
+{
+	Destroy();
+
+	if (threadCount <= 0)
+		threadCount = (int)std::thread::hardware_concurrency();
+	mBandCount = std::min(std::max(threadCount, 1), MAX_THREADS);
+
+	mQuit = false;
+	mGeneration = 0;
+	for (int band = 1; band < mBandCount; ++band)
+		mWorkers.push_back(std::thread(&OcclusionRasterizer::WorkerLoop, this, band));
+}
+
+void OcclusionRasterizer::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+	for (std::thread& worker : mWorkers)
+		worker.join();
+	mWorkers.clear();
+	mBandCount = 1;
+}
+
+void OcclusionRasterizer::BeginFrame(const glm::mat4& viewProjection)
+{
+	mViewProjection = viewProjection;
+	mClipVertices.clear();
+}
+
+void OcclusionRasterizer::AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	mClipVertices.push_back(mViewProjection * glm::vec4(a, 1.0f));
+	mClipVertices.push_back(mViewProjection * glm::vec4(b, 1.0f));
+	mClipVertices.push_back(mViewProjection * glm::vec4(c, 1.0f));
+}
+
+void OcclusionRasterizer::AddOccluder(const AABB& box, const glm::mat4& model)
+{
+	glm::vec3 corners[8];
+	for (int i = 0; i < 8; ++i)
+		corners[i] = glm::vec3(model * glm::vec4(BoxCorner(box, i), 1.0f));
+
+	for (const int* triangle : BOX_TRIANGLES)
+		AddTriangle(corners[triangle[0]], corners[triangle[1]], corners[triangle[2]]);
+}
+
+///////////////////////////////////////////////////
+//	SetupTriangle(const glm::vec4[3])
+//
+//	Clips one clip-space triangle against the near plane (z >= -w) and
+//	appends a Setup for each of the at most two triangles left. Beyond
+//	the near plane w is positive, so the other planes are handled by
+//	clamping the bounding rectangle to the buffer.
+///////////////////////////////////////////////////
+void OcclusionRasterizer::SetupTriangle(const glm::vec4 clip[3])
+{
+	glm::vec4 polygon[4];
+	int count = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		const glm::vec4& p = clip[i];
+		const glm::vec4& q = clip[(i + 1) % 3];
+		float dp = p.z + p.w;
+		float dq = q.z + q.w;
+		if (dp >= 0.0f)
+			polygon[count++] = p;
+		if ((dp >= 0.0f) != (dq >= 0.0f))
+			polygon[count++] = p + (q - p) * (dp / (dp - dq));
+	}
+
+	glm::vec3 screen[4];
+	for (int i = 0; i < count; ++i)
+	{
+		glm::vec3 ndc = glm::vec3(polygon[i]) / polygon[i].w;
+		screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+	}
+
+	for (int i = 2; i < count; ++i)
+	{
+		glm::vec3 v0 = screen[0];
+		glm::vec3 v1 = screen[i - 1];
+		glm::vec3 v2 = screen[i];
+
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		if (std::fabs(area) < MIN_AREA)
+			continue;
+		// Counter-clockwise from here on, so inside is where all edges are >= 0
+		if (area < 0.0f)
+		{
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		Setup setup;
+		const glm::vec3* vertices[3] = { &v0, &v1, &v2 };
+		for (int e = 0; e < 3; ++e)
+		{
+			const glm::vec3& from = *vertices[e];
+			const glm::vec3& to = *vertices[(e + 1) % 3];
+			setup.edgeA[e] = from.y - to.y;
+			setup.edgeB[e] = to.x - from.x;
+			setup.edgeC[e] = -(setup.edgeA[e] * from.x + setup.edgeB[e] * from.y);
+			// Half a pixel inwards: at a pixel center, the worst corner of the pixel is this far further out
+			setup.edgeC[e] -= 0.5f * (std::fabs(setup.edgeA[e]) + std::fabs(setup.edgeB[e]));
+		}
+
+		glm::vec3 d1 = v1 - v0;
+		glm::vec3 d2 = v2 - v0;
+		setup.depthA = (d1.z * d2.y - d2.z * d1.y) / area;
+		setup.depthB = (d2.z * d1.x - d1.z * d2.x) / area;
+		setup.depthC = v0.z - setup.depthA * v0.x - setup.depthB * v0.y;
+		// Likewise the farthest depth over the pixel rather than the one at its center
+		setup.depthC += 0.5f * (std::fabs(setup.depthA) + std::fabs(setup.depthB));
+
+		// Pixels whose center may be covered; the inset edges reject the ones only partly inside
+		setup.minX = std::max((int)std::ceil(std::min(std::min(v0.x, v1.x), v2.x) - 0.5f), 0);
+		setup.maxX = std::min((int)std::floor(std::max(std::max(v0.x, v1.x), v2.x) - 0.5f), WIDTH - 1);
+		setup.minY = std::max((int)std::ceil(std::min(std::min(v0.y, v1.y), v2.y) - 0.5f), 0);
+		setup.maxY = std::min((int)std::floor(std::max(std::max(v0.y, v1.y), v2.y) - 0.5f), HEIGHT - 1);
+		if (setup.minX > setup.maxX || setup.minY > setup.maxY)
+			continue;
+
+		mSetups.push_back(setup);
+	}
+}
+
+void OcclusionRasterizer::Rasterize()
+{
+	mSetups.clear();
+	for (size_t i = 0; i + 2 < mClipVertices.size(); i += 3)
+		SetupTriangle(&mClipVertices[i]);
+
+	if (!mWorkers.empty())
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mPending = (int)mWorkers.size();
+		++mGeneration;
+	}
+	mWake.notify_all();
+
+	// The calling thread takes the first band itself
+	RasterizeBand(0);
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock, [this] { return mPending == 0; });
+}
+
+void OcclusionRasterizer::WorkerLoop(int band)
+{
+	unsigned int generation = 0;
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		mWake.wait(lock, [&] { return mQuit || mGeneration != generation; });
+		if (mQuit)
+			return;
+		generation = mGeneration;
+
+		lock.unlock();
+		RasterizeBand(band);
+		lock.lock();
+
+		if (--mPending == 0)
+			mDone.notify_one();
+	}
+}
+
+///////////////////////////////////////////////////
+//	RasterizeBand(int)
+//
+//	Clears rows [band * HEIGHT / mBandCount, (band + 1) * HEIGHT / mBandCount)
+//	and draws every triangle over them
+///////////////////////////////////////////////////
+void OcclusionRasterizer::RasterizeBand(int band)
+{
+	const int firstRow = band * HEIGHT / mBandCount;
+	const int endRow = (band + 1) * HEIGHT / mBandCount;
+	std::fill(mDepth + firstRow * WIDTH, mDepth + endRow * WIDTH, 1.0f);
+
+#if defined(__AVX__)
+	const int LANES = 8;
+	const __m256 laneCenters = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+#else
+	const int LANES = 4;
+	const __m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+#endif
+
+	for (const Setup& setup : mSetups)
+	{
+		int minY = std::max(setup.minY, firstRow);
+		int maxY = std::min(setup.maxY, endRow - 1);
+		int startX = setup.minX & ~(LANES - 1);
+
+		for (int y = minY; y <= maxY; ++y)
+		{
+			float centerY = y + 0.5f;
+			float* row = mDepth + y * WIDTH;
+
+#if defined(__AVX__)
+			__m256 x = _mm256_add_ps(_mm256_set1_ps((float)startX), laneCenters);
+			__m256 edge[3], step[3];
+			for (int e = 0; e < 3; ++e)
+			{
+				edge[e] = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(setup.edgeA[e]), x), _mm256_set1_ps(setup.edgeB[e] * centerY + setup.edgeC[e]));
+				step[e] = _mm256_set1_ps(setup.edgeA[e] * LANES);
+			}
+			__m256 depth = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(setup.depthA), x), _mm256_set1_ps(setup.depthB * centerY + setup.depthC));
+			__m256 depthStep = _mm256_set1_ps(setup.depthA * LANES);
+			const __m256 zero = _mm256_setzero_ps();
+
+			for (int px = startX; px <= setup.maxX; px += LANES)
+			{
+				__m256 covered = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(edge[0], zero, _CMP_GE_OQ), _mm256_cmp_ps(edge[1], zero, _CMP_GE_OQ)),
+					_mm256_cmp_ps(edge[2], zero, _CMP_GE_OQ));
+				if (_mm256_movemask_ps(covered) != 0)
+				{
+					__m256 stored = _mm256_load_ps(row + px);
+					_mm256_store_ps(row + px, _mm256_blendv_ps(stored, _mm256_min_ps(stored, depth), covered));
+				}
+
+				for (int e = 0; e < 3; ++e)
+					edge[e] = _mm256_add_ps(edge[e], step[e]);
+				depth = _mm256_add_ps(depth, depthStep);
+			}
+#else
+			__m128 x = _mm_add_ps(_mm_set1_ps((float)startX), laneCenters);
+			__m128 edge[3], step[3];
+			for (int e = 0; e < 3; ++e)
+			{
+				edge[e] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.edgeA[e]), x), _mm_set1_ps(setup.edgeB[e] * centerY + setup.edgeC[e]));
+				step[e] = _mm_set1_ps(setup.edgeA[e] * LANES);
+			}
+			__m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(setup.depthA), x), _mm_set1_ps(setup.depthB * centerY + setup.depthC));
+			__m128 depthStep = _mm_set1_ps(setup.depthA * LANES);
+			const __m128 zero = _mm_setzero_ps();
+
+			for (int px = startX; px <= setup.maxX; px += LANES)
+			{
+				__m128 covered = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge[0], zero), _mm_cmpge_ps(edge[1], zero)), _mm_cmpge_ps(edge[2], zero));
+				if (_mm_movemask_ps(covered) != 0)
+				{
+					__m128 stored = _mm_load_ps(row + px);
+					__m128 nearer = _mm_min_ps(stored, depth);
+					_mm_store_ps(row + px, _mm_or_ps(_mm_and_ps(covered, nearer), _mm_andnot_ps(covered, stored)));
+				}
+
+				for (int e = 0; e < 3; ++e)
+					edge[e] = _mm_add_ps(edge[e], step[e]);
+				depth = _mm_add_ps(depth, depthStep);
+			}
+#endif
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	TestAABB(const AABB&)
+//
+//	Projects the box to a rectangle covering every pixel it touches and
+//	compares its nearest depth against the buffer, a SIMD register of
+//	pixels at a time. Boxes reaching behind the eye or off the buffer are
+//	reported visible; the frustum test decides those.
+///////////////////////////////////////////////////
+bool OcclusionRasterizer::TestAABB(const AABB& box) const
+{
+	glm::vec2 rectMin(1.0f);
+	glm::vec2 rectMax(-1.0f);
+	float nearest = 1.0f;
+	for (int i = 0; i < 8; ++i)
+	{
+		glm::vec4 clip = mViewProjection * glm::vec4(BoxCorner(box, i), 1.0f);
+		if (clip.w <= 0.0f)
+			return true;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		rectMin = glm::min(rectMin, glm::vec2(ndc));
+		rectMax = glm::max(rectMax, glm::vec2(ndc));
+		nearest = std::min(nearest, ndc.z);
+	}
+	nearest = nearest * 0.5f + 0.5f;
+	if (nearest <= 0.0f)
+		return true;
+
+	int minX = std::max((int)std::floor((rectMin.x * 0.5f + 0.5f) * WIDTH), 0);
+	int maxX = std::min((int)std::floor((rectMax.x * 0.5f + 0.5f) * WIDTH), WIDTH - 1);
+	int minY = std::max((int)std::floor((rectMin.y * 0.5f + 0.5f) * HEIGHT), 0);
+	int maxY = std::min((int)std::floor((rectMax.y * 0.5f + 0.5f) * HEIGHT), HEIGHT - 1);
+	if (minX > maxX || minY > maxY)
+		return true;
+
+#if defined(__AVX__)
+	const int LANES = 8;
+	const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+	const __m256 nearestDepth = _mm256_set1_ps(nearest);
+	const __m256 firstColumn = _mm256_set1_ps((float)minX);
+	const __m256 lastColumn = _mm256_set1_ps((float)maxX);
+#else
+	const int LANES = 4;
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	const __m128 nearestDepth = _mm_set1_ps(nearest);
+	const __m128 firstColumn = _mm_set1_ps((float)minX);
+	const __m128 lastColumn = _mm_set1_ps((float)maxX);
+#endif
+
+	int startX = minX & ~(LANES - 1);
+	for (int y = minY; y <= maxY; ++y)
+	{
+		const float* row = mDepth + y * WIDTH;
+		for (int px = startX; px <= maxX; px += LANES)
+		{
+#if defined(__AVX__)
+			__m256 column = _mm256_add_ps(_mm256_set1_ps((float)px), lanes);
+			__m256 inside = _mm256_and_ps(_mm256_cmp_ps(column, firstColumn, _CMP_GE_OQ), _mm256_cmp_ps(column, lastColumn, _CMP_LE_OQ));
+			__m256 inFront = _mm256_cmp_ps(nearestDepth, _mm256_load_ps(row + px), _CMP_LE_OQ);
+			if (_mm256_movemask_ps(_mm256_and_ps(inside, inFront)) != 0)
+				return true;
+#else
+			__m128 column = _mm_add_ps(_mm_set1_ps((float)px), lanes);
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(column, firstColumn), _mm_cmple_ps(column, lastColumn));
+			__m128 inFront = _mm_cmple_ps(nearestDepth, _mm_load_ps(row + px));
+			if (_mm_movemask_ps(_mm_and_ps(inside, inFront)) != 0)
+				return true;
+#endif
+		}
+	}
+	return false;
+}
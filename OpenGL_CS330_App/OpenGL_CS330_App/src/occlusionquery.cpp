@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////////
+//  occlusionquery.cpp
+//  ==================
+//  Occlusion queries with conditional rendering.
+//
+//  An expensive object is replaced by its twelve-triangle box, drawn with
+//  color and depth writes off inside a GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+//  query. The real draws follow inside glBeginConditionalRender with
+//  GL_QUERY_NO_WAIT, so the GPU itself drops them when no sample of the box
+//  passed; the CPU does not look at the result to decide anything. Results
+//  are only read, for statistics, when the query's slot comes round again
+//  FRAMES_IN_FLIGHT frames later, and then only if they are available.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "occlusionquery.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <iostream>
+
+/*Shader program Macro*/
+#ifndef GLSL
+#define GLSL(Version, Source) "#version " #Version " core \n" #Source
+#endif
+
+namespace
+{
+	/* Box vertex shader: the unit cube stretched over the world-space box */
+	const GLchar* boxVertexShaderSource = GLSL(440,
+
+	layout(location = 0) in vec3 corner;
+
+	uniform mat4 viewProjection;
+	uniform vec3 boxMin;
+	uniform vec3 boxMax;
+
+	void main()
+	{
+		gl_Position = viewProjection * vec4(mix(boxMin, boxMax, corner), 1.0);
+	}
+	);
+
+	/* Box fragment shader: writes are masked off, only the samples count */
+	const GLchar* boxFragmentShaderSource = GLSL(440,
+
+	void main()
+	{
+	}
+	);
+
+	///////////////////////////////////////////////////
+	//	UCreateBoxProgram(GLuint&)
+	//
+	//	Compile and link the box program
+	///////////////////////////////////////////////////
+	bool UCreateBoxProgram(GLuint& programId)
+	{
+		int success = 0;
+		char infoLog[512];
+
+		const GLchar* sources[2] = { boxVertexShaderSource, boxFragmentShaderSource };
+		const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+		GLuint shaderIds[2] = { 0, 0 };
+		for (int i = 0; i < 2; ++i)
+		{
+			shaderIds[i] = glCreateShader(types[i]);
+			glShaderSource(shaderIds[i], 1, &sources[i], NULL);
+			glCompileShader(shaderIds[i]);
+			glGetShaderiv(shaderIds[i], GL_COMPILE_STATUS, &success);
+			if (!success)
+			{
+				glGetShaderInfoLog(shaderIds[i], sizeof(infoLog), NULL, infoLog);
+				std::cout << "ERROR::SHADER::OCCLUSION_BOX::COMPILATION_FAILED\n" << infoLog << std::endl;
+				glDeleteShader(shaderIds[0]);
+				glDeleteShader(shaderIds[1]);
+				return false;
+			}
+		}
+
+		programId = glCreateProgram();
+		glAttachShader(programId, shaderIds[0]);
+		glAttachShader(programId, shaderIds[1]);
+		glLinkProgram(programId);
+		glDeleteShader(shaderIds[0]);
+		glDeleteShader(shaderIds[1]);
+		glGetProgramiv(programId, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+			std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+			glDeleteProgram(programId);
+			programId = 0;
+			return false;
+		}
+		return true;
+	}
+}
+
+OcclusionQueries::OcclusionQueries()
+	: mProgram(0), mViewProjectionLocation(-1), mBoxMinLocation(-1), mBoxMaxLocation(-1), mVao(0), mBuffers(),
+	mObjectCount(0), mSlot(0), mConditional(false), mViewProjection(1.0f), mIssuedCount(0), mResultCount(0), mHiddenCount(0)
+{
+}
+
+bool OcclusionQueries::Initialize(int objectCount)
+{
+	if (!UCreateBoxProgram(mProgram))
+	{
+		std::cout << "Failed to create the occlusion query program" << std::endl;
+		return false;
+	}
+	mViewProjectionLocation = glGetUniformLocation(mProgram, "viewProjection");
+	mBoxMinLocation = glGetUniformLocation(mProgram, "boxMin");
+	mBoxMaxLocation = glGetUniformLocation(mProgram, "boxMax");
+
+	// Unit cube
+	const GLfloat corners[] = {
+		0.0f, 0.0f, 0.0f,	1.0f, 0.0f, 0.0f,	1.0f, 1.0f, 0.0f,	0.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,	1.0f, 0.0f, 1.0f,	1.0f, 1.0f, 1.0f,	0.0f, 1.0f, 1.0f
+	};
+	const GLubyte indices[] = {
+		0, 2, 1,	0, 3, 2,	// back
+		4, 5, 6,	4, 6, 7,	// front
+		0, 4, 7,	0, 7, 3,	// left
+		1, 2, 6,	1, 6, 5,	// right
+		0, 1, 5,	0, 5, 4,	// bottom
+		3, 7, 6,	3, 6, 2		// top
+	};
+
+	glGenVertexArrays(1, &mVao);
+	glBindVertexArray(mVao);
+	glGenBuffers(2, mBuffers);
+	glBindBuffer(GL_ARRAY_BUFFER, mBuffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mBuffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+	glEnableVertexAttribArray(0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	mObjectCount = objectCount;
+	mQueries.resize(FRAMES_IN_FLIGHT * objectCount);
+	glGenQueries((GLsizei)mQueries.size(), mQueries.data());
+	mIssued.assign(mQueries.size(), 0);
+	mSlot = 0;
+	return true;
+}
+
+void OcclusionQueries::Destroy()
+{
+	if (!mQueries.empty())
+		glDeleteQueries((GLsizei)mQueries.size(), mQueries.data());
+	mQueries.clear();
+	mIssued.clear();
+	mObjectCount = 0;
+
+	if (mVao != 0)
+	{
+		glDeleteVertexArrays(1, &mVao);
+		glDeleteBuffers(2, mBuffers);
+	}
+	mVao = 0;
+
+	if (mProgram != 0)
+		glDeleteProgram(mProgram);
+	mProgram = 0;
+}
+
+void OcclusionQueries::BeginFrame(const glm::mat4& viewProjection)
+{
+	mSlot = (mSlot + 1) % FRAMES_IN_FLIGHT;
+	mViewProjection = viewProjection;
+	mIssuedCount = 0;
+	mResultCount = 0;
+	mHiddenCount = 0;
+
+	// Results that have not arrived by now are dropped; the query is simply issued again
+	for (int object = 0; object < mObjectCount; ++object)
+	{
+		unsigned char& issued = mIssued[mSlot * mObjectCount + object];
+		if (!issued)
+			continue;
+		issued = 0;
+
+		GLuint available = GL_FALSE;
+		glGetQueryObjectuiv(Query(object), GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			continue;
+
+		GLuint anyPassed = GL_TRUE;
+		glGetQueryObjectuiv(Query(object), GL_QUERY_RESULT, &anyPassed);
+		++mResultCount;
+		mHiddenCount += anyPassed == GL_FALSE;
+	}
+}
+
+void OcclusionQueries::BeginQueries()
+{
+	glUseProgram(mProgram);
+	glUniformMatrix4fv(mViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(mViewProjection));
+	glBindVertexArray(mVao);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+}
+
+void OcclusionQueries::EndQueries()
+{
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+bool OcclusionQueries::Issue(int object, const AABB& box, const glm::vec3& eye, float nearPlane)
+{
+	if (object < 0 || object >= mObjectCount)
+		return false;
+
+	// The corners of the near plane lie farther from the eye than nearPlane, twice it covers any field of view up to 90 degrees
+	float margin = nearPlane * 2.0f;
+	glm::vec3 offset = glm::max(box.min - eye, eye - box.max);
+	if (offset.x < margin && offset.y < margin && offset.z < margin)
+		return false;
+
+	glUniform3fv(mBoxMinLocation, 1, glm::value_ptr(box.min));
+	glUniform3fv(mBoxMaxLocation, 1, glm::value_ptr(box.max));
+	glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, Query(object));
+	glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, nullptr);
+	glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+
+	mIssued[mSlot * mObjectCount + object] = 1;
+	++mIssuedCount;
+	return true;
+}
+
+void OcclusionQueries::BeginConditional(int object)
+{
+	mConditional = object >= 0 && object < mObjectCount && mIssued[mSlot * mObjectCount + object];
+	if (mConditional)
+		glBeginConditionalRender(Query(object), GL_QUERY_NO_WAIT);
+}
+
+void OcclusionQueries::EndConditional()
+{
+	if (mConditional)
+		glEndConditionalRender();
+	mConditional = false;
+}
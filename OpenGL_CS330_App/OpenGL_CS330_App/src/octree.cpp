@@ -0,0 +1,448 @@
+///////////////////////////////////////////////////////////////////////////////
+//  octree.cpp
+//  ==========
+//  Loose octree with pooled nodes and intrusive object lists.
+//
+//  An object goes to the deepest level whose cells are at least as large as
+//  its biggest half extent, into the cell holding its center. Because cells
+//  are loosened to twice their size, that choice depends on nothing but the
+//  object itself: an object never straddles children, and a small move that
+//  keeps its center in the same cell changes nothing but the stored box.
+//  Nodes live in one array with a free list, and each node threads its
+//  objects through the per-object entries, so neither moves nor inserts
+//  allocate once the tree has warmed up.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "octree.h"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+	// Deepest traversal stack a query may need: every level pushes at most eight children
+	const int STACK_SIZE = 8 * (LooseOctree::MAX_DEPTH + 1);
+
+	inline bool BoxesOverlap(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB)
+	{
+		return minA.x <= maxB.x && maxA.x >= minB.x
+			&& minA.y <= maxB.y && maxA.y >= minB.y
+			&& minA.z <= maxB.z && maxA.z >= minB.z;
+	}
+
+	inline bool SphereTouchesBox(const glm::vec3& center, float radiusSq, const glm::vec3& min, const glm::vec3& max)
+	{
+		glm::vec3 offset = glm::clamp(center, min, max) - center;
+		return glm::dot(offset, offset) <= radiusSq;
+	}
+}
+
+///////////////////////////////////////////////////
+//	Initialize(const AABB&, int)
+//
+//	bounds: region the objects usually stay in; the root is the cube around it
+//	maxDepth: levels below the root, at most MAX_DEPTH. Each level halves
+//	the cell size, so this sets the smallest cell to the root's / 2^maxDepth.
+///////////////////////////////////////////////////
+void LooseOctree::Initialize(const AABB& bounds, int maxDepth)
+{
+	glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+	float halfSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+
+	mNodes.clear();
+	mFreeNodes.clear();
+	mEntries.clear();
+	mMaxDepth = std::min(std::max(maxDepth, 0), MAX_DEPTH);
+	mObjectCount = 0;
+	mReinsertions = 0;
+	AllocateNode(-1, 0, (bounds.min + bounds.max) * 0.5f, halfSize);
+}
+
+void LooseOctree::Clear()
+{
+	if (mNodes.empty())
+		return;
+
+	Node root = mNodes[0];
+	mNodes.clear();
+	mFreeNodes.clear();
+	mEntries.clear();
+	mObjectCount = 0;
+	AllocateNode(-1, 0, root.center, root.halfSize);
+}
+
+int LooseOctree::AllocateNode(int parent, int depth, const glm::vec3& center, float halfSize)
+{
+	int index;
+	if (!mFreeNodes.empty())
+	{
+		index = mFreeNodes.back();
+		mFreeNodes.pop_back();
+	}
+	else
+	{
+		index = (int)mNodes.size();
+		mNodes.push_back(Node());
+	}
+
+	Node& node = mNodes[index];
+	node.center = center;
+	node.halfSize = halfSize;
+	for (int i = 0; i < 8; ++i)
+		node.children[i] = -1;
+	node.parent = parent;
+	node.firstObject = -1;
+	node.depth = depth;
+	node.childCount = 0;
+	return index;
+}
+
+///////////////////////////////////////////////////
+//	PlacementDepth(const glm::vec3&, const glm::vec3&)
+//
+//	Deepest level whose cell half size still covers the largest half extent.
+//	Centers outside the root cell stay in the root, which queries treat as
+//	unbounded.
+///////////////////////////////////////////////////
+int LooseOctree::PlacementDepth(const glm::vec3& center, const glm::vec3& extent) const
+{
+	const Node& root = mNodes[0];
+	glm::vec3 offset = glm::abs(center - root.center);
+	if (offset.x > root.halfSize || offset.y > root.halfSize || offset.z > root.halfSize)
+		return 0;
+
+	float radius = std::max(std::max(extent.x, extent.y), extent.z);
+	float halfSize = root.halfSize;
+	int depth = 0;
+	while (depth < mMaxDepth && radius <= halfSize * 0.5f)
+	{
+		halfSize *= 0.5f;
+		++depth;
+	}
+	return depth;
+}
+
+int LooseOctree::ObtainNode(const glm::vec3& center, int depth)
+{
+	int node = 0;
+	while (mNodes[node].depth < depth)
+	{
+		// Copies, AllocateNode() may move the array
+		glm::vec3 nodeCenter = mNodes[node].center;
+		int slot = (center.x >= nodeCenter.x ? 1 : 0) | (center.y >= nodeCenter.y ? 2 : 0) | (center.z >= nodeCenter.z ? 4 : 0);
+		int child = mNodes[node].children[slot];
+		if (child < 0)
+		{
+			float halfSize = mNodes[node].halfSize * 0.5f;
+			glm::vec3 childCenter = nodeCenter + glm::vec3(slot & 1 ? halfSize : -halfSize,
+				slot & 2 ? halfSize : -halfSize, slot & 4 ? halfSize : -halfSize);
+			child = AllocateNode(node, mNodes[node].depth + 1, childCenter, halfSize);
+			mNodes[node].children[slot] = child;
+			++mNodes[node].childCount;
+		}
+		node = child;
+	}
+	return node;
+}
+
+void LooseOctree::Link(int object, int node)
+{
+	Entry& entry = mEntries[object];
+	entry.node = node;
+	entry.previous = -1;
+	entry.next = mNodes[node].firstObject;
+	if (entry.next >= 0)
+		mEntries[entry.next].previous = object;
+	mNodes[node].firstObject = object;
+}
+
+void LooseOctree::Unlink(int object)
+{
+	Entry& entry = mEntries[object];
+	if (entry.previous >= 0)
+		mEntries[entry.previous].next = entry.next;
+	else
+		mNodes[entry.node].firstObject = entry.next;
+	if (entry.next >= 0)
+		mEntries[entry.next].previous = entry.previous;
+	entry.node = -1;
+}
+
+// Return empty leaves to the pool, walking up while the parents become empty leaves too
+void LooseOctree::ReleaseEmpty(int node)
+{
+	while (node > 0 && mNodes[node].firstObject < 0 && mNodes[node].childCount == 0)
+	{
+		Node& parent = mNodes[mNodes[node].parent];
+		for (int i = 0; i < 8; ++i)
+		{
+			if (parent.children[i] == node)
+				parent.children[i] = -1;
+		}
+		--parent.childCount;
+		mFreeNodes.push_back(node);
+		node = mNodes[node].parent;
+	}
+}
+
+void LooseOctree::Insert(int object, const AABB& box)
+{
+	if (mNodes.empty() || object < 0)
+		return;
+	if (Contains(object))
+	{
+		Update(object, box);
+		return;
+	}
+
+	if (object >= (int)mEntries.size())
+	{
+		Entry empty = { box, -1, -1, -1 };
+		mEntries.resize(object + 1, empty);
+	}
+
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	mEntries[object].box = box;
+	Link(object, ObtainNode(center, PlacementDepth(center, extent)));
+	++mObjectCount;
+}
+
+///////////////////////////////////////////////////
+//	Update(int, const AABB&)
+//
+//	Constant time while the object's center stays in its cell and its size
+//	keeps it on the same level, which covers most per-frame motion.
+///////////////////////////////////////////////////
+bool LooseOctree::Update(int object, const AABB& box)
+{
+	if (!Contains(object))
+	{
+		Insert(object, box);
+		return false;
+	}
+
+	Entry& entry = mEntries[object];
+	const Node& node = mNodes[entry.node];
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	int depth = PlacementDepth(center, extent);
+	if (depth == node.depth)
+	{
+		glm::vec3 offset = glm::abs(center - node.center);
+		if (entry.node == 0 || (offset.x <= node.halfSize && offset.y <= node.halfSize && offset.z <= node.halfSize))
+		{
+			entry.box = box;
+			return true;
+		}
+	}
+
+	// Link into the new node before releasing the old one, so a shared ancestor is never freed and recreated
+	int oldNode = entry.node;
+	Unlink(object);
+	mEntries[object].box = box;
+	Link(object, ObtainNode(center, depth));
+	ReleaseEmpty(oldNode);
+	++mReinsertions;
+	return false;
+}
+
+void LooseOctree::Remove(int object)
+{
+	if (!Contains(object))
+		return;
+
+	int node = mEntries[object].node;
+	Unlink(object);
+	ReleaseEmpty(node);
+	--mObjectCount;
+}
+
+void LooseOctree::QueryBox(const AABB& box, std::vector<int>& objects) const
+{
+	if (mObjectCount == 0)
+		return;
+
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		int index = stack[--top];
+		const Node& node = mNodes[index];
+		float looseSize = node.halfSize * 2.0f;
+		if (index != 0 && !BoxesOverlap(node.center - looseSize, node.center + looseSize, box.min, box.max))
+			continue;
+
+		for (int object = node.firstObject; object >= 0; object = mEntries[object].next)
+		{
+			const AABB& objectBox = mEntries[object].box;
+			if (BoxesOverlap(objectBox.min, objectBox.max, box.min, box.max))
+				objects.push_back(object);
+		}
+		for (int i = 0; i < 8 && top < STACK_SIZE; ++i)
+		{
+			if (node.children[i] >= 0)
+				stack[top++] = node.children[i];
+		}
+	}
+}
+
+void LooseOctree::QuerySphere(const glm::vec3& center, float radius, std::vector<int>& objects) const
+{
+	if (mObjectCount == 0)
+		return;
+
+	const float radiusSq = radius * radius;
+	int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		int index = stack[--top];
+		const Node& node = mNodes[index];
+		float looseSize = node.halfSize * 2.0f;
+		if (index != 0 && !SphereTouchesBox(center, radiusSq, node.center - looseSize, node.center + looseSize))
+			continue;
+
+		for (int object = node.firstObject; object >= 0; object = mEntries[object].next)
+		{
+			const AABB& box = mEntries[object].box;
+			if (SphereTouchesBox(center, radiusSq, box.min, box.max))
+				objects.push_back(object);
+		}
+		for (int i = 0; i < 8 && top < STACK_SIZE; ++i)
+		{
+			if (node.children[i] >= 0)
+				stack[top++] = node.children[i];
+		}
+	}
+}
+
+void LooseOctree::QueryFrustum(const glm::vec4 planes[FRUSTUM_PLANE_COUNT], std::vector<int>& objects) const
+{
+	if (mObjectCount == 0)
+		return;
+
+	// second entry: the node is known to be completely inside, skip the plane tests
+	int stack[STACK_SIZE];
+	bool inside[STACK_SIZE];
+	int top = 0;
+	stack[top] = 0;
+	inside[top++] = false;
+
+	while (top > 0)
+	{
+		--top;
+		int index = stack[top];
+		const Node& node = mNodes[index];
+		bool nodeInside = inside[top];
+		if (!nodeInside && index != 0)
+		{
+			float looseSize = node.halfSize * 2.0f;
+			int result = ClassifyAABB(planes, node.center - looseSize, node.center + looseSize);
+			if (result == 0)
+				continue;
+			nodeInside = (result == 2);
+		}
+
+		for (int object = node.firstObject; object >= 0; object = mEntries[object].next)
+		{
+			if (nodeInside || AABBInFrustum(planes, mEntries[object].box))
+				objects.push_back(object);
+		}
+		for (int i = 0; i < 8 && top < STACK_SIZE; ++i)
+		{
+			if (node.children[i] >= 0)
+			{
+				stack[top] = node.children[i];
+				inside[top++] = nodeInside;
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////
+//	Raycast(const glm::vec3&, const glm::vec3&, float&, const RayTest&)
+//
+//	Children are pushed farthest first so the nearest is visited next, and
+//	nodes entered beyond the closest hit so far are skipped when popped.
+///////////////////////////////////////////////////
+int LooseOctree::Raycast(const glm::vec3& origin, const glm::vec3& direction, float& t, const RayTest& test) const
+{
+	if (mObjectCount == 0)
+		return -1;
+
+	glm::vec3 invDirection = 1.0f / direction;
+	int hit = -1;
+	int stack[STACK_SIZE];
+	float stackT[STACK_SIZE];
+	int top = 0;
+	stack[top] = 0;
+	stackT[top++] = 0.0f;
+
+	while (top > 0)
+	{
+		--top;
+		if (stackT[top] > t)
+			continue;
+		const Node& node = mNodes[stack[top]];
+
+		for (int object = node.firstObject; object >= 0; object = mEntries[object].next)
+		{
+			const AABB& box = mEntries[object].box;
+			float boxT = RayAABB(origin, invDirection, box.min, box.max, t);
+			if (boxT == FLT_MAX)
+				continue;
+
+			// without a precise test the box itself is the hit
+			float objectT = boxT;
+			if (test)
+			{
+				objectT = t;
+				if (!test(object, objectT))
+					continue;
+			}
+
+			if (objectT < t)
+			{
+				t = objectT;
+				hit = object;
+			}
+		}
+
+		// Insertion sort of the children the ray enters, farthest first
+		int children[8];
+		float childT[8];
+		int count = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			int child = node.children[i];
+			if (child < 0)
+				continue;
+			float looseSize = mNodes[child].halfSize * 2.0f;
+			float enter = RayAABB(origin, invDirection, mNodes[child].center - looseSize, mNodes[child].center + looseSize, t);
+			if (enter == FLT_MAX)
+				continue;
+
+			int j = count++;
+			for (; j > 0 && childT[j - 1] < enter; --j)
+			{
+				children[j] = children[j - 1];
+				childT[j] = childT[j - 1];
+			}
+			children[j] = child;
+			childT[j] = enter;
+		}
+		for (int i = 0; i < count && top < STACK_SIZE; ++i)
+		{
+			stack[top] = children[i];
+			stackT[top++] = childT[i];
+		}
+	}
+	return hit;
+}
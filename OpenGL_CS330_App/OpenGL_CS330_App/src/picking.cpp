@@ -0,0 +1,250 @@
+///////////////////////////////////////////////////////////////////////////////
+//  picking.cpp
+//  ===========
+//  Ray-triangle tests for picking.
+//
+//  Moller-Trumbore, run on a whole batch of triangles per step: the ray is
+//  broadcast once and every lane computes its determinant, barycentrics
+//  and distance. Lanes that hit closer than the best so far are resolved
+//  in a short scalar loop. Triangles left after the last full batch use
+//  the scalar version of the same test.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "picking.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#else
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+	// Scalar Moller-Trumbore; returns true and sets t when the hit is closer than t
+	bool IntersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+		const glm::vec3& v0, const glm::vec3& e1, const glm::vec3& e2, float& t)
+	{
+		glm::vec3 p = glm::cross(direction, e2);
+		float det = glm::dot(e1, p);
+		if (det == 0.0f)
+			return false;
+		float invDet = 1.0f / det;
+
+		glm::vec3 s = origin - v0;
+		float u = glm::dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(direction, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		float hit = glm::dot(e2, q) * invDet;
+		if (hit <= 0.0f || hit >= t)
+			return false;
+		t = hit;
+		return true;
+	}
+}
+
+void PickShape::Clear()
+{
+	mV0x.clear(); mV0y.clear(); mV0z.clear();
+	mE1x.clear(); mE1y.clear(); mE1z.clear();
+	mE2x.clear(); mE2y.clear(); mE2z.clear();
+}
+
+void PickShape::AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	glm::vec3 e1 = b - a;
+	glm::vec3 e2 = c - a;
+	mV0x.push_back(a.x); mV0y.push_back(a.y); mV0z.push_back(a.z);
+	mE1x.push_back(e1.x); mE1y.push_back(e1.y); mE1z.push_back(e1.z);
+	mE2x.push_back(e2.x); mE2y.push_back(e2.y); mE2z.push_back(e2.z);
+}
+
+///////////////////////////////////////////////////
+//	AddTriangles(const std::vector<glm::vec3>&, const std::vector<GLuint>&, GLenum, GLint, GLsizei)
+//
+//	Assembles triangles the way GL does for the mode. Elements outside
+//	the position or index arrays end the range early.
+///////////////////////////////////////////////////
+void PickShape::AddTriangles(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, GLenum mode, GLint first, GLsizei count)
+{
+	std::vector<glm::vec3> vertices;
+	for (GLsizei i = 0; i < count; ++i)
+	{
+		size_t element = first + i;
+		if (!indices.empty())
+		{
+			if (element >= indices.size())
+				break;
+			element = indices[element];
+		}
+		if (element >= positions.size())
+			break;
+		vertices.push_back(positions[element]);
+	}
+
+	size_t n = vertices.size();
+	if (mode == GL_TRIANGLES)
+	{
+		for (size_t i = 0; i + 2 < n; i += 3)
+			AddTriangle(vertices[i], vertices[i + 1], vertices[i + 2]);
+	}
+	else if (mode == GL_TRIANGLE_STRIP)
+	{
+		for (size_t i = 0; i + 2 < n; ++i)
+			AddTriangle(vertices[i], vertices[i + 1], vertices[i + 2]);
+	}
+	else if (mode == GL_TRIANGLE_FAN)
+	{
+		for (size_t i = 1; i + 1 < n; ++i)
+			AddTriangle(vertices[0], vertices[i], vertices[i + 1]);
+	}
+}
+
+int PickShape::Intersect(const glm::vec3& origin, const glm::vec3& direction, float& t) const
+{
+	const size_t count = mV0x.size();
+	int nearest = -1;
+	size_t i = 0;
+
+#if defined(__AVX__)
+	const size_t WIDTH = 8;
+	const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+	const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	__m256 best = _mm256_set1_ps(t);
+
+	for (; i + WIDTH <= count; i += WIDTH)
+	{
+		__m256 e1x = _mm256_loadu_ps(&mE1x[i]), e1y = _mm256_loadu_ps(&mE1y[i]), e1z = _mm256_loadu_ps(&mE1z[i]);
+		__m256 e2x = _mm256_loadu_ps(&mE2x[i]), e2y = _mm256_loadu_ps(&mE2y[i]), e2z = _mm256_loadu_ps(&mE2z[i]);
+
+		// p = direction x e2, det = e1 . p
+		__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+		__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+		__m256 invDet = _mm256_div_ps(one, det);
+
+		// s = origin - v0, u = (s . p) / det
+		__m256 sx = _mm256_sub_ps(ox, _mm256_loadu_ps(&mV0x[i]));
+		__m256 sy = _mm256_sub_ps(oy, _mm256_loadu_ps(&mV0y[i]));
+		__m256 sz = _mm256_sub_ps(oz, _mm256_loadu_ps(&mV0z[i]));
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+		// q = s x e1, v = (direction . q) / det, hit distance = (e2 . q) / det
+		__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+		__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+		__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+		__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+		__m256 hit = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+		// Ordered compares are false for the NaNs a zero determinant leaves behind
+		__m256 mask = _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(hit, zero, _CMP_GT_OQ));
+		mask = _mm256_and_ps(mask, _mm256_cmp_ps(hit, best, _CMP_LT_OQ));
+
+		int lanes = _mm256_movemask_ps(mask);
+		if (lanes != 0)
+		{
+			alignas(32) float distances[WIDTH];
+			_mm256_store_ps(distances, hit);
+			for (size_t k = 0; k < WIDTH; ++k)
+			{
+				if ((lanes >> k) & 1 && distances[k] < t)
+				{
+					t = distances[k];
+					nearest = (int)(i + k);
+				}
+			}
+			best = _mm256_set1_ps(t);
+		}
+	}
+#else
+	const size_t WIDTH = 4;
+	const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+	const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 best = _mm_set1_ps(t);
+
+	for (; i + WIDTH <= count; i += WIDTH)
+	{
+		__m128 e1x = _mm_loadu_ps(&mE1x[i]), e1y = _mm_loadu_ps(&mE1y[i]), e1z = _mm_loadu_ps(&mE1z[i]);
+		__m128 e2x = _mm_loadu_ps(&mE2x[i]), e2y = _mm_loadu_ps(&mE2y[i]), e2z = _mm_loadu_ps(&mE2z[i]);
+
+		// p = direction x e2, det = e1 . p
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 invDet = _mm_div_ps(one, det);
+
+		// s = origin - v0, u = (s . p) / det
+		__m128 sx = _mm_sub_ps(ox, _mm_loadu_ps(&mV0x[i]));
+		__m128 sy = _mm_sub_ps(oy, _mm_loadu_ps(&mV0y[i]));
+		__m128 sz = _mm_sub_ps(oz, _mm_loadu_ps(&mV0z[i]));
+		__m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+		// q = s x e1, v = (direction . q) / det, hit distance = (e2 . q) / det
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		__m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+		__m128 hit = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+		// Ordered compares are false for the NaNs a zero determinant leaves behind
+		__m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+		mask = _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+		mask = _mm_and_ps(mask, _mm_cmpgt_ps(hit, zero));
+		mask = _mm_and_ps(mask, _mm_cmplt_ps(hit, best));
+
+		int lanes = _mm_movemask_ps(mask);
+		if (lanes != 0)
+		{
+			alignas(16) float distances[WIDTH];
+			_mm_store_ps(distances, hit);
+			for (size_t k = 0; k < WIDTH; ++k)
+			{
+				if ((lanes >> k) & 1 && distances[k] < t)
+				{
+					t = distances[k];
+					nearest = (int)(i + k);
+				}
+			}
+			best = _mm_set1_ps(t);
+		}
+	}
+#endif
+
+	// remaining triangles one at a time
+	for (; i < count; ++i)
+	{
+		glm::vec3 v0(mV0x[i], mV0y[i], mV0z[i]);
+		glm::vec3 e1(mE1x[i], mE1y[i], mE1z[i]);
+		glm::vec3 e2(mE2x[i], mE2y[i], mE2z[i]);
+		if (IntersectTriangle(origin, direction, v0, e1, e2, t))
+			nearest = (int)i;
+	}
+
+	return nearest;
+}
+
+void ScreenPointToRay(const glm::mat4& viewProjection, const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction)
+{
+	glm::mat4 inverse = glm::inverse(viewProjection);
+	glm::vec4 nearPoint = inverse * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverse * glm::vec4(ndc, 1.0f, 1.0f);
+	origin = glm::vec3(nearPoint) / nearPoint.w;
+	direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
@@ -0,0 +1,144 @@
+///////////////////////////////////////////////////////////////////////////////
+//  ringbuffer.cpp
+//  ==============
+//  Per-frame dynamic data without driver round trips.
+//
+//  The buffer is allocated once with immutable storage and mapped for the
+//  lifetime of the program (persistent + coherent), so writing uniforms is a
+//  plain memcpy. It is split into FRAME_COUNT regions; a fence placed after
+//  each frame's draws tells us when the GPU is done reading a region so the
+//  CPU can overwrite it three frames later.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "ringbuffer.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	// Upper bound for one wait in BeginFrame(), in nanoseconds
+	const GLuint64 FENCE_TIMEOUT = 1000000000;
+}
+
+RingBuffer::RingBuffer()
+	: mTarget(GL_UNIFORM_BUFFER), mBuffer(0), mMapped(nullptr), mFrameSize(0), mAlignment(1),
+	mFrame(0), mHead(0), mFences(), mStalls(0)
+{
+}
+
+///////////////////////////////////////////////////
+//	Initialize(GLenum, GLsizeiptr)
+//
+//	Creates FRAME_COUNT regions of frameSize bytes, each rounded up so every
+//	region starts on the offset alignment the target requires.
+///////////////////////////////////////////////////
+bool RingBuffer::Initialize(GLenum target, GLsizeiptr frameSize)
+{
+	GLint alignment = 1;
+	if (target == GL_UNIFORM_BUFFER)
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	else if (target == GL_SHADER_STORAGE_BUFFER)
+		glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	mTarget = target;
+	mAlignment = alignment > 0 ? alignment : 1;
+	mFrameSize = (frameSize + mAlignment - 1) / mAlignment * mAlignment;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &mBuffer);
+	glBindBuffer(mTarget, mBuffer);
+	glBufferStorage(mTarget, mFrameSize * FRAME_COUNT, nullptr, flags);
+	mMapped = (unsigned char*)glMapBufferRange(mTarget, 0, mFrameSize * FRAME_COUNT, flags);
+	glBindBuffer(mTarget, 0);
+
+	if (mMapped == nullptr)
+	{
+		std::cout << "Failed to map ring buffer of " << mFrameSize * FRAME_COUNT << " bytes" << std::endl;
+		Destroy();
+		return false;
+	}
+
+	mFrame = 0;
+	mHead = 0;
+	return true;
+}
+
+void RingBuffer::Destroy()
+{
+	for (GLsync& fence : mFences)
+	{
+		if (fence != 0)
+			glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (mBuffer != 0)
+	{
+		if (mMapped != nullptr)
+		{
+			glBindBuffer(mTarget, mBuffer);
+			glUnmapBuffer(mTarget);
+			glBindBuffer(mTarget, 0);
+		}
+		glDeleteBuffers(1, &mBuffer);
+	}
+	mBuffer = 0;
+	mMapped = nullptr;
+}
+
+void RingBuffer::BeginFrame()
+{
+	mFrame = (mFrame + 1) % FRAME_COUNT;
+	mHead = 0;
+
+	GLsync& fence = mFences[mFrame];
+	if (fence == 0)
+		return;
+
+	// cheap poll first so the stall counter only counts real waits
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED)
+	{
+		++mStalls;
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+	}
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+void RingBuffer::EndFrame()
+{
+	if (mFences[mFrame] != 0)
+		glDeleteSync(mFences[mFrame]);
+	mFences[mFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* RingBuffer::Allocate(GLsizeiptr size, GLintptr& offset)
+{
+	GLsizeiptr start = (mHead + mAlignment - 1) / mAlignment * mAlignment;
+	if (mMapped == nullptr || start + size > mFrameSize)
+		return nullptr;
+
+	mHead = start + size;
+	offset = mFrame * mFrameSize + start;
+	return mMapped + offset;
+}
+
+GLintptr RingBuffer::Write(const void* data, GLsizeiptr size)
+{
+	GLintptr offset;
+	void* dest = Allocate(size, offset);
+	if (dest == nullptr)
+		return -1;
+
+	std::memcpy(dest, data, size);
+	return offset;
+}
+
+void RingBuffer::Bind(GLuint index, GLintptr offset, GLsizeiptr size) const
+{
+	glBindBufferRange(mTarget, index, mBuffer, offset, size);
+}
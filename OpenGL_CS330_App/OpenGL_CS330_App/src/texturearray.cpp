@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+//  texturearray.cpp
+//  ================
+//  Texture array for small textures.
+//
+//  Every layer has the same size, so an image is resampled up to the layer
+//  size before it is uploaded (see TextureLoader::LoadLayer); only images
+//  no larger than a layer are packed, so none loses resolution. Each layer
+//  has a full mip chain, generated on the worker like a 2D texture's. Texture
+//  coordinates are normalized, which keeps the mapping and the repeat
+//  wrapping of the original texture. Objects sample their layer through
+//  one sampler2DArray binding, so a batch of them needs no texture binds.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturearray.h"
+
+#include <iostream>
+
+TextureArray::TextureArray()
+	: mTexture(0), mLayerSize(0), mLevels(0), mLayerCount(0)
+{
+}
+
+bool TextureArray::Initialize(GLsizei layerSize, GLsizei layerCount)
+{
+	Destroy();
+
+	GLint maxSize = 0, maxLayers = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	if (layerSize <= 0 || layerSize > maxSize || layerCount <= 0 || layerCount > maxLayers)
+	{
+		std::cout << "Failed to create a " << layerSize << "x" << layerSize << "x" << layerCount << " texture array" << std::endl;
+		return false;
+	}
+
+	glGenTextures(1, &mTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mTexture);
+	GLsizei levels = 1;
+	while ((layerSize >> levels) > 0)
+		++levels;
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layerSize, layerSize, layerCount);
+
+	// Same sampling as the 2D textures
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	for (GLint level = 0; level < levels; ++level)
+		glClearTexImage(mTexture, level, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+
+	mLayerSize = layerSize;
+	mLevels = levels;
+	mLayerCount = layerCount;
+	for (GLint layer = layerCount - 1; layer >= 0; --layer)
+		mFreeLayers.push_back(layer);
+	return true;
+}
+
+void TextureArray::Destroy()
+{
+	if (mTexture != 0)
+		glDeleteTextures(1, &mTexture);
+	mTexture = 0;
+	mLayerSize = 0;
+	mLevels = 0;
+	mLayerCount = 0;
+	mFreeLayers.clear();
+}
+
+GLint TextureArray::AllocateLayer()
+{
+	if (mFreeLayers.empty())
+		return -1;
+	GLint layer = mFreeLayers.back();
+	mFreeLayers.pop_back();
+	return layer;
+}
+
+void TextureArray::FreeLayer(GLint layer)
+{
+	if (layer >= 0 && layer < mLayerCount)
+		mFreeLayers.push_back(layer);
+}
+
+size_t TextureArray::LayerBytes() const
+{
+	size_t bytes = 0;
+	for (GLsizei level = 0; level < mLevels; ++level)
+		bytes += (size_t)(mLayerSize >> level) * (mLayerSize >> level) * 4;
+	return bytes;
+}
@@ -0,0 +1,196 @@
+///////////////////////////////////////////////////////////////////////////////
+//  texturecache.cpp
+//  ================
+//  Texture cache.
+//
+//  Two maps lead to one entry per texture: path to texture, so asking
+//  for the same file again costs a lookup, and content hash to texture, so
+//  a copy of an image under another name is recognised from its bytes
+//  before anything is decoded. The hash is FNV-1a over the file, mixed
+//  with its length. Reading a file is cheap next to decoding and uploading
+//  it; the bytes read for the hash are handed to the loader, which decodes
+//  from memory. Images small enough to share the texture array are decoded
+//  into one of its layers instead of a texture of their own. DDS and KTX2
+//  files are mapped instead of read and hashed through the mapping.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturecache.h"
+
+#include <stb_image.h>
+
+#include <iostream>
+#include <memory>
+
+namespace
+{
+	// Map key for a handle: texture name above, layer + 1 below
+	uint64_t UHandleKey(const TextureHandle& handle)
+	{
+		return ((uint64_t)handle.texture << 32) | (uint32_t)(handle.layer + 1);
+	}
+}
+
+TextureCache::TextureCache()
+	: mLoader(nullptr), mUploads(nullptr), mSmallTextures(nullptr), mHits(0), mMisses(0), mResidentBytes(0)
+{
+}
+
+void TextureCache::Initialize(TextureLoader* loader, UploadQueue* uploads, TextureArray* smallTextures)
+{
+	mLoader = loader;
+	mUploads = uploads;
+	mSmallTextures = smallTextures;
+}
+
+void TextureCache::Destroy()
+{
+	for (const std::pair<const uint64_t, Entry>& entry : mEntries)
+		Free(entry.second);
+	mEntries.clear();
+	mByPath.clear();
+	mByHash.clear();
+	mResidentBytes = 0;
+}
+
+///////////////////////////////////////////////////
+//	Acquire(const char*)
+//
+//	The resident size is estimated from the header, see
+//	TextureLoader::ResidentBytes(). A packed image costs its layer.
+///////////////////////////////////////////////////
+TextureHandle TextureCache::Acquire(const char* filename)
+{
+	const TextureHandle failed = { 0, -1 };
+
+	std::unordered_map<std::string, uint64_t>::iterator byPath = mByPath.find(filename);
+	if (byPath != mByPath.end())
+	{
+		Entry& entry = mEntries[byPath->second];
+		++entry.references;
+		++mHits;
+		return entry.handle;
+	}
+
+	// Containers are mapped rather than read: their levels upload from the mapping
+	std::vector<unsigned char> bytes;
+	std::shared_ptr<MappedFile> mapped;
+	if (IsTextureContainerFile(filename))
+	{
+		mapped = std::make_shared<MappedFile>();
+		if (!mapped->Open(filename))
+			return failed;
+	}
+	else if (!ReadFileBytes(filename, bytes))
+		return failed;
+
+	uint64_t hash = mapped ? HashFileBytes(mapped->Data(), mapped->Size()) : HashFileBytes(bytes);
+	std::unordered_map<uint64_t, uint64_t>::iterator byHash = mByHash.find(hash);
+	if (byHash != mByHash.end())
+	{
+		Entry& entry = mEntries[byHash->second];
+		++entry.references;
+		entry.paths.push_back(filename);
+		mByPath[filename] = byHash->second;
+		++mHits;
+		return entry.handle;
+	}
+
+	Entry entry = {};
+	entry.handle = failed;
+	if (mapped)
+	{
+		// Stored mips and block formats don't fit an RGBA8 layer, so containers are never packed
+		TextureContainer container;
+		if (!ParseTextureContainer(filename, mapped->Data(), mapped->Size(), container)
+			|| !mLoader->Load(filename, std::move(mapped), container, entry.handle.texture))
+			return failed;
+		entry.bytes = ContainerBytes(container);
+	}
+	else
+	{
+		int width = 0, height = 0, channels = 0;
+		stbi_info_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels);
+
+		// Only images a layer can hold at full resolution are packed
+		int packLimit = mSmallTextures != nullptr ? mSmallTextures->LayerSize() : 0;
+		GLint layer = (width <= packLimit && height <= packLimit) ? mSmallTextures->AllocateLayer() : -1;
+		if (layer >= 0)
+		{
+			if (!mLoader->LoadLayer(filename, std::move(bytes), *mSmallTextures, layer))
+			{
+				mSmallTextures->FreeLayer(layer);
+				return failed;
+			}
+			entry.handle.texture = mSmallTextures->Texture();
+			entry.handle.layer = layer;
+			entry.bytes = mSmallTextures->LayerBytes();
+		}
+		else
+		{
+			if (!mLoader->Load(filename, std::move(bytes), entry.handle.texture))
+				return failed;
+			entry.bytes = mLoader->ResidentBytes(width, height, channels);
+		}
+	}
+	++mMisses;
+
+	uint64_t key = UHandleKey(entry.handle);
+	entry.hash = hash;
+	entry.references = 1;
+	entry.paths.push_back(filename);
+	mResidentBytes += entry.bytes;
+	mEntries[key] = entry;
+	mByPath[filename] = key;
+	mByHash[hash] = key;
+	return entry.handle;
+}
+
+void TextureCache::Release(TextureHandle handle)
+{
+	std::unordered_map<uint64_t, Entry>::iterator found = mEntries.find(UHandleKey(handle));
+	if (found == mEntries.end())
+		return;
+
+	Entry& entry = found->second;
+	if (--entry.references > 0)
+		return;
+
+	for (const std::string& path : entry.paths)
+		mByPath.erase(path);
+	mByHash.erase(entry.hash);
+	mResidentBytes -= entry.bytes;
+	Free(entry);
+	mEntries.erase(found);
+}
+
+TextureCacheStats TextureCache::GetStats() const
+{
+	TextureCacheStats stats = {};
+	stats.hits = mHits;
+	stats.misses = mMisses;
+	stats.textures = (unsigned int)mEntries.size();
+	for (const std::pair<const uint64_t, Entry>& entry : mEntries)
+		stats.packedLayers += entry.second.handle.layer >= 0;
+	stats.residentBytes = mResidentBytes;
+	return stats;
+}
+
+///////////////////////////////////////////////////
+//	Free(const Entry&)
+//
+//	Work still pending for the texture or layer is cancelled first, so a
+//	late decode or upload cannot land in a deleted texture or in a layer
+//	that has been handed to another image.
+///////////////////////////////////////////////////
+void TextureCache::Free(const Entry& entry)
+{
+	GLuint texture = entry.handle.texture;
+	mLoader->Cancel(texture, entry.handle.layer);
+	mUploads->CancelTexture(texture, entry.handle.layer);
+	if (entry.handle.layer >= 0)
+		mSmallTextures->FreeLayer(entry.handle.layer);
+	else
+		glDeleteTextures(1, &texture);
+}
@@ -0,0 +1,324 @@
+///////////////////////////////////////////////////////////////////////////////
+//  texturecontainer.cpp
+//  ====================
+//  DDS and KTX2 parsing.
+//
+//  Both formats store every mip level ready for the GPU, so loading one
+//  is a matter of finding the levels: nothing is decoded, and the level
+//  bytes can go from a mapping of the file straight into a staging buffer.
+//  Both describe the pixel format with a code from another API (DXGI or
+//  Vulkan); one table translates either to GL. Old DDS files without the
+//  DX10 header use a FourCC or channel masks instead, which are first
+//  mapped to the matching Vulkan code.
+//
+//  Levels are uploaded as stored, top row first. JPEG and PNG textures are
+//  flipped on load instead, so containers should be written bottom row
+//  first (texconv -vflip, toktx --lower_left_maps_to_s0t0).
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturecontainer.h"
+
+#include "blockencoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+// EXT_texture_compression_s3tc and EXT_texture_sRGB formats beyond the ones blockencoder.h needs
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT3_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+namespace
+{
+	// A pixel format both containers can name
+	struct FormatInfo
+	{
+		uint32_t dxgiFormat;		// 0 when DXGI has no such format
+		uint32_t vkFormat;
+		GLenum internalFormat;
+		GLenum format;				// 0 for block compressed formats
+		int bytes;					// Per 4x4 block when compressed, else per texel
+	};
+
+	const FormatInfo FORMATS[] =
+	{
+		{ 28, 37, GL_RGBA8, GL_RGBA, 4 },
+		{ 29, 43, GL_SRGB8_ALPHA8, GL_RGBA, 4 },
+		{ 87, 44, GL_RGBA8, GL_BGRA, 4 },
+		{ 91, 50, GL_SRGB8_ALPHA8, GL_BGRA, 4 },
+		{ 0, 23, GL_RGB8, GL_RGB, 3 },
+		{ 0, 29, GL_SRGB8, GL_RGB, 3 },
+		{ 0, 30, GL_RGB8, GL_BGR, 3 },
+		{ 0, 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 0, 8 },
+		{ 0, 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 0, 8 },
+		{ 71, 133, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 0, 8 },
+		{ 72, 134, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 0, 8 },
+		{ 74, 135, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 0, 16 },
+		{ 75, 136, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 0, 16 },
+		{ 77, 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 0, 16 },
+		{ 78, 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 0, 16 },
+		{ 80, 139, GL_COMPRESSED_RED_RGTC1, 0, 8 },
+		{ 81, 140, GL_COMPRESSED_SIGNED_RED_RGTC1, 0, 8 },
+		{ 83, 141, GL_COMPRESSED_RG_RGTC2, 0, 16 },
+		{ 84, 142, GL_COMPRESSED_SIGNED_RG_RGTC2, 0, 16 },
+		{ 95, 143, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 0, 16 },
+		{ 96, 144, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 0, 16 },
+		{ 98, 145, GL_COMPRESSED_RGBA_BPTC_UNORM, 0, 16 },
+		{ 99, 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 0, 16 },
+	};
+
+	const FormatInfo* UFindDxgiFormat(uint32_t dxgiFormat)
+	{
+		for (const FormatInfo& info : FORMATS)
+			if (dxgiFormat != 0 && info.dxgiFormat == dxgiFormat)
+				return &info;
+		return nullptr;
+	}
+
+	const FormatInfo* UFindVkFormat(uint32_t vkFormat)
+	{
+		for (const FormatInfo& info : FORMATS)
+			if (info.vkFormat == vkFormat)
+				return &info;
+		return nullptr;
+	}
+
+	// Bytes of one level of width x height
+	size_t ULevelSize(const FormatInfo& info, GLsizei width, GLsizei height)
+	{
+		if (info.format == 0)
+			return (size_t)((width + 3) / 4) * ((height + 3) / 4) * info.bytes;
+		return (size_t)width * height * info.bytes;
+	}
+
+	bool UReject(const std::string& name, const char* reason)
+	{
+		std::cout << "Failed to load texture " << name << ": " << reason << std::endl;
+		return false;
+	}
+
+	// Unaligned little endian reads; both formats are little endian throughout
+	uint32_t URead32(const unsigned char* data)
+	{
+		uint32_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	uint64_t URead64(const unsigned char* data)
+	{
+		uint64_t value;
+		memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	uint32_t UFourCC(const char* code)
+	{
+		return (uint32_t)(unsigned char)code[0] | ((uint32_t)(unsigned char)code[1] << 8)
+			| ((uint32_t)(unsigned char)code[2] << 16) | ((uint32_t)(unsigned char)code[3] << 24);
+	}
+
+	// Levels of a mip chain have no reason to go beyond 32
+	const uint32_t MAX_LEVELS = 32;
+
+	// DDS: "DDS ", a 124 byte header holding a 32 byte pixel format, and with
+	// the FourCC "DX10" a 20 byte extension; then the levels back to back
+	const size_t DDS_HEADER_OFFSET = 4;
+	const size_t DDS_HEADER_SIZE = 124;
+	const size_t DDS_DX10_SIZE = 20;
+	const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+	const uint32_t DDPF_ALPHAPIXELS = 0x1;
+	const uint32_t DDPF_FOURCC = 0x4;
+	const uint32_t DDPF_RGB = 0x40;
+	const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+	const uint32_t DDSCAPS2_VOLUME = 0x200000;
+	const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+	const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+	///////////////////////////////////////////////////
+	//	UParseDDS(const std::string&, const unsigned char*, size_t, TextureContainer&)
+	//
+	//	Field offsets are from the start of the file, magic included.
+	///////////////////////////////////////////////////
+	bool UParseDDS(const std::string& name, const unsigned char* data, size_t size, TextureContainer& container)
+	{
+		if (size < DDS_HEADER_OFFSET + DDS_HEADER_SIZE || URead32(data + 4) != DDS_HEADER_SIZE)
+			return UReject(name, "truncated DDS header");
+
+		uint32_t flags = URead32(data + 8);
+		uint32_t height = URead32(data + 12);
+		uint32_t width = URead32(data + 16);
+		uint32_t levels = (flags & DDSD_MIPMAPCOUNT) ? std::max(URead32(data + 28), 1u) : 1;
+		uint32_t pixelFlags = URead32(data + 80);
+		uint32_t fourCC = URead32(data + 84);
+		uint32_t bitCount = URead32(data + 88);
+		uint32_t redMask = URead32(data + 92);
+		uint32_t caps2 = URead32(data + 112);
+		if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+			return UReject(name, "DDS cube maps and volumes are not supported");
+
+		size_t offset = DDS_HEADER_OFFSET + DDS_HEADER_SIZE;
+		const FormatInfo* info = nullptr;
+		if ((pixelFlags & DDPF_FOURCC) && fourCC == UFourCC("DX10"))
+		{
+			if (size < offset + DDS_DX10_SIZE)
+				return UReject(name, "truncated DDS header");
+			const unsigned char* dx10 = data + offset;
+			if (URead32(dx10 + 4) != DDS_DIMENSION_TEXTURE2D || (URead32(dx10 + 8) & DDS_RESOURCE_MISC_TEXTURECUBE) || URead32(dx10 + 12) > 1)
+				return UReject(name, "only single 2D DDS textures are supported");
+			info = UFindDxgiFormat(URead32(dx10));
+			offset += DDS_DX10_SIZE;
+		}
+		else if (pixelFlags & DDPF_FOURCC)
+		{
+			if (fourCC == UFourCC("DXT1"))
+				info = UFindVkFormat((pixelFlags & DDPF_ALPHAPIXELS) ? 133 : 131);
+			else if (fourCC == UFourCC("DXT2") || fourCC == UFourCC("DXT3"))
+				info = UFindVkFormat(135);
+			else if (fourCC == UFourCC("DXT4") || fourCC == UFourCC("DXT5"))
+				info = UFindVkFormat(137);
+			else if (fourCC == UFourCC("ATI1") || fourCC == UFourCC("BC4U"))
+				info = UFindVkFormat(139);
+			else if (fourCC == UFourCC("BC4S"))
+				info = UFindVkFormat(140);
+			else if (fourCC == UFourCC("ATI2") || fourCC == UFourCC("BC5U"))
+				info = UFindVkFormat(141);
+			else if (fourCC == UFourCC("BC5S"))
+				info = UFindVkFormat(142);
+		}
+		else if (pixelFlags & DDPF_RGB)
+		{
+			// Byte order follows from where red sits
+			if (bitCount == 32 && redMask == 0x000000ff)
+				info = UFindVkFormat(37);
+			else if (bitCount == 32 && redMask == 0x00ff0000)
+				info = UFindVkFormat(44);
+			else if (bitCount == 24 && redMask == 0x000000ff)
+				info = UFindVkFormat(23);
+			else if (bitCount == 24 && redMask == 0x00ff0000)
+				info = UFindVkFormat(30);
+		}
+		if (info == nullptr)
+			return UReject(name, "unsupported DDS pixel format");
+		if (width == 0 || height == 0 || levels > MAX_LEVELS)
+			return UReject(name, "bad DDS size or level count");
+
+		container.width = (GLsizei)width;
+		container.height = (GLsizei)height;
+		container.internalFormat = info->internalFormat;
+		container.format = info->format;
+		container.generateMipmaps = false;
+		for (uint32_t level = 0; level < levels; ++level)
+		{
+			size_t levelSize = ULevelSize(*info, std::max((GLsizei)(width >> level), 1), std::max((GLsizei)(height >> level), 1));
+			if (levelSize > size - offset)
+				return UReject(name, "DDS levels run past the end of the file");
+			container.levelOffsets.push_back(offset);
+			container.levelSizes.push_back((GLsizei)levelSize);
+			offset += levelSize;
+		}
+		return true;
+	}
+
+	// KTX2: 12 byte identifier, nine 32-bit fields, the data format, key/value
+	// and supercompression indices, then one 24 byte entry per level
+	const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+	const size_t KTX2_LEVEL_INDEX_OFFSET = 80;
+	const size_t KTX2_LEVEL_ENTRY_SIZE = 24;
+
+	bool UParseKTX2(const std::string& name, const unsigned char* data, size_t size, TextureContainer& container)
+	{
+		if (size < KTX2_LEVEL_INDEX_OFFSET)
+			return UReject(name, "truncated KTX2 header");
+
+		uint32_t vkFormat = URead32(data + 12);
+		uint32_t width = URead32(data + 20);
+		uint32_t height = URead32(data + 24);
+		uint32_t depth = URead32(data + 28);
+		uint32_t layers = URead32(data + 32);
+		uint32_t faces = URead32(data + 36);
+		uint32_t levelCount = URead32(data + 40);
+		uint32_t supercompression = URead32(data + 44);
+		if (depth > 1 || layers > 1 || faces != 1 || height == 0)
+			return UReject(name, "only single 2D KTX2 textures are supported");
+		if (supercompression != 0)
+			return UReject(name, "supercompressed KTX2 would need decoding");
+
+		const FormatInfo* info = UFindVkFormat(vkFormat);
+		if (info == nullptr)
+			return UReject(name, "unsupported KTX2 vkFormat");
+		// A level count of 0 asks the loader to build the chain itself
+		uint32_t levels = std::max(levelCount, 1u);
+		if (width == 0 || levels > MAX_LEVELS || size < KTX2_LEVEL_INDEX_OFFSET + levels * KTX2_LEVEL_ENTRY_SIZE)
+			return UReject(name, "bad KTX2 size or level count");
+
+		container.width = (GLsizei)width;
+		container.height = (GLsizei)height;
+		container.internalFormat = info->internalFormat;
+		container.format = info->format;
+		container.generateMipmaps = levelCount == 0 && info->format != 0;
+		for (uint32_t level = 0; level < levels; ++level)
+		{
+			const unsigned char* entry = data + KTX2_LEVEL_INDEX_OFFSET + level * KTX2_LEVEL_ENTRY_SIZE;
+			uint64_t offset = URead64(entry);
+			uint64_t length = URead64(entry + 8);
+			size_t levelSize = ULevelSize(*info, std::max((GLsizei)(width >> level), 1), std::max((GLsizei)(height >> level), 1));
+			if (length < levelSize)
+				return UReject(name, "KTX2 level is smaller than its size says");
+			if (offset > size || levelSize > size - offset)
+				return UReject(name, "KTX2 levels run past the end of the file");
+			container.levelOffsets.push_back((size_t)offset);
+			container.levelSizes.push_back((GLsizei)levelSize);
+		}
+		return true;
+	}
+}
+
+bool IsTextureContainerFile(const char* filename)
+{
+	std::string extension = filename;
+	size_t dot = extension.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	extension.erase(0, dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+	return extension == "dds" || extension == "ktx2";
+}
+
+bool ParseTextureContainer(const std::string& name, const unsigned char* data, size_t size, TextureContainer& container)
+{
+	container = TextureContainer();
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+		return UParseKTX2(name, data, size, container);
+	if (size >= DDS_HEADER_OFFSET && URead32(data) == UFourCC("DDS "))
+		return UParseDDS(name, data, size, container);
+	return UReject(name, "neither a DDS nor a KTX2 file");
+}
+
+size_t ContainerBytes(const TextureContainer& container)
+{
+	size_t total = 0;
+	for (GLsizei levelSize : container.levelSizes)
+		total += (size_t)levelSize;
+	return container.generateMipmaps ? total * 4 / 3 : total;
+}
@@ -0,0 +1,550 @@
+///////////////////////////////////////////////////////////////////////////////
+//  textureloader.cpp
+//  =================
+//  Asynchronous texture loading.
+//
+//  Decoding a JPEG takes far longer than uploading it, so it leaves the GL
+//  thread: Load() reads the header, creates the texture with a placeholder
+//  and submits the file to the thread pool. Workers decode into a vector
+//  and park it under the mutex; Update() moves the finished images into
+//  the upload queue, which then streams them in within its frame budget.
+//  The GL context is only ever touched by the thread that calls Load() and
+//  Update().
+//
+//  Workers also build each 2D texture's mip chain (see mipgenerator.cpp),
+//  so the GL thread never runs glGenerateMipmap. With compression enabled
+//  a worker then block compresses every level and writes the result to
+//  the disk cache under the file's content hash. The next run finds it
+//  there and skips the decode, the filtering and the encode. With a
+//  streamer the finished chain goes to it rather than straight to the
+//  upload queue, and only the levels the scene needs are uploaded.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "textureloader.h"
+
+#include "imageprep.h"
+#include "mipgenerator.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace
+{
+	// Start of a disk cache file. The level sizes follow, then the levels.
+	struct EncodedHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t internalFormat;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		uint32_t mipSettings;		// MipSettingsKey() of the settings the chain was built with
+	};
+	const char ENCODED_MAGIC[4] = { 'B', 'C', 'T', 'X' };
+	// Bump when the encoder's output changes so stale files are rebuilt
+	const uint32_t ENCODED_VERSION = 2;
+
+	// formatName: BlockFormatName() of an encoded chain, "rgba8" for raw pixels
+	std::string UEncodedPath(const std::string& directory, uint64_t hash, const char* formatName)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "%016llx_%s.bct", (unsigned long long)hash, formatName);
+		return (std::filesystem::path(directory) / name).string();
+	}
+
+	// Where level 0 starts in a cache file holding levelCount levels
+	size_t UEncodedLevelsOffset(size_t levelCount)
+	{
+		return sizeof(EncodedHeader) + levelCount * sizeof(GLsizei);
+	}
+
+	///////////////////////////////////////////////////
+	//	UReadEncoded(const std::string&, BlockFormat, uint32_t, int, int, ...)
+	//
+	//	Fills in the mip chain of a width x height image from a cache file.
+	//	Nothing in the file is trusted: the header must name this format,
+	//	size and mip settings, every level must hold exactly the blocks its
+	//	size needs, down to 1x1, and the file must end where the last level
+	//	does. Anything else (missing, stale, truncated or corrupt) reads as
+	//	a miss and the image is encoded again.
+	///////////////////////////////////////////////////
+	bool UReadEncoded(const std::string& path, BlockFormat format, uint32_t mipSettings, int width, int height, std::vector<GLsizei>& levelSizes, std::vector<unsigned char>& levels)
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			return false;
+		std::streamoff fileSize = file.tellg();
+		file.seekg(0);
+
+		EncodedHeader header;
+		if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, ENCODED_MAGIC, sizeof(ENCODED_MAGIC)) != 0
+			|| header.version != ENCODED_VERSION || header.internalFormat != BlockInternalFormat(format) || header.mipSettings != mipSettings
+			|| header.width != (uint32_t)width || header.height != (uint32_t)height)
+			return false;
+
+		uint32_t levelCount = 1;
+		while ((std::max(width, height) >> levelCount) > 0)
+			++levelCount;
+		if (header.levels != levelCount)
+			return false;
+
+		levelSizes.resize(levelCount);
+		if (!file.read((char*)levelSizes.data(), levelCount * sizeof(GLsizei)))
+			return false;
+		size_t total = 0;
+		for (uint32_t level = 0; level < levelCount; ++level)
+		{
+			if ((size_t)levelSizes[level] != EncodedSize(format, std::max(width >> level, 1), std::max(height >> level, 1)))
+				return false;
+			total += (size_t)levelSizes[level];
+		}
+		if ((size_t)fileSize != UEncodedLevelsOffset(levelCount) + total)
+			return false;
+
+		levels.resize(total);
+		return (bool)file.read((char*)levels.data(), total);
+	}
+
+	// Written beside the final name and renamed into place, so a reader never sees half a file.
+	// false when the file could not be written.
+	bool UWriteEncoded(const std::string& path, GLenum internalFormat, uint32_t mipSettings, int width, int height, const std::vector<GLsizei>& levelSizes, const std::vector<unsigned char>& levels)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+		EncodedHeader header;
+		memcpy(header.magic, ENCODED_MAGIC, sizeof(ENCODED_MAGIC));
+		header.version = ENCODED_VERSION;
+		header.internalFormat = internalFormat;
+		header.width = (uint32_t)width;
+		header.height = (uint32_t)height;
+		header.levels = (uint32_t)levelSizes.size();
+		header.mipSettings = mipSettings;
+
+		std::string temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file.write((const char*)&header, sizeof(header));
+			file.write((const char*)levelSizes.data(), levelSizes.size() * sizeof(GLsizei));
+			file.write((const char*)levels.data(), levels.size());
+			if (!file)
+				return false;
+		}
+		std::filesystem::rename(temporary, path, error);
+		return !error;
+	}
+
+	// Channel counts the GL formats below cover
+	bool USupportedChannels(int channels)
+	{
+		if (channels == 3 || channels == 4)
+			return true;
+		std::cout << "Not implemented to handle an image with " << channels << " channels" << std::endl;
+		return false;
+	}
+}
+
+bool ReadFileBytes(const char* filename, std::vector<unsigned char>& bytes)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file)
+		return false;
+	bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return !bytes.empty();
+}
+
+uint64_t HashFileBytes(const std::vector<unsigned char>& bytes)
+{
+	return HashFileBytes(bytes.data(), bytes.size());
+}
+
+uint64_t HashFileBytes(const unsigned char* bytes, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	hash ^= (uint64_t)size;
+	hash *= 1099511628211ull;
+	return hash;
+}
+
+TextureLoader::TextureLoader()
+	: mPool(nullptr), mUploads(nullptr), mStreamer(nullptr), mNextJob(0), mCompress(false), mFormat(BLOCK_BC1), mAlphaFormat(BLOCK_BC3)
+{
+	mMipSettings.filter = MIP_FILTER_KAISER;
+	mMipSettings.srgb = true;
+	mMipSettings.alphaCutoff = 0.0f;
+}
+
+void TextureLoader::Initialize(ThreadPool* pool, UploadQueue* uploads)
+{
+	mPool = pool;
+	mUploads = uploads;
+}
+
+void TextureLoader::EnableCompression(BlockFormat format, BlockFormat alphaFormat, const std::string& cacheDirectory)
+{
+	mCompress = true;
+	mFormat = format;
+	mAlphaFormat = alphaFormat;
+	mCacheDirectory = cacheDirectory;
+}
+
+void TextureLoader::SetStreamer(TextureStreamer* streamer, const std::string& cacheDirectory)
+{
+	mStreamer = streamer;
+	mCacheDirectory = cacheDirectory;
+}
+
+///////////////////////////////////////////////////
+//	ResidentBytes(int, int, int)
+//
+//	Raw textures are RGBA8, four bytes per texel; compressed ones count
+//	their blocks. The mip chain adds a third.
+///////////////////////////////////////////////////
+size_t TextureLoader::ResidentBytes(int width, int height, int channels) const
+{
+	size_t level0 = mCompress ? EncodedSize(channels == 4 ? mAlphaFormat : mFormat, width, height) : (size_t)width * height * 4;
+	return level0 * 4 / 3;
+}
+
+void TextureLoader::Destroy()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDecodeDone.wait(lock, [this] { return mDecoding.empty(); });
+	mDecoded.clear();
+}
+
+///////////////////////////////////////////////////
+//	Load(const char*, GLuint&)
+//
+//	filename: image to decode on the pool
+//	textureId: receives the new texture, usable for drawing right away
+///////////////////////////////////////////////////
+bool TextureLoader::Load(const char* filename, GLuint& textureId)
+{
+	int width, height, channels;
+	if (!stbi_info(filename, &width, &height, &channels) || !USupportedChannels(channels))
+		return false;
+
+	CreatePlaceholder(textureId);
+
+	GLuint texture = textureId;
+	unsigned int job = BeginDecode(texture, -1);
+	std::string name = filename;
+	mPool->Submit([this, job, texture, name] { Decode(job, texture, -1, 0, name, std::vector<unsigned char>()); });
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Load(const std::string&, std::vector<unsigned char>&&, GLuint&)
+//
+//	The worker decodes straight from file, which the task takes over, so
+//	a caller that had to read the file anyway does not read it twice.
+///////////////////////////////////////////////////
+bool TextureLoader::Load(const std::string& name, std::vector<unsigned char>&& file, GLuint& textureId)
+{
+	int width, height, channels;
+	if (!stbi_info_from_memory(file.data(), (int)file.size(), &width, &height, &channels) || !USupportedChannels(channels))
+		return false;
+
+	CreatePlaceholder(textureId);
+
+	GLuint texture = textureId;
+	unsigned int job = BeginDecode(texture, -1);
+	mPool->Submit([this, job, texture, name, bytes = std::move(file)] { Decode(job, texture, -1, 0, name, bytes); });
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Load(const std::string&, std::shared_ptr<const MappedFile>, const TextureContainer&, GLuint&)
+//
+//	Container levels need no decoding, so the job goes to the upload queue
+//	right away and keeps the mapping alive until its levels are copied.
+//	Every BCn format but S3TC is core in GL 4.4.
+///////////////////////////////////////////////////
+bool TextureLoader::Load(const std::string& name, std::shared_ptr<const MappedFile> file, const TextureContainer& container, GLuint& textureId)
+{
+	bool s3tc = (container.internalFormat >= 0x83F0 && container.internalFormat <= 0x83F3)
+		|| (container.internalFormat >= 0x8C4C && container.internalFormat <= 0x8C4F);
+	if (s3tc && !BlockFormatSupported(BLOCK_BC1))
+	{
+		std::cout << "Failed to load texture " << name << ": S3TC is not supported by the driver" << std::endl;
+		return false;
+	}
+
+	CreatePlaceholder(textureId);
+	mUploads->EnqueueMappedTexture(textureId, container.width, container.height, container.internalFormat, container.format,
+		container.levelOffsets, container.levelSizes, std::move(file), container.generateMipmaps);
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	LoadLayer(const std::string&, std::vector<unsigned char>&&, const TextureArray&, GLint)
+//
+//	The layer keeps whatever it held, the array's grey at first, until the
+//	image arrives. The caller allocates and frees the layer.
+///////////////////////////////////////////////////
+bool TextureLoader::LoadLayer(const std::string& name, std::vector<unsigned char>&& file, const TextureArray& array, GLint layer)
+{
+	int width, height, channels;
+	if (!stbi_info_from_memory(file.data(), (int)file.size(), &width, &height, &channels) || !USupportedChannels(channels))
+		return false;
+
+	GLuint texture = array.Texture();
+	GLsizei layerSize = array.LayerSize();
+	unsigned int job = BeginDecode(texture, layer);
+	mPool->Submit([this, job, texture, layer, layerSize, name, bytes = std::move(file)] { Decode(job, texture, layer, layerSize, name, bytes); });
+	return true;
+}
+
+///////////////////////////////////////////////////
+//	Cancel(GLuint, GLint)
+//
+//	A finished result is removed at once; a decode still running is marked
+//	and dropped by the worker when it is done.
+///////////////////////////////////////////////////
+void TextureLoader::Cancel(GLuint texture, GLint layer)
+{
+	if (mStreamer != nullptr && layer < 0)
+		mStreamer->Remove(texture);
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mDecoded.erase(std::remove_if(mDecoded.begin(), mDecoded.end(),
+		[texture, layer](const Decoded& image) { return image.texture == texture && image.layer == layer; }), mDecoded.end());
+	for (InFlight& decoding : mDecoding)
+		if (decoding.texture == texture && decoding.layer == layer)
+			decoding.cancelled = true;
+}
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	Takes the finished images out under the lock and enqueues them outside
+//	it, so workers are never held up by the upload queue. A file that failed
+//	to decode keeps its placeholder.
+///////////////////////////////////////////////////
+void TextureLoader::Update()
+{
+	std::vector<Decoded> decoded;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mDecoded.empty())
+			return;
+		decoded.swap(mDecoded);
+	}
+
+	for (Decoded& image : decoded)
+	{
+		if (image.pixels.empty())
+		{
+			std::cout << "Failed to load texture " << image.filename << std::endl;
+			continue;
+		}
+
+		if (image.layer >= 0)
+		{
+			mUploads->EnqueueTextureLayer(image.texture, image.layer, image.width, image.height, GL_RGBA, std::move(image.levelSizes), std::move(image.pixels));
+			continue;
+		}
+
+		// Every 2D texture arrives with its whole mip chain, RGBA8 or block compressed
+		GLenum internalFormat = (image.compressedFormat != 0) ? image.compressedFormat : GL_RGBA8;
+		GLenum format = (image.compressedFormat != 0) ? 0 : GL_RGBA;
+		if (mStreamer != nullptr)
+		{
+			size_t pathOffset = UEncodedLevelsOffset(image.levelSizes.size());
+			mStreamer->Add(image.texture, image.width, image.height, internalFormat, format, std::move(image.levelSizes), std::move(image.pixels),
+				image.chainPath, pathOffset);
+		}
+		else
+			mUploads->EnqueueTextureLevels(image.texture, image.width, image.height, internalFormat, format, std::move(image.levelSizes), std::move(image.pixels));
+	}
+}
+
+size_t TextureLoader::Pending() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mDecoding.size() + mDecoded.size();
+}
+
+///////////////////////////////////////////////////
+//	CreatePlaceholder(GLuint&)
+//
+//	Texture parameters are the ones every texture in the scene uses: repeat
+//	wrapping and linear filtering. Mipmaps are built when the image arrives.
+///////////////////////////////////////////////////
+void TextureLoader::CreatePlaceholder(GLuint& textureId)
+{
+	glGenTextures(1, &textureId);
+	glBindTexture(GL_TEXTURE_2D, textureId);
+
+	// Set the texture wrapping parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	// Set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// 1x1 grey placeholder until the real image is decoded and uploaded
+	const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+unsigned int TextureLoader::BeginDecode(GLuint texture, GLint layer)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	InFlight decoding = { mNextJob++, texture, layer, false };
+	mDecoding.push_back(decoding);
+	return decoding.job;
+}
+
+///////////////////////////////////////////////////
+//	Decode(unsigned int, GLuint, GLint, GLsizei, const std::string&, const std::vector<unsigned char>&)
+//
+//	Runs on a worker, decoding file when it holds the bytes and reading
+//	filename otherwise. Whatever the path, the image leaves as RGBA rows
+//	bottom first (see imageprep.cpp), so GL never unpacks 3 byte texels.
+///////////////////////////////////////////////////
+void TextureLoader::Decode(unsigned int job, GLuint texture, GLint layer, GLsizei layerSize, const std::string& filename, const std::vector<unsigned char>& file)
+{
+	Decoded result = {};
+	result.texture = texture;
+	result.layer = layer;
+	result.filename = filename;
+
+	if (mCompress && layer < 0)
+		DecodeCompressed(filename, file, result);
+	else
+	{
+		unsigned char* image = file.empty()
+			? stbi_load(filename.c_str(), &result.width, &result.height, &result.channels, 0)
+			: stbi_load_from_memory(file.data(), (int)file.size(), &result.width, &result.height, &result.channels, 0);
+		if (image)
+		{
+			// The header may have changed since Load() looked at it
+			if ((result.channels == 3 || result.channels == 4) && layer >= 0)
+			{
+				std::vector<unsigned char> rgba((size_t)layerSize * layerSize * 4);
+				ResampleToRGBA(image, result.width, result.height, result.channels, layerSize, layerSize, true, rgba.data());
+				GenerateMipChain(rgba.data(), layerSize, layerSize, mMipSettings, result.pixels, result.levelSizes);
+				result.width = layerSize;
+				result.height = layerSize;
+				result.channels = 4;
+			}
+			else if (result.channels == 3 || result.channels == 4)
+			{
+				std::vector<unsigned char> rgba((size_t)result.width * result.height * 4);
+				ConvertToRGBA(image, result.width, result.height, result.channels, true, rgba.data());
+				GenerateMipChain(rgba.data(), result.width, result.height, mMipSettings, result.pixels, result.levelSizes);
+				result.channels = 4;
+			}
+			stbi_image_free(image);
+		}
+		if (layer < 0 && mStreamer != nullptr && !result.pixels.empty())
+			StoreChain(filename, file, result);
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	std::vector<InFlight>::iterator decoding = std::find_if(mDecoding.begin(), mDecoding.end(),
+		[job](const InFlight& entry) { return entry.job == job; });
+	if (!decoding->cancelled)
+		mDecoded.push_back(std::move(result));
+	mDecoding.erase(decoding);
+	mDecodeDone.notify_all();
+}
+
+///////////////////////////////////////////////////
+//	DecodeCompressed(const std::string&, const std::vector<unsigned char>&, Decoded&)
+//
+//	Worker side of a compressed 2D texture: the disk cache first, else
+//	decode to RGBA, build the mip chain, encode every level, and store
+//	the result for next time. Leaves result.pixels empty on failure.
+///////////////////////////////////////////////////
+void TextureLoader::DecodeCompressed(const std::string& filename, const std::vector<unsigned char>& file, Decoded& result) const
+{
+	std::vector<unsigned char> read;
+	if (file.empty() && !ReadFileBytes(filename.c_str(), read))
+		return;
+	const std::vector<unsigned char>& bytes = file.empty() ? read : file;
+
+	int width, height, channels;
+	if (!stbi_info_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels))
+		return;
+	BlockFormat format = channels == 4 ? mAlphaFormat : mFormat;
+	result.compressedFormat = BlockInternalFormat(format);
+	result.channels = 4;
+
+	std::string path = UEncodedPath(mCacheDirectory, HashFileBytes(bytes), BlockFormatName(format));
+	uint32_t mipSettings = MipSettingsKey(mMipSettings);
+	if (UReadEncoded(path, format, mipSettings, width, height, result.levelSizes, result.pixels))
+	{
+		result.width = width;
+		result.height = height;
+		result.chainPath = path;
+		return;
+	}
+	result.levelSizes.clear();
+	result.pixels.clear();
+
+	unsigned char* image = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 4);
+	if (!image)
+		return;
+	std::vector<unsigned char> level((size_t)width * height * 4);
+	ConvertToRGBA(image, width, height, 4, true, level.data());
+	stbi_image_free(image);
+
+	std::vector<unsigned char> chain;
+	std::vector<GLsizei> chainSizes;
+	GenerateMipChain(level.data(), width, height, mMipSettings, chain, chainSizes);
+
+	result.width = width;
+	result.height = height;
+	const unsigned char* source = chain.data();
+	for (size_t index = 0; index < chainSizes.size(); ++index)
+	{
+		int levelWidth = std::max(width >> index, 1);
+		int levelHeight = std::max(height >> index, 1);
+		size_t size = EncodedSize(format, levelWidth, levelHeight);
+		size_t offset = result.pixels.size();
+		result.pixels.resize(offset + size);
+		EncodeImage(format, source, levelWidth, levelHeight, result.pixels.data() + offset);
+		result.levelSizes.push_back((GLsizei)size);
+		source += chainSizes[index];
+	}
+
+	if (UWriteEncoded(path, result.compressedFormat, mipSettings, result.width, result.height, result.levelSizes, result.pixels))
+		result.chainPath = path;
+}
+
+///////////////////////////////////////////////////
+//	StoreChain(const std::string&, const std::vector<unsigned char>&, Decoded&)
+//
+//	Worker side of a streamed RGBA8 texture: writes its chain to the disk
+//	cache in the encoded chains' layout, so the streamer can read levels
+//	back from it. result.chainPath stays empty when that fails.
+///////////////////////////////////////////////////
+void TextureLoader::StoreChain(const std::string& filename, const std::vector<unsigned char>& file, Decoded& result) const
+{
+	std::vector<unsigned char> read;
+	if (mCacheDirectory.empty() || (file.empty() && !ReadFileBytes(filename.c_str(), read)))
+		return;
+	std::string path = UEncodedPath(mCacheDirectory, HashFileBytes(file.empty() ? read : file), "rgba8");
+	if (UWriteEncoded(path, GL_RGBA8, MipSettingsKey(mMipSettings), result.width, result.height, result.levelSizes, result.pixels))
+		result.chainPath = path;
+}
@@ -0,0 +1,365 @@
+///////////////////////////////////////////////////////////////////////////////
+//  texturestreamer.cpp
+//  ===================
+//  Texture mip streaming.
+//
+//  A streamed texture gets immutable storage for its whole chain when its
+//  image arrives, but only the small levels are uploaded with it. Each
+//  frame the renderer reports how many pixels one repeat of the texture
+//  covers on every object using it; the ratio of texels to pixels gives
+//  the finest level sampling can reach. Update() then moves the textures
+//  that fall short one level finer at a time through the upload queue,
+//  whose copy also lowers GL_TEXTURE_BASE_LEVEL, so a level is sampled
+//  from the frame it lands in.
+//
+//  The uploaded levels are counted from the base level down and kept
+//  under a byte budget. When a level does not fit, a texture holding
+//  levels finer than it needs (because it was seen from further away, or
+//  not at all since the last update) gives its finest one up: the base
+//  level goes back up and the texels are invalidated. Immutable storage
+//  keeps its allocation either way, so the budget bounds what is uploaded
+//  and sampled, not GPU memory.
+//
+//  Nor does the chain stay in RAM. The loader leaves it in its disk cache,
+//  so once a level is queued its bytes belong to the upload queue, and a
+//  level needed again is read back from the file on a worker. Only a chain
+//  the cache could not store keeps its fine levels in memory.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "texturestreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+TextureStreamer::TextureStreamer()
+	: mPool(nullptr), mUploads(nullptr), mBudgetBytes(0), mUploadedBytes(0), mMemoryBytes(0), mFrame(0), mNextSerial(0),
+	mLevelsStreamed(0), mLevelsDropped(0), mLevelsRead(0), mReading(0)
+{
+}
+
+void TextureStreamer::Initialize(ThreadPool* pool, UploadQueue* uploads, size_t budgetBytes)
+{
+	mPool = pool;
+	mUploads = uploads;
+	mBudgetBytes = budgetBytes;
+}
+
+void TextureStreamer::Destroy()
+{
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mReadDone.wait(lock, [this] { return mReading == 0; });
+		mRead.clear();
+	}
+	mEntries.clear();
+	mUploadedBytes = 0;
+	mMemoryBytes = 0;
+}
+
+///////////////////////////////////////////////////
+//	Add(GLuint, GLsizei, GLsizei, GLenum, GLenum, ...)
+//
+//	texture: the 2D texture the chain belongs to, still holding its
+//	placeholder; glTexStorage2D replaces it when the first upload runs
+//	internalFormat, format: as for EnqueueStreamedLevels()
+//	levelSizes, levels: the chain down to 1x1
+//	path, pathOffset: cache file with the chain at pathOffset, "" for none
+//
+//	The coarse levels always go in, whatever the budget says, so every
+//	texture can be drawn with something better than the placeholder. They
+//	are never dropped, so their bytes go to the upload queue; so do the
+//	finer ones when path can give them back.
+///////////////////////////////////////////////////
+void TextureStreamer::Add(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& levels,
+	const std::string& path, size_t pathOffset)
+{
+	Remove(texture);
+
+	Entry entry;
+	entry.width = width;
+	entry.height = height;
+	entry.internalFormat = internalFormat;
+	entry.format = format;
+	entry.levelSizes = std::move(levelSizes);
+	entry.path = path;
+	entry.pathOffset = pathOffset;
+	size_t offset = 0;
+	for (GLsizei size : entry.levelSizes)
+	{
+		entry.levelOffsets.push_back(offset);
+		offset += (size_t)size;
+	}
+
+	GLint lastLevel = (GLint)entry.levelSizes.size() - 1;
+	entry.coarseLevel = 0;
+	while (entry.coarseLevel < lastLevel && std::max(width >> entry.coarseLevel, height >> entry.coarseLevel) > COARSE_SIZE)
+		++entry.coarseLevel;
+	entry.finestLevel = 0;
+	entry.residentLevel = entry.coarseLevel;
+	entry.wantedLevel = entry.coarseLevel;
+	entry.requestFrame = mFrame - 1;
+	entry.serial = mNextSerial++;
+	entry.reading = false;
+	entry.ticket = 0;
+
+	for (GLint level = entry.coarseLevel; level <= lastLevel; ++level)
+		mUploadedBytes += (size_t)entry.levelSizes[level];
+
+	std::vector<unsigned char> coarse(levels.begin() + entry.levelOffsets[entry.coarseLevel], levels.end());
+	if (entry.path.empty())
+	{
+		levels.resize(entry.levelOffsets[entry.coarseLevel]);
+		levels.shrink_to_fit();
+		entry.levels = std::move(levels);
+		mMemoryBytes += entry.levels.size();
+	}
+	else
+		levels = std::vector<unsigned char>();
+
+	Entry& added = mEntries.emplace(texture, std::move(entry)).first->second;
+	Enqueue(texture, added, added.coarseLevel, lastLevel, true, std::move(coarse));
+}
+
+// The caller cancels the texture's queued uploads (see TextureCache::Free)
+void TextureStreamer::Remove(GLuint texture)
+{
+	std::unordered_map<GLuint, Entry>::iterator found = mEntries.find(texture);
+	if (found == mEntries.end())
+		return;
+	const Entry& entry = found->second;
+	for (GLint level = entry.residentLevel; level < (GLint)entry.levelSizes.size(); ++level)
+		mUploadedBytes -= (size_t)entry.levelSizes[level];
+	mMemoryBytes -= entry.levels.size();
+	mEntries.erase(found);
+}
+
+///////////////////////////////////////////////////
+//	Request(GLuint, float)
+//
+//	Level n has 2^n fewer texels across than level 0; the finest level
+//	with no more texels than pixels is the one trilinear filtering starts
+//	from. Textures that are not streamed, such as array layers, are
+//	ignored.
+///////////////////////////////////////////////////
+void TextureStreamer::Request(GLuint texture, float pixels)
+{
+	std::unordered_map<GLuint, Entry>::iterator found = mEntries.find(texture);
+	if (found == mEntries.end())
+		return;
+	Entry& entry = found->second;
+
+	GLint level = 0;
+	float texels = (float)std::max(entry.width, entry.height);
+	if (pixels < texels)
+		level = pixels > 0.0f ? (GLint)std::floor(std::log2(texels / pixels)) : entry.coarseLevel;
+	level = std::min(level, entry.coarseLevel);
+
+	if (entry.requestFrame != mFrame)
+	{
+		entry.wantedLevel = level;
+		entry.requestFrame = mFrame;
+	}
+	else
+		entry.wantedLevel = std::min(entry.wantedLevel, level);
+}
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	A texture has at most one read or upload in flight, so a texture
+//	coming close refines a level per upload and the queue's frame budget
+//	spreads the copies out. Small levels that fit are not held back by a
+//	large one that does not. A level counts against the budget from the
+//	moment its read starts.
+///////////////////////////////////////////////////
+void TextureStreamer::Update()
+{
+	FinishReads();
+
+	for (std::pair<const GLuint, Entry>& item : mEntries)
+	{
+		if (item.second.ticket != 0 && mUploads->IsReady(item.second.ticket))
+			item.second.ticket = 0;
+	}
+
+	// The budget may have shrunk
+	while (mUploadedBytes > mBudgetBytes && DropLevel(0))
+	{
+	}
+
+	std::vector<std::pair<GLuint, Entry*>> blurred;
+	for (std::pair<const GLuint, Entry>& item : mEntries)
+	{
+		if (item.second.ticket == 0 && !item.second.reading && WantedLevel(item.second) < item.second.residentLevel)
+			blurred.push_back(std::make_pair(item.first, &item.second));
+	}
+	std::sort(blurred.begin(), blurred.end(), [this](const std::pair<GLuint, Entry*>& a, const std::pair<GLuint, Entry*>& b)
+	{
+		GLint shortA = a.second->residentLevel - WantedLevel(*a.second);
+		GLint shortB = b.second->residentLevel - WantedLevel(*b.second);
+		return shortA != shortB ? shortA > shortB : a.second->levelSizes[a.second->residentLevel - 1] < b.second->levelSizes[b.second->residentLevel - 1];
+	});
+
+	for (std::pair<GLuint, Entry*>& item : blurred)
+	{
+		Entry& entry = *item.second;
+		GLint level = entry.residentLevel - 1;
+		size_t bytes = (size_t)entry.levelSizes[level];
+		while (mUploadedBytes + bytes > mBudgetBytes && DropLevel(item.first))
+		{
+		}
+		if (mUploadedBytes + bytes > mBudgetBytes)
+			continue;
+
+		mUploadedBytes += bytes;
+		entry.residentLevel = level;
+		if (entry.path.empty())
+		{
+			const unsigned char* first = entry.levels.data() + entry.levelOffsets[level];
+			Enqueue(item.first, entry, level, level, false, std::vector<unsigned char>(first, first + bytes));
+		}
+		else
+			StartRead(item.first, entry, level);
+		++mLevelsStreamed;
+	}
+
+	++mFrame;
+}
+
+TextureStreamerStats TextureStreamer::GetStats() const
+{
+	TextureStreamerStats stats;
+	stats.textures = (unsigned int)mEntries.size();
+	stats.uploadedBytes = mUploadedBytes;
+	stats.budgetBytes = mBudgetBytes;
+	stats.memoryBytes = mMemoryBytes;
+	stats.levelsStreamed = mLevelsStreamed;
+	stats.levelsDropped = mLevelsDropped;
+	stats.levelsRead = mLevelsRead;
+	return stats;
+}
+
+// Level the last requests asked for; a texture nobody asked for only needs its coarse levels
+GLint TextureStreamer::WantedLevel(const Entry& entry) const
+{
+	return entry.requestFrame == mFrame ? std::max(entry.wantedLevel, entry.finestLevel) : entry.coarseLevel;
+}
+
+///////////////////////////////////////////////////
+//	DropLevel(GLuint)
+//
+//	Gives up the finest level of the texture, other than keep, with the
+//	most levels it does not need; the bigger level goes on a tie. Textures
+//	with a read or upload in flight are left alone. false when there is
+//	nothing to drop.
+///////////////////////////////////////////////////
+bool TextureStreamer::DropLevel(GLuint keep)
+{
+	GLuint victim = 0;
+	Entry* dropped = nullptr;
+	GLint mostSpare = 0;
+	for (std::pair<const GLuint, Entry>& item : mEntries)
+	{
+		Entry& entry = item.second;
+		GLint spare = WantedLevel(entry) - entry.residentLevel;
+		if (item.first == keep || entry.ticket != 0 || entry.reading || spare <= 0)
+			continue;
+		if (spare > mostSpare || (spare == mostSpare && entry.levelSizes[entry.residentLevel] > dropped->levelSizes[dropped->residentLevel]))
+		{
+			victim = item.first;
+			dropped = &entry;
+			mostSpare = spare;
+		}
+	}
+	if (dropped == nullptr)
+		return false;
+
+	GLint level = dropped->residentLevel;
+	glBindTexture(GL_TEXTURE_2D, victim);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glInvalidateTexImage(victim, level);
+
+	mUploadedBytes -= (size_t)dropped->levelSizes[level];
+	dropped->residentLevel = level + 1;
+	++mLevelsDropped;
+	return true;
+}
+
+// Queue levels firstLevel to lastLevel, whose bytes data holds; the upload makes firstLevel the base level
+void TextureStreamer::Enqueue(GLuint texture, Entry& entry, GLint firstLevel, GLint lastLevel, bool allocate, std::vector<unsigned char>&& data)
+{
+	std::vector<GLsizei> sizes(entry.levelSizes.begin() + firstLevel, entry.levelSizes.begin() + lastLevel + 1);
+	entry.ticket = mUploads->EnqueueStreamedLevels(texture, entry.width, entry.height, (GLint)entry.levelSizes.size(),
+		entry.internalFormat, entry.format, firstLevel, allocate, std::move(sizes), std::move(data));
+}
+
+// Read level of texture back from its cache file on a worker; Update() queues it once it arrives
+void TextureStreamer::StartRead(GLuint texture, Entry& entry, GLint level)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mReading;
+	}
+	entry.reading = true;
+	LevelRead read = { texture, entry.serial, level, std::vector<unsigned char>() };
+	size_t offset = entry.pathOffset + entry.levelOffsets[level];
+	size_t size = (size_t)entry.levelSizes[level];
+	std::string path = entry.path;
+	mPool->Submit([this, read, path, offset, size] { ReadLevel(read, path, offset, size); });
+}
+
+// Runs on a worker
+void TextureStreamer::ReadLevel(LevelRead read, const std::string& path, size_t offset, size_t size)
+{
+	std::ifstream file(path, std::ios::binary);
+	read.bytes.resize(size);
+	if (!file.seekg((std::streamoff)offset) || !file.read((char*)read.bytes.data(), (std::streamsize)size))
+		read.bytes = std::vector<unsigned char>();
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	mRead.push_back(std::move(read));
+	--mReading;
+	mReadDone.notify_all();
+}
+
+///////////////////////////////////////////////////
+//	FinishReads()
+//
+//	Queues the levels read back since the last update. A read for a
+//	texture removed meanwhile is thrown away. When the file cannot give a
+//	level back, the texture keeps the levels it has from then on.
+///////////////////////////////////////////////////
+void TextureStreamer::FinishReads()
+{
+	std::vector<LevelRead> read;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		if (mRead.empty())
+			return;
+		read.swap(mRead);
+	}
+
+	for (LevelRead& level : read)
+	{
+		std::unordered_map<GLuint, Entry>::iterator found = mEntries.find(level.texture);
+		if (found == mEntries.end() || found->second.serial != level.serial)
+			continue;
+		Entry& entry = found->second;
+		entry.reading = false;
+		if (level.bytes.empty())
+		{
+			std::cout << "WARNING: Could not read mip level " << level.level << " back from " << entry.path << "; the texture stops streaming there" << std::endl;
+			mUploadedBytes -= (size_t)entry.levelSizes[level.level];
+			entry.residentLevel = level.level + 1;
+			entry.finestLevel = level.level + 1;
+			continue;
+		}
+		Enqueue(level.texture, entry, level.level, level.level, false, std::move(level.bytes));
+		++mLevelsRead;
+	}
+}
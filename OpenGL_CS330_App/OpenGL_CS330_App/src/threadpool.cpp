@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+//  threadpool.cpp
+//  ==============
+//  Workers sleep on a condition variable until a task is queued and take
+//  tasks from the front of one shared queue. A counter of running tasks
+//  lets WaitIdle() tell an empty queue from finished work.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "threadpool.h"
+
+ThreadPool::ThreadPool()
+	: mBusy(0), mStopping(false)
+{
+}
+
+///////////////////////////////////////////////////
+//	Initialize(unsigned int)
+//
+//	threadCount: workers to start, 0 for one per core minus the render
+//	thread. A single core machine gets no workers and Submit() runs tasks
+//	inline.
+///////////////////////////////////////////////////
+void ThreadPool::Initialize(unsigned int threadCount)
+{
+	Destroy();
+
+	if (threadCount == 0)
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		threadCount = cores > 1 ? cores - 1 : 0;
+	}
+
+	mStopping = false;
+	for (unsigned int i = 0; i < threadCount; ++i)
+		mThreads.emplace_back(&ThreadPool::WorkerMain, this);
+}
+
+void ThreadPool::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (std::thread& thread : mThreads)
+		thread.join();
+	mThreads.clear();
+	mStopping = false;
+}
+
+///////////////////////////////////////////////////
+//	Submit(Task)
+//
+//	Queues task for the first idle worker. Tasks may run in any order
+//	relative to each other once more than one worker is started.
+///////////////////////////////////////////////////
+void ThreadPool::Submit(Task task)
+{
+	if (mThreads.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mTasks.push_back(std::move(task));
+	}
+	mWake.notify_one();
+}
+
+void ThreadPool::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mIdle.wait(lock, [this] { return mTasks.empty() && mBusy == 0; });
+}
+
+void ThreadPool::WorkerMain()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		// Queued tasks still run after Destroy() is called
+		mWake.wait(lock, [this] { return mStopping || !mTasks.empty(); });
+		if (mTasks.empty())
+			return;
+
+		Task task = std::move(mTasks.front());
+		mTasks.pop_front();
+		++mBusy;
+		lock.unlock();
+
+		task();
+
+		lock.lock();
+		--mBusy;
+		if (mTasks.empty() && mBusy == 0)
+			mIdle.notify_all();
+	}
+}
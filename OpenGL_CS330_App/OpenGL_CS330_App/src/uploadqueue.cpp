@@ -0,0 +1,521 @@
+///////////////////////////////////////////////////////////////////////////////
+//  uploadqueue.cpp
+//  ===============
+//  Spreads glBufferData / glTexImage2D style work over several frames.
+//
+//  Data is copied into a CPU-side job when it is enqueued, so callers may
+//  pass stack arrays; mapped files are the exception and are read in
+//  place when the job is issued. Each frame the queue writes as many jobs (or 1 MB
+//  slices of large buffers) as fit in its time budget into pixel-unpack
+//  staging buffers and lets the driver copy from there. A fence after every
+//  step tells us when the staging buffer can be reused and when the
+//  destination is resident.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "uploadqueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	// Default time budget per frame
+	const double DEFAULT_BUDGET_MS = 2.0;
+	// One second waits on a fence before a waiting RetireFinished() gives up on it
+	const int MAX_FENCE_WAITS = 5;
+}
+
+UploadQueue::UploadQueue()
+	: mBudgetMs(DEFAULT_BUDGET_MS), mNextTicket(1), mCompleted(0)
+{
+}
+
+///////////////////////////////////////////////////
+//	EnqueueBuffer(...)
+//
+//	buffer: destination buffer, storage already allocated
+//	offset: destination offset in bytes
+//	data, size: source bytes, copied before returning
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueBuffer(GLuint buffer, GLintptr offset, const void* data, GLsizeiptr size)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = false;
+	job.target = buffer;
+	job.destOffset = offset;
+	job.offset = 0;
+	job.data.assign((const unsigned char*)data, (const unsigned char*)data + size);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueTexture(...)
+//
+//	texture: destination texture name (GL_TEXTURE_2D)
+//	width, height, internalFormat, format: as for glTexImage2D with GL_UNSIGNED_BYTE
+//	pixels: tightly packed rows, copied before returning
+//	generateMipmaps: rebuild the mip chain once level 0 is in place
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, const void* pixels, bool generateMipmaps)
+{
+	int channels = (format == GL_RGBA) ? 4 : (format == GL_RGB) ? 3 : (format == GL_RG) ? 2 : 1;
+	size_t size = (size_t)width * height * channels;
+
+	std::vector<unsigned char> data((const unsigned char*)pixels, (const unsigned char*)pixels + size);
+	return EnqueueTexture(texture, width, height, internalFormat, format, std::move(data), generateMipmaps);
+}
+
+///////////////////////////////////////////////////
+//	EnqueueTexture(..., std::vector<unsigned char>&&, bool)
+//
+//	As above, but the job keeps pixels' storage: images decoded elsewhere
+//	reach the staging buffer without a copy on the GL thread.
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<unsigned char>&& pixels, bool generateMipmaps)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.internalFormat = internalFormat;
+	job.format = format;
+	job.generateMipmaps = generateMipmaps;
+	job.layer = -1;
+	job.data = std::move(pixels);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueTextureLevels(...)
+//
+//	texture: destination texture name (GL_TEXTURE_2D)
+//	width, height: size of level 0
+//	internalFormat, format: as for glTexImage2D with GL_UNSIGNED_BYTE, or
+//	format 0 for glCompressedTexImage2D
+//	levelSizes: bytes of levels 0, 1, ... down to the last one stored
+//	data: the levels back to back, kept by the job
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueTextureLevels(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.internalFormat = internalFormat;
+	job.format = format;
+	job.generateMipmaps = false;
+	job.layer = -1;
+	job.levelSizes = std::move(levelSizes);
+	job.data = std::move(data);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueMappedTexture(...)
+//
+//	texture: destination texture name (GL_TEXTURE_2D)
+//	width, height: size of level 0
+//	internalFormat, format: as for glTexImage2D with GL_UNSIGNED_BYTE, or
+//	format 0 for glCompressedTexImage2D
+//	levelOffsets, levelSizes: where each level sits in file, level 0 first
+//	generateMipmaps: build the levels after the last one stored
+//
+//	Nothing is copied here. When the job is issued the span of the file
+//	holding every level goes into the staging buffer in one copy, so
+//	padding between levels rides along and each level keeps its distance
+//	from the first.
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueMappedTexture(GLuint texture, GLsizei width, GLsizei height, GLenum internalFormat, GLenum format, const std::vector<size_t>& levelOffsets, const std::vector<GLsizei>& levelSizes, std::shared_ptr<const MappedFile> file, bool generateMipmaps)
+{
+	size_t first = *std::min_element(levelOffsets.begin(), levelOffsets.end());
+	size_t end = 0;
+	for (size_t level = 0; level < levelOffsets.size(); ++level)
+		end = std::max(end, levelOffsets[level] + (size_t)levelSizes[level]);
+
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.internalFormat = internalFormat;
+	job.format = format;
+	job.generateMipmaps = generateMipmaps;
+	job.layer = -1;
+	job.levelSizes = levelSizes;
+	for (size_t offset : levelOffsets)
+		job.levelOffsets.push_back((GLintptr)(offset - first));
+	job.file = std::move(file);
+	job.fileOffset = first;
+	job.fileBytes = end - first;
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueStreamedLevels(...)
+//
+//	texture: destination texture name (GL_TEXTURE_2D)
+//	width, height, levels: size of level 0 and depth of the whole chain
+//	internalFormat, format: as for glTexSubImage2D with GL_UNSIGNED_BYTE,
+//	or format 0 for glCompressedTexSubImage2D
+//	firstLevel: level the first of levelSizes goes to; the rest follow
+//	allocate: give the texture its immutable storage first
+//	data: the levels back to back, kept by the job
+//
+//	The base level moves in the same step as the copy, so GL never
+//	samples a level whose texels have not arrived.
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueStreamedLevels(GLuint texture, GLsizei width, GLsizei height, GLint levels, GLenum internalFormat, GLenum format, GLint firstLevel, bool allocate, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.internalFormat = internalFormat;
+	job.format = format;
+	job.generateMipmaps = false;
+	job.layer = -1;
+	job.levelSizes = std::move(levelSizes);
+	job.firstLevel = firstLevel;
+	job.storageLevels = levels;
+	job.allocateStorage = allocate;
+	job.data = std::move(data);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueTextureRegion(...)
+//
+//	texture: destination GL_TEXTURE_2D
+//	x, y, width, height: rectangle of level 0 to replace
+//	format: the pixels, as for glTexSubImage2D with GL_UNSIGNED_BYTE
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueTextureRegion(GLuint texture, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, std::vector<unsigned char>&& pixels)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.format = format;
+	job.generateMipmaps = false;
+	job.layer = -1;
+	job.isRegion = true;
+	job.regionX = x;
+	job.regionY = y;
+	job.data = std::move(pixels);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	EnqueueTextureLayer(...)
+//
+//	texture: destination GL_TEXTURE_2D_ARRAY with immutable storage
+//	layer: layer to replace
+//	width, height, format: level 0, as for glTexSubImage3D with GL_UNSIGNED_BYTE
+//	levelSizes: bytes of levels 0, 1, ... in data, as many as the layer is given
+///////////////////////////////////////////////////
+UploadTicket UploadQueue::EnqueueTextureLayer(GLuint texture, GLint layer, GLsizei width, GLsizei height, GLenum format, std::vector<GLsizei>&& levelSizes, std::vector<unsigned char>&& data)
+{
+	Job job = {};
+	job.ticket = mNextTicket++;
+	job.isTexture = true;
+	job.target = texture;
+	job.width = width;
+	job.height = height;
+	job.format = format;
+	job.generateMipmaps = false;
+	job.layer = layer;
+	job.levelSizes = std::move(levelSizes);
+	job.data = std::move(data);
+	mJobs.push_back(std::move(job));
+	return mJobs.back().ticket;
+}
+
+///////////////////////////////////////////////////
+//	CancelTexture(GLuint, GLint)
+//
+//	A texture job is issued in a single step, so every queued job for
+//	texture is still untouched and can simply be removed. Copies already
+//	issued are harmless: GL defers deleting a texture the GPU still uses.
+//	A dropped job's ticket reports ready along with the jobs after it.
+///////////////////////////////////////////////////
+void UploadQueue::CancelTexture(GLuint texture, GLint layer)
+{
+	mJobs.erase(std::remove_if(mJobs.begin(), mJobs.end(),
+		[texture, layer](const Job& job) { return job.isTexture && job.target == texture && job.layer == layer; }), mJobs.end());
+}
+
+///////////////////////////////////////////////////
+//	ProcessUploads()
+//
+//	Retires signalled fences, then issues queued work until the frame
+//	budget is used up. At least one step is issued per call so progress is
+//	guaranteed even with a tiny budget, unless a staging buffer cannot be
+//	mapped; the job then waits for the next call.
+///////////////////////////////////////////////////
+void UploadQueue::ProcessUploads()
+{
+	RetireFinished(false);
+
+	auto start = std::chrono::steady_clock::now();
+	while (!mJobs.empty())
+	{
+		if (!IssueNext())
+			break;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (elapsed.count() >= mBudgetMs)
+			break;
+	}
+}
+
+// A job whose staging buffer will not map even with every copy retired stays queued
+void UploadQueue::Flush()
+{
+	while (!mJobs.empty())
+	{
+		if (IssueNext())
+			continue;
+		RetireFinished(true);
+		if (!IssueNext())
+			break;
+	}
+	RetireFinished(true);
+}
+
+void UploadQueue::Destroy()
+{
+	Flush();
+	for (Staging& staging : mFree)
+		glDeleteBuffers(1, &staging.pbo);
+	mFree.clear();
+}
+
+size_t UploadQueue::PendingBytes() const
+{
+	size_t total = 0;
+	for (const Job& job : mJobs)
+		total += (job.file ? job.fileBytes : job.data.size()) - (job.isTexture ? 0 : job.offset);
+	return total;
+}
+
+///////////////////////////////////////////////////
+//	RetireFinished(bool)
+//
+//	Moves staging buffers whose fence has signalled back to the free list.
+//	A fence that fails to wait, or that a waiting call has waited on
+//	MAX_FENCE_WAITS times (lost context, hung GPU), would otherwise be
+//	retried forever: its copy is retired anyway and the staging buffer,
+//	which the GPU may still be reading, is deleted rather than reused.
+///////////////////////////////////////////////////
+void UploadQueue::RetireFinished(bool wait)
+{
+	int waits = 0;
+	while (!mInFlight.empty())
+	{
+		Staging& staging = mInFlight.front();
+		GLuint64 timeout = wait ? GLuint64(1000000000) : 0;
+		GLenum status = glClientWaitSync(staging.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+		if (status == GL_TIMEOUT_EXPIRED && (!wait || ++waits < MAX_FENCE_WAITS))
+		{
+			if (!wait)
+				break;
+			continue;
+		}
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			std::cout << "WARNING: Upload fence " << (status == GL_WAIT_FAILED ? "wait failed" : "never signalled")
+				<< ", dropping its staging buffer" << std::endl;
+			if (staging.pbo != 0)
+				glDeleteBuffers(1, &staging.pbo);
+			staging.pbo = 0;
+		}
+		waits = 0;
+
+		glDeleteSync(staging.fence);
+		staging.fence = 0;
+		// fences signal in submission order, so completion is monotonic
+		mCompleted = std::max(mCompleted, staging.ticket);
+		if (staging.pbo != 0)
+			mFree.push_back(staging);
+		mInFlight.pop_front();
+	}
+}
+
+// Find a free staging buffer that holds at least size bytes, or create one
+GLuint UploadQueue::AcquireStaging(GLsizeiptr size, GLsizeiptr& capacity)
+{
+	for (size_t i = 0; i < mFree.size(); ++i)
+	{
+		if (mFree[i].capacity >= size)
+		{
+			GLuint pbo = mFree[i].pbo;
+			capacity = mFree[i].capacity;
+			mFree.erase(mFree.begin() + i);
+			return pbo;
+		}
+	}
+
+	GLuint pbo;
+	capacity = std::max(size, CHUNK_SIZE);
+	glGenBuffers(1, &pbo);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return pbo;
+}
+
+// Issue one texture or one buffer slice. Returns false when the staging buffer could not be
+// written, leaving the job untouched at the head of the queue to be retried.
+bool UploadQueue::IssueNext()
+{
+	Job& job = mJobs.front();
+
+	const unsigned char* source = job.file ? job.file->Data() + job.fileOffset : job.data.data();
+	GLsizeiptr total = (GLsizeiptr)(job.file ? job.fileBytes : job.data.size());
+	GLsizeiptr remaining = total - job.offset;
+	GLsizeiptr size = job.isTexture ? remaining : std::min(remaining, CHUNK_SIZE);
+
+	Staging staging = {};
+	if (size > 0)
+	{
+		staging.pbo = AcquireStaging(size, staging.capacity);
+
+		// fill the staging buffer; the fence guarantees the GPU is done with it
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.pbo);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		bool written = mapped != nullptr;
+		if (written)
+		{
+			memcpy(mapped, source + (job.isTexture ? 0 : job.offset), size);
+			// GL_FALSE: the store was lost while mapped and holds undefined bytes
+			written = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+		}
+		if (!written)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			mFree.push_back(staging);
+			return false;
+		}
+
+		if (job.isTexture && job.layer >= 0)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, job.target);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			GLintptr levelOffset = 0;
+			for (GLint level = 0; level < (GLint)job.levelSizes.size(); ++level)
+			{
+				GLsizei levelWidth = std::max(job.width >> level, 1);
+				GLsizei levelHeight = std::max(job.height >> level, 1);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, job.layer, levelWidth, levelHeight, 1, job.format, GL_UNSIGNED_BYTE, (void*)levelOffset);
+				levelOffset += job.levelSizes[level];
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+		else if (job.isTexture && job.isRegion)
+		{
+			glBindTexture(GL_TEXTURE_2D, job.target);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, job.regionX, job.regionY, job.width, job.height, job.format, GL_UNSIGNED_BYTE, (void*)0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		else if (job.isTexture && !job.levelSizes.empty())
+		{
+			// Each level is read from its own offset into the staging buffer
+			glBindTexture(GL_TEXTURE_2D, job.target);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			if (job.allocateStorage)
+				glTexStorage2D(GL_TEXTURE_2D, job.storageLevels, job.internalFormat, job.width, job.height);
+			GLintptr levelOffset = 0;
+			GLint levels = (GLint)job.levelSizes.size();
+			for (GLint index = 0; index < levels; ++index)
+			{
+				GLint level = job.firstLevel + index;
+				GLsizei levelWidth = std::max(job.width >> level, 1);
+				GLsizei levelHeight = std::max(job.height >> level, 1);
+				if (!job.levelOffsets.empty())
+					levelOffset = job.levelOffsets[index];
+				if (job.storageLevels > 0 && job.format == 0)
+					glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, job.internalFormat, job.levelSizes[index], (void*)levelOffset);
+				else if (job.storageLevels > 0)
+					glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, job.format, GL_UNSIGNED_BYTE, (void*)levelOffset);
+				else if (job.format == 0)
+					glCompressedTexImage2D(GL_TEXTURE_2D, level, job.internalFormat, levelWidth, levelHeight, 0, job.levelSizes[index], (void*)levelOffset);
+				else
+					glTexImage2D(GL_TEXTURE_2D, level, job.internalFormat, levelWidth, levelHeight, 0, job.format, GL_UNSIGNED_BYTE, (void*)levelOffset);
+				levelOffset += job.levelSizes[index];
+			}
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			if (job.storageLevels > 0)
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.firstLevel);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.storageLevels - 1);
+				levels = job.storageLevels;
+			}
+			else if (job.generateMipmaps)
+				glGenerateMipmap(GL_TEXTURE_2D);
+			else
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+			// Sample the chain now that there is one
+			if (levels > 1 || job.generateMipmaps)
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		else if (job.isTexture)
+		{
+			// with a buffer bound to GL_PIXEL_UNPACK_BUFFER the pointer argument is an offset
+			glBindTexture(GL_TEXTURE_2D, job.target);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, job.internalFormat, job.width, job.height, 0, job.format, GL_UNSIGNED_BYTE, (void*)0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			if (job.generateMipmaps)
+				glGenerateMipmap(GL_TEXTURE_2D);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		else
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glBindBuffer(GL_COPY_READ_BUFFER, staging.pbo);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, job.target);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, job.destOffset + job.offset, size);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+	}
+
+	bool finished = job.isTexture || job.offset + size >= total;
+	job.offset += size;
+
+	staging.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	staging.ticket = finished ? job.ticket : 0;
+	mInFlight.push_back(staging);
+
+	if (finished)
+		mJobs.pop_front();
+	return true;
+}
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////
+//  vertexweld.cpp
+//  ==============
+//  Vertex welding through a spatial hash on the vertex position.
+//
+//  Positions are snapped to a grid with epsilon sized cells. A vertex can
+//  only match vertices stored in its own cell or one of the 26 neighbours,
+//  and is then compared against those on every component.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "vertexweld.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace
+{
+	// Grid cell of a single coordinate
+	inline int64_t Cell(float value, float cellSize)
+	{
+		return (int64_t)std::floor(value / cellSize);
+	}
+
+	// Mix three cell coordinates into one hash key
+	inline uint64_t CellKey(int64_t x, int64_t y, int64_t z)
+	{
+		uint64_t h = (uint64_t)x * 0x9E3779B185EBCA87ull;
+		h ^= (uint64_t)y * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+		h ^= (uint64_t)z * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+		return h;
+	}
+
+	// true when every component of a and b differs by at most epsilon
+	inline bool SameVertex(const GLfloat* a, const GLfloat* b, size_t floatsPerVertex, float epsilon)
+	{
+		for (size_t i = 0; i < floatsPerVertex; ++i)
+		{
+			if (std::fabs(a[i] - b[i]) > epsilon)
+				return false;
+		}
+		return true;
+	}
+}
+
+///////////////////////////////////////////////////
+//	WeldVertices(...)
+//
+//	Vertices keep their first-seen order in the output so the compacted
+//	array stays close to the original layout.
+///////////////////////////////////////////////////
+WeldResult WeldVertices(const GLfloat* verts, size_t vertexCount, size_t floatsPerVertex, float epsilon)
+{
+	WeldResult result;
+	result.inputVertices = vertexCount;
+	result.indices.reserve(vertexCount);
+
+	const float cellSize = epsilon > 0.0f ? epsilon : 1e-6f;
+
+	// cell key -> welded vertices whose position falls in that cell
+	std::unordered_map<uint64_t, std::vector<GLuint>> grid;
+	grid.reserve(vertexCount);
+
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		const GLfloat* vertex = verts + v * floatsPerVertex;
+		int64_t cx = Cell(vertex[0], cellSize);
+		int64_t cy = Cell(vertex[1], cellSize);
+		int64_t cz = Cell(vertex[2], cellSize);
+
+		// look for a match in the 3x3x3 block of cells around the vertex
+		GLuint match = ~0u;
+		for (int dx = -1; dx <= 1 && match == ~0u; ++dx)
+		{
+			for (int dy = -1; dy <= 1 && match == ~0u; ++dy)
+			{
+				for (int dz = -1; dz <= 1 && match == ~0u; ++dz)
+				{
+					auto it = grid.find(CellKey(cx + dx, cy + dy, cz + dz));
+					if (it == grid.end())
+						continue;
+
+					for (GLuint candidate : it->second)
+					{
+						if (SameVertex(&result.vertices[candidate * floatsPerVertex], vertex, floatsPerVertex, epsilon))
+						{
+							match = candidate;
+							break;
+						}
+					}
+				}
+			}
+		}
+
+		if (match == ~0u)
+		{
+			match = (GLuint)(result.vertices.size() / floatsPerVertex);
+			result.vertices.insert(result.vertices.end(), vertex, vertex + floatsPerVertex);
+			grid[CellKey(cx, cy, cz)].push_back(match);
+		}
+		result.indices.push_back(match);
+	}
+
+	result.outputVertices = result.vertices.size() / floatsPerVertex;
+	result.inputBytes = vertexCount * floatsPerVertex * sizeof(GLfloat);
+	result.outputBytes = result.vertices.size() * sizeof(GLfloat) + result.indices.size() * sizeof(GLuint);
+	return result;
+}
@@ -0,0 +1,726 @@
+///////////////////////////////////////////////////////////////////////////////
+//  virtualtexture.cpp
+//  ==================
+//  Software virtual texturing.
+//
+//  A virtual texture is a square power-of-two number of tiles, with a mip
+//  chain of tiles down to a single one, stored tile by tile in a file of
+//  its own. Only the tiles the camera actually sees are kept on the GPU,
+//  in one fixed-size cache texture shared by every virtual texture, so
+//  texture memory does not grow with the textures' resolution or number.
+//
+//  Each texture has a page table, one RGBA8 texel per tile and a level
+//  per mip level, naming the cache slot and level of the finest resident
+//  tile that covers it. The surface shader looks its tile up there and
+//  samples the cache, and one fragment in each FEEDBACK_SCALE square
+//  also writes the tile it wanted into a feedback image. That image is
+//  copied into a pixel buffer at the end of the frame and read a frame
+//  or two later, as the id buffer does with clicks.
+//
+//  Missing tiles are read from the mapped file on the pool, coarse levels
+//  first, and uploaded into the least recently used slot through the
+//  upload queue. A texture's page table is only rewritten once a tile has
+//  landed, and before an evicted slot is overwritten, so the shader never
+//  samples a slot holding another tile. Every texture keeps its coarsest
+//  tile resident, so there is always something to fall back to.
+//
+//  Tiled files are baked from an ordinary image the first time it is seen
+//  and named by its content hash. Baking resamples the image up to the
+//  tile grid and runs the CPU mip generator over it in memory, which is
+//  fine for desk textures; a gigapixel source would be baked offline into
+//  the same format. The bake runs on the pool, and until the file is open
+//  the texture is not ready and its object samples its ordinary streamed
+//  texture instead.
+//
+//	CS-330-Computational Graphics and Visualization
+///////////////////////////////////////////////////////////////////////////////
+
+#include "virtualtexture.h"
+
+#include "imageprep.h"
+#include "mipgenerator.h"
+#include "textureloader.h"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	// Start of a tiled file; the tiles follow, level 0 first, each level
+	// row by row from the bottom, each tile PADDED_TILE_SIZE square RGBA8
+	struct TileFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t tileSize;
+		uint32_t tileBorder;
+		uint32_t tilesPerSide;
+		uint32_t levels;
+		uint32_t mipSettings;		// MipSettingsKey() of the settings the levels were built with
+	};
+	const char TILE_FILE_MAGIC[4] = { 'V', 'T', 'E', 'X' };
+	const uint32_t TILE_FILE_VERSION = 1;
+	const MipSettings BAKE_MIP_SETTINGS = { MIP_FILTER_KAISER, true, 0.0f };
+
+	const size_t TILE_BYTES = (size_t)VirtualTextureSystem::PADDED_TILE_SIZE * VirtualTextureSystem::PADDED_TILE_SIZE * 4;
+
+	// Tiles are named by the same 32 bits the shader writes to the feedback image
+	uint32_t UTileKey(int texture, int level, int x, int y)
+	{
+		return ((uint32_t)(texture + 1) << 24) | ((uint32_t)level << 20) | ((uint32_t)y << 10) | (uint32_t)x;
+	}
+
+	void UDecodeTileKey(uint32_t tile, int& texture, int& level, int& x, int& y)
+	{
+		texture = (int)(tile >> 24) - 1;
+		level = (int)((tile >> 20) & 15);
+		y = (int)((tile >> 10) & 1023);
+		x = (int)(tile & 1023);
+	}
+
+	int ULevelCount(int tilesPerSide)
+	{
+		int levels = 1;
+		while ((tilesPerSide >> (levels - 1)) > 1)
+			++levels;
+		return levels;
+	}
+
+	// A header this build can read, for a file large enough to hold every tile it promises
+	bool UValidTileFile(const MappedFile& file)
+	{
+		if (file.Size() < sizeof(TileFileHeader))
+			return false;
+		TileFileHeader header;
+		memcpy(&header, file.Data(), sizeof(header));
+		if (memcmp(header.magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC)) != 0 || header.version != TILE_FILE_VERSION
+			|| header.tileSize != (uint32_t)VirtualTextureSystem::TILE_SIZE || header.tileBorder != (uint32_t)VirtualTextureSystem::TILE_BORDER
+			|| header.mipSettings != MipSettingsKey(BAKE_MIP_SETTINGS) || header.tilesPerSide == 0
+			|| header.tilesPerSide > (uint32_t)VirtualTextureSystem::MAX_TILES_PER_SIDE || header.levels != (uint32_t)ULevelCount((int)header.tilesPerSide))
+			return false;
+
+		size_t tiles = 0;
+		for (uint32_t level = 0; level < header.levels; ++level)
+			tiles += (size_t)(header.tilesPerSide >> level) * (header.tilesPerSide >> level);
+		return file.Size() >= sizeof(header) + tiles * TILE_BYTES;
+	}
+
+	///////////////////////////////////////////////////
+	//	UBakeTileFile(const char*, const std::vector<unsigned char>&, const std::string&)
+	//
+	//	The image is resampled to the smallest power-of-two number of tiles
+	//	covering its larger side, so every level is a whole number of tiles
+	//	and texture coordinates keep their meaning. Written beside path and
+	//	renamed into place, like the compressed texture cache.
+	///////////////////////////////////////////////////
+	bool UBakeTileFile(const char* filename, const std::vector<unsigned char>& file, const std::string& path)
+	{
+		int width, height, channels;
+		unsigned char* image = stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &channels, 0);
+		if (!image)
+			return false;
+		if (channels != 3 && channels != 4)
+		{
+			std::cout << "Not implemented to handle an image with " << channels << " channels" << std::endl;
+			stbi_image_free(image);
+			return false;
+		}
+
+		const int tileSize = VirtualTextureSystem::TILE_SIZE;
+		const int border = VirtualTextureSystem::TILE_BORDER;
+		const int padded = VirtualTextureSystem::PADDED_TILE_SIZE;
+		int tilesPerSide = 1;
+		while (tilesPerSide * tileSize < std::max(width, height) && tilesPerSide < VirtualTextureSystem::MAX_TILES_PER_SIDE)
+			tilesPerSide *= 2;
+		int size = tilesPerSide * tileSize;
+		int levels = ULevelCount(tilesPerSide);
+
+		std::vector<unsigned char> rgba((size_t)size * size * 4);
+		ResampleToRGBA(image, width, height, channels, size, size, true, rgba.data());
+		stbi_image_free(image);
+		std::vector<unsigned char> chain;
+		std::vector<GLsizei> levelSizes;
+		GenerateMipChain(rgba.data(), size, size, BAKE_MIP_SETTINGS, chain, levelSizes);
+		rgba.clear();
+		rgba.shrink_to_fit();
+
+		std::error_code error;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+		std::string temporary = path + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			TileFileHeader header;
+			memcpy(header.magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC));
+			header.version = TILE_FILE_VERSION;
+			header.tileSize = (uint32_t)tileSize;
+			header.tileBorder = (uint32_t)border;
+			header.tilesPerSide = (uint32_t)tilesPerSide;
+			header.levels = (uint32_t)levels;
+			header.mipSettings = MipSettingsKey(BAKE_MIP_SETTINGS);
+			out.write((const char*)&header, sizeof(header));
+
+			std::vector<unsigned char> tile(TILE_BYTES);
+			const unsigned char* level = chain.data();
+			for (int index = 0; index < levels; ++index)
+			{
+				int levelSize = size >> index;
+				int tiles = tilesPerSide >> index;
+				for (int tileY = 0; tileY < tiles; ++tileY)
+				{
+					for (int tileX = 0; tileX < tiles; ++tileX)
+					{
+						// The border wraps around the level, as GL_REPEAT sampling would
+						for (int row = 0; row < padded; ++row)
+						{
+							int sourceY = (tileY * tileSize - border + row + levelSize) % levelSize;
+							for (int column = 0; column < padded; ++column)
+							{
+								int sourceX = (tileX * tileSize - border + column + levelSize) % levelSize;
+								memcpy(&tile[((size_t)row * padded + column) * 4], level + ((size_t)sourceY * levelSize + sourceX) * 4, 4);
+							}
+						}
+						out.write((const char*)tile.data(), tile.size());
+					}
+				}
+				level += levelSizes[index];
+			}
+			if (!out)
+			{
+				std::cout << "Failed to write tiled texture " << temporary << " for " << filename << std::endl;
+				return false;
+			}
+		}
+		std::filesystem::rename(temporary, path, error);
+		return !error;
+	}
+}
+
+VirtualTextureSystem::VirtualTextureSystem()
+	: mPool(nullptr), mUploads(nullptr), mCacheTilesPerSide(0), mCache(0), mFeedback(0), mFeedbackWidth(0), mFeedbackHeight(0),
+	mReadbacks(), mWorking(0), mFrame(0), mStats()
+{
+}
+
+///////////////////////////////////////////////////
+//	Initialize(ThreadPool*, UploadQueue*, int, int, int, const std::string&)
+//
+//	The cache is allocated once at its full size and cleared to the grey
+//	of the texture placeholders, which is what a tile shows until it lands.
+///////////////////////////////////////////////////
+bool VirtualTextureSystem::Initialize(ThreadPool* pool, UploadQueue* uploads, int cacheTilesPerSide, int width, int height, const std::string& directory)
+{
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int cacheSize = cacheTilesPerSide * PADDED_TILE_SIZE;
+	if (cacheTilesPerSide <= 0 || cacheTilesPerSide > 255 || cacheSize > maxSize)
+	{
+		std::cout << "Failed to create a virtual texture cache of " << cacheTilesPerSide << "x" << cacheTilesPerSide << " tiles" << std::endl;
+		return false;
+	}
+
+	mPool = pool;
+	mUploads = uploads;
+	mDirectory = directory;
+	mCacheTilesPerSide = cacheTilesPerSide;
+
+	glGenTextures(1, &mCache);
+	glBindTexture(GL_TEXTURE_2D, mCache);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, cacheSize, cacheSize);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glClearTexImage(mCache, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+
+	Slot free = { SLOT_FREE, 0, 0, 0, false };
+	mSlots.assign((size_t)cacheTilesPerSide * cacheTilesPerSide, free);
+	mStats.cacheTiles = (unsigned int)mSlots.size();
+
+	for (Readback& readback : mReadbacks)
+	{
+		glGenBuffers(1, &readback.buffer);
+		readback.fence = 0;
+		readback.texels = 0;
+	}
+	CreateFeedback(width, height);
+	return true;
+}
+
+void VirtualTextureSystem::Destroy()
+{
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mWorkDone.wait(lock, [this] { return mWorking == 0; });
+		mOpened.clear();
+		mRead.clear();
+	}
+
+	for (Readback& readback : mReadbacks)
+	{
+		if (readback.fence != 0)
+			glDeleteSync(readback.fence);
+		if (readback.buffer != 0)
+			glDeleteBuffers(1, &readback.buffer);
+		readback = Readback();
+	}
+	DestroyFeedback();
+
+	for (Texture& texture : mTextures)
+	{
+		if (texture.pageTable != 0)
+			glDeleteTextures(1, &texture.pageTable);
+	}
+	mTextures.clear();
+	if (mCache != 0)
+	{
+		mUploads->CancelTexture(mCache);
+		glDeleteTextures(1, &mCache);
+	}
+	mCache = 0;
+	mSlots.clear();
+	mSlotOfTile.clear();
+}
+
+void VirtualTextureSystem::Resize(int width, int height)
+{
+	int feedbackWidth = std::max((width + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE, 1);
+	int feedbackHeight = std::max((height + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE, 1);
+	if (mCache == 0 || (feedbackWidth == mFeedbackWidth && feedbackHeight == mFeedbackHeight))
+		return;
+
+	DestroyFeedback();
+	CreateFeedback(width, height);
+}
+
+///////////////////////////////////////////////////
+//	Add(const char*)
+//
+//	The texture gets its id at once but stays unready: reading the image,
+//	hashing it and baking its tiled file all happen on a worker, and
+//	Update() finishes the texture once the file is open.
+///////////////////////////////////////////////////
+int VirtualTextureSystem::Add(const char* filename)
+{
+	if (mCache == 0 || (int)mTextures.size() >= MAX_TEXTURES)
+		return -1;
+
+	Texture texture;
+	texture.ready = false;
+	texture.tilesPerSide = 0;
+	texture.levels = 0;
+	texture.pageTable = 0;
+	texture.pinnedSlot = -1;
+	texture.dirty = false;
+	int id = (int)mTextures.size();
+	mTextures.push_back(std::move(texture));
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mWorking;
+	}
+
+	std::string source = filename;
+	std::string directory = mDirectory;
+	mPool->Submit([this, id, source, directory]
+	{
+		OpenedFile opened;
+		opened.texture = id;
+		opened.filename = source;
+		std::vector<unsigned char> bytes;
+		if (ReadFileBytes(source.c_str(), bytes))
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "%016llx.vtex", (unsigned long long)HashFileBytes(bytes));
+			std::string path = (std::filesystem::path(directory) / name).string();
+
+			std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+			if (file->Open(path.c_str()) && UValidTileFile(*file))
+				opened.file = file;
+			else
+			{
+				file->Close();
+				if (UBakeTileFile(source.c_str(), bytes, path) && file->Open(path.c_str()) && UValidTileFile(*file))
+					opened.file = file;
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mOpened.push_back(std::move(opened));
+		--mWorking;
+		mWorkDone.notify_all();
+	});
+	return id;
+}
+
+///////////////////////////////////////////////////
+//	FinishAdd(OpenedFile&)
+//
+//	The page table starts out pointing every tile at the coarsest one,
+//	which is read right away and pinned in the cache.
+///////////////////////////////////////////////////
+void VirtualTextureSystem::FinishAdd(OpenedFile& opened)
+{
+	if (!opened.file)
+	{
+		std::cout << "Failed to bake virtual texture " << opened.filename << std::endl;
+		return;
+	}
+	int pinned = AllocateSlot();
+	if (pinned < 0)
+	{
+		std::cout << "No room in the virtual texture cache for " << opened.filename << std::endl;
+		return;
+	}
+
+	TileFileHeader header;
+	memcpy(&header, opened.file->Data(), sizeof(header));
+	Texture& texture = mTextures[opened.texture];
+	texture.file = opened.file;
+	texture.tilesPerSide = (int)header.tilesPerSide;
+	texture.levels = (int)header.levels;
+	texture.pinnedSlot = pinned;
+	for (int level = 0; level < texture.levels; ++level)
+	{
+		int tiles = texture.tilesPerSide >> level;
+		texture.slots.push_back(std::vector<int>((size_t)tiles * tiles, -1));
+	}
+
+	glGenTextures(1, &texture.pageTable);
+	glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+	glTexStorage2D(GL_TEXTURE_2D, texture.levels, GL_RGBA8, texture.tilesPerSide, texture.tilesPerSide);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	mSlots[pinned].pinned = true;
+	StartRead(pinned, UTileKey(opened.texture, texture.levels - 1, 0, 0));
+	WritePageTable(texture);
+	texture.ready = true;
+	++mStats.textures;
+}
+
+///////////////////////////////////////////////////
+//	Update()
+//
+//	Textures whose files have been opened are finished first. Then
+//	feedback, so tiles asked for are protected from eviction before
+//	new reads pick their slots. Uploads that have completed make their
+//	tiles resident; each changed page table is written once at the end.
+///////////////////////////////////////////////////
+void VirtualTextureSystem::Update()
+{
+	if (mCache == 0)
+		return;
+
+	std::vector<OpenedFile> opened;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		opened.swap(mOpened);
+	}
+	for (OpenedFile& file : opened)
+		FinishAdd(file);
+
+	for (Readback& readback : mReadbacks)
+	{
+		if (readback.fence == 0)
+			continue;
+		GLenum status = glClientWaitSync(readback.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			continue;
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const uint32_t* texels = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.texels * sizeof(uint32_t), GL_MAP_READ_BIT);
+		if (texels)
+		{
+			TakeFeedback(texels, readback.texels);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	std::vector<ReadTile> read;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		read.swap(mRead);
+	}
+	for (ReadTile& tile : read)
+	{
+		Slot& slot = mSlots[tile.slot];
+		int x = (tile.slot % mCacheTilesPerSide) * PADDED_TILE_SIZE;
+		int y = (tile.slot / mCacheTilesPerSide) * PADDED_TILE_SIZE;
+		slot.ticket = mUploads->EnqueueTextureRegion(mCache, x, y, PADDED_TILE_SIZE, PADDED_TILE_SIZE, GL_RGBA, std::move(tile.texels));
+		slot.state = SLOT_UPLOADING;
+	}
+
+	for (size_t index = 0; index < mSlots.size(); ++index)
+	{
+		Slot& slot = mSlots[index];
+		if (slot.state != SLOT_UPLOADING || !mUploads->IsReady(slot.ticket))
+			continue;
+		int texture, level, x, y;
+		UDecodeTileKey(slot.tile, texture, level, x, y);
+		Texture& owner = mTextures[texture];
+		owner.slots[level][(size_t)y * (owner.tilesPerSide >> level) + x] = (int)index;
+		owner.dirty = true;
+		slot.state = SLOT_RESIDENT;
+		slot.lastUsed = mFrame;
+		++mStats.loadedTiles;
+	}
+
+	for (Texture& texture : mTextures)
+	{
+		if (texture.dirty)
+			WritePageTable(texture);
+	}
+	++mFrame;
+}
+
+void VirtualTextureSystem::BeginFeedback()
+{
+	if (mFeedback == 0)
+		return;
+	const GLuint nothing = 0;
+	glClearTexImage(mFeedback, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &nothing);
+	glBindImageTexture(FEEDBACK_IMAGE_UNIT, mFeedback, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+}
+
+///////////////////////////////////////////////////
+//	EndFeedback()
+//
+//	With every pixel buffer still waiting for the GPU this frame's
+//	feedback is skipped; the next one asks for much the same tiles.
+///////////////////////////////////////////////////
+void VirtualTextureSystem::EndFeedback()
+{
+	if (mFeedback == 0)
+		return;
+	glBindImageTexture(FEEDBACK_IMAGE_UNIT, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+
+	Readback* readback = std::find_if(mReadbacks, mReadbacks + READBACK_COUNT, [](const Readback& candidate) { return candidate.fence == 0; });
+	if (readback == mReadbacks + READBACK_COUNT)
+		return;
+
+	// The image stores must be visible to the copy
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+	readback->texels = (size_t)mFeedbackWidth * mFeedbackHeight;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, readback->texels * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+	glBindTexture(GL_TEXTURE_2D, mFeedback);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+VirtualTextureStats VirtualTextureSystem::GetStats() const
+{
+	VirtualTextureStats stats = mStats;
+	stats.residentTiles = 0;
+	for (const Slot& slot : mSlots)
+		stats.residentTiles += slot.state == SLOT_RESIDENT;
+	return stats;
+}
+
+void VirtualTextureSystem::CreateFeedback(int width, int height)
+{
+	mFeedbackWidth = std::max((width + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE, 1);
+	mFeedbackHeight = std::max((height + FEEDBACK_SCALE - 1) / FEEDBACK_SCALE, 1);
+	glGenTextures(1, &mFeedback);
+	glBindTexture(GL_TEXTURE_2D, mFeedback);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, mFeedbackWidth, mFeedbackHeight);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void VirtualTextureSystem::DestroyFeedback()
+{
+	if (mFeedback != 0)
+		glDeleteTextures(1, &mFeedback);
+	mFeedback = 0;
+}
+
+///////////////////////////////////////////////////
+//	TakeFeedback(const uint32_t*, size_t)
+//
+//	Each distinct tile counts once. Tiles already resident or on their
+//	way are only marked used; the rest are read, coarsest level first so
+//	a blurred area sharpens evenly, as far as the per-update limit and
+//	the slots not needed by this feedback allow.
+///////////////////////////////////////////////////
+void VirtualTextureSystem::TakeFeedback(const uint32_t* texels, size_t count)
+{
+	std::vector<uint32_t> tiles(texels, texels + count);
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+	std::vector<uint32_t> missing;
+	for (uint32_t tile : tiles)
+	{
+		int texture, level, x, y;
+		UDecodeTileKey(tile, texture, level, x, y);
+		if (tile == 0 || texture >= (int)mTextures.size() || level >= mTextures[texture].levels
+			|| x >= (mTextures[texture].tilesPerSide >> level) || y >= (mTextures[texture].tilesPerSide >> level))
+			continue;
+		Touch(tile);
+		if (mSlotOfTile.find(tile) == mSlotOfTile.end())
+			missing.push_back(tile);
+	}
+	mStats.requestedTiles = (unsigned int)std::count_if(tiles.begin(), tiles.end(), [](uint32_t tile) { return tile != 0; });
+	mStats.missingTiles = (unsigned int)missing.size();
+
+	// Level sits above the tile coordinates in the key
+	std::sort(missing.begin(), missing.end(), [](uint32_t a, uint32_t b) { return ((a >> 20) & 15) > ((b >> 20) & 15); });
+	int reads = 0;
+	for (uint32_t tile : missing)
+	{
+		if (reads == MAX_READS_PER_UPDATE)
+			break;
+		int slot = AllocateSlot();
+		if (slot < 0)
+			break;
+		StartRead(slot, tile);
+		++reads;
+	}
+}
+
+// Mark tile used, along with every coarser resident tile covering it, which the shader may be sampling instead
+void VirtualTextureSystem::Touch(uint32_t tile)
+{
+	int texture, level, x, y;
+	UDecodeTileKey(tile, texture, level, x, y);
+	const Texture& owner = mTextures[texture];
+
+	std::unordered_map<uint32_t, int>::iterator found = mSlotOfTile.find(tile);
+	if (found != mSlotOfTile.end())
+		mSlots[found->second].lastUsed = mFrame;
+	for (int coarser = level + 1; coarser < owner.levels; ++coarser)
+	{
+		int slot = owner.slots[coarser][(size_t)(y >> (coarser - level)) * (owner.tilesPerSide >> coarser) + (x >> (coarser - level))];
+		if (slot >= 0)
+			mSlots[slot].lastUsed = mFrame;
+	}
+}
+
+///////////////////////////////////////////////////
+//	AllocateSlot()
+//
+//	A free slot, else the resident one unused for longest. Slots the
+//	current feedback needs, pinned ones and ones still being filled are
+//	never taken. The evicted tile leaves its page table at once, so the
+//	table is rewritten before the new tile's upload can be issued.
+///////////////////////////////////////////////////
+int VirtualTextureSystem::AllocateSlot()
+{
+	int victim = -1;
+	for (size_t index = 0; index < mSlots.size(); ++index)
+	{
+		const Slot& slot = mSlots[index];
+		if (slot.state == SLOT_FREE)
+			return (int)index;
+		if (slot.state == SLOT_RESIDENT && !slot.pinned && slot.lastUsed != mFrame && (victim < 0 || slot.lastUsed < mSlots[victim].lastUsed))
+			victim = (int)index;
+	}
+	if (victim < 0)
+		return -1;
+
+	Slot& slot = mSlots[victim];
+	int texture, level, x, y;
+	UDecodeTileKey(slot.tile, texture, level, x, y);
+	Texture& owner = mTextures[texture];
+	owner.slots[level][(size_t)y * (owner.tilesPerSide >> level) + x] = -1;
+	WritePageTable(owner);
+	mSlotOfTile.erase(slot.tile);
+	slot.state = SLOT_FREE;
+	++mStats.evictedTiles;
+	return victim;
+}
+
+// Copy tile out of its file on a worker; Update() queues the upload
+void VirtualTextureSystem::StartRead(int slot, uint32_t tile)
+{
+	int texture, level, x, y;
+	UDecodeTileKey(tile, texture, level, x, y);
+	std::shared_ptr<const MappedFile> file = mTextures[texture].file;
+	size_t offset = TileOffset(mTextures[texture], level, x, y);
+
+	mSlots[slot].state = SLOT_READING;
+	mSlots[slot].tile = tile;
+	mSlots[slot].lastUsed = mFrame;
+	mSlotOfTile[tile] = slot;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mWorking;
+	}
+
+	mPool->Submit([this, slot, tile, file, offset]
+	{
+		ReadTile read;
+		read.slot = slot;
+		read.tile = tile;
+		read.texels.assign(file->Data() + offset, file->Data() + offset + TILE_BYTES);
+
+		std::lock_guard<std::mutex> lock(mMutex);
+		mRead.push_back(std::move(read));
+		--mWorking;
+		mWorkDone.notify_all();
+	});
+}
+
+///////////////////////////////////////////////////
+//	WritePageTable(Texture&)
+//
+//	Built from the coarsest level down: a tile that is not resident takes
+//	the entry of the tile covering it one level up. The coarsest entry is
+//	the pinned slot, which holds the grey of the cleared cache until its
+//	tile lands.
+///////////////////////////////////////////////////
+void VirtualTextureSystem::WritePageTable(Texture& texture)
+{
+	std::vector<unsigned char> coarser, entries;
+	glBindTexture(GL_TEXTURE_2D, texture.pageTable);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int level = texture.levels - 1; level >= 0; --level)
+	{
+		int tiles = texture.tilesPerSide >> level;
+		entries.resize((size_t)tiles * tiles * 4);
+		for (int y = 0; y < tiles; ++y)
+		{
+			for (int x = 0; x < tiles; ++x)
+			{
+				unsigned char* entry = &entries[((size_t)y * tiles + x) * 4];
+				int slot = level == texture.levels - 1 ? texture.pinnedSlot : texture.slots[level][(size_t)y * tiles + x];
+				if (slot >= 0)
+				{
+					entry[0] = (unsigned char)(slot % mCacheTilesPerSide);
+					entry[1] = (unsigned char)(slot / mCacheTilesPerSide);
+					entry[2] = (unsigned char)level;
+					entry[3] = 255;
+				}
+				else
+					memcpy(entry, &coarser[((size_t)(y / 2) * (tiles / 2) + x / 2) * 4], 4);
+			}
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tiles, tiles, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+		coarser.swap(entries);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	texture.dirty = false;
+}
+
+size_t VirtualTextureSystem::TileOffset(const Texture& texture, int level, int x, int y) const
+{
+	size_t tiles = 0;
+	for (int finer = 0; finer < level; ++finer)
+		tiles += (size_t)(texture.tilesPerSide >> finer) * (texture.tilesPerSide >> finer);
+	tiles += (size_t)y * (texture.tilesPerSide >> level) + x;
+	return sizeof(TileFileHeader) + tiles * TILE_BYTES;
+}